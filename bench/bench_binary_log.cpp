@@ -0,0 +1,115 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// The cost of a log record on the thread that writes it, for the binary log (binary_log.hpp)
+// and, when built with MQTT_USE_LOG, for the Boost.Log setup of setup_log().
+//   disabled: a record below the threshold
+//   literal:  a record with a string literal only
+//   publish:  a record like the one of a received PUBLISH packet
+// The binary log only copies the arguments into a ring buffer, and the background thread
+// formats them. Boost.Log formats and writes the record on the calling thread.
+
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+
+#include <mqtt/binary_log.hpp>
+#include <mqtt/setup_log.hpp>
+
+namespace {
+
+namespace bl = MQTT_NS::binary_log;
+
+// The formatted lines are discarded. The benchmark thread also flushes every 1024 records
+// outside of the timing, so the ring buffer never overflows and only the producer side is
+// measured.
+template <typename Log>
+void binary_log(benchmark::State& state, Log log) {
+    bl::set_threshold({ { "mqtt_bench", MQTT_NS::severity_level::info } });
+    bl::start([](MQTT_NS::string_view) {});
+    std::size_t n = 0;
+    for (auto _ : state) {
+        log();
+        if ((++n & 1023) == 0) {
+            state.PauseTiming();
+            bl::flush();
+            state.ResumeTiming();
+        }
+    }
+    bl::stop();
+    state.counters["dropped"] = static_cast<double>(bl::dropped());
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+
+BENCHMARK_CAPTURE(binary_log, disabled, [] {
+    MQTT_BINARY_LOG("mqtt_bench", trace) << "disabled";
+});
+BENCHMARK_CAPTURE(binary_log, literal, [] {
+    MQTT_BINARY_LOG("mqtt_bench", info) << "publish received";
+});
+BENCHMARK_CAPTURE(binary_log, publish, [] {
+    static std::string const topic = "building3/floor7/room1/sensor12";
+    static int const dummy = 0;
+    MQTT_BINARY_LOG("mqtt_bench", info)
+        << MQTT_BINARY_ADD_VALUE(address, &dummy)
+        << "publish"
+        << " pid:" << 1234
+        << " topic:" << topic
+        << " qos:" << 1
+        << " retain:" << false;
+});
+
+#if defined(MQTT_USE_LOG) && !defined(MQTT_USE_BINARY_LOG)
+
+// Discards what setup_log() writes to std::clog
+class null_buffer : public std::streambuf {
+protected:
+    int_type overflow(int_type c) override {
+        return c;
+    }
+    std::streamsize xsputn(char const*, std::streamsize n) override {
+        return n;
+    }
+};
+
+// The baseline: MQTT_LOG with the formatter and the filter of setup_log()
+template <typename Log>
+void boost_log(benchmark::State& state, Log log) {
+    null_buffer null;
+    auto org = std::clog.rdbuf(&null);
+    MQTT_NS::setup_log({ { "mqtt_bench", MQTT_NS::severity_level::info } });
+    for (auto _ : state) {
+        log();
+    }
+    boost::log::core::get()->remove_all_sinks();
+    boost::log::core::get()->reset_filter();
+    std::clog.rdbuf(org);
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+
+BENCHMARK_CAPTURE(boost_log, disabled, [] {
+    MQTT_LOG("mqtt_bench", trace) << "disabled";
+});
+BENCHMARK_CAPTURE(boost_log, literal, [] {
+    MQTT_LOG("mqtt_bench", info) << "publish received";
+});
+BENCHMARK_CAPTURE(boost_log, publish, [] {
+    static std::string const topic = "building3/floor7/room1/sensor12";
+    static int const dummy = 0;
+    MQTT_LOG("mqtt_bench", info)
+        << MQTT_ADD_VALUE(address, &dummy)
+        << "publish"
+        << " pid:" << 1234
+        << " topic:" << topic
+        << " qos:" << 1
+        << " retain:" << false;
+});
+
+#endif // defined(MQTT_USE_LOG) && !defined(MQTT_USE_BINARY_LOG)
+
+} // anonymous namespace
@@ -0,0 +1,227 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// broker_t with simulated clients connected by loopback_endpoint, so no kernel networking
+// is involved. The broker and the clients run on the benchmark thread, which makes the
+// results stable and the broker easy to profile.
+//
+// Arguments: pattern, number of clients, QoS
+// Each iteration publishes `batch` messages and waits until all of them are delivered.
+// The latency is from the publish call on the client to the publish handler of the receiver.
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cstring>
+
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/broker/broker.hpp>
+
+namespace {
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+
+using client_t = MQTT_NS::server<>::endpoint_t;
+
+enum class pattern {
+    pairs,      ///< each client subscribes to its own topic and publishes to it
+    fan_out,    ///< the first client publishes, all the other clients subscribe
+    fan_in,     ///< the first client subscribes, all the other clients publish
+};
+
+char const* pattern_to_str(pattern p) {
+    switch (p) {
+    case pattern::pairs:   return "pairs";
+    case pattern::fan_out: return "fan_out";
+    case pattern::fan_in:  return "fan_in";
+    }
+    return "unknown";
+}
+
+constexpr std::size_t batch = 64;
+constexpr std::size_t payload_size = 64;
+
+std::int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+class harness {
+public:
+    harness(pattern p, std::size_t num_of_clients, MQTT_NS::qos qos)
+        :b_(ioc_), pattern_(p), qos_(qos) {
+        for (std::size_t i = 0; i != num_of_clients; ++i) {
+            auto sockets = MQTT_NS::make_loopback_pair(ioc_, ioc_);
+            b_.handle_accept(std::make_shared<MQTT_NS::broker::endpoint_t>(ioc_, sockets.first));
+            auto c = std::make_shared<client_t>(ioc_, sockets.second, MQTT_NS::protocol_version::v5);
+            c->set_async_operation(true);
+            setup(*c);
+            clients_.push_back(std::move(c));
+        }
+
+        // connect and subscribe
+        std::size_t ready = 0;
+        std::size_t expected_ready = 0;
+        for (std::size_t i = 0; i != clients_.size(); ++i) {
+            auto& c = *clients_[i];
+            bool sub = subscriber(i);
+            if (sub) ++expected_ready;
+            c.set_v5_connack_handler(
+                [this, &c, sub, i]
+                (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+                    if (sub) c.async_subscribe(topic(i), qos_);
+                    return true;
+                }
+            );
+            c.set_v5_suback_handler(
+                [&ready]
+                (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+                    ++ready;
+                    return true;
+                }
+            );
+            c.start_session(clients_[i]);
+            c.async_connect(
+                MQTT_NS::allocate_buffer("bench_cid" + std::to_string(i)),
+                MQTT_NS::nullopt,
+                MQTT_NS::nullopt,
+                MQTT_NS::nullopt,
+                0
+            );
+        }
+        while (ready != expected_ready) ioc_.run_one();
+
+        for (std::size_t i = 0; i != clients_.size(); ++i) {
+            if (publisher(i)) publishers_.push_back(i);
+        }
+        std::size_t subscribers_per_topic =
+            pattern_ == pattern::fan_out ? clients_.size() - 1 : 1;
+        deliveries_per_batch_ = batch * subscribers_per_topic;
+    }
+
+    ~harness() {
+        std::size_t closed = 0;
+        for (auto& c : clients_) {
+            c->set_close_handler([&closed] { ++closed; });
+            c->set_error_handler([&closed] (MQTT_NS::error_code) { ++closed; });
+            c->async_disconnect();
+        }
+        while (closed != clients_.size()) ioc_.run_one();
+    }
+
+    // Publish a batch and wait for the deliveries
+    void run_batch() {
+        received_ = 0;
+        for (std::size_t n = 0; n != batch; ++n) {
+            auto i = publishers_[n % publishers_.size()];
+            auto t = now();
+            std::memcpy(&payload_[0], &t, sizeof(t));
+            clients_[i]->async_publish(
+                topic(i),
+                payload_,
+                qos_
+            );
+        }
+        while (received_ != deliveries_per_batch_) ioc_.run_one();
+    }
+
+    std::size_t deliveries_per_batch() const {
+        return deliveries_per_batch_;
+    }
+
+    MQTT_NS::broker::histogram_snapshot const& latency() const {
+        return latency_;
+    }
+
+private:
+    void setup(client_t& c) {
+        c.set_v5_publish_handler(
+            [this]
+            (MQTT_NS::optional<std::uint16_t>,
+             MQTT_NS::publish_options,
+             MQTT_NS::buffer,
+             MQTT_NS::buffer contents,
+             MQTT_NS::v5::properties) {
+                std::int64_t t;
+                std::memcpy(&t, contents.data(), sizeof(t));
+                latency_.add(
+                    MQTT_NS::broker::histogram_snapshot::bucket_index(static_cast<std::uint64_t>(now() - t)),
+                    1
+                );
+                ++received_;
+                return true;
+            }
+        );
+    }
+
+    bool subscriber(std::size_t i) const {
+        switch (pattern_) {
+        case pattern::pairs:   return true;
+        case pattern::fan_out: return i != 0;
+        case pattern::fan_in:  return i == 0;
+        }
+        return false;
+    }
+
+    bool publisher(std::size_t i) const {
+        switch (pattern_) {
+        case pattern::pairs:   return true;
+        case pattern::fan_out: return i == 0;
+        case pattern::fan_in:  return i != 0;
+        }
+        return false;
+    }
+
+    std::string topic(std::size_t i) const {
+        if (pattern_ == pattern::pairs) return "bench/" + std::to_string(i);
+        return "bench/shared";
+    }
+
+    as::io_context ioc_;
+    MQTT_NS::broker::broker_t b_;
+    pattern pattern_;
+    MQTT_NS::qos qos_;
+    std::vector<std::shared_ptr<client_t>> clients_;
+    std::vector<std::size_t> publishers_;
+    std::size_t deliveries_per_batch_ = 0;
+    std::size_t received_ = 0;
+    std::string payload_ = std::string(payload_size, 'p');
+    MQTT_NS::broker::histogram_snapshot latency_;
+};
+
+void BM_broker_loopback(benchmark::State& state) {
+    auto p = static_cast<pattern>(state.range(0));
+    harness h(
+        p,
+        static_cast<std::size_t>(state.range(1)),
+        static_cast<MQTT_NS::qos>(state.range(2))
+    );
+    for (auto _ : state) {
+        h.run_batch();
+    }
+    state.SetLabel(pattern_to_str(p));
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * h.deliveries_per_batch()));
+    auto const& l = h.latency();
+    state.counters["p50_ns"] = static_cast<double>(l.value_at_percentile(50));
+    state.counters["p99_ns"] = static_cast<double>(l.value_at_percentile(99));
+    state.counters["p99.9_ns"] = static_cast<double>(l.value_at_percentile(99.9));
+    state.counters["max_ns"] = static_cast<double>(l.max());
+}
+
+void loopback_args(benchmark::internal::Benchmark* b) {
+    for (auto qos : { MQTT_NS::qos::at_most_once, MQTT_NS::qos::at_least_once, MQTT_NS::qos::exactly_once }) {
+        for (auto clients : { 2, 16, 128 }) {
+            for (auto p : { pattern::pairs, pattern::fan_out, pattern::fan_in }) {
+                b->Args({ static_cast<std::int64_t>(p), clients, static_cast<std::int64_t>(qos) });
+            }
+        }
+    }
+}
+BENCHMARK(BM_broker_loopback)->Apply(loopback_args)->Unit(benchmark::kMicrosecond);
+
+} // anonymous namespace
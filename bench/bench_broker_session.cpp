@@ -0,0 +1,238 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Session management of broker_t with simulated clients connected by loopback_endpoint.
+// As in bench_broker_loopback.cpp, the broker and the clients run on the benchmark thread.
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/broker/broker.hpp>
+
+namespace {
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+
+using client_t = MQTT_NS::server<>::endpoint_t;
+using client_sp = std::shared_ptr<client_t>;
+
+constexpr std::size_t payload_size = 64;
+constexpr std::uint32_t session_expiry = 3600;
+
+std::int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+class harness {
+public:
+    harness()
+        :b_(ioc_) {}
+
+    MQTT_NS::broker::broker_t& broker() {
+        return b_;
+    }
+
+    // Create a client connected to the broker. CONNECT is not sent yet.
+    client_sp make_client() {
+        auto sockets = MQTT_NS::make_loopback_pair(ioc_, ioc_);
+        b_.handle_accept(std::make_shared<MQTT_NS::broker::endpoint_t>(ioc_, sockets.first));
+        auto c = std::make_shared<client_t>(ioc_, sockets.second, MQTT_NS::protocol_version::v5);
+        c->set_async_operation(true);
+        return c;
+    }
+
+    // Send CONNECT. If expiry is not zero, the session is kept for expiry seconds after
+    // the disconnection.
+    void connect(client_sp const& c, std::string const& client_id, std::uint32_t expiry) {
+        c->start_session(c);
+        c->async_connect(
+            MQTT_NS::allocate_buffer(client_id),
+            MQTT_NS::nullopt,
+            MQTT_NS::nullopt,
+            MQTT_NS::nullopt,
+            0,
+            expiry == 0
+            ? MQTT_NS::v5::properties {}
+            : MQTT_NS::v5::properties { MQTT_NS::v5::property::session_expiry_interval(expiry) }
+        );
+    }
+
+    client_sp connect_and_wait(std::string const& client_id, std::uint32_t expiry) {
+        auto c = make_client();
+        bool connected = false;
+        c->set_v5_connack_handler(
+            [&connected]
+            (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+                connected = true;
+                return true;
+            }
+        );
+        connect(c, client_id, expiry);
+        run_until([&] { return connected; });
+        return c;
+    }
+
+    void disconnect_and_wait(std::vector<client_sp> const& cs) {
+        std::size_t closed = 0;
+        for (auto& c : cs) {
+            c->set_close_handler([&closed] { ++closed; });
+            c->set_error_handler([&closed] (MQTT_NS::error_code) { ++closed; });
+            c->async_disconnect();
+        }
+        run_until([&] { return closed == cs.size(); });
+    }
+
+    template <typename Pred>
+    void run_until(Pred&& pred) {
+        while (!pred()) ioc_.run_one();
+    }
+
+private:
+    as::io_context ioc_;
+    MQTT_NS::broker::broker_t b_;
+};
+
+// Arguments: number of offline sessions in the broker
+// Each iteration connects a new client and disconnects it. The session is created and
+// erased in the session index that holds the offline sessions.
+void BM_broker_connect_churn(benchmark::State& state) {
+    harness h;
+    auto resident = static_cast<std::size_t>(state.range(0));
+    for (std::size_t i = 0; i != resident; ++i) {
+        h.disconnect_and_wait({ h.connect_and_wait("resident" + std::to_string(i), session_expiry) });
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+        h.disconnect_and_wait({ h.connect_and_wait("churn" + std::to_string(i++), 0) });
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_broker_connect_churn)
+    ->Arg(0)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMicrosecond);
+
+// Arguments: number of clients, offline messages of each client, offline message batch size
+// All clients have offline sessions with queued QoS1 messages and reconnect at once.
+// The latency is from the start of the reconnection to the CONNACK of each client.
+// An iteration finishes when all offline messages are delivered.
+void BM_broker_reconnect_storm(benchmark::State& state) {
+    auto num_of_clients = static_cast<std::size_t>(state.range(0));
+    auto num_of_messages = static_cast<std::size_t>(state.range(1));
+    harness h;
+    h.broker().set_offline_message_batch_size(static_cast<std::size_t>(state.range(2)));
+
+    auto client_id = [](std::size_t i) { return "storm" + std::to_string(i); };
+    auto topic = [](std::size_t i) { return "storm/" + std::to_string(i); };
+
+    for (std::size_t i = 0; i != num_of_clients; ++i) {
+        auto c = h.connect_and_wait(client_id(i), session_expiry);
+        bool subscribed = false;
+        c->set_v5_suback_handler(
+            [&subscribed]
+            (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+                subscribed = true;
+                return true;
+            }
+        );
+        c->async_subscribe(topic(i), MQTT_NS::qos::at_least_once);
+        h.run_until([&] { return subscribed; });
+        h.disconnect_and_wait({ c });
+    }
+
+    auto pub = h.connect_and_wait("storm_pub", 0);
+    std::size_t acked = 0;
+    pub->set_v5_puback_handler(
+        [&acked]
+        (std::uint16_t, MQTT_NS::v5::puback_reason_code, MQTT_NS::v5::properties) {
+            ++acked;
+            return true;
+        }
+    );
+    std::string payload(payload_size, 'p');
+
+    MQTT_NS::broker::histogram_snapshot latency;
+    for (auto _ : state) {
+        state.PauseTiming();
+        // queue the offline messages. Wait for each client not to exhaust the packet ids.
+        acked = 0;
+        for (std::size_t i = 0; i != num_of_clients; ++i) {
+            for (std::size_t m = 0; m != num_of_messages; ++m) {
+                pub->async_publish(topic(i), payload, MQTT_NS::qos::at_least_once);
+            }
+            h.run_until([&] { return acked == (i + 1) * num_of_messages; });
+        }
+        state.ResumeTiming();
+
+        std::size_t connacked = 0;
+        std::size_t received = 0;
+        std::vector<client_sp> cs;
+        cs.reserve(num_of_clients);
+        auto begin = now();
+        for (std::size_t i = 0; i != num_of_clients; ++i) {
+            auto c = h.make_client();
+            c->set_v5_connack_handler(
+                [&latency, &connacked, begin]
+                (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+                    latency.add(
+                        MQTT_NS::broker::histogram_snapshot::bucket_index(static_cast<std::uint64_t>(now() - begin)),
+                        1
+                    );
+                    ++connacked;
+                    return true;
+                }
+            );
+            c->set_v5_publish_handler(
+                [&received]
+                (MQTT_NS::optional<std::uint16_t>,
+                 MQTT_NS::publish_options,
+                 MQTT_NS::buffer,
+                 MQTT_NS::buffer,
+                 MQTT_NS::v5::properties) {
+                    ++received;
+                    return true;
+                }
+            );
+            h.connect(c, client_id(i), session_expiry);
+            cs.push_back(std::move(c));
+        }
+        h.run_until(
+            [&] {
+                return connacked == num_of_clients && received == num_of_clients * num_of_messages;
+            }
+        );
+
+        state.PauseTiming();
+        h.disconnect_and_wait(cs);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * num_of_clients));
+    state.counters["connack_p50_ns"] = static_cast<double>(latency.value_at_percentile(50));
+    state.counters["connack_p99_ns"] = static_cast<double>(latency.value_at_percentile(99));
+    state.counters["connack_max_ns"] = static_cast<double>(latency.max());
+    h.disconnect_and_wait({ pub });
+}
+
+void storm_args(benchmark::internal::Benchmark* b) {
+    for (auto clients : { 100, 1000 }) {
+        for (auto messages : { 0, 100 }) {
+            for (auto batch : { 0, 64 }) {
+                if (messages == 0 && batch == 0) continue;
+                b->Args({ clients, messages, batch });
+            }
+        }
+    }
+}
+BENCHMARK(BM_broker_reconnect_storm)->Apply(storm_args)->Unit(benchmark::kMillisecond);
+
+} // anonymous namespace
@@ -0,0 +1,219 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Scaling of the broker with the number of threads.
+// Each thread runs one io_context, and the clients connected by loopback_endpoint are spread
+// over them. Each client subscribes to its own topic and publishes to it.
+// In the shared mode, one broker_t serves all io_contexts. In the sharded mode, broker_shards
+// creates a broker_t for each io_context and forwards each message to the other shards.
+//
+// Arguments: mode, number of threads, clients per thread
+// Each iteration publishes `batch` messages from each client and waits until all of them are
+// delivered.
+
+#include <benchmark/benchmark.h>
+
+#include <condition_variable>
+#include <thread>
+
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/broker/broker_shards.hpp>
+
+namespace {
+
+namespace as = boost::asio;
+
+using client_t = MQTT_NS::server<>::endpoint_t;
+
+enum class mode {
+    shared,     ///< one broker_t for all threads
+    sharded,    ///< broker_shards
+};
+
+char const* mode_to_str(mode m) {
+    switch (m) {
+    case mode::shared:  return "shared";
+    case mode::sharded: return "sharded";
+    }
+    return "unknown";
+}
+
+constexpr std::size_t batch = 16;
+constexpr std::size_t payload_size = 64;
+
+class harness {
+public:
+    harness(mode m, std::size_t num_of_threads, std::size_t clients_per_thread)
+        :iocs_(num_of_threads) {
+        if (m == mode::shared) {
+            b_.emplace(iocs_.front());
+        }
+        else {
+            shards_.emplace(iocs_);
+        }
+        for (auto& ioc : iocs_) {
+            guards_.emplace_back(ioc.get_executor());
+            threads_.emplace_back([&ioc] { ioc.run(); });
+        }
+
+        for (std::size_t t = 0; t != num_of_threads; ++t) {
+            for (std::size_t i = 0; i != clients_per_thread; ++i) {
+                auto& ioc = iocs_[t];
+                auto sockets = MQTT_NS::make_loopback_pair(ioc, ioc);
+                auto c = std::make_shared<client_t>(ioc, sockets.second, MQTT_NS::protocol_version::v5);
+                c->set_async_operation(true);
+                clients_.emplace_back(t, c, "shard" + std::to_string(t) + "/" + std::to_string(i));
+                as::post(
+                    ioc,
+                    [this, &ioc, c, server = sockets.first, topic = clients_.back().topic] {
+                        auto ep = std::make_shared<MQTT_NS::broker::endpoint_t>(ioc, server);
+                        if (b_) b_->handle_accept(std::move(ep));
+                        else shards_->handle_accept(std::move(ep));
+                        setup(c, topic);
+                    }
+                );
+            }
+        }
+        wait(clients_.size());
+    }
+
+    ~harness() {
+        reset_counter();
+        for (auto& e : clients_) {
+            as::post(
+                iocs_[e.thread],
+                [this, c = e.c] {
+                    c->set_close_handler([this] { count_up(); });
+                    c->set_error_handler([this] (MQTT_NS::error_code) { count_up(); });
+                    c->async_disconnect();
+                }
+            );
+        }
+        wait(clients_.size());
+        guards_.clear();
+        for (auto& th : threads_) th.join();
+    }
+
+    // Publish a batch from each client and wait for the deliveries
+    void run_batch() {
+        reset_counter();
+        for (auto& e : clients_) {
+            as::post(
+                iocs_[e.thread],
+                [this, c = e.c, topic = e.topic] {
+                    for (std::size_t n = 0; n != batch; ++n) {
+                        c->async_publish(topic, payload_, MQTT_NS::qos::at_most_once);
+                    }
+                }
+            );
+        }
+        wait(deliveries_per_batch());
+    }
+
+    std::size_t deliveries_per_batch() const {
+        return clients_.size() * batch;
+    }
+
+private:
+    struct client_entry {
+        client_entry(std::size_t thread, std::shared_ptr<client_t> c, std::string topic)
+            : thread(thread), c(std::move(c)), topic(std::move(topic)) {}
+
+        std::size_t thread;
+        std::shared_ptr<client_t> c;
+        std::string topic;
+    };
+
+    // called on the thread of the client
+    void setup(std::shared_ptr<client_t> const& c, std::string const& topic) {
+        c->set_v5_connack_handler(
+            [&c = *c, topic]
+            (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+                c.async_subscribe(topic, MQTT_NS::qos::at_most_once);
+                return true;
+            }
+        );
+        c->set_v5_suback_handler(
+            [this]
+            (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+                count_up();
+                return true;
+            }
+        );
+        c->set_v5_publish_handler(
+            [this]
+            (MQTT_NS::optional<std::uint16_t>,
+             MQTT_NS::publish_options,
+             MQTT_NS::buffer,
+             MQTT_NS::buffer,
+             MQTT_NS::v5::properties) {
+                count_up();
+                return true;
+            }
+        );
+        c->start_session(c);
+        c->async_connect(
+            MQTT_NS::allocate_buffer("bench_" + topic),
+            MQTT_NS::nullopt,
+            MQTT_NS::nullopt,
+            MQTT_NS::nullopt,
+            0
+        );
+    }
+
+    void reset_counter() {
+        std::lock_guard<std::mutex> g(mtx_);
+        count_ = 0;
+    }
+
+    void count_up() {
+        std::lock_guard<std::mutex> g(mtx_);
+        ++count_;
+        cv_.notify_one();
+    }
+
+    void wait(std::size_t expected) {
+        std::unique_lock<std::mutex> g(mtx_);
+        cv_.wait(g, [&] { return count_ == expected; });
+    }
+
+    std::vector<as::io_context> iocs_;
+    MQTT_NS::optional<MQTT_NS::broker::broker_t> b_;
+    MQTT_NS::optional<MQTT_NS::broker::broker_shards> shards_;
+    std::vector<as::executor_work_guard<as::io_context::executor_type>> guards_;
+    std::vector<std::thread> threads_;
+    std::vector<client_entry> clients_;
+    std::string payload_ = std::string(payload_size, 'p');
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::size_t count_ = 0;
+};
+
+void BM_broker_shards(benchmark::State& state) {
+    auto m = static_cast<mode>(state.range(0));
+    harness h(
+        m,
+        static_cast<std::size_t>(state.range(1)),
+        static_cast<std::size_t>(state.range(2))
+    );
+    for (auto _ : state) {
+        h.run_batch();
+    }
+    state.SetLabel(mode_to_str(m));
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * h.deliveries_per_batch()));
+}
+
+void shards_args(benchmark::internal::Benchmark* b) {
+    for (auto threads : { 1, 2, 4 }) {
+        for (auto m : { mode::shared, mode::sharded }) {
+            b->Args({ static_cast<std::int64_t>(m), threads, 16 });
+        }
+    }
+}
+BENCHMARK(BM_broker_shards)->Apply(shards_args)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+} // anonymous namespace
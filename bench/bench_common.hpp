@@ -0,0 +1,76 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BENCH_COMMON_HPP)
+#define MQTT_BENCH_COMMON_HPP
+
+#include <random>
+#include <string>
+#include <vector>
+
+// The inputs are generated from fixed seeds, so every run (and every commit) measures the
+// same data.
+
+namespace bench {
+
+constexpr std::mt19937::result_type seed = 20210401;
+
+/**
+ * @brief Generate topic names like "building3/floor12/room7/sensor5".
+ * @param count  the number of topics
+ * @param levels the number of levels of each topic
+ * @param fan    the number of distinct names at each level
+ */
+inline std::vector<std::string> make_topics(std::size_t count, std::size_t levels, std::size_t fan) {
+    static char const* const names[] = { "building", "floor", "room", "sensor", "value", "unit", "id", "x" };
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<std::size_t> dist(0, fan - 1);
+    std::vector<std::string> topics;
+    topics.reserve(count);
+    for (std::size_t i = 0; i != count; ++i) {
+        std::string t;
+        for (std::size_t l = 0; l != levels; ++l) {
+            if (l != 0) t += '/';
+            t += names[l % (sizeof(names) / sizeof(names[0]))];
+            t += std::to_string(dist(gen));
+        }
+        topics.push_back(std::move(t));
+    }
+    return topics;
+}
+
+/**
+ * @brief Turn some levels of the topics into wildcards.
+ * @param topics       topic names made by make_topics()
+ * @param wildcard_pct the percentage of the filters that contain a wildcard.
+ *                     Half of them get a '+' at a random level and the other half end with '#'.
+ */
+inline std::vector<std::string> make_filters(std::vector<std::string> topics, int wildcard_pct) {
+    std::mt19937 gen(seed + 1);
+    std::uniform_int_distribution<int> pct(0, 99);
+    for (auto& t : topics) {
+        if (pct(gen) >= wildcard_pct) continue;
+        std::vector<std::string::size_type> slashes;
+        for (std::string::size_type i = 0; i != t.size(); ++i) {
+            if (t[i] == '/') slashes.push_back(i);
+        }
+        if (slashes.empty()) continue;
+        std::uniform_int_distribution<std::size_t> at(0, slashes.size() - 1);
+        auto i = at(gen);
+        if (pct(gen) < 50) {
+            auto b = i == 0 ? 0 : slashes[i - 1] + 1;
+            t.replace(b, slashes[i] - b, "+");
+        }
+        else {
+            t.replace(slashes[i] + 1, std::string::npos, "#");
+        }
+    }
+    return topics;
+}
+
+} // namespace bench
+
+#endif // MQTT_BENCH_COMMON_HPP
@@ -0,0 +1,231 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// The cost of an endpoint per PUBLISH, for the endpoints specialized for a protocol version
+// at compile time (the Version template parameter) and the ones that decide it at runtime
+// (protocol_version::undetermined).
+//
+// The endpoint is connected through loopback_endpoint to a raw peer, so only the endpoint
+// is measured:
+//   parse:  the peer writes encoded QoS0 PUBLISH packets. The endpoint reads them and calls
+//           the publish handler.
+//   encode: the endpoint publishes QoS0 messages, and the peer reads and drops the bytes.
+// Besides the time, the "instructions" counter reports the retired instructions per PUBLISH
+// (see instruction_counter.hpp).
+
+#include <benchmark/benchmark.h>
+
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/server.hpp>
+
+#include "instruction_counter.hpp"
+
+namespace {
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+using MQTT_NS::protocol_version;
+
+constexpr std::size_t batch = 64;
+
+auto const topic = "building3/floor7/room1/sensor12"_mb;
+auto const payload = MQTT_NS::allocate_buffer(std::string(64, 'p'));
+
+template <protocol_version Version>
+class harness {
+public:
+    using endpoint_t = typename MQTT_NS::server<
+        MQTT_NS::strand,
+        std::mutex,
+        std::lock_guard,
+        2,
+        MQTT_NS::packet_id_manager,
+        Version
+    >::endpoint_t;
+
+    explicit harness(protocol_version version) {
+        auto sockets = MQTT_NS::make_loopback_pair(ioc_, ioc_);
+        peer_ = sockets.second;
+        ep_ = std::make_shared<endpoint_t>(ioc_, sockets.first, version, true);
+
+        bool connected = false;
+        if (version == protocol_version::v3_1_1) {
+            packet_ = MQTT_NS::v3_1_1::publish_message(
+                0,
+                as::buffer(topic),
+                std::vector<as::const_buffer>{ as::buffer(payload) },
+                MQTT_NS::qos::at_most_once
+            ).continuous_buffer();
+            ep_->set_connack_handler(
+                [&connected]
+                (bool, MQTT_NS::connect_return_code) {
+                    connected = true;
+                    return true;
+                }
+            );
+            ep_->set_publish_handler(
+                [this]
+                (MQTT_NS::optional<std::uint16_t>,
+                 MQTT_NS::publish_options,
+                 MQTT_NS::buffer,
+                 MQTT_NS::buffer) {
+                    ++received_;
+                    return true;
+                }
+            );
+        }
+        else {
+            packet_ = MQTT_NS::v5::publish_message(
+                0,
+                as::buffer(topic),
+                std::vector<as::const_buffer>{ as::buffer(payload) },
+                MQTT_NS::qos::at_most_once,
+                MQTT_NS::v5::properties{}
+            ).continuous_buffer();
+            ep_->set_v5_connack_handler(
+                [&connected]
+                (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+                    connected = true;
+                    return true;
+                }
+            );
+            ep_->set_v5_publish_handler(
+                [this]
+                (MQTT_NS::optional<std::uint16_t>,
+                 MQTT_NS::publish_options,
+                 MQTT_NS::buffer,
+                 MQTT_NS::buffer,
+                 MQTT_NS::v5::properties) {
+                    ++received_;
+                    return true;
+                }
+            );
+        }
+        ep_->set_close_handler([] {});
+        ep_->set_error_handler([](MQTT_NS::error_code) {});
+
+        ep_->start_session(ep_);
+        ep_->async_connect("bench_cid"_mb, MQTT_NS::nullopt, MQTT_NS::nullopt, MQTT_NS::nullopt, 0);
+
+        // The CONNECT is shorter than 128 bytes, so the remaining length is one byte.
+        buf_.resize(2);
+        peer_->async_read(
+            as::buffer(buf_),
+            [this, version](MQTT_NS::error_code ec, std::size_t) {
+                if (ec) return;
+                buf_.resize(static_cast<std::uint8_t>(buf_[1]));
+                peer_->async_read(
+                    as::buffer(buf_),
+                    [this, version](MQTT_NS::error_code ec, std::size_t) {
+                        if (ec) return;
+                        static char const connack_v3_1_1[] = { 0x20, 0x02, 0x00, 0x00 };
+                        static char const connack_v5[] = { 0x20, 0x03, 0x00, 0x00, 0x00 };
+                        MQTT_NS::error_code wec;
+                        peer_->write(
+                            { version == protocol_version::v3_1_1 ? as::buffer(connack_v3_1_1) : as::buffer(connack_v5) },
+                            wec
+                        );
+                        drain();
+                    }
+                );
+            }
+        );
+        while (!connected) ioc_.run_one();
+    }
+
+    ~harness() {
+        peer_.reset();
+        ep_.reset();
+        ioc_.run();
+    }
+
+    // The peer writes a batch of PUBLISH packets, and the endpoint parses them.
+    void parse_batch() {
+        received_ = 0;
+        for (std::size_t i = 0; i != batch; ++i) {
+            MQTT_NS::error_code ec;
+            peer_->write({ as::buffer(packet_) }, ec);
+        }
+        while (received_ != batch) ioc_.run_one();
+    }
+
+    // The endpoint encodes and sends a batch of PUBLISH packets.
+    void encode_batch() {
+        drained_ = 0;
+        for (std::size_t i = 0; i != batch; ++i) {
+            ep_->async_publish(0, as::buffer(topic), as::buffer(payload), MQTT_NS::qos::at_most_once);
+        }
+        while (drained_ != batch) ioc_.run_one();
+    }
+
+private:
+    // The endpoint sends the same packet as packet_, so read it packet by packet.
+    void drain() {
+        buf_.resize(packet_.size());
+        peer_->async_read(
+            as::buffer(buf_),
+            [this](MQTT_NS::error_code ec, std::size_t) {
+                if (ec) return;
+                ++drained_;
+                drain();
+            }
+        );
+    }
+
+    as::io_context ioc_;
+    std::shared_ptr<MQTT_NS::loopback_endpoint<>> peer_;
+    std::shared_ptr<endpoint_t> ep_;
+    std::string packet_;
+    std::string buf_;
+    std::size_t received_ = 0;
+    std::size_t drained_ = 0;
+};
+
+template <protocol_version Version, typename Run>
+void run(benchmark::State& state, protocol_version version, Run run_batch) {
+    harness<Version> h(version);
+    bench::instruction_counter counter;
+    std::uint64_t instructions = 0;
+    for (auto _ : state) {
+        auto begin = counter.read();
+        run_batch(h);
+        instructions += counter.read() - begin;
+    }
+    auto packets = static_cast<std::uint64_t>(state.iterations()) * batch;
+    state.SetItemsProcessed(static_cast<std::int64_t>(packets));
+    bench::report_instructions(state, counter, instructions, packets);
+}
+
+// Version is the template parameter of the endpoint, Wire is the version of the connection.
+template <protocol_version Version, protocol_version Wire>
+struct config {};
+
+using v3_1_1_fixed = config<protocol_version::v3_1_1, protocol_version::v3_1_1>;
+using v3_1_1_undetermined = config<protocol_version::undetermined, protocol_version::v3_1_1>;
+using v5_fixed = config<protocol_version::v5, protocol_version::v5>;
+using v5_undetermined = config<protocol_version::undetermined, protocol_version::v5>;
+
+template <protocol_version Version, protocol_version Wire>
+void parse(benchmark::State& state, config<Version, Wire>) {
+    run<Version>(state, Wire, [](harness<Version>& h) { h.parse_batch(); });
+}
+
+template <protocol_version Version, protocol_version Wire>
+void encode(benchmark::State& state, config<Version, Wire>) {
+    run<Version>(state, Wire, [](harness<Version>& h) { h.encode_batch(); });
+}
+
+} // anonymous namespace
+
+BENCHMARK_CAPTURE(parse, v3_1_1_fixed, v3_1_1_fixed{});
+BENCHMARK_CAPTURE(parse, v3_1_1_undetermined, v3_1_1_undetermined{});
+BENCHMARK_CAPTURE(parse, v5_fixed, v5_fixed{});
+BENCHMARK_CAPTURE(parse, v5_undetermined, v5_undetermined{});
+
+BENCHMARK_CAPTURE(encode, v3_1_1_fixed, v3_1_1_fixed{});
+BENCHMARK_CAPTURE(encode, v3_1_1_undetermined, v3_1_1_undetermined{});
+BENCHMARK_CAPTURE(encode, v5_fixed, v5_fixed{});
+BENCHMARK_CAPTURE(encode, v5_undetermined, v5_undetermined{});
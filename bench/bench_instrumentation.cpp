@@ -0,0 +1,88 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// The cost that metrics and tracing add to each packet.
+
+#if !defined(MQTT_USE_TRACE)
+#define MQTT_USE_TRACE
+#endif // !defined(MQTT_USE_TRACE)
+
+#include <benchmark/benchmark.h>
+
+#include <mqtt/trace.hpp>
+#include <mqtt/broker/metrics.hpp>
+#include <mqtt/broker/trace_sink.hpp>
+
+namespace {
+
+// Shared by the threads of the multi threaded runs
+MQTT_NS::broker::metrics& get_metrics() {
+    static MQTT_NS::broker::metrics m;
+    return m;
+}
+
+void BM_metrics_add(benchmark::State& state) {
+    auto& m = get_metrics();
+    for (auto _ : state) {
+        m.add(MQTT_NS::broker::metrics::counter::publish_received);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_metrics_add)->Threads(1)->Threads(4);
+
+void BM_metrics_record(benchmark::State& state) {
+    auto& m = get_metrics();
+    std::uint64_t v = 0;
+    for (auto _ : state) {
+        m.record(MQTT_NS::broker::metrics::histogram::match_latency, v);
+        v = v * 6364136223846793005ULL + 1442695040888963407ULL;
+        v >>= 40;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_metrics_record)->Threads(1)->Threads(4);
+
+void BM_metrics_get_histogram(benchmark::State& state) {
+    auto& m = get_metrics();
+    for (auto _ : state) {
+        auto s = m.get(MQTT_NS::broker::metrics::histogram::match_latency);
+        benchmark::DoNotOptimize(s);
+    }
+}
+BENCHMARK(BM_metrics_get_histogram);
+
+void BM_trace_stamp(benchmark::State& state) {
+    auto ctx = MQTT_NS::trace_context::start();
+    MQTT_NS::trace_scope scope(ctx);
+    for (auto _ : state) {
+        MQTT_TRACE_STAMP(match);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_trace_stamp);
+
+void BM_trace_stamp_no_context(benchmark::State& state) {
+    for (auto _ : state) {
+        MQTT_TRACE_STAMP(match);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_trace_stamp_no_context);
+
+void BM_histogram_trace_sink(benchmark::State& state) {
+    MQTT_NS::broker::histogram_trace_sink sink;
+    auto ctx = MQTT_NS::trace_context::start();
+    for (std::size_t i = 0; i != MQTT_NS::trace_context::num_of_stages; ++i) {
+        ctx.stamp(static_cast<MQTT_NS::trace_stage>(i));
+    }
+    for (auto _ : state) {
+        sink.on_trace(ctx);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_histogram_trace_sink);
+
+} // anonymous namespace
@@ -0,0 +1,476 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+#include <mqtt/message_variant.hpp>
+#include <mqtt/encoded_properties.hpp>
+#include <mqtt/property_parse.hpp>
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/server.hpp>
+
+// Encode:         construct the message and serialize it, as the endpoint does for each send.
+// Decode message: construct the message from the received bytes. Only PUBLISH and PUBREL have
+//                 a decoding constructor.
+// Decode:         an endpoint parses the received packets field by field and calls the handler,
+//                 for every MQTT v5 packet type.
+
+namespace {
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+namespace v5 = MQTT_NS::v5;
+
+v5::properties publish_props() {
+    return v5::properties {
+        v5::property::payload_format_indicator(v5::property::payload_format_indicator::string),
+        v5::property::message_expiry_interval(3600),
+        v5::property::content_type("application/json"_mb),
+        v5::property::response_topic("reply/to/me"_mb),
+        v5::property::correlation_data("0123456789abcdef"_mb),
+        v5::property::user_property("key1"_mb, "value1"_mb),
+        v5::property::user_property("key2"_mb, "value2"_mb),
+    };
+}
+
+v5::properties ack_props() {
+    return v5::properties {
+        v5::property::reason_string("reason"_mb),
+        v5::property::user_property("key1"_mb, "value1"_mb),
+    };
+}
+
+template <typename Make>
+void encode(benchmark::State& state, Make make) {
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        auto m = make();
+        auto cbs = m.const_buffer_sequence();
+        benchmark::DoNotOptimize(cbs);
+        bytes += m.size();
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(bytes));
+}
+
+auto topic = "building3/floor7/room1/sensor12"_mb;
+auto payload = MQTT_NS::allocate_buffer(std::string(256, 'p'));
+
+BENCHMARK_CAPTURE(encode, connect, [] {
+    return v5::connect_message(
+        60,
+        "client_id_1234"_mb,
+        true,
+        MQTT_NS::will("will/topic"_mb, "will message"_mb, MQTT_NS::qos::at_least_once, ack_props()),
+        "user"_mb,
+        "password"_mb,
+        v5::properties {
+            v5::property::session_expiry_interval(3600),
+            v5::property::receive_maximum(100),
+            v5::property::topic_alias_maximum(16),
+        }
+    );
+});
+BENCHMARK_CAPTURE(encode, connack, [] {
+    return v5::connack_message(
+        false,
+        v5::connect_reason_code::success,
+        v5::properties {
+            v5::property::topic_alias_maximum(16),
+            v5::property::assigned_client_identifier("assigned_1234"_mb),
+        }
+    );
+});
+BENCHMARK_CAPTURE(encode, publish, [] {
+    return v5::publish_message(
+        1,
+        as::buffer(topic),
+        std::vector<as::const_buffer>{ as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        publish_props()
+    );
+});
+BENCHMARK_CAPTURE(encode, publish_shared_props, [] {
+    static MQTT_NS::v5::encoded_properties const shared(publish_props());
+    return v5::publish_message(
+        1,
+        as::buffer(topic),
+        std::vector<as::const_buffer>{ as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        shared,
+        v5::properties { v5::property::subscription_identifier(5) }
+    );
+});
+BENCHMARK_CAPTURE(encode, puback, [] {
+    return v5::puback_message(1, v5::puback_reason_code::success, ack_props());
+});
+BENCHMARK_CAPTURE(encode, pubrec, [] {
+    return v5::pubrec_message(1, v5::pubrec_reason_code::success, ack_props());
+});
+BENCHMARK_CAPTURE(encode, pubrel, [] {
+    return v5::pubrel_message(1, v5::pubrel_reason_code::success, ack_props());
+});
+BENCHMARK_CAPTURE(encode, pubcomp, [] {
+    return v5::pubcomp_message(1, v5::pubcomp_reason_code::success, ack_props());
+});
+BENCHMARK_CAPTURE(encode, subscribe, [] {
+    return v5::subscribe_message(
+        std::vector<std::tuple<as::const_buffer, MQTT_NS::subscribe_options>> {
+            { as::buffer(topic), MQTT_NS::qos::at_least_once },
+            { as::buffer("building3/+/room1/#"_mb), MQTT_NS::qos::at_most_once },
+        },
+        1,
+        v5::properties { v5::property::subscription_identifier(5) }
+    );
+});
+BENCHMARK_CAPTURE(encode, suback, [] {
+    return v5::suback_message(
+        std::vector<v5::suback_reason_code> {
+            v5::suback_reason_code::granted_qos_1,
+            v5::suback_reason_code::granted_qos_0,
+        },
+        1,
+        ack_props()
+    );
+});
+BENCHMARK_CAPTURE(encode, unsubscribe, [] {
+    return v5::unsubscribe_message(
+        std::vector<as::const_buffer> { as::buffer(topic), as::buffer("building3/+/room1/#"_mb) },
+        1,
+        v5::properties {}
+    );
+});
+BENCHMARK_CAPTURE(encode, unsuback, [] {
+    return v5::unsuback_message(
+        std::vector<v5::unsuback_reason_code> {
+            v5::unsuback_reason_code::success,
+            v5::unsuback_reason_code::no_subscription_existed,
+        },
+        1,
+        ack_props()
+    );
+});
+BENCHMARK_CAPTURE(encode, pingreq, [] {
+    return v5::pingreq_message();
+});
+BENCHMARK_CAPTURE(encode, pingresp, [] {
+    return v5::pingresp_message();
+});
+BENCHMARK_CAPTURE(encode, disconnect, [] {
+    return v5::disconnect_message(v5::disconnect_reason_code::normal_disconnection, ack_props());
+});
+BENCHMARK_CAPTURE(encode, auth, [] {
+    return v5::auth_message(
+        v5::auth_reason_code::continue_authentication,
+        v5::properties {
+            v5::property::authentication_method("SCRAM-SHA-1"_mb),
+            v5::property::authentication_data("0123456789abcdef0123456789abcdef"_mb),
+        }
+    );
+});
+
+// Decode the message with its decoding constructor
+template <typename Make>
+void decode_message(benchmark::State& state, Make make) {
+    using message_t = decltype(make());
+    auto bytes = MQTT_NS::allocate_buffer(make().continuous_buffer());
+    for (auto _ : state) {
+        message_t m(bytes);
+        benchmark::DoNotOptimize(m);
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * bytes.size()));
+}
+
+BENCHMARK_CAPTURE(decode_message, publish, [] {
+    return v5::publish_message(
+        1,
+        as::buffer(topic),
+        std::vector<as::const_buffer>{ as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        publish_props()
+    );
+});
+BENCHMARK_CAPTURE(decode_message, publish_no_props, [] {
+    return v5::publish_message(
+        1,
+        as::buffer(topic),
+        std::vector<as::const_buffer>{ as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        v5::properties {}
+    );
+});
+BENCHMARK_CAPTURE(decode_message, pubrel, [] {
+    return v5::pubrel_message(1, v5::pubrel_reason_code::success, ack_props());
+});
+
+constexpr std::size_t batch = 64;
+
+// The bytes that the endpoint sends for the message.
+// continuous_buffer() of CONNACK doesn't contain the property length, so it isn't used.
+template <typename Message>
+std::string to_bytes(Message const& m) {
+    std::string bytes;
+    for (auto const& b : m.const_buffer_sequence()) {
+        bytes.append(static_cast<char const*>(b.data()), b.size());
+    }
+    return bytes;
+}
+
+v5::connect_message connect(std::uint16_t) {
+    return v5::connect_message(
+        60,
+        "client_id_1234"_mb,
+        true,
+        MQTT_NS::will("will/topic"_mb, "will message"_mb, MQTT_NS::qos::at_least_once, ack_props()),
+        "user"_mb,
+        "password"_mb,
+        v5::properties {
+            v5::property::session_expiry_interval(3600),
+            v5::property::receive_maximum(100),
+            v5::property::topic_alias_maximum(16),
+        }
+    );
+}
+
+/**
+ * An endpoint that receives the packets written by a raw peer through loopback_endpoint.
+ * It is made connected by a CONNECT, so it accepts every packet type. The handlers only count
+ * the packets, and the endpoint doesn't respond to them (auto_pub_response is off and nothing
+ * is sent from the handlers), so only the parsing of the endpoint is measured.
+ */
+class receiver {
+public:
+    using endpoint_t = MQTT_NS::server<>::endpoint_t;
+
+    explicit receiver(as::io_context& ioc) {
+        auto sockets = MQTT_NS::make_loopback_pair(ioc, ioc);
+        peer_ = sockets.second;
+        ep_ = std::make_shared<endpoint_t>(ioc, sockets.first, MQTT_NS::protocol_version::v5, true);
+        ep_->set_auto_pub_response(false);
+
+        auto count = [this](auto&&...) { ++received_; return true; };
+        ep_->set_v5_connect_handler(count);
+        ep_->set_v5_connack_handler(count);
+        ep_->set_v5_publish_handler(count);
+        ep_->set_v5_puback_handler(count);
+        ep_->set_v5_pubrec_handler(count);
+        ep_->set_v5_pubrel_handler(count);
+        ep_->set_v5_pubcomp_handler(count);
+        ep_->set_v5_subscribe_handler(count);
+        ep_->set_v5_suback_handler(count);
+        ep_->set_v5_unsubscribe_handler(count);
+        ep_->set_v5_unsuback_handler(count);
+        ep_->set_pingreq_handler(count);
+        ep_->set_pingresp_handler(count);
+        ep_->set_v5_disconnect_handler(count);
+        ep_->set_v5_auth_handler(count);
+        ep_->set_close_handler([] {});
+        ep_->set_error_handler([](MQTT_NS::error_code) {});
+
+        ep_->start_session(ep_);
+        write(to_bytes(connect(0)));
+        while (received_ == 0) ioc.run_one();
+    }
+
+    // Write the bytes from the peer. received() increases when the endpoint handled a packet.
+    void write(std::string const& bytes) {
+        MQTT_NS::error_code ec;
+        peer_->write({ as::buffer(bytes) }, ec);
+    }
+
+    std::size_t received() const {
+        return received_;
+    }
+
+    endpoint_t& endpoint() {
+        return *ep_;
+    }
+
+private:
+    std::shared_ptr<MQTT_NS::loopback_endpoint<>> peer_;
+    std::shared_ptr<endpoint_t> ep_;
+    std::size_t received_ = 0;
+};
+
+// The packets of a batch, with the packet ids 1 to batch
+template <typename Make>
+std::string encode_batch(Make make) {
+    std::string bytes;
+    for (std::size_t i = 1; i <= batch; ++i) {
+        bytes += to_bytes(make(static_cast<std::uint16_t>(i)));
+    }
+    return bytes;
+}
+
+/**
+ * Decode the packets with the endpoint. Each iteration writes a batch of packets at once and
+ * runs the endpoint until it handled all of them.
+ * A SUBACK and an UNSUBACK release their packet id, so the ids of the batch are registered
+ * to the endpoint, outside of the timing, before each batch if register_ids is true.
+ */
+template <typename Make>
+void decode(benchmark::State& state, Make make, bool register_ids = false) {
+    as::io_context ioc;
+    auto bytes = encode_batch(make);
+    {
+        receiver r(ioc);
+        for (auto _ : state) {
+            if (register_ids) {
+                state.PauseTiming();
+                for (std::size_t i = 1; i <= batch; ++i) {
+                    r.endpoint().register_packet_id(static_cast<std::uint16_t>(i));
+                }
+                state.ResumeTiming();
+            }
+            auto goal = r.received() + batch;
+            r.write(bytes);
+            while (r.received() != goal) ioc.run_one();
+        }
+    }
+    ioc.run();
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * batch));
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * bytes.size()));
+}
+
+/**
+ * Decode DISCONNECT. The endpoint is shut down by it, so each iteration connects a batch of
+ * endpoints outside of the timing and writes one DISCONNECT to each of them.
+ */
+void decode_disconnect(benchmark::State& state) {
+    as::io_context ioc;
+    auto bytes = to_bytes(
+        v5::disconnect_message(v5::disconnect_reason_code::normal_disconnection, ack_props())
+    );
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<std::unique_ptr<receiver>> rs;
+        for (std::size_t i = 0; i != batch; ++i) {
+            rs.push_back(std::make_unique<receiver>(ioc));
+        }
+        state.ResumeTiming();
+        for (auto& r : rs) r->write(bytes);
+        for (auto& r : rs) {
+            while (r->received() != 2) ioc.run_one();
+        }
+        state.PauseTiming();
+        rs.clear();
+        ioc.run();
+        ioc.restart();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * batch));
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * batch * bytes.size()));
+}
+
+BENCHMARK_CAPTURE(decode, connect, connect);
+BENCHMARK_CAPTURE(decode, connack, [](std::uint16_t) {
+    return v5::connack_message(
+        false,
+        v5::connect_reason_code::success,
+        v5::properties {
+            v5::property::topic_alias_maximum(16),
+            v5::property::assigned_client_identifier("assigned_1234"_mb),
+        }
+    );
+});
+BENCHMARK_CAPTURE(decode, publish, [](std::uint16_t packet_id) {
+    return v5::publish_message(
+        packet_id,
+        as::buffer(topic),
+        std::vector<as::const_buffer>{ as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        publish_props()
+    );
+});
+BENCHMARK_CAPTURE(decode, publish_no_props, [](std::uint16_t packet_id) {
+    return v5::publish_message(
+        packet_id,
+        as::buffer(topic),
+        std::vector<as::const_buffer>{ as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        v5::properties {}
+    );
+});
+BENCHMARK_CAPTURE(decode, puback, [](std::uint16_t packet_id) {
+    return v5::puback_message(packet_id, v5::puback_reason_code::success, ack_props());
+});
+BENCHMARK_CAPTURE(decode, pubrec, [](std::uint16_t packet_id) {
+    return v5::pubrec_message(packet_id, v5::pubrec_reason_code::success, ack_props());
+});
+BENCHMARK_CAPTURE(decode, pubrel, [](std::uint16_t packet_id) {
+    return v5::pubrel_message(packet_id, v5::pubrel_reason_code::success, ack_props());
+});
+BENCHMARK_CAPTURE(decode, pubcomp, [](std::uint16_t packet_id) {
+    return v5::pubcomp_message(packet_id, v5::pubcomp_reason_code::success, ack_props());
+});
+BENCHMARK_CAPTURE(decode, subscribe, [](std::uint16_t packet_id) {
+    return v5::subscribe_message(
+        std::vector<std::tuple<as::const_buffer, MQTT_NS::subscribe_options>> {
+            { as::buffer(topic), MQTT_NS::qos::at_least_once },
+            { as::buffer("building3/+/room1/#"_mb), MQTT_NS::qos::at_most_once },
+        },
+        packet_id,
+        v5::properties { v5::property::subscription_identifier(5) }
+    );
+});
+BENCHMARK_CAPTURE(decode, suback, [](std::uint16_t packet_id) {
+    return v5::suback_message(
+        std::vector<v5::suback_reason_code> {
+            v5::suback_reason_code::granted_qos_1,
+            v5::suback_reason_code::granted_qos_0,
+        },
+        packet_id,
+        ack_props()
+    );
+}, true);
+BENCHMARK_CAPTURE(decode, unsubscribe, [](std::uint16_t packet_id) {
+    return v5::unsubscribe_message(
+        std::vector<as::const_buffer> { as::buffer(topic), as::buffer("building3/+/room1/#"_mb) },
+        packet_id,
+        v5::properties {}
+    );
+});
+BENCHMARK_CAPTURE(decode, unsuback, [](std::uint16_t packet_id) {
+    return v5::unsuback_message(
+        std::vector<v5::unsuback_reason_code> {
+            v5::unsuback_reason_code::success,
+            v5::unsuback_reason_code::no_subscription_existed,
+        },
+        packet_id,
+        ack_props()
+    );
+}, true);
+BENCHMARK_CAPTURE(decode, pingreq, [](std::uint16_t) {
+    return v5::pingreq_message();
+});
+BENCHMARK_CAPTURE(decode, pingresp, [](std::uint16_t) {
+    return v5::pingresp_message();
+});
+BENCHMARK(decode_disconnect);
+BENCHMARK_CAPTURE(decode, auth, [](std::uint16_t) {
+    return v5::auth_message(
+        v5::auth_reason_code::continue_authentication,
+        v5::properties {
+            v5::property::authentication_method("SCRAM-SHA-1"_mb),
+            v5::property::authentication_data("0123456789abcdef0123456789abcdef"_mb),
+        }
+    );
+});
+
+void BM_property_parse(benchmark::State& state) {
+    MQTT_NS::v5::encoded_properties encoded(publish_props());
+    auto const& bytes = encoded.bytes();
+    for (auto _ : state) {
+        auto props = v5::property::parse(bytes);
+        benchmark::DoNotOptimize(props);
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * bytes.size()));
+}
+BENCHMARK(BM_property_parse);
+
+} // anonymous namespace
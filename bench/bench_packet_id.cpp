@@ -0,0 +1,73 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include <mqtt/value_allocator.hpp>
+#include <mqtt/packet_id_manager.hpp>
+#include <mqtt/bitmap_packet_id_manager.hpp>
+
+#include "bench_common.hpp"
+
+// Packet id churn: keep range(0) ids in flight and release them out of order,
+// like acknowledgements that arrive in a different order than the PUBLISH packets.
+
+namespace {
+
+template <typename Manager>
+void packet_id_churn(benchmark::State& state) {
+    Manager m;
+    auto inflight = static_cast<std::size_t>(state.range(0));
+    std::vector<std::uint16_t> used;
+    for (std::size_t i = 0; i != inflight; ++i) {
+        used.push_back(m.acquire_unique_id().value());
+    }
+    std::mt19937 gen(bench::seed);
+    std::uniform_int_distribution<std::size_t> dist(0, inflight - 1);
+    for (auto _ : state) {
+        auto& id = used[dist(gen)];
+        m.release_id(id);
+        id = m.acquire_unique_id().value();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+
+BENCHMARK_TEMPLATE(packet_id_churn, MQTT_NS::packet_id_manager<std::uint16_t>)
+    ->Arg(16)->Arg(1024)->Arg(32768);
+BENCHMARK_TEMPLATE(packet_id_churn, MQTT_NS::bitmap_packet_id_manager<std::uint16_t>)
+    ->Arg(16)->Arg(1024)->Arg(32768);
+
+void BM_value_allocator_allocate_deallocate(benchmark::State& state) {
+    MQTT_NS::value_allocator<std::uint16_t> va(1, 0xffff);
+    for (auto _ : state) {
+        auto v = va.allocate();
+        benchmark::DoNotOptimize(v);
+        va.deallocate(v.value());
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_value_allocator_allocate_deallocate);
+
+// use() of a value inside a fragmented vacant interval set
+void BM_value_allocator_use_fragmented(benchmark::State& state) {
+    MQTT_NS::value_allocator<std::uint16_t> va(1, 0xffff);
+    for (std::uint32_t i = 1; i <= 0xffff; ++i) va.allocate();
+    for (std::uint32_t i = 1; i <= 0xffff; i += 2) va.deallocate(static_cast<std::uint16_t>(i));
+    std::mt19937 gen(bench::seed);
+    std::uniform_int_distribution<std::uint16_t> dist(0, 0x7ffe);
+    for (auto _ : state) {
+        auto v = static_cast<std::uint16_t>(dist(gen) * 2 + 1);
+        va.use(v);
+        va.deallocate(v);
+    }
+    state.counters["intervals"] = static_cast<double>(va.interval_count());
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_value_allocator_use_fragmented);
+
+} // anonymous namespace
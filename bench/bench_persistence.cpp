@@ -0,0 +1,189 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Startup and write costs of the durable state: restoring the broker from log_persistence,
+// loading the retained message snapshot, and appending to the endpoint store_log with each
+// sync policy.
+// The files are written to the current directory and removed at the end of each benchmark.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+
+#include <mqtt/store_log.hpp>
+#include <mqtt/broker/broker.hpp>
+#include <mqtt/broker/log_persistence.hpp>
+
+#include "bench_common.hpp"
+
+namespace {
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+
+struct remove_file {
+    explicit remove_file(std::string path) : path(path) {
+        remove();
+    }
+    ~remove_file() {
+        remove();
+    }
+    void remove() const {
+        std::remove(path.c_str());
+        std::remove((path + ".tmp").c_str());
+    }
+    std::string path;
+};
+
+constexpr std::size_t payload_size = 64;
+
+// Arguments: number of offline sessions, number of offline messages of each session
+// Each session has two subscriptions. An iteration opens the log, replays it, and restores
+// the sessions to a new broker.
+void BM_session_recovery(benchmark::State& state) {
+    remove_file rf("bench_session_recovery.log");
+    auto num_of_sessions = static_cast<std::size_t>(state.range(0));
+    auto num_of_messages = static_cast<std::size_t>(state.range(1));
+    as::io_context ioc;
+    {
+        MQTT_NS::broker::log_persistence ps(ioc, rf.path);
+        std::string payload(payload_size, 'p');
+        for (std::size_t i = 0; i != num_of_sessions; ++i) {
+            auto cid = MQTT_NS::allocate_buffer("bench_cid" + std::to_string(i));
+            auto topic = MQTT_NS::allocate_buffer("bench/" + std::to_string(i));
+            ps.put_session(cid, MQTT_NS::protocol_version::v5, std::chrono::steady_clock::duration(std::chrono::hours(24)));
+            ps.put_subscription(cid, ""_mb, topic, MQTT_NS::qos::at_least_once, MQTT_NS::nullopt);
+            ps.put_subscription(cid, ""_mb, "bench/all/#"_mb, MQTT_NS::qos::at_most_once, MQTT_NS::nullopt);
+            ps.session_offline(cid, {}, {});
+            for (std::size_t m = 0; m != num_of_messages; ++m) {
+                ps.push_offline_message(
+                    cid,
+                    topic,
+                    MQTT_NS::allocate_buffer(payload),
+                    MQTT_NS::qos::at_least_once,
+                    MQTT_NS::v5::properties {}
+                );
+            }
+        }
+    }
+
+    for (auto _ : state) {
+        MQTT_NS::optional<MQTT_NS::broker::broker_t> b;
+        b.emplace(ioc);
+        b->set_persistence(std::make_shared<MQTT_NS::broker::log_persistence>(ioc, rf.path));
+        state.PauseTiming();
+        b = MQTT_NS::nullopt;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * num_of_sessions));
+}
+BENCHMARK(BM_session_recovery)
+    ->Args({1000, 0})
+    ->Args({1000, 100})
+    ->Args({100000, 0})
+    ->Args({100000, 10})
+    ->Unit(benchmark::kMillisecond);
+// Writing the log of 1M sessions takes longer than the recovery, so it is recovered once.
+BENCHMARK(BM_session_recovery)
+    ->Args({1000000, 0})
+    ->Args({1000000, 1})
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
+
+// Arguments: number of retained messages
+// An iteration maps the snapshot and builds the retained topic index of a new broker.
+void BM_retained_snapshot_load(benchmark::State& state) {
+    remove_file rf("bench_retained_snapshot.snap");
+    auto num_of_topics = static_cast<std::size_t>(state.range(0));
+    {
+        MQTT_NS::broker::retained_snapshot::writer w(rf.path);
+        std::string payload(payload_size, 'p');
+        // Seven levels of 32 names, so the topics are distinct enough for 5M messages.
+        for (auto const& t : bench::make_topics(num_of_topics, 7, 32)) {
+            w.add(t, payload, MQTT_NS::v5::properties {}, MQTT_NS::qos::at_most_once, MQTT_NS::nullopt);
+        }
+        w.commit();
+    }
+
+    as::io_context ioc;
+    std::size_t loaded = 0;
+    for (auto _ : state) {
+        MQTT_NS::optional<MQTT_NS::broker::broker_t> b;
+        b.emplace(ioc);
+        loaded = b->load_retained_snapshot(rf.path);
+        state.PauseTiming();
+        b = MQTT_NS::nullopt;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * loaded));
+}
+BENCHMARK(BM_retained_snapshot_load)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Arg(5000000)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
+
+// The same retained messages restored from the log, for comparison with the snapshot.
+void BM_retained_log_restore(benchmark::State& state) {
+    remove_file rf("bench_retained_log_restore.log");
+    auto num_of_topics = static_cast<std::size_t>(state.range(0));
+    as::io_context ioc;
+    {
+        MQTT_NS::broker::log_persistence ps(ioc, rf.path);
+        std::string payload(payload_size, 'p');
+        for (auto const& t : bench::make_topics(num_of_topics, 7, 32)) {
+            ps.put_retained(
+                MQTT_NS::allocate_buffer(t),
+                MQTT_NS::allocate_buffer(payload),
+                MQTT_NS::v5::properties {},
+                MQTT_NS::qos::at_most_once
+            );
+        }
+    }
+
+    for (auto _ : state) {
+        MQTT_NS::optional<MQTT_NS::broker::broker_t> b;
+        b.emplace(ioc);
+        b->set_persistence(std::make_shared<MQTT_NS::broker::log_persistence>(ioc, rf.path));
+        state.PauseTiming();
+        b = MQTT_NS::nullopt;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * num_of_topics));
+}
+BENCHMARK(BM_retained_log_restore)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
+
+// Arguments: sync policy bytes (0 means sync on each append), sync policy interval in ms
+// An iteration records a PUBLISH and its removal, like a QoS1 message that is acknowledged.
+void BM_store_log_sync(benchmark::State& state) {
+    remove_file rf("bench_store_log_sync.log");
+    as::io_context ioc;
+    MQTT_NS::store_log::config c;
+    c.sync.bytes = static_cast<std::size_t>(state.range(0));
+    c.sync.interval = std::chrono::milliseconds(state.range(1));
+    MQTT_NS::store_log log(ioc, rf.path, c);
+    std::string serialized(payload_size, 'p');
+    std::uint16_t packet_id = 0;
+    for (auto _ : state) {
+        if (++packet_id == 0) packet_id = 1;
+        log.put(packet_id, serialized);
+        log.remove(packet_id);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * serialized.size()));
+}
+BENCHMARK(BM_store_log_sync)
+    ->Args({0, 0})
+    ->Args({64 * 1024, 10})
+    ->Args({1024 * 1024, 100})
+    ->Unit(benchmark::kMicrosecond);
+
+} // anonymous namespace
@@ -0,0 +1,58 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include <benchmark/benchmark.h>
+
+#include <mqtt/broker/retained_topic_map.hpp>
+
+#include "bench_common.hpp"
+
+// Arguments: number of retained messages
+
+namespace {
+
+using map_t = MQTT_NS::broker::retained_topic_map<int>;
+
+void fill(map_t& m, std::size_t count) {
+    auto topics = bench::make_topics(count, 4, 16);
+    for (std::size_t i = 0; i != topics.size(); ++i) {
+        m.insert_or_assign(topics[i], static_cast<int>(i));
+    }
+}
+
+// A subscription with a filter scans the retained messages
+void retained_scan(benchmark::State& state, std::string const& filter) {
+    map_t m;
+    fill(m, static_cast<std::size_t>(state.range(0)));
+    std::size_t found = 0;
+    for (auto _ : state) {
+        m.find(filter, [&](int) { ++found; });
+    }
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(static_cast<std::int64_t>(found));
+}
+
+// The first topic made by fill()
+BENCHMARK_CAPTURE(retained_scan, exact, bench::make_topics(1, 4, 16).front())->Arg(1000)->Arg(100000);
+BENCHMARK_CAPTURE(retained_scan, plus, std::string("building3/+/room1/+"))->Arg(1000)->Arg(100000);
+BENCHMARK_CAPTURE(retained_scan, hash, std::string("building3/#"))->Arg(1000)->Arg(100000);
+BENCHMARK_CAPTURE(retained_scan, all, std::string("#"))->Arg(1000)->Arg(100000);
+
+void BM_retained_topic_map_insert_erase(benchmark::State& state) {
+    map_t m;
+    fill(m, static_cast<std::size_t>(state.range(0)));
+    auto topics = bench::make_topics(1024, 5, 16);
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto const& t = topics[i++ & 1023];
+        m.insert_or_assign(t, 0);
+        m.erase(t);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_retained_topic_map_insert_erase)->Arg(1000)->Arg(100000);
+
+} // anonymous namespace
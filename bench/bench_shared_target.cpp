@@ -0,0 +1,74 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+#include <mqtt/broker/broker.hpp>
+
+// Arguments: number of sessions that share the subscription
+
+namespace {
+
+namespace as = boost::asio;
+
+struct sessions {
+    explicit sessions(std::size_t count) {
+        for (std::size_t i = 0; i != count; ++i) {
+            ss.emplace_back(
+                std::make_unique<MQTT_NS::broker::session_state>(
+                    ioc,
+                    mtx_subs_map,
+                    subs_map,
+                    targets,
+                    broker_metrics,
+                    MQTT_NS::protocol_version::v5,
+                    MQTT_NS::allocate_buffer("cid" + std::to_string(i)),
+                    MQTT_NS::nullopt
+                )
+            );
+        }
+    }
+
+    as::io_context ioc;
+    MQTT_NS::broker::mutex mtx_subs_map;
+    MQTT_NS::broker::sub_con_map subs_map;
+    MQTT_NS::broker::shared_target targets;
+    MQTT_NS::broker::metrics broker_metrics;
+    std::vector<std::unique_ptr<MQTT_NS::broker::session_state>> ss;
+};
+
+// Round robin selection of the session for each PUBLISH
+void BM_shared_target_get_target(benchmark::State& state) {
+    sessions s(static_cast<std::size_t>(state.range(0)));
+    auto sn = MQTT_NS::allocate_buffer("group");
+    auto tf = MQTT_NS::allocate_buffer("building/+/room/#");
+    for (auto& ss : s.ss) s.targets.insert(sn, tf, *ss);
+    for (auto _ : state) {
+        auto t = s.targets.get_target(sn, tf);
+        benchmark::DoNotOptimize(t);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_shared_target_get_target)->Arg(2)->Arg(64)->Arg(1024);
+
+void BM_shared_target_insert_erase(benchmark::State& state) {
+    sessions s(static_cast<std::size_t>(state.range(0)) + 1);
+    auto sn = MQTT_NS::allocate_buffer("group");
+    auto tf = MQTT_NS::allocate_buffer("building/+/room/#");
+    for (std::size_t i = 1; i != s.ss.size(); ++i) s.targets.insert(sn, tf, *s.ss[i]);
+    auto& churn = *s.ss.front();
+    for (auto _ : state) {
+        s.targets.insert(sn, tf, churn);
+        s.targets.erase(sn, tf, churn);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_shared_target_insert_erase)->Arg(2)->Arg(64)->Arg(1024);
+
+} // anonymous namespace
@@ -0,0 +1,67 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include <benchmark/benchmark.h>
+
+#include <mqtt/utf8encoded_strings.hpp>
+
+// Arguments: string length in bytes
+// Without MQTT_USE_STR_CHECK the validation is a no-op, so the results are meaningless.
+
+namespace {
+
+std::string ascii(std::size_t len) {
+    std::string s;
+    while (s.size() < len) s += "building/floor3/room12/sensor/temperature/";
+    s.resize(len);
+    return s;
+}
+
+std::string mixed(std::size_t len) {
+    std::string s;
+    while (s.size() < len) s += u8"building/étage3/部屋12/sensor/";
+    // Don't cut a multi byte sequence
+    while (s.size() > len) s.pop_back();
+    while (!s.empty() && (static_cast<unsigned char>(s.back()) & 0xc0) == 0x80) s.pop_back();
+    if (!s.empty() && static_cast<unsigned char>(s.back()) >= 0xc0) s.pop_back();
+    return s;
+}
+
+std::string cjk(std::size_t len) {
+    std::string s;
+    while (s.size() < len) s += u8"建物三階部屋十二温度センサー";
+    // Don't cut a multi byte sequence
+    while (s.size() > len) s.pop_back();
+    while (!s.empty() && (static_cast<unsigned char>(s.back()) & 0xc0) == 0x80) s.pop_back();
+    if (!s.empty() && static_cast<unsigned char>(s.back()) >= 0xc0) s.pop_back();
+    return s;
+}
+
+template <typename Validate>
+void validate(benchmark::State& state, std::string (*make)(std::size_t), Validate v) {
+    auto s = make(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state) {
+        auto r = v(s);
+        benchmark::DoNotOptimize(r);
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * s.size()));
+}
+
+auto scalar = [](MQTT_NS::string_view s) {
+    return MQTT_NS::utf8string::validate_contents_scalar(s);
+};
+auto dispatched = [](MQTT_NS::string_view s) {
+    return MQTT_NS::utf8string::validate_contents(s);
+};
+
+BENCHMARK_CAPTURE(validate, ascii_scalar, ascii, scalar)->Arg(16)->Arg(64)->Arg(1024);
+BENCHMARK_CAPTURE(validate, ascii, ascii, dispatched)->Arg(16)->Arg(64)->Arg(1024);
+BENCHMARK_CAPTURE(validate, mixed_scalar, mixed, scalar)->Arg(16)->Arg(64)->Arg(1024);
+BENCHMARK_CAPTURE(validate, mixed, mixed, dispatched)->Arg(16)->Arg(64)->Arg(1024);
+BENCHMARK_CAPTURE(validate, cjk_scalar, cjk, scalar)->Arg(16)->Arg(64)->Arg(1024);
+BENCHMARK_CAPTURE(validate, cjk, cjk, dispatched)->Arg(16)->Arg(64)->Arg(1024);
+
+} // anonymous namespace
@@ -0,0 +1,133 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include <benchmark/benchmark.h>
+
+#include <mqtt/broker/broker.hpp>
+#include <mqtt/broker/subscription_map.hpp>
+#include <mqtt/broker/topic_levels.hpp>
+
+#include "bench_common.hpp"
+
+// Arguments: number of subscriptions, percentage of wildcard filters
+
+namespace {
+
+using map_t = MQTT_NS::broker::multiple_subscription_map<std::string, int>;
+
+void fill(map_t& m, benchmark::State const& state) {
+    auto count = static_cast<std::size_t>(state.range(0));
+    auto filters = bench::make_filters(bench::make_topics(count, 4, 16), static_cast<int>(state.range(1)));
+    for (std::size_t i = 0; i != filters.size(); ++i) {
+        m.insert_or_assign(filters[i], "cid" + std::to_string(i), static_cast<int>(i));
+    }
+}
+
+void match_args(benchmark::internal::Benchmark* b) {
+    for (auto count : { 100, 10000, 100000 }) {
+        for (auto pct : { 0, 10, 50 }) {
+            b->Args({count, pct});
+        }
+    }
+}
+
+void BM_subscription_map_match(benchmark::State& state) {
+    map_t m;
+    fill(m, state);
+    auto topics = bench::make_topics(1024, 4, 16);
+    std::size_t i = 0;
+    std::size_t matched = 0;
+    for (auto _ : state) {
+        m.find(topics[i++ & 1023], [&](std::string const&, int) { ++matched; });
+    }
+    benchmark::DoNotOptimize(matched);
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+    state.counters["matched_per_publish"] =
+        static_cast<double>(matched) / static_cast<double>(state.iterations());
+}
+BENCHMARK(BM_subscription_map_match)->Apply(match_args);
+
+// The broker scans the topic once and matches with the scanned levels
+void BM_subscription_map_match_levels(benchmark::State& state) {
+    map_t m;
+    fill(m, state);
+    auto topics = bench::make_topics(1024, 4, 16);
+    std::size_t i = 0;
+    std::size_t matched = 0;
+    for (auto _ : state) {
+        MQTT_NS::broker::topic_levels levels(topics[i++ & 1023]);
+        m.modify(levels, [&](std::string const&, int&) { ++matched; });
+    }
+    benchmark::DoNotOptimize(matched);
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_subscription_map_match_levels)->Apply(match_args);
+
+void BM_subscription_map_insert_erase(benchmark::State& state) {
+    map_t m;
+    fill(m, state);
+    auto filters = bench::make_filters(bench::make_topics(1024, 4, 16), static_cast<int>(state.range(1)));
+    std::string const key = "bench";
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto const& f = filters[i++ & 1023];
+        m.insert_or_assign(f, key, 0);
+        m.erase(f, key);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_subscription_map_insert_erase)->Apply(match_args);
+
+// Scan a received topic name with topic_levels: validation and level offsets in one pass,
+// then tokenize it as the subscription map does.
+void BM_topic_levels(benchmark::State& state) {
+    auto topics = bench::make_topics(1024, static_cast<std::size_t>(state.range(0)), 16);
+    std::size_t i = 0;
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        auto const& t = topics[i++ & 1023];
+        MQTT_NS::broker::topic_levels levels(t);
+        bool valid = levels.valid_topic_name() && levels.utf8() == MQTT_NS::utf8string::validation::well_formed;
+        benchmark::DoNotOptimize(valid);
+        MQTT_NS::broker::topic_filter_tokenizer(
+            levels,
+            [](MQTT_NS::string_view l) {
+                benchmark::DoNotOptimize(l);
+                return true;
+            }
+        );
+        bytes += t.size();
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(bytes));
+}
+BENCHMARK(BM_topic_levels)->Arg(5)->Arg(8)->Arg(10);
+
+// The scalar baseline of BM_topic_levels: the character by character validation and
+// the tokenizer that searches for '/'.
+void BM_topic_levels_scalar(benchmark::State& state) {
+    auto topics = bench::make_topics(1024, static_cast<std::size_t>(state.range(0)), 16);
+    std::size_t i = 0;
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        auto const& t = topics[i++ & 1023];
+        bool valid =
+            MQTT_NS::broker::validate_topic_name(t) &&
+            MQTT_NS::utf8string::validate_contents_scalar(t) == MQTT_NS::utf8string::validation::well_formed;
+        benchmark::DoNotOptimize(valid);
+        MQTT_NS::broker::topic_filter_tokenizer(
+            t,
+            [](MQTT_NS::string_view l) {
+                benchmark::DoNotOptimize(l);
+                return true;
+            }
+        );
+        bytes += t.size();
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(bytes));
+}
+BENCHMARK(BM_topic_levels_scalar)->Arg(5)->Arg(8)->Arg(10);
+
+} // anonymous namespace
@@ -0,0 +1,92 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Per packet cost of restarting the keep alive timeout of a connection.
+// Arguments: number of connections
+// Each iteration restarts the timeout of one connection, like the broker does for each
+// received packet. The connections are visited round robin.
+
+#include <benchmark/benchmark.h>
+
+#include <mqtt/broker/timer_wheel.hpp>
+
+namespace {
+
+namespace as = boost::asio;
+
+constexpr auto keep_alive = std::chrono::seconds(60);
+
+// One steady_timer per connection. Restarting it cancels the pending wait, so the aborted
+// handler has to be run and the wait has to be set again.
+void BM_keep_alive_steady_timer(benchmark::State& state) {
+    as::io_context ioc;
+    auto num_of_connections = static_cast<std::size_t>(state.range(0));
+    std::vector<std::unique_ptr<as::steady_timer>> timers;
+    timers.reserve(num_of_connections);
+    for (std::size_t i = 0; i != num_of_connections; ++i) {
+        timers.push_back(std::make_unique<as::steady_timer>(ioc, keep_alive));
+        timers.back()->async_wait([](boost::system::error_code) {});
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto& tim = *timers[i];
+        tim.expires_after(keep_alive);
+        tim.async_wait([](boost::system::error_code) {});
+        ioc.poll();
+        if (++i == num_of_connections) i = 0;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+    for (auto& tim : timers) tim->cancel();
+    ioc.poll();
+}
+BENCHMARK(BM_keep_alive_steady_timer)->Arg(1000)->Arg(100000);
+
+// One timer_wheel for all connections. Restarting the timeout is a relaxed store.
+void BM_keep_alive_timer_wheel(benchmark::State& state) {
+    as::io_context ioc;
+    auto num_of_connections = static_cast<std::size_t>(state.range(0));
+    MQTT_NS::broker::timer_wheel wheel(ioc);
+    std::vector<MQTT_NS::broker::timer_wheel::entry_sp> entries;
+    entries.reserve(num_of_connections);
+    for (std::size_t i = 0; i != num_of_connections; ++i) {
+        entries.push_back(MQTT_NS::broker::timer_wheel::make_entry([] {}));
+        wheel.schedule(entries.back(), keep_alive);
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+        wheel.touch(*entries[i]);
+        if (++i == num_of_connections) i = 0;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+    for (auto& e : entries) wheel.cancel(*e);
+    ioc.poll();
+}
+BENCHMARK(BM_keep_alive_timer_wheel)->Arg(1000)->Arg(100000);
+
+// Connect and disconnect: schedule and cancel an entry while the other connections are
+// scheduled.
+void BM_timer_wheel_schedule_cancel(benchmark::State& state) {
+    as::io_context ioc;
+    auto num_of_connections = static_cast<std::size_t>(state.range(0));
+    MQTT_NS::broker::timer_wheel wheel(ioc);
+    std::vector<MQTT_NS::broker::timer_wheel::entry_sp> entries;
+    entries.reserve(num_of_connections);
+    for (std::size_t i = 0; i != num_of_connections; ++i) {
+        entries.push_back(MQTT_NS::broker::timer_wheel::make_entry([] {}));
+        wheel.schedule(entries.back(), keep_alive);
+    }
+    auto conn = MQTT_NS::broker::timer_wheel::make_entry([] {});
+    for (auto _ : state) {
+        wheel.schedule(conn, keep_alive);
+        wheel.cancel(*conn);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+    for (auto& e : entries) wheel.cancel(*e);
+    ioc.poll();
+}
+BENCHMARK(BM_timer_wheel_schedule_cancel)->Arg(1000)->Arg(100000);
+
+} // anonymous namespace
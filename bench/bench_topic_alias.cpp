@@ -0,0 +1,178 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include <benchmark/benchmark.h>
+
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/broker/broker.hpp>
+#include <mqtt/topic_alias_send.hpp>
+#include <mqtt/topic_alias_recv.hpp>
+
+#include "bench_common.hpp"
+
+// Arguments: topic alias maximum, number of distinct topics
+
+namespace {
+
+void alias_args(benchmark::internal::Benchmark* b) {
+    for (auto max : { 16, 1024 }) {
+        for (auto topics : { 16, 1024, 65536 }) {
+            b->Args({max, topics});
+        }
+    }
+}
+
+// The sender side of a PUBLISH: reuse the alias of the topic, or replace the least recently
+// used one.
+void BM_topic_alias_send(benchmark::State& state) {
+    MQTT_NS::topic_alias_send tas(static_cast<MQTT_NS::topic_alias_t>(state.range(0)));
+    auto num_of_topics = static_cast<std::size_t>(state.range(1));
+    auto topics = bench::make_topics(num_of_topics, 4, 32);
+    std::mt19937 gen(bench::seed);
+    std::uniform_int_distribution<std::size_t> dist(0, num_of_topics - 1);
+    std::size_t hit = 0;
+    for (auto _ : state) {
+        auto const& t = topics[dist(gen)];
+        if (auto alias = tas.find(t)) {
+            tas.insert_or_update(t, alias.value());
+            ++hit;
+        }
+        else {
+            tas.insert_or_update(t, tas.get_lru_alias());
+        }
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+    state.counters["hit_ratio"] = static_cast<double>(hit) / static_cast<double>(state.iterations());
+}
+BENCHMARK(BM_topic_alias_send)->Apply(alias_args);
+
+// The receiver side: register or resolve the alias of each PUBLISH.
+void BM_topic_alias_recv(benchmark::State& state) {
+    auto max = static_cast<MQTT_NS::topic_alias_t>(state.range(0));
+    MQTT_NS::topic_alias_recv tar(max);
+    auto num_of_topics = static_cast<std::size_t>(state.range(1));
+    auto topics = bench::make_topics(num_of_topics, 4, 32);
+    std::mt19937 gen(bench::seed);
+    std::uniform_int_distribution<std::size_t> dist(0, num_of_topics - 1);
+    for (auto _ : state) {
+        auto i = dist(gen);
+        auto alias = static_cast<MQTT_NS::topic_alias_t>(i % max + 1);
+        auto t = tar.find(alias);
+        if (t != topics[i]) tar.insert_or_update(topics[i], alias);
+        benchmark::DoNotOptimize(t);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+BENCHMARK(BM_topic_alias_recv)->Apply(alias_args);
+
+// Bytes on the wire of the broker deliveries with the topic aliases assigned by the broker.
+// A subscriber that sets the topic alias maximum (0 means no topic alias) receives messages
+// that are published to random topics by another client over loopback_endpoint.
+void BM_broker_topic_alias_bytes(benchmark::State& state) {
+    using client_t = MQTT_NS::server<>::endpoint_t;
+    namespace as = boost::asio;
+
+    constexpr std::size_t batch = 64;
+    auto max = static_cast<MQTT_NS::topic_alias_t>(state.range(0));
+    auto num_of_topics = static_cast<std::size_t>(state.range(1));
+    auto topics = bench::make_topics(num_of_topics, 4, 32);
+    std::string payload(16, 'p');
+
+    as::io_context ioc;
+    MQTT_NS::broker::broker_t b(ioc);
+    b.set_auto_map_topic_alias_send(max != 0);
+    auto make_client =
+        [&] {
+            auto sockets = MQTT_NS::make_loopback_pair(ioc, ioc);
+            b.handle_accept(std::make_shared<MQTT_NS::broker::endpoint_t>(ioc, sockets.first));
+            auto c = std::make_shared<client_t>(ioc, sockets.second, MQTT_NS::protocol_version::v5);
+            c->set_async_operation(true);
+            return c;
+        };
+    auto sub = make_client();
+    auto pub = make_client();
+    sub->set_topic_alias_maximum(max);
+
+    std::size_t ready = 0;
+    std::size_t received = 0;
+    sub->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+            sub->async_subscribe("#", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    sub->set_v5_suback_handler(
+        [&]
+        (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+            ++ready;
+            return true;
+        }
+    );
+    sub->set_v5_publish_handler(
+        [&]
+        (MQTT_NS::optional<std::uint16_t>,
+         MQTT_NS::publish_options,
+         MQTT_NS::buffer,
+         MQTT_NS::buffer,
+         MQTT_NS::v5::properties) {
+            ++received;
+            return true;
+        }
+    );
+    pub->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+            ++ready;
+            return true;
+        }
+    );
+    for (auto const& c : { sub, pub }) {
+        c->start_session(c);
+        c->async_connect(
+            MQTT_NS::allocate_buffer(c == sub ? "bench_sub" : "bench_pub"),
+            MQTT_NS::nullopt,
+            MQTT_NS::nullopt,
+            MQTT_NS::nullopt,
+            0
+        );
+    }
+    while (ready != 2) ioc.run_one();
+
+    std::mt19937 gen(bench::seed);
+    std::uniform_int_distribution<std::size_t> dist(0, num_of_topics - 1);
+    auto bytes_begin = sub->get_total_bytes_received();
+    for (auto _ : state) {
+        received = 0;
+        for (std::size_t n = 0; n != batch; ++n) {
+            pub->async_publish(topics[dist(gen)], payload, MQTT_NS::qos::at_most_once);
+        }
+        while (received != batch) ioc.run_one();
+    }
+    auto messages = state.iterations() * batch;
+    state.SetItemsProcessed(static_cast<std::int64_t>(messages));
+    state.counters["bytes_per_message"] =
+        static_cast<double>(sub->get_total_bytes_received() - bytes_begin) / static_cast<double>(messages);
+
+    std::size_t closed = 0;
+    for (auto const& c : { sub, pub }) {
+        c->set_close_handler([&closed] { ++closed; });
+        c->set_error_handler([&closed] (MQTT_NS::error_code) { ++closed; });
+        c->async_disconnect();
+    }
+    while (closed != 2) ioc.run_one();
+}
+
+void alias_bytes_args(benchmark::internal::Benchmark* b) {
+    for (auto max : { 0, 16, 1024 }) {
+        for (auto topics : { 16, 1024 }) {
+            b->Args({max, topics});
+        }
+    }
+}
+BENCHMARK(BM_broker_topic_alias_bytes)->Apply(alias_bytes_args)->Unit(benchmark::kMicrosecond);
+
+} // anonymous namespace
@@ -0,0 +1,94 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BENCH_INSTRUCTION_COUNTER_HPP)
+#define MQTT_BENCH_INSTRUCTION_COUNTER_HPP
+
+#include <cstdint>
+
+#include <benchmark/benchmark.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // defined(__linux__)
+
+namespace bench {
+
+/**
+ * @brief Retired user space instructions of the calling thread.
+ *
+ * It is read with perf_event_open on Linux. The instruction count doesn't depend on the
+ * frequency and the load of the machine, so small differences of the code paths can be
+ * compared. If the hardware counter is not available (not Linux, a VM without a PMU, or
+ * kernel.perf_event_paranoid > 2), available() returns false and read() returns 0.
+ */
+class instruction_counter {
+public:
+    instruction_counter() {
+#if defined(__linux__)
+        perf_event_attr attr {};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif // defined(__linux__)
+    }
+
+    ~instruction_counter() {
+#if defined(__linux__)
+        if (fd_ != -1) close(fd_);
+#endif // defined(__linux__)
+    }
+
+    instruction_counter(instruction_counter const&) = delete;
+    instruction_counter& operator=(instruction_counter const&) = delete;
+
+    bool available() const {
+        return fd_ != -1;
+    }
+
+    std::uint64_t read() const {
+        std::uint64_t v = 0;
+#if defined(__linux__)
+        if (fd_ != -1 && ::read(fd_, &v, sizeof(v)) != sizeof(v)) v = 0;
+#endif // defined(__linux__)
+        return v;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+/**
+ * @brief Report the instructions per item as the "instructions" user counter.
+ *        If the counter is not available, it is noted in the label instead.
+ * @param state        benchmark state
+ * @param counter      the counter that instructions is read from
+ * @param instructions the instructions of all iterations
+ * @param items        the number of items processed in all iterations
+ */
+inline void report_instructions(
+    benchmark::State& state,
+    instruction_counter const& counter,
+    std::uint64_t instructions,
+    std::uint64_t items) {
+    if (!counter.available()) {
+        state.SetLabel("instruction counter is not available");
+        return;
+    }
+    if (items == 0) return;
+    state.counters["instructions"] =
+        static_cast<double>(instructions) / static_cast<double>(items);
+}
+
+} // namespace bench
+
+#endif // MQTT_BENCH_INSTRUCTION_COUNTER_HPP
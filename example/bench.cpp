@@ -10,14 +10,27 @@
 
 #include <thread>
 #include <fstream>
+#include <random>
+#include <set>
+#include <map>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/wait.h>
+#endif // !defined(_WIN32)
 
 #include <boost/program_options.hpp>
 #include <boost/format.hpp>
 
 #include "locked_cout.hpp"
+#include "hdr_histogram.hpp"
+#include "bench_control.hpp"
 
 namespace as = boost::asio;
 
+// Index of the worker thread. Each worker thread records latencies to its own histogram.
+thread_local std::size_t worker_index = 0;
+
 // moved to global to avoid MSVC error
 enum class phase {
     connect,
@@ -33,7 +46,8 @@ int main(int argc, char **argv) {
     try {
         boost::program_options::options_description desc;
 
-        constexpr std::size_t min_payload = 15;
+        // index(8) send times(8) send time stamp(16)
+        constexpr std::size_t min_payload = 31;
         std::string payload_size_desc =
             "payload bytes. must be greater than " + std::to_string(min_payload);
 
@@ -180,18 +194,113 @@ int main(int argc, char **argv) {
                 boost::program_options::value<std::size_t>()->default_value(1),
                 "ideling publish count. it is useful to ignore authorization cache."
             )
+            (
+                "scenario",
+                boost::program_options::value<std::string>()->default_value("single"),
+                "load pattern. single, fan_out, fan_in, shared, wildcard, retained, or reconnect"
+            )
+            (
+                "publishers",
+                boost::program_options::value<std::size_t>()->default_value(1),
+                "number of publishing clients for fan_out, shared, wildcard, and retained. the rest of the clients subscribe."
+            )
+            (
+                "subscribers",
+                boost::program_options::value<std::size_t>()->default_value(1),
+                "number of subscribing clients for fan_in. the rest of the clients publish."
+            )
+            (
+                "shared_groups",
+                boost::program_options::value<std::size_t>()->default_value(1),
+                "number of shared subscription groups for shared"
+            )
+            (
+                "topic_depth",
+                boost::program_options::value<std::size_t>()->default_value(4),
+                "number of topic levels for wildcard and retained"
+            )
+            (
+                "topic_fanout",
+                boost::program_options::value<std::size_t>()->default_value(4),
+                "number of child levels of each topic level for wildcard and retained"
+            )
+            (
+                "wildcard_ratio",
+                boost::program_options::value<double>()->default_value(0.3),
+                "probability that each level of the topic filter is a wildcard for wildcard and retained (0.0 to 1.0)"
+            )
+            (
+                "seed",
+                boost::program_options::value<std::uint32_t>()->default_value(1),
+                "random seed for topics and topic filters"
+            )
+            (
+                "pub_rate",
+                boost::program_options::value<double>()->default_value(0),
+                "total publishes per second of all publishers. if set, pub_interval_ms is ignored. 0 means using pub_interval_ms"
+            )
+            (
+                "co_correction",
+                boost::program_options::value<bool>()->default_value(true),
+                "correct coordinated omission of the latency histogram using the publish interval"
+            )
+            (
+                "hdr_output",
+                boost::program_options::value<std::string>()->default_value(""),
+                "output file of the latency percentile distribution in HdrHistogram format (milliseconds)"
+            )
+            (
+                "open_loop",
+                boost::program_options::value<bool>()->default_value(false),
+                "measure the latency from the scheduled send time instead of the actual send time. "
+                "a late send caused by a slow broker or client is included in the latency, so co_correction is not applied"
+            )
+            (
+                "hdr_log",
+                boost::program_options::value<std::string>()->default_value(""),
+                "output file of the latency histogram in HdrHistogram interval log format (microseconds). "
+                "the logs of the bench processes can be merged by hdr_merge"
+            )
+            (
+                "workers",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "number of bench worker processes. if set, this process is the coordinator. "
+                "it synchronizes the phases of the workers and reports the merged latency. "
+                "each worker runs clients, times, and pub_rate with its own client_id and topic prefix"
+            )
+            (
+                "spawn_workers",
+                boost::program_options::value<bool>()->default_value(true),
+                "true: the coordinator starts the workers with the same options. "
+                "false: the coordinator waits for the workers that are started with control and worker_id"
+            )
+            (
+                "control",
+                boost::program_options::value<std::string>()->default_value(""),
+                "Unix domain socket path of the control channel between the coordinator and the workers"
+            )
+            (
+                "worker_id",
+                boost::program_options::value<std::size_t>(),
+                "run as a worker of the coordinator that listens on control. the workers must have different ids"
+            )
+            (
+                "hdr_merge",
+                boost::program_options::value<std::vector<std::string>>()->multitoken(),
+                "merge the given hdr_log files, report the percentiles, and exit. hdr_output can be used with it"
+            )
             (
                 "progress_timer_sec",
                 boost::program_options::value<std::size_t>()->default_value(10),
                 "report progress timer for each given seconds."
             )
-#if defined(MQTT_USE_LOG)
+#if defined(MQTT_USE_LOG) || defined(MQTT_USE_BINARY_LOG)
             (
                 "verbose",
                 boost::program_options::value<unsigned int>()->default_value(1),
                 "set verbose level, possible values:\n 0 - Fatal\n 1 - Error\n 2 - Warning\n 3 - Info\n 4 - Debug\n 5 - Trace"
             )
-#endif // defined(MQTT_USE_LOG)
+#endif // defined(MQTT_USE_LOG) || defined(MQTT_USE_BINARY_LOG)
             (
                 "cacert",
                 boost::program_options::value<std::string>(),
@@ -250,11 +359,17 @@ int main(int argc, char **argv) {
             else if (auto p = boost::any_cast<bool>(&e.second.value())) {
                 std::cout << std::boolalpha << *p;
             }
+            else if (auto p = boost::any_cast<double>(&e.second.value())) {
+                std::cout << *p;
+            }
+            else if (auto p = boost::any_cast<std::vector<std::string>>(&e.second.value())) {
+                for (auto const& s : *p) std::cout << s << ' ';
+            }
             std::cout << std::endl;
         }
 
 
-#if defined(MQTT_USE_LOG)
+#if defined(MQTT_USE_LOG) || defined(MQTT_USE_BINARY_LOG)
         switch (vm["verbose"].as<unsigned int>()) {
         case 5:
             MQTT_NS::setup_log(MQTT_NS::severity_level::trace);
@@ -279,6 +394,160 @@ int main(int argc, char **argv) {
         MQTT_NS::setup_log();
 #endif
 
+        auto report_percentiles =
+            [](char const* name, hdr_histogram const& h) {
+                locked_cout()
+                    << name
+                    << " p50:" << h.value_at_percentile(50)
+                    << " p90:" << h.value_at_percentile(90)
+                    << " p99:" << h.value_at_percentile(99)
+                    << " p99.9:" << h.value_at_percentile(99.9)
+                    << " p99.99:" << h.value_at_percentile(99.99)
+                    << " max:" << h.max()
+                    << " us count:" << h.total_count()
+                    << std::endl;
+            };
+
+        // Report the histograms merged from the bench processes
+        auto report_merged =
+            [&](std::map<std::string, hdr_histogram> const& merged) {
+                // The untagged histogram is the latency, the others are reported by their tags.
+                for (auto const& e : merged) {
+                    auto name = e.first.empty() ? std::string("latency") : "latency " + e.first;
+                    report_percentiles((boost::format("%-17s") % name).str().c_str(), e.second);
+                }
+                auto hdr_output = vm["hdr_output"].as<std::string>();
+                if (!hdr_output.empty() && merged.count("")) {
+                    std::ofstream o(hdr_output);
+                    merged.at("").output_percentile_distribution(o, 1000.0);
+                    std::cout << "percentile distribution (ms) is written to " << hdr_output << std::endl;
+                }
+            };
+
+        if (vm.count("hdr_merge")) {
+            std::map<std::string, hdr_histogram> merged;
+            for (auto const& file : vm["hdr_merge"].as<std::vector<std::string>>()) {
+                std::ifstream input(file);
+                if (!input.good()) {
+                    std::cerr << "hdr_log file '" << file << "' not found" << std::endl;
+                    return -1;
+                }
+                try {
+                    hdr_log_read(
+                        input,
+                        [&](std::string const& tag, double, double, hdr_histogram h) {
+                            auto it = merged.find(tag);
+                            if (it == merged.end()) {
+                                merged.emplace(tag, MQTT_NS::force_move(h));
+                            }
+                            else if (!it->second.same_layout(h)) {
+                                throw std::runtime_error("histogram settings of tag '" + tag + "' don't match");
+                            }
+                            else {
+                                it->second.add(h);
+                            }
+                        }
+                    );
+                }
+                catch (std::exception const& e) {
+                    std::cerr << file << ": " << e.what() << std::endl;
+                    return -1;
+                }
+            }
+            report_merged(merged);
+            return 0;
+        }
+
+        auto control_path = vm["control"].as<std::string>();
+        auto worker_id =
+            [&] () -> MQTT_NS::optional<std::size_t> {
+                if (vm.count("worker_id")) {
+                    return vm["worker_id"].as<std::size_t>();
+                }
+                return MQTT_NS::nullopt;
+            } ();
+        auto workers = vm["workers"].as<std::size_t>();
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        if (worker_id && control_path.empty()) {
+            std::cerr << "worker_id requires control" << std::endl;
+            return -1;
+        }
+        if (workers != 0 && !worker_id) {
+            // ==== coordinator
+#if !defined(_WIN32)
+            if (control_path.empty()) {
+                control_path = (boost::format("/tmp/mqtt_bench_%d.sock") % ::getpid()).str();
+            }
+#endif // !defined(_WIN32)
+            as::io_context ioc_control;
+            bench_control_coordinator coordinator(ioc_control, control_path);
+#if !defined(_WIN32)
+            std::vector<pid_t> children;
+#endif // !defined(_WIN32)
+            if (vm["spawn_workers"].as<bool>()) {
+#if !defined(_WIN32)
+                // The workers get the same arguments, so they also read the same configuration file.
+                for (std::size_t i = 0; i != workers; ++i) {
+                    std::vector<std::string> args(argv, argv + argc);
+                    args.emplace_back("--worker_id");
+                    args.emplace_back(std::to_string(i));
+                    if (vm["control"].as<std::string>().empty()) {
+                        args.emplace_back("--control");
+                        args.emplace_back(control_path);
+                    }
+                    std::vector<char*> cargs;
+                    for (auto& arg : args) cargs.push_back(&arg[0]);
+                    cargs.push_back(nullptr);
+                    auto pid = ::fork();
+                    if (pid == 0) {
+                        ::execvp(cargs[0], cargs.data());
+                        std::perror("execvp");
+                        std::_Exit(127);
+                    }
+                    if (pid < 0) {
+                        std::perror("fork");
+                        return -1;
+                    }
+                    children.push_back(pid);
+                }
+#else  // !defined(_WIN32)
+                std::cerr << "spawn_workers is not supported on this platform. start the workers manually" << std::endl;
+                return -1;
+#endif // !defined(_WIN32)
+            }
+            std::cout << "Waiting for " << workers << " workers on " << control_path << std::endl;
+            coordinator.accept(workers);
+            std::chrono::system_clock::time_point tp_measure;
+            for (auto phase : { "connected", "subscribed", "idle" }) {
+                coordinator.barrier(phase);
+                tp_measure = std::chrono::system_clock::now();
+                std::cout << "All workers " << phase << std::endl;
+            }
+            auto merged = coordinator.collect();
+            std::cout << "Report (" << workers << " workers)" << std::endl;
+            report_merged(merged);
+            auto hdr_log = vm["hdr_log"].as<std::string>();
+            if (!hdr_log.empty()) {
+                auto length = std::chrono::duration<double>(std::chrono::system_clock::now() - tp_measure).count();
+                std::ofstream o(hdr_log);
+                hdr_log_write_header(o, std::chrono::duration<double>(tp_measure.time_since_epoch()).count());
+                for (auto const& e : merged) {
+                    hdr_log_write_interval(o, e.first, 0, length, e.second, 1000.0);
+                }
+                std::cout << "latency histogram (us) is written to " << hdr_log << std::endl;
+            }
+#if !defined(_WIN32)
+            for (auto pid : children) ::waitpid(pid, nullptr, 0);
+#endif // !defined(_WIN32)
+            return 0;
+        }
+#else  // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        if (worker_id || workers != 0) {
+            std::cerr << "workers and worker_id require Unix domain sockets" << std::endl;
+            return -1;
+        }
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
         if (!vm.count("host")) {
             std::cerr << "host must be set" << std::endl;
             return -1;
@@ -291,6 +560,7 @@ int main(int argc, char **argv) {
         std::chrono::steady_clock::time_point tp_idle;
         std::chrono::steady_clock::time_point tp_pub_after_idle_delay;
         std::chrono::steady_clock::time_point tp_publish;
+        std::chrono::system_clock::time_point tp_publish_wall;
 
         auto detail_report = vm["detail_report"].as<bool>();
         auto host = vm["host"].as<std::string>();
@@ -343,6 +613,11 @@ int main(int argc, char **argv) {
             } ();
         auto cid_prefix = vm["cid_prefix"].as<std::string>();
         auto topic_prefix = vm["topic_prefix"].as<std::string>();
+        if (worker_id) {
+            // The clients of each worker use their own client_ids and topics
+            cid_prefix += "w" + std::to_string(worker_id.value()) + "_";
+            topic_prefix += "w" + std::to_string(worker_id.value()) + "/";
+        }
 
         auto cacert =
             [&] () -> MQTT_NS::optional<std::string> {
@@ -370,11 +645,269 @@ int main(int argc, char **argv) {
 
         auto progress_timer_sec = vm["progress_timer_sec"].as<std::size_t>();
 
-        std::uint64_t pub_interval_us = pub_interval_ms * 1000;
+        auto scenario = vm["scenario"].as<std::string>();
+        auto publishers = vm["publishers"].as<std::size_t>();
+        auto subscribers = vm["subscribers"].as<std::size_t>();
+        auto shared_groups = vm["shared_groups"].as<std::size_t>();
+        auto topic_depth = vm["topic_depth"].as<std::size_t>();
+        auto topic_fanout = vm["topic_fanout"].as<std::size_t>();
+        auto wildcard_ratio = vm["wildcard_ratio"].as<double>();
+        auto seed = vm["seed"].as<std::uint32_t>();
+        auto pub_rate = vm["pub_rate"].as<double>();
+        auto co_correction = vm["co_correction"].as<bool>();
+        auto hdr_output = vm["hdr_output"].as<std::string>();
+        auto open_loop = vm["open_loop"].as<bool>();
+        auto hdr_log = vm["hdr_log"].as<std::string>();
+        if (worker_id) {
+            // The coordinator merges the histograms of the workers and writes them
+            hdr_output.clear();
+            hdr_log.clear();
+        }
+        if (open_loop && co_correction) {
+            std::cout << "open_loop measures from the scheduled send time, co_correction is not applied" << std::endl;
+            co_correction = false;
+        }
+
+        // ==== scenario
+        // Each client subscribes sub_filter (if any) and publishes to pub_topics in turn.
+        // deliveries is the number of subscribers that receive a publish to each of pub_topics.
+        struct client_plan {
+            MQTT_NS::optional<std::string> sub_filter;
+            std::vector<std::string> pub_topics;
+            std::vector<std::size_t> deliveries;
+            bool reconnect = false;
+        };
+        std::vector<client_plan> plans(clients);
+
+        auto index_to_str =
+            [](std::size_t index) {
+                return (boost::format("%08d") % index).str();
+            };
+        auto need_subscribers =
+            [&](std::size_t num_of_pubs) {
+                if (num_of_pubs == 0 || num_of_pubs >= clients) {
+                    std::cerr << "scenario " << scenario << " requires 1 to clients - 1 publishers" << std::endl;
+                    return false;
+                }
+                return true;
+            };
+
+        // Topic tree for wildcard and retained. The leaf topic is topic_prefix + "d0/d1/.../dn".
+        std::size_t num_of_leaves = 1;
+        for (std::size_t i = 0; i != topic_depth; ++i) num_of_leaves *= topic_fanout;
+        auto leaf_levels =
+            [&](std::size_t leaf) {
+                std::vector<std::string> levels(topic_depth);
+                for (std::size_t i = topic_depth; i != 0; --i) {
+                    levels[i - 1] = std::to_string(leaf % topic_fanout);
+                    leaf /= topic_fanout;
+                }
+                return levels;
+            };
+        auto join =
+            [&](std::vector<std::string> const& levels) {
+                std::string ret = topic_prefix;
+                for (std::size_t i = 0; i != levels.size(); ++i) {
+                    if (i != 0) ret += '/';
+                    ret += levels[i];
+                }
+                return ret;
+            };
+        std::mt19937 gen(seed);
+        // Replace each level by '+' with wildcard_ratio, and the trailing '+'s by '#'
+        auto wildcard_filter =
+            [&](std::size_t leaf) {
+                std::uniform_real_distribution<double> dist(0.0, 1.0);
+                auto levels = leaf_levels(leaf);
+                for (auto& level : levels) {
+                    if (dist(gen) < wildcard_ratio) level = "+";
+                }
+                if (!levels.empty() && levels.back() == "+") {
+                    while (!levels.empty() && levels.back() == "+") levels.pop_back();
+                    levels.emplace_back("#");
+                }
+                return join(levels);
+            };
+
+        if (scenario == "single") {
+            for (std::size_t i = 0; i != clients; ++i) {
+                plans[i].sub_filter = topic_prefix + index_to_str(i);
+                plans[i].pub_topics.push_back(topic_prefix + index_to_str(i));
+            }
+        }
+        else if (scenario == "fan_out" || scenario == "fan_in" || scenario == "shared") {
+            auto topic = topic_prefix + scenario;
+            if (scenario == "fan_in") {
+                if (!need_subscribers(clients - std::min(subscribers, clients))) return -1;
+            }
+            else {
+                if (!need_subscribers(publishers)) return -1;
+            }
+            if (shared_groups == 0) {
+                std::cerr << "shared_groups must be greater than 0" << std::endl;
+                return -1;
+            }
+            for (std::size_t i = 0; i != clients; ++i) {
+                bool pub = scenario == "fan_in" ? i >= subscribers : i < publishers;
+                if (pub) {
+                    plans[i].pub_topics.push_back(topic);
+                }
+                else if (scenario == "shared") {
+                    plans[i].sub_filter =
+                        "$share/g" + std::to_string((i - publishers) % shared_groups) + "/" + topic;
+                }
+                else {
+                    plans[i].sub_filter = topic;
+                }
+            }
+        }
+        else if (scenario == "wildcard" || scenario == "retained") {
+            if (!need_subscribers(publishers)) return -1;
+            if (topic_depth == 0 || topic_fanout == 0) {
+                std::cerr << "topic_depth and topic_fanout must be greater than 0" << std::endl;
+                return -1;
+            }
+            std::uniform_int_distribution<std::size_t> leaf_dist(0, num_of_leaves - 1);
+            if (scenario == "wildcard") {
+                // Each publisher is a device that publishes to its own leaf topic
+                for (std::size_t i = 0; i != publishers; ++i) {
+                    plans[i].pub_topics.push_back(join(leaf_levels(leaf_dist(gen))));
+                }
+            }
+            else {
+                // Each publish stores a retained message to the next leaf topic
+                retain = MQTT_NS::retain::yes;
+                for (std::size_t leaf = 0; leaf != num_of_leaves; ++leaf) {
+                    plans[leaf % publishers].pub_topics.push_back(join(leaf_levels(leaf)));
+                }
+            }
+            // Each subscriber is a dashboard that subscribes a part of the topic tree
+            std::uniform_int_distribution<std::size_t> pub_dist(0, publishers - 1);
+            for (std::size_t i = publishers; i != clients; ++i) {
+                auto leaf =
+                    [&] {
+                        if (scenario == "retained") return leaf_dist(gen);
+                        // Subscribe around the topic of a publisher
+                        auto const& topic = plans[pub_dist(gen)].pub_topics.front();
+                        std::size_t leaf = 0;
+                        std::size_t b = topic_prefix.size();
+                        for (std::size_t l = 0; l != topic_depth; ++l) {
+                            auto e = topic.find('/', b);
+                            leaf = leaf * topic_fanout + std::stoul(topic.substr(b, e - b));
+                            b = e + 1;
+                        }
+                        return leaf;
+                    } ();
+                plans[i].sub_filter = wildcard_filter(leaf);
+            }
+        }
+        else if (scenario == "reconnect") {
+            for (auto& plan : plans) plan.reconnect = true;
+        }
+        else {
+            std::cerr << "invalid scenario:" << scenario << std::endl;
+            return -1;
+        }
+
+        if (compare && scenario != "single") {
+            std::cout << "compare is supported only by the single scenario. compare is disabled" << std::endl;
+            compare = false;
+        }
+
+        auto split =
+            [](std::string const& s) {
+                std::vector<std::string> levels;
+                std::size_t b = 0;
+                while (true) {
+                    auto e = s.find('/', b);
+                    levels.push_back(s.substr(b, e - b));
+                    if (e == std::string::npos) break;
+                    b = e + 1;
+                }
+                return levels;
+            };
+        auto match =
+            [&](std::string const& filter, std::string const& topic) {
+                auto fl = split(filter);
+                auto tl = split(topic);
+                for (std::size_t i = 0; i != fl.size(); ++i) {
+                    if (fl[i] == "#") return true;
+                    if (i == tl.size()) return false;
+                    if (fl[i] != "+" && fl[i] != tl[i]) return false;
+                }
+                return fl.size() == tl.size();
+            };
+
+        // A publish is delivered to each matched subscriber and once to each matched shared group
+        std::map<std::string, std::size_t> deliveries_cache;
+        auto deliveries_of =
+            [&](std::string const& topic) {
+                auto it = deliveries_cache.find(topic);
+                if (it != deliveries_cache.end()) return it->second;
+                std::size_t n = 0;
+                std::set<std::string> groups;
+                for (auto const& plan : plans) {
+                    if (!plan.sub_filter) continue;
+                    auto const& filter = plan.sub_filter.value();
+                    if (filter.compare(0, 7, "$share/") == 0) {
+                        auto pos = filter.find('/', 7);
+                        if (match(filter.substr(pos + 1), topic)) groups.insert(filter.substr(7, pos - 7));
+                    }
+                    else if (match(filter, topic)) {
+                        ++n;
+                    }
+                }
+                n += groups.size();
+                deliveries_cache.emplace(topic, n);
+                return n;
+            };
+
+        // The phase finishes when all operations are sent and all of their deliveries are received.
+        // An operation is a publish, or a reconnect whose delivery is the CONNACK.
+        std::size_t active_clients = 0;
+        std::uint64_t all_idle = 0;
+        std::uint64_t all_times = 0;
+        std::uint64_t measured_deliveries = 0;
+        for (auto& plan : plans) {
+            if (plan.reconnect) {
+                plan.deliveries.push_back(1);
+            }
+            else {
+                for (auto const& topic : plan.pub_topics) plan.deliveries.push_back(deliveries_of(topic));
+            }
+            if (plan.deliveries.empty()) continue;
+            ++active_clients;
+            auto deliveries_until =
+                [&](std::size_t n) {
+                    std::uint64_t sum = 0;
+                    for (std::size_t i = 0; i != n; ++i) sum += plan.deliveries[i % plan.deliveries.size()];
+                    return sum;
+                };
+            auto idle_deliveries = deliveries_until(pub_idle_count);
+            auto all_deliveries = deliveries_until(times);
+            all_idle += pub_idle_count + idle_deliveries;
+            all_times += times + all_deliveries;
+            measured_deliveries += all_deliveries - idle_deliveries;
+        }
+        if (measured_deliveries == 0) {
+            std::cerr << "no subscriber receives the publishes of scenario " << scenario << std::endl;
+            return -1;
+        }
+        std::cout
+            << "scenario:" << scenario
+            << " active clients:" << active_clients
+            << " measured deliveries:" << measured_deliveries
+            << std::endl;
+
+        std::uint64_t pub_interval_ns =
+            pub_rate > 0
+            ? static_cast<std::uint64_t>(1000.0 * 1000 * 1000 * static_cast<double>(active_clients) / pub_rate)
+            : pub_interval_ms * 1000 * 1000;
+        std::int64_t pub_interval_us = static_cast<std::int64_t>(pub_interval_ns / 1000);
         std::cout << "pub_interval:" << pub_interval_us << " us" << std::endl;
-        std::uint64_t all_interval_ns = pub_interval_us * 1000 / static_cast<std::uint64_t>(clients);
+        std::uint64_t all_interval_ns = pub_interval_ns / static_cast<std::uint64_t>(active_clients);
         std::cout << "all_interval:" << all_interval_ns << " ns" << std::endl;
-        std::cout << (double(1) * 1000 * 1000 * 1000 / static_cast<double>(all_interval_ns)) <<  " publish/sec" << std::endl;
+        std::cout << (double(1) * 1000 * 1000 * 1000 * static_cast<double>(active_clients) / static_cast<double>(pub_interval_ns)) <<  " publish/sec" << std::endl;
         auto num_of_iocs =
             [&] () -> std::size_t {
                 if (vm.count("iocs")) {
@@ -449,121 +982,65 @@ int main(int argc, char **argv) {
                 as::executor_work_guard<as::io_context::executor_type> guard_ioc_timer(ioc_timer.get_executor());
                 as::steady_timer tim_delay{ioc_timer};
 
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                std::unique_ptr<bench_control_worker> control;
+                if (worker_id) {
+                    control = std::make_unique<bench_control_worker>(ioc_timer, control_path, worker_id.value());
+                }
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+                std::size_t num_of_subscribers = 0;
+                for (auto const& plan : plans) {
+                    if (plan.sub_filter) ++num_of_subscribers;
+                }
                 std::atomic<std::size_t> rest_connect{clients};
-                std::atomic<std::size_t> rest_sub{clients};
-                std::atomic<std::size_t> rest_idle{pub_idle_count * clients};
-                std::atomic<std::uint64_t> rest_times{times * clients};
+                std::atomic<std::size_t> rest_sub{num_of_subscribers};
+                std::atomic<std::uint64_t> rest_idle{all_idle};
+                std::atomic<std::uint64_t> rest_times{all_times};
 
-                // ==== begin local lambda expressions
-                auto sub_proc =
-                    [&] {
-                        ph.store(phase::sub_delay);
-                        tp_sub_delay = std::chrono::steady_clock::now();
-                        tim_delay.expires_after(std::chrono::milliseconds(sub_delay_ms));
-                        tim_delay.async_wait(
-                            [&] (boost::system::error_code const& ec) {
-                                if (ec) {
-                                    std::cout << "timer error:" << ec.message() << std::endl;
-                                    return;
-                                }
-                                ph.store(phase::subscribe);
-                                tp_subscribe = std::chrono::steady_clock::now();
-                                std::cout << "Subscribe" << std::endl;
-                                std::size_t index = 0;
-                                for (auto& ci : cis) {
-                                    ci.tim->expires_after(std::chrono::milliseconds(sub_interval_ms) * ++index);
-                                    ci.tim->async_wait(
-                                        [&] (boost::system::error_code const& ec) {
-                                            if (ec) {
-                                                std::cout << "timer error:" << ec.message() << std::endl;
-                                                return;
-                                            }
-                                            ci.c->async_subscribe(
-                                                topic_prefix + ci.index_str,
-                                                qos,
-                                                [&](MQTT_NS::error_code ec) {
-                                                    if (ec) {
-                                                        std::cout << "sub error:" << ec.message() << std::endl;
-                                                    }
-                                                }
-                                            );
-                                        }
-                                    );
-                                }
-                            }
-                        );
-                    };
+                // Latency histograms of each worker thread
+                std::vector<hdr_histogram> hists(num_of_iocs * threads_per_ioc);
+                std::vector<hdr_histogram> hists_corrected(num_of_iocs * threads_per_ioc);
 
+                // ==== begin local lambda expressions
                 using ci_t = typename std::remove_reference_t<decltype(cis.front())>;
                 std::function <void(ci_t&)> async_wait_pub;
-                async_wait_pub =
-                    [&] (ci_t& ci) {
-                        ci.tim->async_wait(
-                            [&] (boost::system::error_code const& ec) {
-                                if (ec && ec != as::error::operation_aborted) {
-                                    std::cout << "timer error:" << ec.message() << std::endl;
-                                }
-                                else {
-                                    MQTT_NS::publish_options opts = qos | retain;
-                                    ci.sent.at(ci.send_times - 1) = std::chrono::steady_clock::now();
-
-                                    ci.c->async_publish(
-                                        MQTT_NS::allocate_buffer(topic_prefix + ci.index_str),
-                                        ci.send_payload(),
-                                        opts,
-                                        [&](MQTT_NS::error_code ec) {
-                                            if (ec) {
-                                                locked_cout() << "pub error:" << ec.message() << std::endl;
-                                            }
-                                        }
-                                    );
 
-                                    BOOST_ASSERT(ci.send_times != 0);
-                                    --ci.send_times;
-
-                                    switch (ph.load()) {
-                                    case phase::idle:
-                                        BOOST_ASSERT(ci.send_idle_count != 0);
-                                        if (--ci.send_idle_count != 0) {
-                                            ci.tim->expires_at(
-                                                ci.tim->expiry() +
-                                                std::chrono::milliseconds(pub_interval_ms)
-                                            );
-                                            async_wait_pub(ci);
-                                        }
-                                        break;
-                                    case phase::publish:
-                                        if (ci.send_times != 0) {
-                                            ci.tim->expires_at(
-                                                ci.tim->expiry() +
-                                                std::chrono::milliseconds(pub_interval_ms)
-                                            );
-                                            async_wait_pub(ci);
-                                        }
-                                        break;
-                                    default:
-                                        BOOST_ASSERT(false);
-                                        break;
-                                    };
-                                }
-                            }
-                        );
+                // Go on to the next phase. A worker waits for all the workers of the coordinator.
+                auto barrier =
+                    [&] (char const* phase, std::function<void()> f) {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                        if (control) {
+                            control->barrier(phase, MQTT_NS::force_move(f));
+                            return;
+                        }
+#else  // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                        static_cast<void>(phase);
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                        f();
                     };
 
-                auto pub_idle_proc =
-                    [&] {
-                        ph.store(phase::idle);
-                        tp_idle = std::chrono::steady_clock::now();
-                        locked_cout() << "Publish (idle)" << std::endl;
+                auto pub_start =
+                    [&] (std::chrono::nanoseconds delay) {
                         std::size_t index = 0;
                         for (auto& ci : cis) {
+                            if (plans.at(ci.index).deliveries.empty()) continue;
                             auto tp =
+                                delay +
                                 std::chrono::nanoseconds(all_interval_ns) * index++;
                             ci.tim->expires_after(tp);
                             async_wait_pub(ci);
                         }
                     };
 
+                auto pub_idle_proc =
+                    [&] {
+                        ph.store(phase::idle);
+                        tp_idle = std::chrono::steady_clock::now();
+                        locked_cout() << "Publish (idle)" << std::endl;
+                        pub_start(std::chrono::nanoseconds(0));
+                    };
+
                 auto pub_idle_delay_proc =
                     [&] {
                         locked_cout() << "Publish (idle) delay" << std::endl;
@@ -585,15 +1062,9 @@ int main(int argc, char **argv) {
                     [&] {
                         ph.store(phase::publish);
                         tp_publish = std::chrono::steady_clock::now();
+                        tp_publish_wall = std::chrono::system_clock::now();
                         locked_cout() << "Publish (measure)" << std::endl;
-                        std::size_t index = 0;
-                        for (auto& ci : cis) {
-                            auto tp =
-                                std::chrono::milliseconds(pub_after_idle_delay_ms) +
-                                std::chrono::nanoseconds(all_interval_ns) * index++;
-                            ci.tim->expires_after(tp);
-                            async_wait_pub(ci);
-                        }
+                        pub_start(std::chrono::milliseconds(pub_after_idle_delay_ms));
                     };
 
                 auto pub_after_idle_delay_proc =
@@ -626,6 +1097,7 @@ int main(int argc, char **argv) {
                         std::size_t maxmin = 0;
                         std::string maxmin_cid;
                         for (auto& ci : cis) {
+                            if (ci.rtt_us.empty()) continue;
                             std::sort(ci.rtt_us.begin(), ci.rtt_us.end());
                             std::string cid = ci.c->get_client_id();
                             std::size_t max = ci.rtt_us.back();
@@ -679,6 +1151,44 @@ int main(int argc, char **argv) {
                             << "(" << boost::format("%+8d") % (maxmin / 1000) << " ms ) "
                             << "client_id:" << maxmin_cid << std::endl;
 
+                        hdr_histogram hist;
+                        hdr_histogram hist_corrected;
+                        for (auto const& h : hists) hist.add(h);
+                        for (auto const& h : hists_corrected) hist_corrected.add(h);
+                        report_percentiles("latency          ", hist);
+                        if (co_correction) {
+                            report_percentiles("latency corrected", hist_corrected);
+                        }
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                        if (control) {
+                            control->send_histogram("", hist);
+                            if (co_correction) control->send_histogram("corrected", hist_corrected);
+                            control->done();
+                        }
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+                        if (!hdr_output.empty()) {
+                            std::ofstream o(hdr_output);
+                            (co_correction ? hist_corrected : hist).output_percentile_distribution(o, 1000.0);
+                            locked_cout() << "percentile distribution (ms) is written to " << hdr_output << std::endl;
+                        }
+                        if (!hdr_log.empty()) {
+                            // One interval that covers the measure phase.
+                            // Interval_Max is in milliseconds like the other HdrHistogram tools.
+                            auto length = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - tp_publish
+                            ).count();
+                            std::ofstream o(hdr_log);
+                            hdr_log_write_header(
+                                o,
+                                std::chrono::duration<double>(tp_publish_wall.time_since_epoch()).count()
+                            );
+                            hdr_log_write_interval(o, "", 0, length, hist, 1000.0);
+                            if (co_correction) {
+                                hdr_log_write_interval(o, "corrected", 0, length, hist_corrected, 1000.0);
+                            }
+                            locked_cout() << "latency histogram (us) is written to " << hdr_log << std::endl;
+                        }
+
                         for (auto& ci : cis) {
                             ci.c->async_force_disconnect();
                         }
@@ -687,6 +1197,205 @@ int main(int argc, char **argv) {
                         guard_ioc_timer.reset();
                     };
 
+
+                auto subscribed_proc =
+                    [&] {
+                        barrier(
+                            "subscribed",
+                            [&] {
+                                if (pub_idle_count == 0) {
+                                    barrier("idle", pub_after_idle_delay_proc);
+                                }
+                                else {
+                                    pub_idle_delay_proc();
+                                }
+                            }
+                        );
+                    };
+
+                auto sub_proc =
+                    [&] {
+                        ph.store(phase::sub_delay);
+                        tp_sub_delay = std::chrono::steady_clock::now();
+                        tim_delay.expires_after(std::chrono::milliseconds(sub_delay_ms));
+                        tim_delay.async_wait(
+                            [&] (boost::system::error_code const& ec) {
+                                if (ec) {
+                                    std::cout << "timer error:" << ec.message() << std::endl;
+                                    return;
+                                }
+                                ph.store(phase::subscribe);
+                                tp_subscribe = std::chrono::steady_clock::now();
+                                std::cout << "Subscribe" << std::endl;
+                                if (num_of_subscribers == 0) {
+                                    subscribed_proc();
+                                    return;
+                                }
+                                std::size_t index = 0;
+                                for (auto& ci : cis) {
+                                    auto const& plan = plans.at(ci.index);
+                                    if (!plan.sub_filter) continue;
+                                    ci.tim->expires_after(std::chrono::milliseconds(sub_interval_ms) * ++index);
+                                    ci.tim->async_wait(
+                                        [&] (boost::system::error_code const& ec) {
+                                            if (ec) {
+                                                std::cout << "timer error:" << ec.message() << std::endl;
+                                                return;
+                                            }
+                                            ci.c->async_subscribe(
+                                                plan.sub_filter.value(),
+                                                qos,
+                                                [&](MQTT_NS::error_code ec) {
+                                                    if (ec) {
+                                                        std::cout << "sub error:" << ec.message() << std::endl;
+                                                    }
+                                                }
+                                            );
+                                        }
+                                    );
+                                }
+                            }
+                        );
+                    };
+
+                // Count down an operation or a delivery of the idle phase.
+                // Returns false if the idle phase has already finished.
+                auto idle_countdown =
+                    [&] {
+                        auto rest = rest_idle.load();
+                        while (rest != 0 && !rest_idle.compare_exchange_weak(rest, rest - 1)) {}
+                        if (rest == 0) return false;
+                        if (rest == 1) barrier("idle", pub_after_idle_delay_proc);
+                        return true;
+                    };
+
+                auto times_countdown =
+                    [&] {
+                        BOOST_ASSERT(rest_times > 0);
+                        if (--rest_times == 0) finish_proc();
+                    };
+
+                // Schedule the next operation of the client at the constant rate
+                auto pub_next =
+                    [&] (ci_t& ci) {
+                        switch (ph.load()) {
+                        case phase::idle:
+                            if (ci.send_idle_count != 0) {
+                                ci.tim->expires_at(
+                                    ci.tim->expiry() +
+                                    std::chrono::nanoseconds(pub_interval_ns)
+                                );
+                                async_wait_pub(ci);
+                            }
+                            break;
+                        case phase::publish:
+                            if (ci.send_times != 0) {
+                                ci.tim->expires_at(
+                                    ci.tim->expiry() +
+                                    std::chrono::nanoseconds(pub_interval_ns)
+                                );
+                                async_wait_pub(ci);
+                            }
+                            break;
+                        default:
+                            BOOST_ASSERT(false);
+                            break;
+                        };
+                    };
+
+                async_wait_pub =
+                    [&] (ci_t& ci) {
+                        ci.tim->async_wait(
+                            [&] (boost::system::error_code const& ec) {
+                                if (ec && ec != as::error::operation_aborted) {
+                                    std::cout << "timer error:" << ec.message() << std::endl;
+                                }
+                                else {
+                                    auto const& plan = plans.at(ci.index);
+                                    bool idle = ph.load() == phase::idle;
+                                    // The time when the operation should have been started
+                                    auto intended = ci.tim->expiry();
+                                    auto op = times - ci.send_times;
+                                    BOOST_ASSERT(ci.send_times != 0);
+                                    if (plan.reconnect) {
+                                        --ci.send_times;
+                                        if (idle) --ci.send_idle_count;
+                                        // The next operation is scheduled when CONNACK is received
+                                        ci.reconnecting = true;
+                                        ci.tp_intended = intended;
+                                        ci.c->async_disconnect(
+                                            [&](MQTT_NS::error_code ec) {
+                                                if (ec) {
+                                                    locked_cout() << "disconnect error:" << ec.message() << std::endl;
+                                                }
+                                            }
+                                        );
+                                    }
+                                    else {
+                                        MQTT_NS::publish_options opts = qos | retain;
+                                        ci.c->async_publish(
+                                            MQTT_NS::allocate_buffer(plan.pub_topics[op % plan.pub_topics.size()]),
+                                            ci.send_payload(open_loop ? intended : std::chrono::steady_clock::now()),
+                                            opts,
+                                            [&](MQTT_NS::error_code ec) {
+                                                if (ec) {
+                                                    locked_cout() << "pub error:" << ec.message() << std::endl;
+                                                }
+                                            }
+                                        );
+                                        --ci.send_times;
+                                        if (idle) --ci.send_idle_count;
+                                        pub_next(ci);
+                                    }
+                                    if (idle) idle_countdown();
+                                    times_countdown();
+                                }
+                            }
+                        );
+                    };
+
+                auto record_proc =
+                    [&](ci_t& ci, std::int64_t dur_us) {
+                        if (limit_ms != 0 && static_cast<unsigned long>(dur_us) > limit_ms * 1000) {
+                            std::cout << "RTT:" << (dur_us / 1000) << "ms over " << limit_ms << "ms" << std::endl;
+                        }
+                        ci.rtt_us.emplace_back(dur_us);
+                        hists.at(worker_index).record(dur_us);
+                        hists_corrected.at(worker_index).record_corrected(dur_us, pub_interval_us);
+                    };
+
+                // The end of a reconnect operation
+                auto reconnected_proc =
+                    [&](ci_t& ci) {
+                        ci.reconnecting = false;
+                        auto dur_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - (open_loop ? ci.tp_intended : ci.tp_connect)
+                        ).count();
+                        pub_next(ci);
+                        if (!idle_countdown()) record_proc(ci, dur_us);
+                        times_countdown();
+                    };
+
+                auto connect_proc =
+                    [&](ci_t& ci) {
+                        MQTT_NS::v5::properties props;
+                        if (sei != 0) {
+                            props.emplace_back(
+                                MQTT_NS::v5::property::session_expiry_interval(sei)
+                            );
+                        }
+                        ci.tp_connect = std::chrono::steady_clock::now();
+                        ci.c->async_connect(
+                            MQTT_NS::force_move(props),
+                            [&](MQTT_NS::error_code ec) {
+                                if (ec) {
+                                    std::cerr << "async_connect error: " << ec.message() << std::endl;
+                                }
+                                if (!ci.tim) ci.init_timer(ci.c->get_executor());
+                            }
+                        );
+                    };
+
                 using packet_id_t = typename std::remove_reference_t<decltype(*cis.front().c)>::packet_id_t;
                 auto publish_handler =
                     [&](auto& ci,
@@ -699,37 +1408,31 @@ int main(int argc, char **argv) {
                             locked_cout() << "retained publish received and ignored topic:" << topic_name << std::endl;
                             return true;
                         }
-                        BOOST_ASSERT(rest_times > 0);
-                        --rest_times;
-                        if (rest_idle > 0) {
-                            --ci.recv_times;
-                            if (--rest_idle == 0) pub_after_idle_delay_proc();
+                        if (idle_countdown()) {
+                            if (compare) --ci.recv_times;
                         }
                         else {
                             auto recv = std::chrono::steady_clock::now();
                             auto dur_us = std::chrono::duration_cast<std::chrono::microseconds>(
-                                recv - ci.sent.at(ci.recv_times - 1)
+                                recv - ci_t::sent_time(contents)
                             ).count();
-                            if (limit_ms != 0 && static_cast<unsigned long>(dur_us) > limit_ms * 1000) {
-                                std::cout << "RTT:" << (dur_us / 1000) << "ms over " << limit_ms << "ms" << std::endl;
-                            }
                             if (compare) {
-                                if (contents != ci.recv_payload()) {
+                                if (contents != ci.recv_payload(contents)) {
                                     locked_cout() << "received payload doesn't match to sent one" << std::endl;
-                                    locked_cout() << "  expected: " << ci.recv_payload() << std::endl;
+                                    locked_cout() << "  expected: " << ci.recv_payload(contents) << std::endl;
                                     locked_cout() << "  received: " << contents << std::endl;;
                                 }
+                                if (topic_name != topic_prefix + ci.index_str) {
+                                    locked_cout() << "topic doesn't match" << std::endl;
+                                    locked_cout() << "  expected: " << topic_prefix + ci.index_str << std::endl;
+                                    locked_cout() << "  received: " << topic_name << std::endl;
+                                }
+                                BOOST_ASSERT(ci.recv_times != 0);
+                                --ci.recv_times;
                             }
-                            if (topic_name != topic_prefix + ci.index_str) {
-                                locked_cout() << "topic doesn't match" << std::endl;
-                                locked_cout() << "  expected: " << topic_prefix + ci.index_str << std::endl;
-                                locked_cout() << "  received: " << topic_name << std::endl;
-                            }
-                            ci.rtt_us.emplace_back(dur_us);
-                            BOOST_ASSERT(ci.recv_times != 0);
-                            --ci.recv_times;
-                            if (rest_times == 0) finish_proc();
+                            record_proc(ci, dur_us);
                         }
+                        times_countdown();
 
                         return true;
                     };
@@ -747,7 +1450,12 @@ int main(int argc, char **argv) {
                         [&]
                         (bool /*sp*/, MQTT_NS::connect_return_code connack_return_code) {
                             if (connack_return_code == MQTT_NS::connect_return_code::accepted) {
-                                if (--rest_connect == 0) sub_proc();
+                                if (ci.reconnecting) {
+                                    reconnected_proc(ci);
+                                }
+                                else if (--rest_connect == 0) {
+                                    barrier("connected", sub_proc);
+                                }
                             }
                             else {
                                 std::cout << "connack error:" << connack_return_code << std::endl;
@@ -759,7 +1467,12 @@ int main(int argc, char **argv) {
                         [&]
                         (bool /*sp*/, MQTT_NS::v5::connect_reason_code reason_code, MQTT_NS::v5::properties /*props*/) {
                             if (reason_code == MQTT_NS::v5::connect_reason_code::success) {
-                                if (--rest_connect == 0) sub_proc();
+                                if (ci.reconnecting) {
+                                    reconnected_proc(ci);
+                                }
+                                else if (--rest_connect == 0) {
+                                    barrier("connected", sub_proc);
+                                }
                             }
                             else {
                                 std::cout << "connack error:" << reason_code << std::endl;
@@ -775,14 +1488,7 @@ int main(int argc, char **argv) {
                             if (results.front() == MQTT_NS::suback_return_code::success_maximum_qos_0 ||
                                 results.front() == MQTT_NS::suback_return_code::success_maximum_qos_1 ||
                                 results.front() == MQTT_NS::suback_return_code::success_maximum_qos_2) {
-                                if (--rest_sub == 0) {
-                                    if (pub_idle_count == 0) {
-                                        pub_after_idle_delay_proc();
-                                    }
-                                    else {
-                                        pub_idle_delay_proc();
-                                    }
-                                }
+                                if (--rest_sub == 0) subscribed_proc();
                             }
                             return true;
                         }
@@ -796,14 +1502,7 @@ int main(int argc, char **argv) {
                             if (reasons.front() == MQTT_NS::v5::suback_reason_code::granted_qos_0 ||
                                 reasons.front() == MQTT_NS::v5::suback_reason_code::granted_qos_1 ||
                                 reasons.front() == MQTT_NS::v5::suback_reason_code::granted_qos_2) {
-                                if (--rest_sub == 0) {
-                                    if (pub_idle_count == 0) {
-                                        pub_after_idle_delay_proc();
-                                    }
-                                    else {
-                                        pub_idle_delay_proc();
-                                    }
-                                }
+                                if (--rest_sub == 0) subscribed_proc();
                             }
                             return true;
                         }
@@ -828,6 +1527,11 @@ int main(int argc, char **argv) {
                             return publish_handler(ci, packet_id, pubopts, topic_name, contents, MQTT_NS::force_move(props));
                         }
                     );
+                    ci.c->set_close_handler(
+                        [&] {
+                            if (ci.reconnecting) connect_proc(ci);
+                        }
+                    );
                 }
 
                 std::function <void()> tim_progress_proc;
@@ -917,21 +1621,7 @@ int main(int argc, char **argv) {
                                 std::cout << "timer error:" << ec.message() << std::endl;
                                 return;
                             }
-                            MQTT_NS::v5::properties props;
-                            if (sei != 0) {
-                                props.emplace_back(
-                                    MQTT_NS::v5::property::session_expiry_interval(sei)
-                                );
-                            }
-                            ci.c->async_connect(
-                                MQTT_NS::force_move(props),
-                                [&](MQTT_NS::error_code ec) {
-                                    if (ec) {
-                                        std::cerr << "async_connect error: " << ec.message() << std::endl;
-                                    }
-                                    ci.init_timer(ci.c->get_executor());
-                                }
-                            );
+                            connect_proc(ci);
                         }
                     );
                 }
@@ -946,7 +1636,8 @@ int main(int argc, char **argv) {
                 for (auto& ioc : iocs) {
                     for (std::size_t i = 0; i != threads_per_ioc; ++i) {
                         ths.emplace_back(
-                            [&] {
+                            [&, index = ths.size()] {
+                                worker_index = index;
                                 ioc.run();
                             }
                         );
@@ -963,14 +1654,14 @@ int main(int argc, char **argv) {
 
         struct client_info_base {
             client_info_base(std::size_t index, std::size_t payload_size, std::size_t times, std::size_t idle_count)
-                :index_str{(boost::format("%08d") % index).str()},
+                :index{index},
+                 index_str{(boost::format("%08d") % index).str()},
                  send_times{times},
                  recv_times{times},
                  send_idle_count{idle_count},
                  recv_idle_count{idle_count}
             {
                 payload_str.resize(payload_size);
-                sent.resize(times);
                 auto it = payload_str.begin() + min_payload + 1;
                 auto end = payload_str.end();
                 char c = 'A';
@@ -980,20 +1671,40 @@ int main(int argc, char **argv) {
                 }
             }
 
-            MQTT_NS::buffer send_payload() {
+            // The payload contains the index of the publisher, the count, and the send time
+            MQTT_NS::buffer send_payload(std::chrono::steady_clock::time_point sent) {
                 std::string ret = payload_str;
-                auto variable = (boost::format("%s%08d") %index_str % send_times).str();
+                auto variable = (boost::format("%s%08d%016x")
+                    % index_str
+                    % send_times
+                    % static_cast<std::uint64_t>(sent.time_since_epoch().count())
+                ).str();
                 std::copy(variable.begin(), variable.end(), ret.begin());
                 return MQTT_NS::allocate_buffer(ret);
             }
 
-            MQTT_NS::buffer recv_payload() const {
+            // The expected payload. The send time is copied from the received one.
+            MQTT_NS::buffer recv_payload(MQTT_NS::buffer const& received) const {
                 std::string ret = payload_str;
-                auto variable = (boost::format("%s%08d") %index_str % recv_times).str();
+                auto variable = (boost::format("%s%08d%s")
+                    % index_str
+                    % recv_times
+                    % received.substr(16, 16)
+                ).str();
                 std::copy(variable.begin(), variable.end(), ret.begin());
                 return MQTT_NS::allocate_buffer(ret);
             }
 
+            static std::chrono::steady_clock::time_point sent_time(MQTT_NS::buffer const& payload) {
+                return std::chrono::steady_clock::time_point(
+                    std::chrono::steady_clock::duration(
+                        static_cast<std::chrono::steady_clock::rep>(
+                            std::stoull(std::string(payload.substr(16, 16)), nullptr, 16)
+                        )
+                    )
+                );
+            }
+
 #if BOOST_VERSION < 107400 || defined(BOOST_ASIO_USE_TS_EXECUTOR_AS_DEFAULT)
             using executor_t =  as::executor;
 #else  // BOOST_VERSION < 107400 || defined(BOOST_ASIO_USE_TS_EXECUTOR_AS_DEFAULT)
@@ -1004,14 +1715,17 @@ int main(int argc, char **argv) {
                 tim = std::make_shared<as::steady_timer>(exe);
             }
 
+            std::size_t index;
             std::string index_str;
             std::string payload_str;
             std::size_t send_times;
             std::size_t recv_times;
             std::size_t send_idle_count;
             std::size_t recv_idle_count;
-            std::vector<std::chrono::steady_clock::time_point> sent;
             std::vector<std::size_t> rtt_us;
+            bool reconnecting = false;
+            std::chrono::steady_clock::time_point tp_connect;
+            std::chrono::steady_clock::time_point tp_intended;
             std::shared_ptr<as::steady_timer> tim;
         };
 
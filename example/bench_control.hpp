@@ -0,0 +1,196 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BENCH_CONTROL_HPP)
+#define MQTT_BENCH_CONTROL_HPP
+
+#include <mqtt/config.hpp>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <istream>
+#include <functional>
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+
+#include "locked_cout.hpp"
+#include "hdr_histogram.hpp"
+
+// Control channel between the bench coordinator and the bench worker processes.
+// It is a line based protocol over a Unix domain socket, so the control traffic doesn't go
+// through the broker that is measured.
+//
+//   worker      -> coordinator  "hello <worker_id>"
+//   worker      -> coordinator  "ready <phase>"        the worker has finished the phase
+//   coordinator -> worker       "go <phase>"           all the workers have finished the phase
+//   worker      -> coordinator  "hist <tag> <base64>"  latency histogram. the tag "-" means no tag
+//   worker      -> coordinator  "done"
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+class bench_control_worker {
+public:
+    bench_control_worker(boost::asio::io_context& ioc, std::string const& path, std::size_t worker_id)
+        :socket_(ioc) {
+        socket_.connect(boost::asio::local::stream_protocol::endpoint(path));
+        write("hello " + std::to_string(worker_id));
+    }
+
+    /**
+     * @brief Report that the phase has finished, and call f when all the workers have finished it.
+     *        f is called on the thread that runs the io_context.
+     */
+    void barrier(std::string const& phase, std::function<void()> f) {
+        write("ready " + phase);
+        boost::asio::async_read_until(
+            socket_,
+            buf_,
+            '\n',
+            [this, phase, f = std::move(f)] (boost::system::error_code const& ec, std::size_t) {
+                if (ec) {
+                    locked_cout() << "control channel error:" << ec.message() << std::endl;
+                    return;
+                }
+                std::istream is(&buf_);
+                std::string line;
+                std::getline(is, line);
+                if (line != "go " + phase) {
+                    locked_cout() << "unexpected control message:" << line << std::endl;
+                    return;
+                }
+                f();
+            }
+        );
+    }
+
+    void send_histogram(std::string const& tag, hdr_histogram const& h) {
+        write(
+            "hist " + (tag.empty() ? std::string("-") : tag) + " " +
+            hdr_log_base64_encode(h.encode_compressed())
+        );
+    }
+
+    void done() {
+        write("done");
+    }
+
+private:
+    void write(std::string line) {
+        line.push_back('\n');
+        boost::asio::write(socket_, boost::asio::buffer(line));
+    }
+
+    boost::asio::local::stream_protocol::socket socket_;
+    boost::asio::streambuf buf_;
+};
+
+class bench_control_coordinator {
+public:
+    bench_control_coordinator(boost::asio::io_context& ioc, std::string const& path)
+        :ioc_(ioc),
+         path_(path),
+         acceptor_(ioc) {
+        std::remove(path.c_str());
+        boost::asio::local::stream_protocol::endpoint ep(path);
+        acceptor_.open(ep.protocol());
+        acceptor_.bind(ep);
+        acceptor_.listen();
+    }
+
+    ~bench_control_coordinator() {
+        std::remove(path_.c_str());
+    }
+
+    /**
+     * @brief Wait until the given number of workers are connected.
+     */
+    void accept(std::size_t workers) {
+        while (workers_.size() != workers) {
+            auto w = std::make_unique<worker>(ioc_);
+            acceptor_.accept(w->socket);
+            auto line = read_line(*w);
+            if (line.compare(0, 6, "hello ") != 0) {
+                throw std::runtime_error("unexpected control message:" + line);
+            }
+            w->id = line.substr(6);
+            workers_.push_back(std::move(w));
+        }
+    }
+
+    /**
+     * @brief Wait until all the workers have finished the phase, and then let them go on.
+     */
+    void barrier(std::string const& phase) {
+        for (auto& w : workers_) {
+            auto line = read_line(*w);
+            if (line != "ready " + phase) {
+                throw std::runtime_error("unexpected control message from worker " + w->id + ":" + line);
+            }
+        }
+        std::string go = "go " + phase + "\n";
+        for (auto& w : workers_) {
+            boost::asio::write(w->socket, boost::asio::buffer(go));
+        }
+    }
+
+    /**
+     * @brief Receive the histograms of all the workers and merge them by the tag.
+     */
+    std::map<std::string, hdr_histogram> collect() {
+        std::map<std::string, hdr_histogram> merged;
+        for (auto& w : workers_) {
+            while (true) {
+                auto line = read_line(*w);
+                if (line == "done") break;
+                auto sp = line.find(' ', 5);
+                if (line.compare(0, 5, "hist ") != 0 || sp == std::string::npos) {
+                    throw std::runtime_error("unexpected control message from worker " + w->id + ":" + line);
+                }
+                auto tag = line.substr(5, sp - 5);
+                if (tag == "-") tag.clear();
+                auto h = hdr_histogram::decode_compressed(hdr_log_base64_decode(line.substr(sp + 1)));
+                auto it = merged.find(tag);
+                if (it == merged.end()) {
+                    merged.emplace(tag, std::move(h));
+                }
+                else {
+                    it->second.add(h);
+                }
+            }
+        }
+        return merged;
+    }
+
+private:
+    struct worker {
+        explicit worker(boost::asio::io_context& ioc)
+            :socket(ioc) {}
+        boost::asio::local::stream_protocol::socket socket;
+        boost::asio::streambuf buf;
+        std::string id;
+    };
+
+    static std::string read_line(worker& w) {
+        boost::asio::read_until(w.socket, w.buf, '\n');
+        std::istream is(&w.buf);
+        std::string line;
+        std::getline(is, line);
+        return line;
+    }
+
+    boost::asio::io_context& ioc_;
+    std::string path_;
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+    std::vector<std::unique_ptr<worker>> workers_;
+};
+
+#endif // defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+#endif // MQTT_BENCH_CONTROL_HPP
@@ -15,7 +15,7 @@
 
 namespace as = boost::asio;
 
-using con_t = MQTT_NS::server<>::endpoint_t;
+using con_t = MQTT_NS::broker::server_t::endpoint_t;
 using con_sp_t = std::shared_ptr<con_t>;
 
 
@@ -60,7 +60,7 @@ public:
     }
 
 private:
-    MQTT_NS::server<> server_;
+    MQTT_NS::broker::server_t server_;
     MQTT_NS::broker::broker_t& b_;
 };
 
@@ -92,7 +92,7 @@ public:
         );
 
         server_.set_accept_handler(
-            [&](std::shared_ptr<MQTT_NS::server_tls<>::endpoint_t> spep) {
+            [&](std::shared_ptr<MQTT_NS::broker::server_tls_t::endpoint_t> spep) {
                 b_.handle_accept(MQTT_NS::force_move(spep));
             }
         );
@@ -125,7 +125,7 @@ public:
     }
 
 private:
-    MQTT_NS::server_tls<> server_;
+    MQTT_NS::broker::server_tls_t server_;
     MQTT_NS::broker::broker_t& b_;
 };
 
@@ -156,7 +156,7 @@ public:
         );
 
         server_.set_accept_handler(
-            [&](std::shared_ptr<MQTT_NS::server_ws<>::endpoint_t> spep) {
+            [&](std::shared_ptr<MQTT_NS::broker::server_ws_t::endpoint_t> spep) {
                 b_.handle_accept(MQTT_NS::force_move(spep));
             }
         );
@@ -173,7 +173,7 @@ public:
     }
 
 private:
-    MQTT_NS::server_ws<> server_;
+    MQTT_NS::broker::server_ws_t server_;
     MQTT_NS::broker::broker_t& b_;
 };
 
@@ -206,7 +206,7 @@ public:
         );
 
         server_.set_accept_handler(
-            [&](std::shared_ptr<MQTT_NS::server_tls_ws<>::endpoint_t> spep) {
+            [&](std::shared_ptr<MQTT_NS::broker::server_tls_ws_t::endpoint_t> spep) {
                 b_.handle_accept(MQTT_NS::force_move(spep));
             }
         );
@@ -239,7 +239,7 @@ public:
     }
 
 private:
-    MQTT_NS::server_tls_ws<> server_;
+    MQTT_NS::broker::server_tls_ws_t server_;
     MQTT_NS::broker::broker_t& b_;
 };
 
@@ -326,11 +326,136 @@ void load_ctx(Server& server, as::steady_timer& reload_timer, boost::program_opt
 
 
 
+void run_servers(
+    boost::program_options::variables_map const& vm,
+    MQTT_NS::broker::broker_t& b,
+    as::io_context& timer_ioc,
+    std::vector<as::io_context>& con_iocs,
+    std::size_t threads_per_ioc) {
+    as::io_context accept_ioc;
+
+    std::mutex mtx_con_iocs;
+
+    std::vector<
+        as::executor_work_guard<
+            as::io_context::executor_type
+        >
+    > guard_con_iocs;
+    guard_con_iocs.reserve(con_iocs.size());
+    for (auto& con_ioc : con_iocs) {
+        guard_con_iocs.emplace_back(con_ioc.get_executor());
+    }
+
+    auto con_iocs_it = con_iocs.begin();
+
+    auto con_ioc_getter =
+        [&mtx_con_iocs, &con_iocs, &con_iocs_it]() -> as::io_context& {
+            std::lock_guard<std::mutex> g{mtx_con_iocs};
+            auto& ret = *con_iocs_it++;
+            if (con_iocs_it == con_iocs.end()) con_iocs_it = con_iocs.begin();
+            return ret;
+        };
+
+    MQTT_NS::optional<server_no_tls> s;
+    if (vm.count("tcp.port")) {
+        s.emplace(
+            accept_ioc,
+            con_ioc_getter,
+            b,
+            vm["tcp.port"].as<std::uint16_t>()
+        );
+    }
+
+#if defined(MQTT_USE_WS)
+    MQTT_NS::optional<server_no_tls_ws> s_ws;
+    if (vm.count("ws.port")) {
+        s_ws.emplace(
+            accept_ioc,
+            con_ioc_getter,
+            b,
+            vm["ws.port"].as<std::uint16_t>()
+        );
+    }
+#endif // defined(MQTT_USE_WS)
+
+#if defined(MQTT_USE_TLS)
+    MQTT_NS::optional<server_tls> s_tls;
+    MQTT_NS::optional<as::steady_timer> s_lts_timer;
+
+    if (vm.count("tls.port")) {
+        s_tls.emplace(
+            accept_ioc,
+            con_ioc_getter,
+            init_ctx(),
+            b,
+            vm["tls.port"].as<std::uint16_t>()
+        );
+        s_lts_timer.emplace(accept_ioc);
+        load_ctx(s_tls.value(), s_lts_timer.value(), vm, "TLS");
+    }
+#endif // defined(MQTT_USE_TLS)
+
+#if defined(MQTT_USE_TLS) && defined(MQTT_USE_WS)
+    MQTT_NS::optional<server_tls_ws> s_tls_ws;
+    MQTT_NS::optional<as::steady_timer> s_tls_ws_timer;
+
+    if (vm.count("wss.port")) {
+        s_tls_ws.emplace(
+            accept_ioc,
+            con_ioc_getter,
+            init_ctx(),
+            b,
+            vm["wss.port"].as<std::uint16_t>()
+        );
+        s_tls_ws_timer.emplace(accept_ioc);
+        load_ctx(s_tls_ws.value(), s_tls_ws_timer.value(), vm, "WSS");
+    }
+#endif // defined(MQTT_USE_TLS) && defined(MQTT_USE_WS)
+
+    std::thread th_accept {
+        [&accept_ioc] {
+            accept_ioc.run();
+            MQTT_LOG("mqtt_broker", trace) << "accept_ioc.run() finished";
+        }
+    };
+
+    as::executor_work_guard<
+        as::io_context::executor_type
+    > guard_timer_ioc(timer_ioc.get_executor());
+
+    std::thread th_timer {
+        [&timer_ioc] {
+            timer_ioc.run();
+            MQTT_LOG("mqtt_broker", trace) << "timer_ioc.run() finished";
+        }
+    };
+    std::vector<std::thread> ts;
+    ts.reserve(con_iocs.size() * threads_per_ioc);
+    for (auto& con_ioc : con_iocs) {
+        for (std::size_t i = 0; i != threads_per_ioc; ++i) {
+            ts.emplace_back(
+                [&con_ioc] {
+                    con_ioc.run();
+                    MQTT_LOG("mqtt_broker", trace) << "con_ioc.run() finished";
+                }
+            );
+        }
+    }
+
+    th_accept.join();
+    MQTT_LOG("mqtt_broker", trace) << "th_accept joined";
+
+    for (auto& g : guard_con_iocs) g.reset();
+    for (auto& t : ts) t.join();
+    MQTT_LOG("mqtt_broker", trace) << "ts joined";
+
+    guard_timer_ioc.reset();
+    th_timer.join();
+    MQTT_LOG("mqtt_broker", trace) << "th_timer joined";
+}
+
 void run_broker(boost::program_options::variables_map const& vm) {
     try {
-        as::io_context timer_ioc;
-        MQTT_NS::broker::broker_t b(timer_ioc);
-
         auto num_of_iocs =
             [&] () -> std::size_t {
                 if (vm.count("iocs")) {
@@ -360,129 +485,16 @@ void run_broker(boost::program_options::variables_map const& vm) {
             << " threads_per_ioc:" << threads_per_ioc
             << " total threads:" << num_of_iocs * threads_per_ioc;
 
-        as::io_context accept_ioc;
-
-        std::mutex mtx_con_iocs;
+        as::io_context timer_ioc;
         std::vector<as::io_context> con_iocs(num_of_iocs);
         BOOST_ASSERT(!con_iocs.empty());
 
-        std::vector<
-            as::executor_work_guard<
-                as::io_context::executor_type
-            >
-        > guard_con_iocs;
-        guard_con_iocs.reserve(con_iocs.size());
-        for (auto& con_ioc : con_iocs) {
-            guard_con_iocs.emplace_back(con_ioc.get_executor());
-        }
-
-        auto con_iocs_it = con_iocs.begin();
-
-        auto con_ioc_getter =
-            [&mtx_con_iocs, &con_iocs, &con_iocs_it]() -> as::io_context& {
-                std::lock_guard<std::mutex> g{mtx_con_iocs};
-                auto& ret = *con_iocs_it++;
-                if (con_iocs_it == con_iocs.end()) con_iocs_it = con_iocs.begin();
-                return ret;
-            };
-
-        MQTT_NS::optional<server_no_tls> s;
-        if (vm.count("tcp.port")) {
-            s.emplace(
-                accept_ioc,
-                con_ioc_getter,
-                b,
-                vm["tcp.port"].as<std::uint16_t>()
-            );
-        }
-
-#if defined(MQTT_USE_WS)
-        MQTT_NS::optional<server_no_tls_ws> s_ws;
-        if (vm.count("ws.port")) {
-            s_ws.emplace(
-                accept_ioc,
-                con_ioc_getter,
-                b,
-                vm["ws.port"].as<std::uint16_t>()
-            );
-        }
-#endif // defined(MQTT_USE_WS)
-
-#if defined(MQTT_USE_TLS)
-        MQTT_NS::optional<server_tls> s_tls;
-        MQTT_NS::optional<as::steady_timer> s_lts_timer;
-
-        if (vm.count("tls.port")) {
-            s_tls.emplace(
-                accept_ioc,
-                con_ioc_getter,
-                init_ctx(),
-                b,
-                vm["tls.port"].as<std::uint16_t>()
-            );
-            s_lts_timer.emplace(accept_ioc);
-            load_ctx(s_tls.value(), s_lts_timer.value(), vm, "TLS");
-        }
-#endif // defined(MQTT_USE_TLS)
-
-#if defined(MQTT_USE_TLS) && defined(MQTT_USE_WS)
-        MQTT_NS::optional<server_tls_ws> s_tls_ws;
-        MQTT_NS::optional<as::steady_timer> s_tls_ws_timer;
-
-        if (vm.count("wss.port")) {
-            s_tls_ws.emplace(
-                accept_ioc,
-                con_ioc_getter,
-                init_ctx(),
-                b,
-                vm["wss.port"].as<std::uint16_t>()
-            );
-            s_tls_ws_timer.emplace(accept_ioc);
-            load_ctx(s_tls_ws.value(), s_tls_ws_timer.value(), vm, "WSS");
-        }
-#endif // defined(MQTT_USE_TLS) && defined(MQTT_USE_WS)
-
-        std::thread th_accept {
-            [&accept_ioc] {
-                accept_ioc.run();
-                MQTT_LOG("mqtt_broker", trace) << "accept_ioc.run() finished";
-            }
-        };
-
-        as::executor_work_guard<
-            as::io_context::executor_type
-        > guard_timer_ioc(timer_ioc.get_executor());
-
-        std::thread th_timer {
-            [&timer_ioc] {
-                timer_ioc.run();
-                MQTT_LOG("mqtt_broker", trace) << "timer_ioc.run() finished";
-            }
-        };
-        std::vector<std::thread> ts;
-        ts.reserve(num_of_iocs * threads_per_ioc);
-        for (auto& con_ioc : con_iocs) {
-            for (std::size_t i = 0; i != threads_per_ioc; ++i) {
-                ts.emplace_back(
-                    [&con_ioc] {
-                        con_ioc.run();
-                        MQTT_LOG("mqtt_broker", trace) << "con_ioc.run() finished";
-                    }
-                );
-            }
+        MQTT_NS::broker::broker_t b(timer_ioc);
+        b.set_auto_map_topic_alias_send(vm["auto_map_topic_alias_send"].as<bool>());
+        if (auto interval = vm["sys_interval"].as<std::size_t>()) {
+            b.start_sys_publisher(std::chrono::seconds(interval));
         }
-
-        th_accept.join();
-        MQTT_LOG("mqtt_broker", trace) << "th_accept joined";
-
-        for (auto& g : guard_con_iocs) g.reset();
-        for (auto& t : ts) t.join();
-        MQTT_LOG("mqtt_broker", trace) << "ts joined";
-
-        guard_timer_ioc.reset();
-        th_timer.join();
-        MQTT_LOG("mqtt_broker", trace) << "th_timer joined";
-
+        run_servers(vm, b, timer_ioc, con_iocs, threads_per_ioc);
     } catch(std::exception &e) {
         MQTT_LOG("mqtt_broker", error) << e.what();
     }
@@ -510,13 +522,23 @@ int main(int argc, char **argv) {
                 boost::program_options::value<std::size_t>()->default_value(1),
                 "Number of worker threads for each io_context."
             )
-#if defined(MQTT_USE_LOG)
+            (
+                "auto_map_topic_alias_send",
+                boost::program_options::value<bool>()->default_value(false),
+                "Assign topic aliases to the PUBLISH packets sent to the subscribers that set Topic Alias Maximum."
+            )
+            (
+                "sys_interval",
+                boost::program_options::value<std::size_t>()->default_value(0),
+                "Interval (seconds) to publish the broker metrics on $SYS topics. 0 means not published."
+            )
+#if defined(MQTT_USE_LOG) || defined(MQTT_USE_BINARY_LOG)
             (
                 "verbose",
                 boost::program_options::value<unsigned int>()->default_value(1),
                 "set verbose level, possible values:\n 0 - Fatal\n 1 - Error\n 2 - Warning\n 3 - Info\n 4 - Debug\n 5 - Trace"
             )
-#endif // defined(MQTT_USE_LOG)
+#endif // defined(MQTT_USE_LOG) || defined(MQTT_USE_BINARY_LOG)
             (
                 "certificate",
                 boost::program_options::value<std::string>(),
@@ -611,7 +633,7 @@ int main(int argc, char **argv) {
             std::cout << std::endl;
         }
 
-#if defined(MQTT_USE_LOG)
+#if defined(MQTT_USE_LOG) || defined(MQTT_USE_BINARY_LOG)
         switch (vm["verbose"].as<unsigned int>()) {
         case 5:
             MQTT_NS::setup_log(MQTT_NS::severity_level::trace);
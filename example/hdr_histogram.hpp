@@ -0,0 +1,629 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_HDR_HISTOGRAM_HPP)
+#define MQTT_HDR_HISTOGRAM_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <istream>
+#include <sstream>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+
+#include <boost/assert.hpp>
+#include <boost/format.hpp>
+
+// Histogram with the same bucket layout as HdrHistogram.
+// Values between lowest and highest are kept with the given number of significant figures.
+// Recording is O(1), and histograms that have the same settings can be added up,
+// so each worker thread records to its own histogram and they are merged for the report.
+// See http://hdrhistogram.org/
+class hdr_histogram {
+public:
+    hdr_histogram(
+        std::int64_t lowest = 1,
+        std::int64_t highest = 3600ll * 1000 * 1000,
+        int significant_figures = 3)
+        :lowest_{lowest},
+         highest_{highest},
+         significant_figures_{significant_figures}
+    {
+        BOOST_ASSERT(lowest >= 1);
+        BOOST_ASSERT(highest >= 2 * lowest);
+        BOOST_ASSERT(significant_figures >= 1 && significant_figures <= 5);
+
+        std::int64_t largest_value_with_single_unit_resolution = 2;
+        for (int i = 0; i != significant_figures; ++i) largest_value_with_single_unit_resolution *= 10;
+        unit_magnitude_ = static_cast<int>(std::floor(std::log2(static_cast<double>(lowest))));
+        auto sub_bucket_count_magnitude =
+            static_cast<int>(std::ceil(std::log2(static_cast<double>(largest_value_with_single_unit_resolution))));
+        sub_bucket_half_count_magnitude_ = std::max(sub_bucket_count_magnitude, 1) - 1;
+        sub_bucket_count_ = std::int64_t(1) << (sub_bucket_half_count_magnitude_ + 1);
+        sub_bucket_half_count_ = sub_bucket_count_ / 2;
+        sub_bucket_mask_ = (sub_bucket_count_ - 1) << unit_magnitude_;
+
+        auto smallest_untrackable_value = sub_bucket_count_ << unit_magnitude_;
+        bucket_count_ = 1;
+        while (smallest_untrackable_value <= highest) {
+            if (smallest_untrackable_value > std::numeric_limits<std::int64_t>::max() / 2) {
+                ++bucket_count_;
+                break;
+            }
+            smallest_untrackable_value <<= 1;
+            ++bucket_count_;
+        }
+        counts_.resize(static_cast<std::size_t>((bucket_count_ + 1) * sub_bucket_half_count_));
+    }
+
+    /**
+     * @brief Record the value. The value greater than highest is recorded as highest.
+     */
+    void record(std::int64_t value, std::int64_t count = 1) {
+        value = std::max(std::int64_t(0), std::min(value, highest_));
+        counts_[static_cast<std::size_t>(counts_index_for(value))] += count;
+        total_count_ += count;
+        if (count != 0) {
+            min_ = std::min(min_, value);
+            max_ = std::max(max_, value);
+        }
+    }
+
+    /**
+     * @brief Record the value, and the values that would have been measured while the
+     *        recording was stalled, assuming one value is measured each expected_interval.
+     *        It is the coordinated omission correction of HdrHistogram.
+     */
+    void record_corrected(std::int64_t value, std::int64_t expected_interval) {
+        record(value);
+        if (expected_interval <= 0) return;
+        for (auto missing = value - expected_interval;
+             missing >= expected_interval;
+             missing -= expected_interval) {
+            record(missing);
+        }
+    }
+
+    /**
+     * @brief Add the counts of the other histogram. The settings must be the same.
+     */
+    void add(hdr_histogram const& other) {
+        BOOST_ASSERT(same_layout(other));
+        for (std::size_t i = 0; i != counts_.size(); ++i) counts_[i] += other.counts_[i];
+        total_count_ += other.total_count_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_count_ = 0;
+        min_ = std::numeric_limits<std::int64_t>::max();
+        max_ = 0;
+    }
+
+    bool same_layout(hdr_histogram const& other) const {
+        return
+            lowest_ == other.lowest_ &&
+            highest_ == other.highest_ &&
+            significant_figures_ == other.significant_figures_;
+    }
+
+    std::int64_t total_count() const {
+        return total_count_;
+    }
+
+    std::int64_t min() const {
+        return total_count_ == 0 ? 0 : lowest_equivalent_value(min_);
+    }
+
+    std::int64_t max() const {
+        return total_count_ == 0 ? 0 : highest_equivalent_value(max_);
+    }
+
+    double mean() const {
+        if (total_count_ == 0) return 0;
+        double total = 0;
+        for (std::size_t i = 0; i != counts_.size(); ++i) {
+            if (counts_[i] == 0) continue;
+            total += static_cast<double>(median_equivalent_value(value_at_index(i))) * static_cast<double>(counts_[i]);
+        }
+        return total / static_cast<double>(total_count_);
+    }
+
+    double stddev() const {
+        if (total_count_ == 0) return 0;
+        auto m = mean();
+        double geometric_dev_total = 0;
+        for (std::size_t i = 0; i != counts_.size(); ++i) {
+            if (counts_[i] == 0) continue;
+            auto dev = static_cast<double>(median_equivalent_value(value_at_index(i))) - m;
+            geometric_dev_total += dev * dev * static_cast<double>(counts_[i]);
+        }
+        return std::sqrt(geometric_dev_total / static_cast<double>(total_count_));
+    }
+
+    /**
+     * @brief Get the value at the percentile.
+     * @param percentile 0.0 to 100.0
+     * @return the highest value that is equivalent to the value at the percentile. 0 if empty.
+     */
+    std::int64_t value_at_percentile(double percentile) const {
+        if (total_count_ == 0) return 0;
+        auto requested = std::min(percentile, 100.0);
+        auto count_at_percentile =
+            std::max(
+                static_cast<std::int64_t>(requested / 100.0 * static_cast<double>(total_count_) + 0.5),
+                std::int64_t(1)
+            );
+        std::int64_t total = 0;
+        for (std::size_t i = 0; i != counts_.size(); ++i) {
+            total += counts_[i];
+            if (total >= count_at_percentile) return highest_equivalent_value(value_at_index(i));
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Output the percentile distribution in the format of HdrHistogram.
+     *        The output can be plotted by the HdrHistogram plotter.
+     * @param o output stream
+     * @param unit_ratio the values are divided by the ratio. e.g. 1000 to output microseconds as milliseconds
+     * @param ticks_per_half_distance the number of percentile lines between each halving of the rest
+     */
+    void output_percentile_distribution(
+        std::ostream& o,
+        double unit_ratio = 1.0,
+        int ticks_per_half_distance = 5) const {
+        o << boost::format("%12s %14s %10s %14s\n\n") % "Value" % "Percentile" % "TotalCount" % "1/(1-Percentile)";
+        if (total_count_ != 0) {
+            double percentile_to_iterate_to = 0.0;
+            std::int64_t total = 0;
+            for (std::size_t i = 0; i != counts_.size(); ++i) {
+                if (counts_[i] == 0) continue;
+                total += counts_[i];
+                auto value = static_cast<double>(highest_equivalent_value(value_at_index(i))) / unit_ratio;
+                auto current_percentile = 100.0 * static_cast<double>(total) / static_cast<double>(total_count_);
+                while (percentile_to_iterate_to <= current_percentile) {
+                    o << boost::format("%12.3f %2.12f %10d %14.2f\n")
+                        % value
+                        % (percentile_to_iterate_to / 100.0)
+                        % total
+                        % (1.0 / (1.0 - percentile_to_iterate_to / 100.0));
+                    auto half_distance = std::pow(
+                        2.0,
+                        std::floor(std::log2(100.0 / (100.0 - percentile_to_iterate_to))) + 1
+                    );
+                    percentile_to_iterate_to += 100.0 / (ticks_per_half_distance * half_distance);
+                    // The last bucket is reported once, and then as 100%
+                    if (total == total_count_) break;
+                }
+            }
+            o << boost::format("%12.3f %2.12f %10d\n")
+                % (static_cast<double>(max()) / unit_ratio)
+                % 1.0
+                % total_count_;
+        }
+        o << boost::format("#[Mean    = %12.3f, StdDeviation   = %12.3f]\n")
+            % (mean() / unit_ratio)
+            % (stddev() / unit_ratio);
+        o << boost::format("#[Max     = %12.3f, Total count    = %12d]\n")
+            % (static_cast<double>(max()) / unit_ratio)
+            % total_count_;
+        o << boost::format("#[Buckets = %12d, SubBuckets     = %12d]\n")
+            % bucket_count_
+            % sub_bucket_count_;
+    }
+
+    /**
+     * @brief Encode to the compressed V2 format of HdrHistogram.
+     *        The deflate stream consists of stored (not compressed) blocks,
+     *        so that no compression library is required. HdrHistogram tools can read it.
+     * @return encoded bytes
+     */
+    std::string encode_compressed() const {
+        std::string payload;
+        if (total_count_ != 0) {
+            auto length = static_cast<std::size_t>(counts_index_for(max_)) + 1;
+            for (std::size_t i = 0; i != length;) {
+                if (counts_[i] == 0) {
+                    // A run of zeros is encoded as a negative count
+                    std::int64_t zeros = 0;
+                    for (; i != length && counts_[i] == 0; ++i) ++zeros;
+                    put_zig_zag(payload, -zeros);
+                }
+                else {
+                    put_zig_zag(payload, counts_[i++]);
+                }
+            }
+        }
+
+        std::string encoded;
+        put_int32(encoded, encoding_cookie);
+        put_int32(encoded, static_cast<std::int32_t>(payload.size()));
+        put_int32(encoded, 0); // normalizing index offset
+        put_int32(encoded, significant_figures_);
+        put_int64(encoded, lowest_);
+        put_int64(encoded, highest_);
+        double ratio = 1.0; // integer to double value conversion ratio
+        std::uint64_t ratio_bits;
+        std::memcpy(&ratio_bits, &ratio, sizeof(ratio));
+        put_int64(encoded, static_cast<std::int64_t>(ratio_bits));
+        encoded += payload;
+
+        auto deflated = zlib_store(encoded);
+        std::string ret;
+        put_int32(ret, compressed_encoding_cookie);
+        put_int32(ret, static_cast<std::int32_t>(deflated.size()));
+        ret += deflated;
+        return ret;
+    }
+
+    /**
+     * @brief Decode the bytes made by encode_compressed().
+     *        The deflate stream must consist of stored blocks.
+     * @exception std::runtime_error the bytes are not supported
+     */
+    static hdr_histogram decode_compressed(std::string const& data) {
+        std::size_t pos = 0;
+        if (get_int32(data, pos) != compressed_encoding_cookie) {
+            throw std::runtime_error("hdr_histogram: not a compressed V2 histogram");
+        }
+        auto deflated_length = static_cast<std::size_t>(get_int32(data, pos));
+        if (data.size() - pos < deflated_length) {
+            throw std::runtime_error("hdr_histogram: truncated histogram");
+        }
+        auto encoded = zlib_unstore(data.substr(pos, deflated_length));
+
+        pos = 0;
+        if (get_int32(encoded, pos) != encoding_cookie) {
+            throw std::runtime_error("hdr_histogram: not a V2 histogram");
+        }
+        auto payload_length = static_cast<std::size_t>(get_int32(encoded, pos));
+        if (get_int32(encoded, pos) != 0) {
+            throw std::runtime_error("hdr_histogram: normalizing index offset is not supported");
+        }
+        auto significant_figures = get_int32(encoded, pos);
+        auto lowest = get_int64(encoded, pos);
+        auto highest = get_int64(encoded, pos);
+        get_int64(encoded, pos); // integer to double value conversion ratio
+        if (lowest < 1 || highest < 2 * lowest || significant_figures < 1 || significant_figures > 5 ||
+            encoded.size() - pos < payload_length) {
+            throw std::runtime_error("hdr_histogram: invalid header");
+        }
+
+        hdr_histogram h(lowest, highest, significant_figures);
+        auto end = pos + payload_length;
+        std::size_t index = 0;
+        while (pos != end) {
+            auto count = get_zig_zag(encoded, pos, end);
+            if (count < 0) {
+                index += static_cast<std::size_t>(-count);
+                continue;
+            }
+            if (index >= h.counts_.size()) {
+                throw std::runtime_error("hdr_histogram: too many counts");
+            }
+            if (count != 0) {
+                h.counts_[index] = count;
+                h.total_count_ += count;
+                h.min_ = std::min(h.min_, h.value_at_index(index));
+                h.max_ = std::max(h.max_, h.value_at_index(index));
+            }
+            ++index;
+        }
+        return h;
+    }
+
+private:
+    static constexpr std::int32_t encoding_cookie = 0x1c849313;
+    static constexpr std::int32_t compressed_encoding_cookie = 0x1c849314;
+
+    static void put_int32(std::string& s, std::int32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            s.push_back(static_cast<char>((static_cast<std::uint32_t>(v) >> shift) & 0xff));
+        }
+    }
+
+    static void put_int64(std::string& s, std::int64_t v) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            s.push_back(static_cast<char>((static_cast<std::uint64_t>(v) >> shift) & 0xff));
+        }
+    }
+
+    static std::int32_t get_int32(std::string const& s, std::size_t& pos) {
+        if (s.size() - pos < 4) throw std::runtime_error("hdr_histogram: truncated histogram");
+        std::uint32_t v = 0;
+        for (int i = 0; i != 4; ++i) v = (v << 8) | static_cast<unsigned char>(s[pos++]);
+        return static_cast<std::int32_t>(v);
+    }
+
+    static std::int64_t get_int64(std::string const& s, std::size_t& pos) {
+        if (s.size() - pos < 8) throw std::runtime_error("hdr_histogram: truncated histogram");
+        std::uint64_t v = 0;
+        for (int i = 0; i != 8; ++i) v = (v << 8) | static_cast<unsigned char>(s[pos++]);
+        return static_cast<std::int64_t>(v);
+    }
+
+    // ZigZag LEB128 of HdrHistogram. The 9th byte has 8 bits.
+    static void put_zig_zag(std::string& s, std::int64_t signed_value) {
+        auto v = (static_cast<std::uint64_t>(signed_value) << 1) ^ static_cast<std::uint64_t>(signed_value >> 63);
+        for (int i = 0; i != 8; ++i) {
+            if ((v >> 7) == 0) {
+                s.push_back(static_cast<char>(v));
+                return;
+            }
+            s.push_back(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        s.push_back(static_cast<char>(v));
+    }
+
+    static std::int64_t get_zig_zag(std::string const& s, std::size_t& pos, std::size_t end) {
+        std::uint64_t v = 0;
+        int shift = 0;
+        for (int i = 0; i != 9; ++i, shift += 7) {
+            if (pos == end) throw std::runtime_error("hdr_histogram: truncated counts");
+            auto b = static_cast<std::uint64_t>(static_cast<unsigned char>(s[pos++]));
+            if (i == 8) {
+                v |= b << 56;
+                break;
+            }
+            v |= (b & 0x7f) << shift;
+            if (!(b & 0x80)) break;
+        }
+        return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+    }
+
+    // zlib stream of stored deflate blocks
+    static std::string zlib_store(std::string const& data) {
+        std::string s;
+        s.push_back(static_cast<char>(0x78));
+        s.push_back(static_cast<char>(0x01));
+        std::size_t pos = 0;
+        do {
+            auto len = std::min(data.size() - pos, std::size_t(0xffff));
+            bool final = pos + len == data.size();
+            s.push_back(static_cast<char>(final ? 1 : 0));
+            s.push_back(static_cast<char>(len & 0xff));
+            s.push_back(static_cast<char>(len >> 8));
+            s.push_back(static_cast<char>(~len & 0xff));
+            s.push_back(static_cast<char>((~len >> 8) & 0xff));
+            s.append(data, pos, len);
+            pos += len;
+        } while (pos != data.size());
+        put_int32(s, static_cast<std::int32_t>(adler32(data)));
+        return s;
+    }
+
+    static std::string zlib_unstore(std::string const& s) {
+        if (s.size() < 6 || (static_cast<unsigned char>(s[0]) & 0x0f) != 8) {
+            throw std::runtime_error("hdr_histogram: not a zlib stream");
+        }
+        std::string data;
+        std::size_t pos = 2;
+        while (true) {
+            if (s.size() - pos < 5) throw std::runtime_error("hdr_histogram: truncated zlib stream");
+            auto header = static_cast<unsigned char>(s[pos++]);
+            if ((header >> 1) & 0x03) {
+                throw std::runtime_error("hdr_histogram: compressed deflate blocks are not supported");
+            }
+            std::size_t len =
+                static_cast<unsigned char>(s[pos]) |
+                (static_cast<std::size_t>(static_cast<unsigned char>(s[pos + 1])) << 8);
+            pos += 4;
+            if (s.size() - pos < len) throw std::runtime_error("hdr_histogram: truncated zlib stream");
+            data.append(s, pos, len);
+            pos += len;
+            if (header & 0x01) break;
+        }
+        if (static_cast<std::uint32_t>(get_int32(s, pos)) != adler32(data)) {
+            throw std::runtime_error("hdr_histogram: zlib checksum mismatch");
+        }
+        return data;
+    }
+
+    static std::uint32_t adler32(std::string const& data) {
+        std::uint32_t a = 1;
+        std::uint32_t b = 0;
+        for (auto c : data) {
+            a = (a + static_cast<unsigned char>(c)) % 65521;
+            b = (b + a) % 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    int bucket_index_of(std::int64_t value) const {
+        int pow2ceiling = 64 - count_leading_zeros(static_cast<std::uint64_t>(value | sub_bucket_mask_));
+        return pow2ceiling - unit_magnitude_ - (sub_bucket_half_count_magnitude_ + 1);
+    }
+
+    int sub_bucket_index_of(std::int64_t value, int bucket_index) const {
+        return static_cast<int>(value >> (bucket_index + unit_magnitude_));
+    }
+
+    std::int64_t counts_index_for(std::int64_t value) const {
+        auto bucket_index = bucket_index_of(value);
+        auto sub_bucket_index = sub_bucket_index_of(value, bucket_index);
+        auto bucket_base_index = std::int64_t(bucket_index + 1) << sub_bucket_half_count_magnitude_;
+        return bucket_base_index + sub_bucket_index - sub_bucket_half_count_;
+    }
+
+    std::int64_t value_at_index(std::size_t index) const {
+        auto bucket_index = static_cast<int>(index >> sub_bucket_half_count_magnitude_) - 1;
+        auto sub_bucket_index = static_cast<std::int64_t>(index & static_cast<std::size_t>(sub_bucket_half_count_ - 1)) + sub_bucket_half_count_;
+        if (bucket_index < 0) {
+            sub_bucket_index -= sub_bucket_half_count_;
+            bucket_index = 0;
+        }
+        return sub_bucket_index << (bucket_index + unit_magnitude_);
+    }
+
+    std::int64_t size_of_equivalent_value_range(std::int64_t value) const {
+        auto bucket_index = bucket_index_of(value);
+        auto sub_bucket_index = sub_bucket_index_of(value, bucket_index);
+        auto adjusted_bucket = sub_bucket_index >= sub_bucket_count_ ? bucket_index + 1 : bucket_index;
+        return std::int64_t(1) << (unit_magnitude_ + adjusted_bucket);
+    }
+
+    std::int64_t lowest_equivalent_value(std::int64_t value) const {
+        auto bucket_index = bucket_index_of(value);
+        auto sub_bucket_index = sub_bucket_index_of(value, bucket_index);
+        return std::int64_t(sub_bucket_index) << (bucket_index + unit_magnitude_);
+    }
+
+    std::int64_t highest_equivalent_value(std::int64_t value) const {
+        return lowest_equivalent_value(value) + size_of_equivalent_value_range(value) - 1;
+    }
+
+    std::int64_t median_equivalent_value(std::int64_t value) const {
+        return lowest_equivalent_value(value) + (size_of_equivalent_value_range(value) >> 1);
+    }
+
+    static int count_leading_zeros(std::uint64_t v) {
+        BOOST_ASSERT(v != 0);
+        int n = 0;
+        for (std::uint64_t mask = std::uint64_t(1) << 63; !(v & mask); mask >>= 1) ++n;
+        return n;
+    }
+
+    std::int64_t lowest_;
+    std::int64_t highest_;
+    int significant_figures_;
+    int unit_magnitude_;
+    int sub_bucket_half_count_magnitude_;
+    std::int64_t sub_bucket_count_;
+    std::int64_t sub_bucket_half_count_;
+    std::int64_t sub_bucket_mask_;
+    int bucket_count_;
+    std::vector<std::int64_t> counts_;
+    std::int64_t total_count_ = 0;
+    std::int64_t min_ = std::numeric_limits<std::int64_t>::max();
+    std::int64_t max_ = 0;
+};
+
+// HdrHistogram interval log (format version 1.3).
+// Each line is an interval histogram that is encoded by encode_compressed() and base64.
+// The logs of the processes can be merged by hdr_log_read() or by HistogramLogProcessor of HdrHistogram.
+
+inline std::string hdr_log_base64_encode(std::string const& data) {
+    static char const table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string ret;
+    std::size_t i = 0;
+    for (; i + 2 < data.size(); i += 3) {
+        auto v =
+            (std::uint32_t(static_cast<unsigned char>(data[i])) << 16) |
+            (std::uint32_t(static_cast<unsigned char>(data[i + 1])) << 8) |
+            std::uint32_t(static_cast<unsigned char>(data[i + 2]));
+        ret.push_back(table[(v >> 18) & 0x3f]);
+        ret.push_back(table[(v >> 12) & 0x3f]);
+        ret.push_back(table[(v >> 6) & 0x3f]);
+        ret.push_back(table[v & 0x3f]);
+    }
+    if (i != data.size()) {
+        auto v = std::uint32_t(static_cast<unsigned char>(data[i])) << 16;
+        if (i + 1 != data.size()) v |= std::uint32_t(static_cast<unsigned char>(data[i + 1])) << 8;
+        ret.push_back(table[(v >> 18) & 0x3f]);
+        ret.push_back(table[(v >> 12) & 0x3f]);
+        ret.push_back(i + 1 != data.size() ? table[(v >> 6) & 0x3f] : '=');
+        ret.push_back('=');
+    }
+    return ret;
+}
+
+inline std::string hdr_log_base64_decode(std::string const& text) {
+    std::string ret;
+    std::uint32_t v = 0;
+    int bits = 0;
+    for (auto c : text) {
+        int d;
+        if (c >= 'A' && c <= 'Z') d = c - 'A';
+        else if (c >= 'a' && c <= 'z') d = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') d = c - '0' + 52;
+        else if (c == '+') d = 62;
+        else if (c == '/') d = 63;
+        else if (c == '=') break;
+        else throw std::runtime_error("hdr_log: invalid base64 character");
+        v = (v << 6) | static_cast<std::uint32_t>(d);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            ret.push_back(static_cast<char>((v >> bits) & 0xff));
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Write the header of the log.
+ * @param start_time the start time (seconds since epoch)
+ */
+inline void hdr_log_write_header(std::ostream& o, double start_time) {
+    o << "#[Histogram log format version 1.3]\n";
+    o << boost::format("#[StartTime: %.3f (seconds since epoch)]\n") % start_time;
+    o << "\"StartTimestamp\",\"Interval_Length\",\"Interval_Max\",\"Interval_Compressed_Histogram\"\n";
+}
+
+/**
+ * @brief Write an interval histogram to the log.
+ * @param tag the tag of the histogram. empty means no tag
+ * @param start the start time of the interval (seconds from StartTime of the header)
+ * @param length the length of the interval (seconds)
+ * @param max_unit_ratio Interval_Max is the max value divided by the ratio
+ */
+inline void hdr_log_write_interval(
+    std::ostream& o,
+    std::string const& tag,
+    double start,
+    double length,
+    hdr_histogram const& h,
+    double max_unit_ratio = 1.0) {
+    if (!tag.empty()) o << "Tag=" << tag << ',';
+    o << boost::format("%.3f,%.3f,%.3f,") % start % length % (static_cast<double>(h.max()) / max_unit_ratio)
+      << hdr_log_base64_encode(h.encode_compressed()) << '\n';
+}
+
+/**
+ * @brief Read the interval histograms of the log.
+ * @param f called with tag, start, length, and the histogram of each interval
+ * @exception std::runtime_error the log is not supported
+ */
+inline void hdr_log_read(
+    std::istream& i,
+    std::function<void(std::string const&, double, double, hdr_histogram)> const& f) {
+    std::string line;
+    while (std::getline(i, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#' || line[0] == '"') continue;
+        std::string tag;
+        if (line.compare(0, 4, "Tag=") == 0) {
+            auto pos = line.find(',');
+            if (pos == std::string::npos) throw std::runtime_error("hdr_log: invalid line:" + line);
+            tag = line.substr(4, pos - 4);
+            line.erase(0, pos + 1);
+        }
+        std::istringstream is(line);
+        std::string start;
+        std::string length;
+        std::string max;
+        std::string hist;
+        if (!std::getline(is, start, ',') ||
+            !std::getline(is, length, ',') ||
+            !std::getline(is, max, ',') ||
+            !std::getline(is, hist)) {
+            throw std::runtime_error("hdr_log: invalid line:" + line);
+        }
+        f(tag, std::stod(start), std::stod(length), hdr_histogram::decode_compressed(hdr_log_base64_decode(hist)));
+    }
+}
+
+#endif // MQTT_HDR_HISTOGRAM_HPP
@@ -0,0 +1,420 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_APPEND_LOG_HPP)
+#define MQTT_APPEND_LOG_HPP
+
+#include <mqtt/config.hpp>
+
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#else  // defined(_WIN32)
+#include <sys/types.h>
+#include <unistd.h>
+#endif // defined(_WIN32)
+
+#include <boost/crc.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <mqtt/namespace.hpp>
+#include <mqtt/buffer.hpp>
+#include <mqtt/string_view.hpp>
+#include <mqtt/move.hpp>
+
+namespace MQTT_NS {
+
+/**
+ * @brief Sync policy of append_log
+ */
+struct append_log_sync_policy {
+    /// sync when the unsynced bytes reach this size. 0 means sync on each append.
+    std::size_t bytes = 1024 * 1024;
+    /// sync on append when this duration has elapsed since the last sync.
+    std::chrono::steady_clock::duration interval = std::chrono::milliseconds(100);
+};
+
+/**
+ * @brief Append only record log file.
+ *
+ * Each record is framed as follows:
+ *   payload length (4 bytes, big endian) | type (1 byte) | payload | crc32 of type and payload (4 bytes, big endian)
+ * A torn record at the end of the file (e.g. power loss while writing) fails the length or crc check,
+ * and replay() stops there. A length that exceeds the rest of the file is treated as broken before
+ * the payload is allocated.
+ *
+ * Records are written to the stdio buffer. append() doesn't sync them, so the caller decides
+ * where the cost of fsync is paid. sync_due() tells when the unsynced bytes or the elapsed
+ * time since the last sync exceed sync_policy. Call sync() then, or periodically from a timer.
+ *
+ * Each record is identified by its offset in the file. The users can keep the offsets
+ * instead of the payloads and read() the records again when they are needed.
+ */
+class append_log {
+public:
+    using sync_policy = append_log_sync_policy;
+
+    /**
+     * @brief Open the log file. If the file doesn't exist, then create it.
+     * @param path   file path
+     * @param policy sync policy
+     */
+    explicit append_log(std::string path, sync_policy policy = sync_policy())
+        : path_(force_move(path)),
+          policy_(force_move(policy))
+    {
+        open();
+    }
+
+    append_log(append_log const&) = delete;
+    append_log& operator=(append_log const&) = delete;
+
+    ~append_log() {
+        if (rfp_) std::fclose(rfp_);
+        if (fp_) {
+            sync_impl(fp_);
+            std::fclose(fp_);
+        }
+    }
+
+    /**
+     * @brief Call f for each valid record from the beginning of the file.
+     * @param f void(std::uint8_t type, buffer payload) or
+     *          void(std::uint8_t type, buffer payload, std::size_t offset).
+     *          payload holds its own lifetime. offset is the offset of the record that read() accepts.
+     * @return true if all records are valid, false if a broken record is found.
+     *         The broken record and the following records are ignored.
+     */
+    template <typename F>
+    bool replay(F&& f) {
+        std::fflush(fp_);
+        std::FILE* fp = std::fopen(path_.c_str(), "rb");
+        if (!fp) throw_error("append_log open for replay");
+        std::fseek(fp, 0, SEEK_END);
+        auto remaining = tell(fp);
+        std::fseek(fp, 0, SEEK_SET);
+
+        bool ret = true;
+        std::size_t offset = 0;
+        char header[header_size];
+        while (true) {
+            auto read = std::fread(header, 1, header_size, fp);
+            if (read == 0) break;
+            if (read != header_size) {
+                ret = false;
+                break;
+            }
+            remaining -= header_size;
+            auto len = static_cast<std::size_t>(get_uint32(header));
+            if (len + trailer_size > remaining) {
+                ret = false;
+                break;
+            }
+            remaining -= len + trailer_size;
+            auto spa = make_shared_ptr_array(len + trailer_size);
+            if (std::fread(spa.get(), 1, len + trailer_size, fp) != len + trailer_size) {
+                ret = false;
+                break;
+            }
+            boost::crc_32_type crc;
+            crc.process_bytes(header + 4, 1);
+            crc.process_bytes(spa.get(), len);
+            if (crc.checksum() != get_uint32(spa.get() + len)) {
+                ret = false;
+                break;
+            }
+            auto ptr = spa.get();
+            call_replay_handler(
+                f,
+                static_cast<std::uint8_t>(header[4]),
+                buffer(string_view(ptr, len), force_move(spa)),
+                offset
+            );
+            offset += header_size + len + trailer_size;
+        }
+        std::fclose(fp);
+        return ret;
+    }
+
+    /**
+     * @brief Append a record. The record is not synced. See sync_due().
+     *        If the record can't be written completely, the log is truncated to the end of the
+     *        previous record, and an exception is thrown.
+     * @param type    record type
+     * @param payload record payload
+     * @return offset of the record
+     */
+    std::size_t append(std::uint8_t type, string_view payload) {
+        auto offset = size_;
+        auto record_size = header_size + payload.size() + trailer_size;
+        unflushed_ = true;
+        if (!write_record(fp_, type, payload)) {
+            auto ec = errno;
+            truncate_to_size();
+            errno = ec;
+            throw_error("append_log write");
+        }
+        size_ += record_size;
+        unsynced_ += record_size;
+        return offset;
+    }
+
+    /**
+     * @brief Check the appended records should be synced according to the sync policy.
+     * @return true if the unsynced bytes or the elapsed time since the last sync exceed the policy.
+     */
+    bool sync_due() const {
+        return
+            unsynced_ != 0 &&
+            (unsynced_ >= policy_.bytes ||
+             std::chrono::steady_clock::now() - last_sync_ >= policy_.interval);
+    }
+
+    /**
+     * @brief Read the record at the offset.
+     *        The appended records that are not flushed yet are flushed first.
+     * @param offset offset returned by append(), rewrite(), or passed by replay()
+     * @return type and payload of the record. payload holds its own lifetime.
+     */
+    std::pair<std::uint8_t, buffer> read(std::size_t offset) const {
+        if (unflushed_) {
+            if (std::fflush(fp_) != 0) throw_error("append_log flush");
+            unflushed_ = false;
+        }
+        if (!rfp_) {
+            rfp_ = std::fopen(path_.c_str(), "rb");
+            if (!rfp_) throw_error("append_log open for read");
+        }
+        char header[header_size];
+        if (!seek(rfp_, offset) ||
+            std::fread(header, 1, header_size, rfp_) != header_size) {
+            throw_error("append_log read");
+        }
+        auto len = static_cast<std::size_t>(get_uint32(header));
+        if (offset + header_size + len + trailer_size > size_) throw_broken_record();
+        auto spa = make_shared_ptr_array(len + trailer_size);
+        if (std::fread(spa.get(), 1, len + trailer_size, rfp_) != len + trailer_size) {
+            throw_error("append_log read");
+        }
+        boost::crc_32_type crc;
+        crc.process_bytes(header + 4, 1);
+        crc.process_bytes(spa.get(), len);
+        if (crc.checksum() != get_uint32(spa.get() + len)) throw_broken_record();
+        auto ptr = spa.get();
+        return { static_cast<std::uint8_t>(header[4]), buffer(string_view(ptr, len), force_move(spa)) };
+    }
+
+    /**
+     * @brief Flush the written records and sync them to the storage.
+     */
+    void sync() {
+        if (unsynced_ == 0) return;
+        sync_impl(fp_);
+        unsynced_ = 0;
+        unflushed_ = false;
+        last_sync_ = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * @brief Replace the whole log with the records written by f.
+     *        The new log is written to a temporary file, synced, and then renamed,
+     *        so either the old or the new log survives a crash.
+     *        f can read() the records of the old log. Their offsets are invalidated after the rewrite.
+     * @param f void(F2 append) where append is std::size_t(std::uint8_t type, string_view payload).
+     *          append returns the offset of the record in the new log.
+     */
+    template <typename F>
+    void rewrite(F&& f) {
+        auto tmp_path = path_ + ".tmp";
+        std::FILE* fp = std::fopen(tmp_path.c_str(), "wb");
+        if (!fp) throw_error("append_log open for rewrite");
+        std::size_t size = 0;
+        std::forward<F>(f)(
+            [&](std::uint8_t type, string_view payload) {
+                auto offset = size;
+                if (!write_record(fp, type, payload)) throw_error("append_log write");
+                size += header_size + payload.size() + trailer_size;
+                return offset;
+            }
+        );
+        sync_impl(fp);
+        std::fclose(fp);
+
+        if (rfp_) {
+            std::fclose(rfp_);
+            rfp_ = nullptr;
+        }
+        std::fclose(fp_);
+        fp_ = nullptr;
+#if defined(_WIN32)
+        // rename() on Windows fails if the destination exists
+        std::remove(path_.c_str());
+#endif // defined(_WIN32)
+        if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) throw_error("append_log rename");
+        open();
+        BOOST_ASSERT(size_ == size);
+    }
+
+    /**
+     * @brief Get the size of the log
+     * @return size in bytes
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    std::string const& path() const {
+        return path_;
+    }
+
+private:
+    static constexpr std::size_t header_size = 5;
+    static constexpr std::size_t trailer_size = 4;
+
+    void open() {
+        fp_ = std::fopen(path_.c_str(), "ab");
+        if (!fp_) throw_error("append_log open");
+        std::fseek(fp_, 0, SEEK_END);
+        size_ = tell(fp_);
+        unsynced_ = 0;
+        unflushed_ = false;
+        last_sync_ = std::chrono::steady_clock::now();
+    }
+
+    template <typename F>
+    static auto call_replay_handler(F& f, std::uint8_t type, buffer payload, std::size_t offset)
+        -> decltype(f(type, force_move(payload), offset), void()) {
+        f(type, force_move(payload), offset);
+    }
+
+    template <typename F>
+    static auto call_replay_handler(F& f, std::uint8_t type, buffer payload, std::size_t)
+        -> decltype(f(type, force_move(payload)), void()) {
+        f(type, force_move(payload));
+    }
+
+    /**
+     * @brief Remove the partially written record after the end of the last complete record.
+     */
+    void truncate_to_size() {
+        if (rfp_) {
+            std::fclose(rfp_);
+            rfp_ = nullptr;
+        }
+        // The rest of the record can be left in the stdio buffer, so close the file first.
+        std::fclose(fp_);
+        fp_ = nullptr;
+#if defined(_WIN32)
+        int fd = -1;
+        if (::_sopen_s(&fd, path_.c_str(), _O_WRONLY | _O_BINARY, _SH_DENYNO, _S_IWRITE) == 0) {
+            ::_chsize_s(fd, static_cast<__int64>(size_));
+            ::_close(fd);
+        }
+#else  // defined(_WIN32)
+        ::truncate(path_.c_str(), static_cast<off_t>(size_));
+#endif // defined(_WIN32)
+        // If the truncation failed, the offsets of the following records still match the file.
+        auto unsynced = unsynced_;
+        open();
+        unsynced_ = unsynced;
+    }
+
+    static bool seek(std::FILE* fp, std::size_t offset) {
+#if defined(_WIN32)
+        return ::_fseeki64(fp, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else  // defined(_WIN32)
+        return ::fseeko(fp, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif // defined(_WIN32)
+    }
+
+    static std::size_t tell(std::FILE* fp) {
+#if defined(_WIN32)
+        return static_cast<std::size_t>(::_ftelli64(fp));
+#else  // defined(_WIN32)
+        return static_cast<std::size_t>(::ftello(fp));
+#endif // defined(_WIN32)
+    }
+
+    /**
+     * @brief Write a record to the stdio buffer of fp.
+     * @return true if the whole record is written.
+     */
+    static bool write_record(std::FILE* fp, std::uint8_t type, string_view payload) {
+        char header[header_size];
+        put_uint32(header, static_cast<std::uint32_t>(payload.size()));
+        header[4] = static_cast<char>(type);
+        boost::crc_32_type crc;
+        crc.process_bytes(header + 4, 1);
+        crc.process_bytes(payload.data(), payload.size());
+        char trailer[trailer_size];
+        put_uint32(trailer, static_cast<std::uint32_t>(crc.checksum()));
+        return
+            std::fwrite(header, 1, header_size, fp) == header_size &&
+            std::fwrite(payload.data(), 1, payload.size(), fp) == payload.size() &&
+            std::fwrite(trailer, 1, trailer_size, fp) == trailer_size;
+    }
+
+    static void sync_impl(std::FILE* fp) {
+        if (std::fflush(fp) != 0) throw_error("append_log flush");
+#if defined(_WIN32)
+        if (::_commit(::_fileno(fp)) != 0) throw_error("append_log sync");
+#else  // defined(_WIN32)
+        if (::fsync(::fileno(fp)) != 0) throw_error("append_log sync");
+#endif // defined(_WIN32)
+    }
+
+    static void put_uint32(char* p, std::uint32_t v) {
+        p[0] = static_cast<char>(v >> 24);
+        p[1] = static_cast<char>(v >> 16);
+        p[2] = static_cast<char>(v >> 8);
+        p[3] = static_cast<char>(v);
+    }
+
+    static std::uint32_t get_uint32(char const* p) {
+        return
+            static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[0])) << 24 |
+            static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[1])) << 16 |
+            static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[2])) << 8 |
+            static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[3]));
+    }
+
+    [[noreturn]] static void throw_error(char const* what) {
+        throw boost::system::system_error(
+            boost::system::error_code(errno, boost::system::generic_category()),
+            what
+        );
+    }
+
+    [[noreturn]] static void throw_broken_record() {
+        throw boost::system::system_error(
+            boost::system::errc::make_error_code(boost::system::errc::io_error),
+            "append_log broken record"
+        );
+    }
+
+    std::string path_;
+    sync_policy policy_;
+    std::FILE* fp_ = nullptr;
+    mutable std::FILE* rfp_ = nullptr; ///< opened by read()
+    mutable bool unflushed_ = false;
+    std::size_t size_ = 0;
+    std::size_t unsynced_ = 0;
+    std::chrono::steady_clock::time_point last_sync_;
+};
+
+} // namespace MQTT_NS
+
+#endif // MQTT_APPEND_LOG_HPP
@@ -0,0 +1,690 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BINARY_LOG_HPP)
+#define MQTT_BINARY_LOG_HPP
+
+// Asynchronous binary logging backend for MQTT_LOG.
+//
+// MQTT_BINARY_LOG(chan, sev) << ... copies the streamed values as raw binary arguments into
+// a record on the stack, and pushes the record into the ring buffer of the calling thread.
+// String literals are recorded as pointers, and strings are copied. Nothing is formatted and
+// nothing is allocated on the calling thread except for the values of the types that are not
+// listed in record::operator<<, which are formatted into the record in place.
+// A char const array can't be told apart from a string literal by its type, so it is also
+// recorded as a pointer. Stream only string literals and arrays with static storage duration
+// that way, and wrap other char const arrays in string_view to copy them.
+// A background thread pops the records, formats them, and passes the lines to the sink.
+//
+// Define MQTT_USE_BINARY_LOG to use it as MQTT_LOG. See log.hpp.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <boost/current_function.hpp>
+
+#include <mqtt/namespace.hpp>
+#include <mqtt/log.hpp>
+#include <mqtt/move.hpp>
+#include <mqtt/string_view.hpp>
+
+// The maximum size of a record. Longer messages are truncated.
+#if !defined(MQTT_BINARY_LOG_RECORD_SIZE)
+#define MQTT_BINARY_LOG_RECORD_SIZE 512
+#endif // !defined(MQTT_BINARY_LOG_RECORD_SIZE)
+
+// The size of the ring buffer of each thread. It must be a power of two.
+// The records are dropped while the ring buffer is full.
+#if !defined(MQTT_BINARY_LOG_RING_SIZE)
+#define MQTT_BINARY_LOG_RING_SIZE (256 * 1024)
+#endif // !defined(MQTT_BINARY_LOG_RING_SIZE)
+
+namespace MQTT_NS {
+
+namespace binary_log {
+
+/**
+ * @brief Static information of a MQTT_BINARY_LOG call site.
+ *        The address of the site is recorded instead of the strings.
+ */
+struct site {
+    site(char const* chan, severity_level s, char const* f, unsigned int l, char const* func)
+        :channel(chan), sev(s), file(f), line(l), function(func) {}
+
+    char const* channel;
+    severity_level sev;
+    char const* file;
+    unsigned int line;
+    char const* function;
+
+    // (generation << 1) | enabled. See enabled().
+    mutable std::atomic<unsigned int> state { 0 };
+};
+
+struct address_value {
+    void const* address;
+};
+
+inline address_value add_address(void const* address) {
+    return { address };
+}
+
+namespace detail {
+
+enum class arg_type : std::uint8_t {
+    literal,     ///< char const* to a string literal
+    string,      ///< std::uint16_t length and characters
+    signed_int,  ///< std::int64_t
+    unsigned_int,///< std::uint64_t
+    floating,    ///< double
+    boolean,     ///< bool
+    character,   ///< char
+    pointer,     ///< void const*
+    manipulator  ///< std::ios_base& (*)(std::ios_base&)
+};
+
+using manipulator_t = std::ios_base& (*)(std::ios_base&);
+
+// Header of each entry in the ring buffer
+struct entry_header {
+    std::uint32_t stride;       ///< bytes to the next entry
+    std::uint32_t payload_size; ///< 0 means padding to the end of the buffer
+};
+
+// Fixed part of the payload. The arguments follow it.
+struct record_header {
+    site const* s;
+    std::int64_t time;          ///< system_clock ticks since epoch
+    void const* address;
+    bool truncated;
+};
+
+/**
+ * @brief Single producer single consumer ring buffer of records.
+ *        The producer is the thread that owns it, and the consumer is the formatting thread.
+ */
+class ring {
+public:
+    static constexpr std::size_t capacity = MQTT_BINARY_LOG_RING_SIZE;
+    static_assert((capacity & (capacity - 1)) == 0, "MQTT_BINARY_LOG_RING_SIZE must be a power of two");
+
+    explicit ring(std::size_t id)
+        :id_(id), buf_(new char[capacity]) {}
+
+    std::size_t id() const {
+        return id_;
+    }
+
+    // producer
+    bool push(char const* payload, std::size_t size) {
+        auto stride = (sizeof(entry_header) + size + 7) & ~std::size_t(7);
+        auto head = head_.load(std::memory_order_relaxed);
+        auto pos = static_cast<std::size_t>(head & (capacity - 1));
+        auto contiguous = capacity - pos;
+        auto required = stride <= contiguous ? stride : contiguous + stride;
+        if (required > capacity - (head - cached_tail_)) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (required > capacity - (head - cached_tail_)) return false;
+        }
+        if (stride > contiguous) {
+            // pos and capacity are multiples of 8, so the header fits
+            write_header(pos, static_cast<std::uint32_t>(contiguous), 0);
+            head += contiguous;
+            pos = 0;
+        }
+        write_header(pos, static_cast<std::uint32_t>(stride), static_cast<std::uint32_t>(size));
+        std::memcpy(buf_.get() + pos + sizeof(entry_header), payload, size);
+        head_.store(head + stride, std::memory_order_release);
+        return true;
+    }
+
+    // consumer
+    template <typename Func>
+    void consume(Func&& f) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto head = head_.load(std::memory_order_acquire);
+        while (tail != head) {
+            auto pos = static_cast<std::size_t>(tail & (capacity - 1));
+            entry_header h;
+            std::memcpy(&h, buf_.get() + pos, sizeof(h));
+            if (h.payload_size != 0) {
+                f(buf_.get() + pos + sizeof(entry_header), std::size_t(h.payload_size));
+            }
+            tail += h.stride;
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+
+    std::atomic<bool> retired { false };
+
+private:
+    void write_header(std::size_t pos, std::uint32_t stride, std::uint32_t payload_size) {
+        entry_header h { stride, payload_size };
+        std::memcpy(buf_.get() + pos, &h, sizeof(h));
+    }
+
+    std::size_t id_;
+    std::unique_ptr<char[]> buf_;
+    // The paddings keep the indexes written by the producer and by the consumer
+    // on different cache lines.
+    char padding0_[64];
+    std::atomic<std::uint64_t> head_ { 0 };
+    std::uint64_t cached_tail_ = 0;
+    char padding1_[64];
+    std::atomic<std::uint64_t> tail_ { 0 };
+};
+
+class core {
+public:
+    ~core() {
+        stop();
+    }
+
+    bool enabled(site const& s) {
+        auto gen = generation_.load(std::memory_order_acquire);
+        auto st = s.state.load(std::memory_order_relaxed);
+        if ((st >> 1) == gen) return st & 1;
+        bool e = false;
+        {
+            std::lock_guard<std::mutex> g(mtx_config_);
+            auto it = threshold_.find(s.channel);
+            e = it != threshold_.end() && s.sev >= it->second;
+        }
+        s.state.store((gen << 1) | (e ? 1 : 0), std::memory_order_relaxed);
+        return e;
+    }
+
+    void set_threshold(std::map<std::string, severity_level> threshold) {
+        std::lock_guard<std::mutex> g(mtx_config_);
+        threshold_ = decltype(threshold_)(threshold.begin(), threshold.end());
+        generation_.fetch_add(1, std::memory_order_release);
+    }
+
+    void push(char const* payload, std::size_t size) {
+        struct holder {
+            ~holder() {
+                if (r) r->retired.store(true, std::memory_order_release);
+            }
+            std::shared_ptr<ring> r;
+        };
+        thread_local holder h;
+        if (!h.r) h.r = add_ring();
+        if (!h.r->push(payload, size)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    void start(std::function<void(string_view)> sink) {
+        std::lock_guard<std::mutex> g(mtx_thread_);
+        {
+            std::lock_guard<std::mutex> gc(mtx_consume_);
+            sink_ = force_move(sink);
+        }
+        if (th_.joinable()) return;
+        running_ = true;
+        th_ = std::thread(
+            [this] {
+                std::unique_lock<std::mutex> lk(mtx_thread_);
+                while (running_) {
+                    lk.unlock();
+                    flush();
+                    lk.lock();
+                    // The producers never notify, so poll.
+                    cv_.wait_for(lk, std::chrono::milliseconds(1));
+                }
+            }
+        );
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> g(mtx_thread_);
+            if (!th_.joinable()) return;
+            running_ = false;
+        }
+        cv_.notify_all();
+        th_.join();
+        flush();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> gc(mtx_consume_);
+        std::vector<std::shared_ptr<ring>> rings;
+        {
+            std::lock_guard<std::mutex> g(mtx_rings_);
+            rings = rings_;
+        }
+        for (auto const& r : rings) {
+            // Check retired before the last consume, so that no record is pushed after it.
+            bool retired = r->retired.load(std::memory_order_acquire);
+            r->consume(
+                [&](char const* payload, std::size_t size) {
+                    format(r->id(), payload, size);
+                }
+            );
+            if (retired) {
+                std::lock_guard<std::mutex> g(mtx_rings_);
+                rings_.erase(std::remove(rings_.begin(), rings_.end(), r), rings_.end());
+            }
+        }
+        if (!sink_) std::clog.flush();
+    }
+
+private:
+    std::shared_ptr<ring> add_ring() {
+        std::lock_guard<std::mutex> g(mtx_rings_);
+        auto r = std::make_shared<ring>(next_ring_id_++);
+        rings_.push_back(r);
+        return r;
+    }
+
+    template <typename T>
+    static T read(char const*& p) {
+        T v;
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+
+    // called under mtx_consume_
+    void format(std::size_t thread_id, char const* payload, std::size_t size) {
+        auto end = payload + size;
+        auto h = read<record_header>(payload);
+
+        os_.str(std::string());
+        os_.clear();
+        os_.flags(std::ios_base::dec | std::ios_base::skipws);
+
+        auto tp = std::chrono::system_clock::time_point(std::chrono::system_clock::duration(h.time));
+        auto t = std::chrono::system_clock::to_time_t(tp);
+        if (t != last_time_) {
+            // localtime is slow, so it is called once a second
+            std::tm tm;
+#if defined(_WIN32)
+            localtime_s(&tm, &t);
+#else  // defined(_WIN32)
+            localtime_r(&t, &tm);
+#endif // defined(_WIN32)
+            char buf[16];
+            last_time_str_.assign(buf, std::strftime(buf, sizeof(buf), "%H:%M:%S", &tm));
+            last_time_ = t;
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(tp.time_since_epoch()).count() % 1000000;
+        os_ << last_time_str_ << '.' << std::setw(6) << std::setfill('0') << us << std::setfill(' ') << ' ';
+        os_ << "T:" << thread_id << ' ';
+        os_ << "S:" << std::setw(7) << std::left << h.s->sev << ' ';
+        os_ << "C:" << std::setw(5) << std::left << h.s->channel << ' ' << std::right;
+        string_view file(h.s->file);
+        auto slash = file.find_last_of("/\\");
+        if (slash != string_view::npos) file = file.substr(slash + 1);
+        os_ << file << ':' << h.s->line << ' ';
+        if (h.address) os_ << "A:" << h.address << ' ';
+
+        while (payload != end) {
+            switch (static_cast<arg_type>(read<std::uint8_t>(payload))) {
+            case arg_type::literal:
+                os_ << read<char const*>(payload);
+                break;
+            case arg_type::string: {
+                auto len = read<std::uint16_t>(payload);
+                os_.write(payload, len);
+                payload += len;
+            } break;
+            case arg_type::signed_int:
+                os_ << read<std::int64_t>(payload);
+                break;
+            case arg_type::unsigned_int:
+                os_ << read<std::uint64_t>(payload);
+                break;
+            case arg_type::floating:
+                os_ << read<double>(payload);
+                break;
+            case arg_type::boolean:
+                os_ << read<bool>(payload);
+                break;
+            case arg_type::character:
+                os_ << read<char>(payload);
+                break;
+            case arg_type::pointer:
+                os_ << read<void const*>(payload);
+                break;
+            case arg_type::manipulator:
+                os_ << read<manipulator_t>(payload);
+                break;
+            }
+        }
+        if (h.truncated) os_ << "...";
+        auto line = os_.str();
+        if (sink_) {
+            sink_(line);
+        }
+        else {
+            std::clog << line << '\n';
+        }
+    }
+
+    std::mutex mtx_config_;
+    std::map<std::string, severity_level, std::less<>> threshold_;
+    std::atomic<unsigned int> generation_ { 1 };
+
+    std::mutex mtx_rings_;
+    std::vector<std::shared_ptr<ring>> rings_;
+    std::size_t next_ring_id_ = 0;
+    std::atomic<std::uint64_t> dropped_ { 0 };
+
+    std::mutex mtx_consume_;
+    std::function<void(string_view)> sink_;
+    std::ostringstream os_;
+    std::time_t last_time_ = 0;
+    std::string last_time_str_;
+
+    std::mutex mtx_thread_;
+    std::condition_variable cv_;
+    bool running_ = false;
+    std::thread th_;
+};
+
+inline core& get_core() {
+    static core c;
+    return c;
+}
+
+// Writes the formatted value of the fallback types into the record in place
+class fixed_streambuf : public std::streambuf {
+public:
+    fixed_streambuf(char* begin, char* end) {
+        setp(begin, end);
+    }
+    std::size_t size() const {
+        return static_cast<std::size_t>(pptr() - pbase());
+    }
+    bool overflowed() const {
+        return overflowed_;
+    }
+protected:
+    int_type overflow(int_type) override {
+        overflowed_ = true;
+        return traits_type::eof();
+    }
+private:
+    bool overflowed_ = false;
+};
+
+template <typename T>
+struct is_char_pointer
+    : std::integral_constant<
+        bool,
+        std::is_same<std::decay_t<T>, char const*>::value || std::is_same<std::decay_t<T>, char*>::value
+    > {};
+
+template <typename T>
+struct is_string_like
+    : std::integral_constant<
+        bool,
+        !std::is_array<T>::value && !std::is_pointer<T>::value && std::is_convertible<T const&, string_view>::value
+    > {};
+
+template <typename T>
+struct is_raw
+    : std::integral_constant<
+        bool,
+        std::is_arithmetic<T>::value || std::is_pointer<T>::value || std::is_array<T>::value ||
+        std::is_function<T>::value || is_string_like<T>::value
+    > {};
+
+} // namespace detail
+
+/**
+ * @brief Set the threshold of each channel.
+ *        The records whose severity_level >= threshold are output.
+ *        The records of the channels that are not in threshold are not output.
+ */
+inline void set_threshold(std::map<std::string, severity_level> threshold) {
+    detail::get_core().set_threshold(force_move(threshold));
+}
+
+/**
+ * @brief Start the formatting thread.
+ * @param sink - called with each formatted line on the formatting thread.
+ *               If empty, the lines are written to std::clog.
+ */
+inline void start(std::function<void(string_view)> sink = {}) {
+    detail::get_core().start(force_move(sink));
+}
+
+/**
+ * @brief Stop the formatting thread after formatting the records pushed so far.
+ */
+inline void stop() {
+    detail::get_core().stop();
+}
+
+/**
+ * @brief Format the records pushed so far on the calling thread.
+ */
+inline void flush() {
+    detail::get_core().flush();
+}
+
+/**
+ * @brief Get the number of the records dropped because the ring buffer was full.
+ */
+inline std::uint64_t dropped() {
+    return detail::get_core().dropped();
+}
+
+/**
+ * @brief A log record that is built on the stack and pushed on destruction.
+ */
+class record {
+public:
+    explicit record(site const& s)
+        :enabled_(detail::get_core().enabled(s))
+    {
+        if (!enabled_) return;
+        detail::record_header h {
+            &s,
+            std::chrono::system_clock::now().time_since_epoch().count(),
+            nullptr,
+            false
+        };
+        std::memcpy(buf_, &h, sizeof(h));
+        size_ = sizeof(h);
+    }
+
+    record(record const&) = delete;
+    record& operator=(record const&) = delete;
+
+    ~record() {
+        if (!enabled_) return;
+        if (truncated_) {
+            bool t = true;
+            std::memcpy(buf_ + offsetof(detail::record_header, truncated), &t, sizeof(t));
+        }
+        detail::get_core().push(buf_, size_);
+    }
+
+    explicit operator bool() const {
+        return enabled_ && !done_;
+    }
+
+    void done() {
+        done_ = true;
+    }
+
+    record& operator<<(address_value v) {
+        std::memcpy(buf_ + offsetof(detail::record_header, address), &v.address, sizeof(v.address));
+        return *this;
+    }
+
+    /**
+     * @brief Record the string literal as a pointer. It is read when the record is formatted
+     *        on the background thread.
+     *        The array must have static storage duration. Wrap a char const array with
+     *        automatic or dynamic storage duration in string_view, then it is copied.
+     */
+    template <std::size_t N>
+    record& operator<<(char const (&v)[N]) {
+        return put(detail::arg_type::literal, static_cast<char const*>(v));
+    }
+
+    // not a literal, so copy it
+    template <std::size_t N>
+    record& operator<<(char (&v)[N]) {
+        return put_string(string_view(v, ::strnlen(v, N)));
+    }
+
+    template <typename T>
+    std::enable_if_t<detail::is_char_pointer<T>::value && !std::is_array<T>::value, record&>
+    operator<<(T const& v) {
+        return put_string(v ? string_view(v) : string_view("(null)"));
+    }
+
+    template <typename T>
+    std::enable_if_t<std::is_pointer<T>::value && !detail::is_char_pointer<T>::value, record&>
+    operator<<(T const& v) {
+        return put(detail::arg_type::pointer, static_cast<void const*>(v));
+    }
+
+    template <typename T>
+    std::enable_if_t<detail::is_string_like<T>::value, record&>
+    operator<<(T const& v) {
+        return put_string(string_view(v));
+    }
+
+    template <typename T>
+    std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value, record&>
+    operator<<(T v) {
+        return put(detail::arg_type::signed_int, static_cast<std::int64_t>(v));
+    }
+
+    template <typename T>
+    std::enable_if_t<std::is_integral<T>::value && !std::is_signed<T>::value, record&>
+    operator<<(T v) {
+        return put(detail::arg_type::unsigned_int, static_cast<std::uint64_t>(v));
+    }
+
+    template <typename T>
+    std::enable_if_t<std::is_floating_point<T>::value, record&>
+    operator<<(T v) {
+        return put(detail::arg_type::floating, static_cast<double>(v));
+    }
+
+    record& operator<<(bool v) {
+        return put(detail::arg_type::boolean, v);
+    }
+
+    record& operator<<(char v) {
+        return put(detail::arg_type::character, v);
+    }
+
+    record& operator<<(detail::manipulator_t v) {
+        return put(detail::arg_type::manipulator, v);
+    }
+
+    /**
+     * @brief Other types are formatted by their operator<< into the record in place.
+     */
+    template <typename T>
+    std::enable_if_t<!detail::is_raw<T>::value, record&>
+    operator<<(T const& v) {
+        auto header = sizeof(std::uint8_t) + sizeof(std::uint16_t);
+        if (truncated_ || size_ + header >= sizeof(buf_)) {
+            truncated_ = true;
+            return *this;
+        }
+        detail::fixed_streambuf sb(buf_ + size_ + header, buf_ + sizeof(buf_));
+        std::ostream os(&sb);
+        os << v;
+        if (sb.overflowed()) truncated_ = true;
+        auto type = static_cast<std::uint8_t>(detail::arg_type::string);
+        auto len = static_cast<std::uint16_t>(sb.size());
+        std::memcpy(buf_ + size_, &type, sizeof(type));
+        std::memcpy(buf_ + size_ + sizeof(type), &len, sizeof(len));
+        size_ += header + len;
+        return *this;
+    }
+
+private:
+    template <typename T>
+    record& put(detail::arg_type type, T const& v) {
+        if (truncated_ || size_ + sizeof(std::uint8_t) + sizeof(T) > sizeof(buf_)) {
+            truncated_ = true;
+            return *this;
+        }
+        buf_[size_] = static_cast<char>(type);
+        std::memcpy(buf_ + size_ + sizeof(std::uint8_t), &v, sizeof(T));
+        size_ += sizeof(std::uint8_t) + sizeof(T);
+        return *this;
+    }
+
+    record& put_string(string_view v) {
+        auto header = sizeof(std::uint8_t) + sizeof(std::uint16_t);
+        if (truncated_ || size_ + header >= sizeof(buf_)) {
+            truncated_ = true;
+            return *this;
+        }
+        auto len = std::min(v.size(), sizeof(buf_) - size_ - header);
+        if (len != v.size()) truncated_ = true;
+        auto type = static_cast<std::uint8_t>(detail::arg_type::string);
+        auto len16 = static_cast<std::uint16_t>(len);
+        std::memcpy(buf_ + size_, &type, sizeof(type));
+        std::memcpy(buf_ + size_ + sizeof(type), &len16, sizeof(len16));
+        std::memcpy(buf_ + size_ + header, v.data(), len);
+        size_ += header + len;
+        return *this;
+    }
+
+    bool enabled_;
+    bool done_ = false;
+    bool truncated_ = false;
+    std::size_t size_ = 0;
+    char buf_[MQTT_BINARY_LOG_RECORD_SIZE];
+};
+
+} // namespace binary_log
+
+} // namespace MQTT_NS
+
+// The static site is created in a lambda, and BOOST_CURRENT_FUNCTION is passed from the
+// enclosing function. All commas are in parentheses, so the macro can be passed to BOOST_PP_IF.
+#define MQTT_BINARY_LOG(chan, sev)                                      \
+    for (MQTT_NS::binary_log::record mqtt_binary_log_record(            \
+             [](char const* mqtt_binary_log_function) -> MQTT_NS::binary_log::site const& { \
+                 static MQTT_NS::binary_log::site s(                    \
+                     (chan), (MQTT_NS::severity_level::sev), (__FILE__), (__LINE__), (mqtt_binary_log_function) \
+                 );                                                     \
+                 return s;                                              \
+             } (BOOST_CURRENT_FUNCTION)                                 \
+         );                                                             \
+         mqtt_binary_log_record;                                        \
+         mqtt_binary_log_record.done())                                 \
+        mqtt_binary_log_record
+
+#define MQTT_BINARY_ADD_VALUE(name, val) MQTT_NS::binary_log::BOOST_PP_CAT(add_, name)(val)
+
+#endif // MQTT_BINARY_LOG_HPP
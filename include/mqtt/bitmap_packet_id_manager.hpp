@@ -0,0 +1,425 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BITMAP_PACKET_ID_MANAGER_HPP)
+#define MQTT_BITMAP_PACKET_ID_MANAGER_HPP
+
+#include <mqtt/config.hpp> // should be top to configure variant limit
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <utility>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif // defined(_MSC_VER)
+
+#include <mqtt/namespace.hpp>
+#include <mqtt/optional.hpp>
+#include <mqtt/move.hpp>
+
+namespace MQTT_NS {
+
+namespace detail {
+
+/**
+ * @brief Get the index of the lowest set bit.
+ * @param v value. It must not be 0.
+ * @return index of the lowest set bit
+ */
+inline std::size_t count_trailing_zeros(std::uint64_t v) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return idx;
+#elif defined(__GNUC__) || defined(__clang__)
+    return static_cast<std::size_t>(__builtin_ctzll(v));
+#else
+    std::size_t n = 0;
+    while ((v & 1) == 0) {
+        v >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/**
+ * @brief 65536 bits set that finds the first zero bit in constant time.
+ *
+ * words_ holds the bits. summary_ has one bit per word that is set when the word is full.
+ * So finding the first zero bit is a scan of 16 summary words and two count_trailing_zeros.
+ */
+class bitmap16 {
+public:
+    static constexpr std::size_t size = 0x10000;
+
+    bool test(std::uint16_t v) const {
+        return (words_[v / word_bits] & bit(v)) != 0;
+    }
+
+    /**
+     * @brief Set the bit
+     * @param v bit index
+     * @return true if the bit was changed from 0 to 1
+     */
+    bool set(std::uint16_t v) {
+        auto& w = words_[v / word_bits];
+        if (w & bit(v)) return false;
+        w |= bit(v);
+        if (w == all_set) summary_[v / (word_bits * word_bits)] |= bit(v / word_bits);
+        ++count_;
+        return true;
+    }
+
+    /**
+     * @brief Reset the bit
+     * @param v bit index
+     * @return true if the bit was changed from 1 to 0
+     */
+    bool reset(std::uint16_t v) {
+        auto& w = words_[v / word_bits];
+        if (!(w & bit(v))) return false;
+        w &= ~bit(v);
+        summary_[v / (word_bits * word_bits)] &= ~bit(v / word_bits);
+        --count_;
+        return true;
+    }
+
+    /**
+     * @brief Find the lowest zero bit
+     * @return bit index. nullopt if all bits are set.
+     */
+    optional<std::uint16_t> find_first_zero() const {
+        for (std::size_t s = 0; s != summary_.size(); ++s) {
+            if (summary_[s] != all_set) {
+                auto wi = s * word_bits + count_trailing_zeros(~summary_[s]);
+                return static_cast<std::uint16_t>(wi * word_bits + count_trailing_zeros(~words_[wi]));
+            }
+        }
+        return nullopt;
+    }
+
+    std::size_t count() const {
+        return count_;
+    }
+
+    bool full() const {
+        return count_ == size;
+    }
+
+    void clear() {
+        words_.fill(0);
+        summary_.fill(0);
+        count_ = 0;
+    }
+
+private:
+    static constexpr std::size_t word_bits = 64;
+    static constexpr std::uint64_t all_set = std::numeric_limits<std::uint64_t>::max();
+
+    static std::uint64_t bit(std::size_t v) {
+        return std::uint64_t(1) << (v % word_bits);
+    }
+
+    std::array<std::uint64_t, size / word_bits> words_ {};
+    std::array<std::uint64_t, size / word_bits / word_bits> summary_ {};
+    std::size_t count_ = 0;
+};
+
+template <typename PacketId, std::size_t Bytes = sizeof(PacketId)>
+class packet_id_bitmap;
+
+// 2 bytes packet id. One bitmap16. Packet id 0 is always set.
+template <typename PacketId>
+class packet_id_bitmap<PacketId, 2> {
+public:
+    packet_id_bitmap() {
+        clear();
+    }
+
+    optional<PacketId> acquire() {
+        auto v = bits_.find_first_zero();
+        if (!v) return nullopt;
+        bits_.set(v.value());
+        return static_cast<PacketId>(v.value());
+    }
+
+    bool use(PacketId v) {
+        return bits_.set(v);
+    }
+
+    void release(PacketId v) {
+        if (v == 0) return;
+        bits_.reset(v);
+    }
+
+    void clear() {
+        bits_.clear();
+        bits_.set(0);
+    }
+
+private:
+    bitmap16 bits_;
+};
+
+// 4 bytes packet id. The upper 16 bits select a bitmap16 block that is allocated on demand,
+// and freed when it becomes empty. full_ has the bit of each full block.
+// Packet id 0 (the bit 0 of the block 0) is always set.
+template <typename PacketId>
+class packet_id_bitmap<PacketId, 4> {
+public:
+    packet_id_bitmap() {
+        clear();
+    }
+
+    optional<PacketId> acquire() {
+        auto hi = full_.find_first_zero();
+        if (!hi) return nullopt;
+        auto& b = block(hi.value());
+        auto lo = b.find_first_zero().value();
+        b.set(lo);
+        if (b.full()) full_.set(hi.value());
+        return make_id(hi.value(), lo);
+    }
+
+    bool use(PacketId v) {
+        auto hi = upper(v);
+        auto& b = block(hi);
+        if (!b.set(lower(v))) return false;
+        if (b.full()) full_.set(hi);
+        return true;
+    }
+
+    void release(PacketId v) {
+        if (v == 0) return;
+        auto hi = upper(v);
+        if (hi >= blocks_.size() || !blocks_[hi]) return;
+        if (!blocks_[hi]->reset(lower(v))) return;
+        full_.reset(hi);
+        if (blocks_[hi]->count() == 0) blocks_[hi].reset();
+    }
+
+    void clear() {
+        blocks_.clear();
+        full_.clear();
+        block(0).set(0);
+    }
+
+private:
+    static std::uint16_t upper(PacketId v) {
+        return static_cast<std::uint16_t>(v >> 16);
+    }
+
+    static std::uint16_t lower(PacketId v) {
+        return static_cast<std::uint16_t>(v & 0xffff);
+    }
+
+    static PacketId make_id(std::uint16_t hi, std::uint16_t lo) {
+        return static_cast<PacketId>((static_cast<PacketId>(hi) << 16) | lo);
+    }
+
+    bitmap16& block(std::uint16_t hi) {
+        if (hi >= blocks_.size()) blocks_.resize(std::size_t(hi) + 1);
+        auto& b = blocks_[hi];
+        if (!b) b = std::make_unique<bitmap16>();
+        return *b;
+    }
+
+    bitmap16 full_;
+    std::vector<std::unique_ptr<bitmap16>> blocks_;
+};
+
+/**
+ * @brief Set of packet ids that are chosen by the peer and released in any order.
+ *
+ * The ids are bits of 4096 bits pages. A page is allocated when the first id of it is inserted.
+ * When a page becomes empty, one page is kept as a spare, so inserting and erasing the ids of
+ * a sliding window (e.g. QoS2 PUBLISH until PUBREL) doesn't allocate memory.
+ */
+template <typename PacketId>
+class packet_id_set {
+public:
+    /**
+     * @brief Insert the id
+     * @return true if inserted, false if the id already exists
+     */
+    bool insert(PacketId v) {
+        auto& w = (*page_of(v))[word(v)];
+        if (w & bit(v)) return false;
+        w |= bit(v);
+        ++count_;
+        return true;
+    }
+
+    /**
+     * @brief Erase the id
+     * @return true if erased, false if the id doesn't exist
+     */
+    bool erase(PacketId v) {
+        auto it = find_page(v);
+        if (it == pages_.end() || it->first != page_index(v)) return false;
+        auto& w = (*it->second)[word(v)];
+        if (!(w & bit(v))) return false;
+        w &= ~bit(v);
+        --count_;
+        if (w == 0 && std::all_of(it->second->begin(), it->second->end(), [](std::uint64_t e) { return e == 0; })) {
+            if (!spare_) spare_ = force_move(it->second);
+            pages_.erase(it);
+        }
+        return true;
+    }
+
+    bool contains(PacketId v) const {
+        auto it = std::lower_bound(pages_.begin(), pages_.end(), page_index(v), page_less());
+        return it != pages_.end() && it->first == page_index(v) && ((*it->second)[word(v)] & bit(v));
+    }
+
+    std::size_t size() const {
+        return count_;
+    }
+
+    bool empty() const {
+        return count_ == 0;
+    }
+
+    void clear() {
+        if (!spare_ && !pages_.empty()) {
+            spare_ = force_move(pages_.front().second);
+            spare_->fill(0);
+        }
+        pages_.clear();
+        count_ = 0;
+    }
+
+    /**
+     * @brief Call f for each id in ascending order
+     * @param f void(PacketId)
+     */
+    template <typename F>
+    void for_each(F&& f) const {
+        for (auto const& p : pages_) {
+            for (std::size_t wi = 0; wi != p.second->size(); ++wi) {
+                auto w = (*p.second)[wi];
+                while (w != 0) {
+                    auto b = count_trailing_zeros(w);
+                    f(static_cast<PacketId>(p.first * page_bits + wi * word_bits + b));
+                    w &= w - 1;
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr std::size_t word_bits = 64;
+    static constexpr std::size_t page_bits = 4096;
+    using page = std::array<std::uint64_t, page_bits / word_bits>;
+    using pages_t = std::vector<std::pair<std::size_t, std::unique_ptr<page>>>;
+
+    static std::size_t page_index(PacketId v) {
+        return static_cast<std::size_t>(v) / page_bits;
+    }
+
+    static std::size_t word(PacketId v) {
+        return static_cast<std::size_t>(v) % page_bits / word_bits;
+    }
+
+    static std::uint64_t bit(PacketId v) {
+        return std::uint64_t(1) << (static_cast<std::size_t>(v) % word_bits);
+    }
+
+    struct page_less {
+        bool operator()(typename pages_t::value_type const& e, std::size_t idx) const {
+            return e.first < idx;
+        }
+    };
+
+    // pages_ is sorted by the page index. It has a few pages because the ids are in a window.
+    typename pages_t::iterator find_page(PacketId v) {
+        return std::lower_bound(pages_.begin(), pages_.end(), page_index(v), page_less());
+    }
+
+    // Get the page of v. If it doesn't exist, then create it.
+    page* page_of(PacketId v) {
+        auto it = find_page(v);
+        if (it != pages_.end() && it->first == page_index(v)) return it->second.get();
+        auto p = spare_ ? force_move(spare_) : std::make_unique<page>();
+        it = pages_.emplace(it, page_index(v), force_move(p));
+        return it->second.get();
+    }
+
+    pages_t pages_;
+    std::unique_ptr<page> spare_; ///< all bits are zero
+    std::size_t count_ = 0;
+};
+
+} // namespace detail
+
+/**
+ * @brief Packet id manager that uses a bitmap instead of free intervals.
+ *
+ * It has the same interface and the same allocation order (the lowest free id first) as
+ * packet_id_manager. Acquire and release are constant time and don't allocate memory
+ * regardless of the release order, at the cost of 8 KiB bitmap per 65536 ids.
+ * Select it by the PacketIdManager template parameter of endpoint.
+ */
+template <typename PacketId>
+class bitmap_packet_id_manager {
+    using packet_id_t = PacketId;
+
+public:
+
+    /**
+     * @brief Acquire the new unique packet id.
+     *        If all packet ids are already in use, then returns nullopt
+     *        After acquiring the packet id, you can call acquired_* functions.
+     *        The ownership of packet id is moved to the library.
+     *        Or you can call release_packet_id to release it.
+     * @return packet id
+     */
+    optional<packet_id_t> acquire_unique_id() {
+        return bits_.acquire();
+    }
+
+    /**
+     * @brief Register packet_id to the library.
+     *        After registering the packet_id, you can call acquired_* functions.
+     *        The ownership of packet id is moved to the library.
+     *        Or you can call release_packet_id to release it.
+     * @return If packet_id is successfully registerd then return true, otherwise return false.
+     */
+    bool register_id(packet_id_t packet_id) {
+        return bits_.use(packet_id);
+    }
+
+    /**
+     * @brief Release packet_id.
+     * @param packet_id packet id to release.
+     *                   only the packet_id gotten by acquire_unique_packet_id, or
+     *                   register_packet_id is permitted.
+     */
+    void release_id(packet_id_t packet_id) {
+        bits_.release(packet_id);
+    }
+
+    /**
+     * @brief Clear all packet ids.
+     */
+    void clear() {
+        bits_.clear();
+    }
+
+private:
+    detail::packet_id_bitmap<packet_id_t> bits_;
+};
+
+} // namespace MQTT_NS
+
+#endif // MQTT_BITMAP_PACKET_ID_MANAGER_HPP
@@ -9,6 +9,9 @@
 
 #include <mqtt/config.hpp>
 
+#include <algorithm>
+#include <array>
+#include <mutex>
 #include <set>
 
 #include <boost/lexical_cast.hpp>
@@ -17,15 +20,24 @@
 #include <mqtt/optional.hpp>
 #include <mqtt/property.hpp>
 #include <mqtt/visitor_util.hpp>
+#include <mqtt/profile.hpp>
 
 #include <mqtt/broker/session_state.hpp>
 #include <mqtt/broker/sub_con_map.hpp>
 #include <mqtt/broker/retained_messages.hpp>
 
 #include <mqtt/broker/retained_topic_map.hpp>
+#include <mqtt/broker/topic_levels.hpp>
 #include <mqtt/broker/shared_target_impl.hpp>
 #include <mqtt/broker/mutex.hpp>
 #include <mqtt/broker/uuid.hpp>
+#include <mqtt/broker/persistence.hpp>
+#include <mqtt/broker/retained_snapshot.hpp>
+#include <mqtt/broker/timer_wheel.hpp>
+#include <mqtt/broker/metrics.hpp>
+#include <mqtt/broker/session_stats.hpp>
+#include <mqtt/broker/trace_sink.hpp>
+#include <mqtt/broker/session_handle.hpp>
 
 MQTT_BROKER_NS_BEGIN
 
@@ -258,7 +270,9 @@ class broker_t {
 public:
     broker_t(as::io_context& timer_ioc)
         :timer_ioc_(timer_ioc),
-         tim_disconnect_(timer_ioc_)
+         tim_disconnect_(timer_ioc_),
+         tim_sys_publish_(timer_ioc_),
+         session_expiry_wheel_(timer_ioc_, std::chrono::milliseconds(100))
     {}
 
     // [begin] for test setting
@@ -317,22 +331,44 @@ public:
         con_wp_t wp(spep);
         endpoint_t& ep = *spep;
 
-        ep.socket().lowest_layer().set_option(as::ip::tcp::no_delay(true));
+        {
+            // Ignore the error on the transports that have no TCP socket (e.g. loopback_endpoint)
+            boost::system::error_code ec;
+            ep.socket().lowest_layer().set_option(as::ip::tcp::no_delay(true), ec);
+        }
         ep.set_auto_pub_response(false);
         ep.set_async_operation(true);
         ep.set_topic_alias_maximum(MQTT_NS::topic_alias_max);
+        ep.set_auto_map_topic_alias_send(auto_map_topic_alias_send_);
+
+        // keep alive timeout entry. It is scheduled when CONNECT is received,
+        // and touched when each packet is processed.
+        auto& kaw = keep_alive_wheel(ep.socket().get_executor());
+        auto ka = timer_wheel::make_entry(
+            [wp] {
+                con_sp_t sp = wp.lock();
+                if (!sp) return;
+                keep_alive_timeout(force_move(sp));
+            }
+        );
+
+        // handle to the session_state of this connection. It is bound when CONNECT is accepted,
+        // so that the PUBLISH and acknowledge handlers don't need to look up sessions_.
+        auto sh = std::make_shared<session_handle>();
 
         // set connection (lower than MQTT) level handlers
         ep.set_close_handler(
-            [this, wp]
+            [this, wp, &kaw, ka]
             (){
+                kaw.cancel(*ka);
                 con_sp_t sp = wp.lock();
                 BOOST_ASSERT(sp);
                 close_proc(force_move(sp), true);
             });
         ep.set_error_handler(
-            [this, wp]
+            [this, wp, &kaw, ka]
             (error_code ec){
+                kaw.cancel(*ka);
                 con_sp_t sp = wp.lock();
                 BOOST_ASSERT(sp);
                 auto ver = sp->get_protocol_version();
@@ -435,8 +471,18 @@ public:
         );
 
         // set MQTT level handlers
+        ep.set_mqtt_message_processed_handler(
+            [wp, &kaw, ka]
+            (any session_life_keeper) {
+                kaw.touch(*ka);
+                con_sp_t sp = wp.lock();
+                BOOST_ASSERT(sp);
+                // same as the default behavior. broker never stops reading by set_auto_next_read().
+                sp->async_read_next_message(force_move(session_life_keeper));
+            }
+        );
         ep.set_connect_handler(
-            [this, wp]
+            [this, wp, &kaw, ka, sh]
             (buffer client_id,
              optional<buffer> username,
              optional<buffer> password,
@@ -445,10 +491,12 @@ public:
              std::uint16_t keep_alive) {
                 con_sp_t sp = wp.lock();
                 BOOST_ASSERT(sp);
+                start_keep_alive(kaw, ka, keep_alive);
                 auto p = sp.get();
                 try {
                     return connect_handler(
                         force_move(sp),
+                        sh,
                         force_move(client_id),
                         force_move(username),
                         force_move(password),
@@ -467,7 +515,7 @@ public:
             }
         );
         ep.set_v5_connect_handler(
-            [this, wp]
+            [this, wp, &kaw, ka, sh]
             (buffer client_id,
              optional<buffer> username,
              optional<buffer> password,
@@ -477,10 +525,16 @@ public:
              v5::properties props) {
                 con_sp_t sp = wp.lock();
                 BOOST_ASSERT(sp);
+                // Server Keep Alive in CONNACK overrides the client's Keep Alive.
+                if (auto v = get_property<v5::property::server_keep_alive>(connack_props_)) {
+                    keep_alive = v.value().val();
+                }
+                start_keep_alive(kaw, ka, keep_alive);
                 auto p = sp.get();
                 try {
                     return connect_handler(
                         force_move(sp),
+                        sh,
                         force_move(client_id),
                         force_move(username),
                         force_move(password),
@@ -532,7 +586,7 @@ public:
             }
         );
         ep.set_puback_handler(
-            [this, wp]
+            [this, wp, sh]
             (packet_id_t packet_id){
                 con_sp_t sp = wp.lock();
                 BOOST_ASSERT(sp);
@@ -540,6 +594,7 @@ public:
                 try {
                     return puback_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         v5::puback_reason_code::success,
                         v5::properties{}
@@ -554,7 +609,7 @@ public:
             }
         );
         ep.set_v5_puback_handler(
-            [this, wp]
+            [this, wp, sh]
             (packet_id_t packet_id,
              v5::puback_reason_code reason_code,
              v5::properties props){
@@ -564,6 +619,7 @@ public:
                 try {
                     return puback_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         reason_code,
                         force_move(props)
@@ -578,7 +634,7 @@ public:
             }
         );
         ep.set_pubrec_handler(
-            [this, wp]
+            [this, wp, sh]
             (packet_id_t packet_id){
                 con_sp_t sp = wp.lock();
                 BOOST_ASSERT(sp);
@@ -586,6 +642,7 @@ public:
                 try {
                     return pubrec_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         v5::pubrec_reason_code::success,
                         v5::properties{}
@@ -600,7 +657,7 @@ public:
             }
         );
         ep.set_v5_pubrec_handler(
-            [this, wp]
+            [this, wp, sh]
             (packet_id_t packet_id,
              v5::pubrec_reason_code reason_code,
              v5::properties props){
@@ -610,6 +667,7 @@ public:
                 try {
                     return pubrec_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         reason_code,
                         force_move(props)
@@ -624,7 +682,7 @@ public:
             }
         );
         ep.set_pubrel_handler(
-            [this, wp]
+            [this, wp, sh]
             (packet_id_t packet_id){
                 con_sp_t sp = wp.lock();
                 BOOST_ASSERT(sp);
@@ -632,6 +690,7 @@ public:
                 try {
                     return pubrel_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         v5::pubrel_reason_code::success,
                         v5::properties{}
@@ -646,7 +705,7 @@ public:
             }
         );
         ep.set_v5_pubrel_handler(
-            [this, wp]
+            [this, wp, sh]
             (packet_id_t packet_id,
              v5::pubrel_reason_code reason_code,
              v5::properties props){
@@ -656,6 +715,7 @@ public:
                 try {
                     return pubrel_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         reason_code,
                         force_move(props)
@@ -670,7 +730,7 @@ public:
             }
         );
         ep.set_pubcomp_handler(
-            [this, wp]
+            [this, wp, sh]
             (packet_id_t packet_id){
                 con_sp_t sp = wp.lock();
                 BOOST_ASSERT(sp);
@@ -678,6 +738,7 @@ public:
                 try {
                     return pubcomp_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         v5::pubcomp_reason_code::success,
                         v5::properties{}
@@ -692,7 +753,7 @@ public:
             }
         );
         ep.set_v5_pubcomp_handler(
-            [this, wp]
+            [this, wp, sh]
             (packet_id_t packet_id,
              v5::pubcomp_reason_code reason_code,
              v5::properties props){
@@ -702,6 +763,7 @@ public:
                 try {
                     return pubcomp_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         reason_code,
                         force_move(props)
@@ -716,7 +778,7 @@ public:
             }
         );
         ep.set_publish_handler(
-            [this, wp]
+            [this, wp, sh]
             (optional<packet_id_t> packet_id,
              publish_options pubopts,
              buffer topic_name,
@@ -727,6 +789,7 @@ public:
                 try {
                     return publish_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         pubopts,
                         force_move(topic_name),
@@ -743,7 +806,7 @@ public:
             }
         );
         ep.set_v5_publish_handler(
-            [this, wp]
+            [this, wp, sh]
             (optional<packet_id_t> packet_id,
              publish_options pubopts,
              buffer topic_name,
@@ -757,6 +820,7 @@ public:
                 try {
                     return publish_handler(
                         force_move(sp),
+                        *sh,
                         packet_id,
                         pubopts,
                         force_move(topic_name),
@@ -972,17 +1036,395 @@ public:
         h_auth_props_ = force_move(h);
     }
 
+    using publish_forward_handler = std::function<
+        void(
+            buffer const& topic,
+            buffer const& contents,
+            publish_options pubopts,
+            v5::properties const& props
+        )
+    >;
+
+    /**
+     * @brief Set the handler that is called for each message published to this broker.
+     *
+     * It is called on the thread that processes the PUBLISH (or the will), before the message
+     * is delivered to the subscribers of this broker. broker_shards uses it to pass the message
+     * to the other shards.
+     *
+     * @param h - handler. The arguments are valid only during the call.
+     */
+    void set_publish_forward_handler(publish_forward_handler h) {
+        h_publish_forward_ = force_move(h);
+    }
+
+    /**
+     * @brief Publish the message that has been published to another broker.
+     *
+     * The message is delivered to the subscribers of this broker and retained if the retain
+     * flag is set, but it is not passed to the publish forward handler again.
+     * No Local is not applied because the publisher is not connected to this broker.
+     *
+     * @param topic - topic name
+     * @param contents - payload
+     * @param pubopts - qos and retain
+     * @param props - properties to forward
+     */
+    void publish_local(
+        buffer topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::properties props) {
+        do_publish_local(
+            nullptr,
+            force_move(topic),
+            force_move(contents),
+            pubopts,
+            force_move(props)
+        );
+    }
+
     void clear_all_sessions() {
         std::lock_guard<mutex> g(mtx_sessions_);
+        if (persistence_) {
+            for (auto const& ss : sessions_.get<tag_cid>()) {
+                persistence_->erase_session(ss.client_id());
+            }
+        }
         sessions_.clear();
     }
 
     void clear_all_retained_topics() {
         std::lock_guard<mutex> g(mtx_retains_);
+        if (persistence_) {
+            retains_.for_each(
+                [&](retain_t const& r) {
+                    persistence_->erase_retained(r.topic);
+                }
+            );
+        }
         retains_.clear();
     }
 
+    /**
+     * @brief Set the persistence and restore the sessions and the retained messages from it.
+     *
+     * Call this function before accepting connections.
+     * After that, persistent sessions and retained messages are recorded to the persistence.
+     * Will messages are not persisted.
+     *
+     * @param ps - persistence. nullptr stops recording.
+     */
+    void set_persistence(std::shared_ptr<persistence> ps) {
+        persistence_ = force_move(ps);
+        if (!persistence_) {
+            std::lock_guard<mutex> g(mtx_sessions_);
+            for (auto const& ss : sessions_.get<tag_cid>()) {
+                // set_persistence never modify key part
+                const_cast<session_state&>(ss).set_persistence(nullptr);
+            }
+            return;
+        }
+        restore_sessions();
+        restore_retains();
+    }
+
+    /**
+     * @brief Set the number of offline messages that are sent at once when a session is inherited.
+     *
+     * The offline messages are sent batch by batch. The next batch is sent after the last
+     * message of the previous batch is written to the socket. It prevents a client that has
+     * a lot of offline messages from occupying the broker when many clients reconnect at once.
+     *
+     * @param size - the number of messages. 0 means unlimited. The default is 64.
+     */
+    void set_offline_message_batch_size(std::size_t size) {
+        offline_message_batch_size_ = size;
+    }
+
+    /**
+     * @brief Assign topic aliases to the PUBLISH packets sent to the v5 subscribers.
+     *
+     * It applies to the connections accepted after the call. If the subscriber sets
+     * Topic Alias Maximum on CONNECT, each topic is mapped to an alias on its first delivery,
+     * and the later deliveries on the same connection send only the alias.
+     * When all aliases are used, the least recently used one is remapped.
+     *
+     * @param b - if true, assign topic aliases. The default is false.
+     */
+    void set_auto_map_topic_alias_send(bool b = true) {
+        auto_map_topic_alias_send_ = b;
+    }
+
+    /**
+     * @brief Get the counters and the histograms recorded on the publish path,
+     *        and the gauges of the sessions.
+     */
+    metrics const& get_metrics() const {
+        return metrics_;
+    }
+
+    /**
+     * @brief Publish the metrics on $SYS topics periodically.
+     *
+     * The messages are published by the broker itself with QoS0 and without retain.
+     * The topics are:
+     *   - $SYS/broker/messages/publish/received  PUBLISH packets received from clients
+     *   - $SYS/broker/messages/publish/sent      messages delivered to subscribers
+     *   - $SYS/broker/clients/total              sessions including offline ones
+     *   - $SYS/broker/clients/connected          connected sessions
+     *   - $SYS/broker/subscriptions/count        subscriptions
+     *   - $SYS/broker/retained/count             retained messages
+     *   - $SYS/broker/offline/messages           messages stored for offline sessions
+     *   - $SYS/broker/offline/bytes              topic and payload bytes of them
+     *   - $SYS/broker/inflight/messages          inflight messages stored for offline sessions
+     *   - $SYS/broker/publish/fanout/{p50,p99,max}            subscribers per PUBLISH
+     *   - $SYS/broker/publish/match_latency_ns/{p50,p99,max}  match and delivery time per PUBLISH
+     *
+     * @param interval - publish interval
+     */
+    void start_sys_publisher(std::chrono::steady_clock::duration interval) {
+        sys_publish_interval_ = interval;
+        schedule_sys_publish();
+    }
+
+    void stop_sys_publisher() {
+        sys_publish_interval_ = std::chrono::steady_clock::duration::zero();
+        tim_sys_publish_.cancel();
+    }
+
+    /**
+     * @brief Publish the metrics on $SYS topics now.
+     *        See start_sys_publisher() for the topics.
+     */
+    void publish_sys_topics() {
+        std::size_t clients = 0;
+        {
+            std::shared_lock<mutex> g(mtx_sessions_);
+            clients = sessions_.size();
+        }
+        std::size_t subscriptions = 0;
+        {
+            std::shared_lock<mutex> g(mtx_subs_map_);
+            subscriptions = subs_map_.size();
+        }
+        std::size_t retained = 0;
+        {
+            std::lock_guard<mutex> g(mtx_retains_);
+            retained = retains_.size();
+        }
+
+        auto publish =
+            [&](string_view topic, std::uint64_t value) {
+                do_publish_local(
+                    nullptr,
+                    allocate_buffer(topic),
+                    allocate_buffer(std::to_string(value)),
+                    qos::at_most_once | MQTT_NS::retain::no,
+                    v5::properties{},
+                    false
+                );
+            };
+        // The stripes are read one by one, so the sum can be negative for a moment.
+        auto gauge =
+            [&](metrics::gauge g) {
+                return static_cast<std::uint64_t>(std::max(metrics_.get(g), std::int64_t(0)));
+            };
+        auto publish_histogram =
+            [&](std::string const& prefix, histogram_snapshot const& h) {
+                publish(prefix + "/p50", h.value_at_percentile(50.0));
+                publish(prefix + "/p99", h.value_at_percentile(99.0));
+                publish(prefix + "/max", h.max());
+            };
+
+        publish("$SYS/broker/messages/publish/received", metrics_.get(metrics::counter::publish_received));
+        publish("$SYS/broker/messages/publish/sent", metrics_.get(metrics::counter::publish_sent));
+        publish("$SYS/broker/clients/total", clients);
+        publish("$SYS/broker/clients/connected", gauge(metrics::gauge::connected_clients));
+        publish("$SYS/broker/subscriptions/count", subscriptions);
+        publish("$SYS/broker/retained/count", retained);
+        publish("$SYS/broker/offline/messages", gauge(metrics::gauge::offline_messages));
+        publish("$SYS/broker/offline/bytes", gauge(metrics::gauge::offline_bytes));
+        publish("$SYS/broker/inflight/messages", gauge(metrics::gauge::inflight_messages));
+        publish_histogram("$SYS/broker/publish/fanout", metrics_.get(metrics::histogram::fan_out));
+        publish_histogram("$SYS/broker/publish/match_latency_ns", metrics_.get(metrics::histogram::match_latency));
+    }
+
+    /**
+     * @brief Get the resource usage of all the sessions.
+     *
+     * The sessions are walked in chunks, see for_each_session_stats(), so it doesn't stall
+     * the io_context threads that connect, disconnect, and publish. It can be called from
+     * any thread.
+     *
+     * @return the stats of the sessions including offline ones
+     */
+    std::vector<session_stats> get_session_stats() const {
+        std::vector<session_stats> stats;
+        for_each_session_stats(
+            [&] {
+                stats.clear();
+            },
+            [&](session_stats s) {
+                stats.push_back(force_move(s));
+            }
+        );
+        return stats;
+    }
+
+    /**
+     * @brief Get the sessions that use the resource most.
+     *        Only the n largest stats are kept while the sessions are walked.
+     *        To get the top sessions of several resources at once, call select_top_sessions()
+     *        on a get_session_stats() result for each key.
+     * @param k the value to compare
+     * @param n the maximum number of sessions to return
+     * @return the sessions in descending order of the value
+     */
+    std::vector<session_stats> top_sessions(session_stats::key k, std::size_t n) const {
+        std::vector<session_stats> heap;
+        if (n == 0) return heap;
+        // min heap, the front is the smallest of the top n
+        auto greater =
+            [k](session_stats const& lhs, session_stats const& rhs) {
+                return lhs.value(k) > rhs.value(k);
+            };
+        for_each_session_stats(
+            [&] {
+                heap.clear();
+            },
+            [&](session_stats s) {
+                if (heap.size() < n) {
+                    heap.push_back(force_move(s));
+                    std::push_heap(heap.begin(), heap.end(), greater);
+                }
+                else if (greater(s, heap.front())) {
+                    std::pop_heap(heap.begin(), heap.end(), greater);
+                    heap.back() = force_move(s);
+                    std::push_heap(heap.begin(), heap.end(), greater);
+                }
+            }
+        );
+        std::sort_heap(heap.begin(), heap.end(), greater);
+        return heap;
+    }
+
+    /**
+     * @brief Save all retained messages to the snapshot file.
+     *        After the snapshot is saved, the persistence drops the tombstones of the retained
+     *        messages that were erased before it. Load the latest snapshot on start.
+     * @param path snapshot file path
+     * @return the number of saved messages
+     */
+    std::size_t save_retained_snapshot(std::string path) const {
+        struct message {
+            buffer topic;
+            buffer contents;
+            v5::properties props;
+            qos qos_value;
+            optional<std::chrono::system_clock::time_point> expiry;
+        };
+        auto now_steady = std::chrono::steady_clock::now();
+        auto now_system = std::chrono::system_clock::now();
+        optional<std::uint64_t> mark;
+        // Only copy the messages under the lock. The buffers are shared, and the file is
+        // written after the lock is released, so the PUBLISH and SUBSCRIBE handlers don't
+        // wait for it.
+        std::vector<message> messages;
+        {
+            std::lock_guard<mutex> g(mtx_retains_);
+            if (persistence_) mark.emplace(persistence_->retained_snapshot_mark());
+            messages.reserve(retains_.size());
+            retains_.for_each(
+                [&](retain_t const& r) {
+                    optional<std::chrono::system_clock::time_point> expiry;
+                    if (r.tim_message_expiry) {
+                        expiry.emplace(
+                            now_system +
+                            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                r.tim_message_expiry->expiry() - now_steady
+                            )
+                        );
+                    }
+                    messages.push_back(message{ r.topic, r.contents, r.props, r.qos_value, expiry });
+                }
+            );
+        }
+        retained_snapshot::writer w(force_move(path));
+        for (auto const& m : messages) {
+            w.add(m.topic, m.contents, m.props, m.qos_value, m.expiry);
+        }
+        auto saved = w.commit();
+        if (mark) persistence_->retained_snapshot_saved(mark.value());
+        return saved;
+    }
+
+    /**
+     * @brief Load the retained messages from the snapshot file.
+     *
+     * The snapshot file is mapped into memory, and the topics, contents, and properties of
+     * the retained messages refer to the mapped region. Only the topic index is built.
+     * The retained messages that have the same topics are overwritten.
+     * The loaded messages are not written to the persistence one by one; the snapshot is
+     * their durable copy, so load it on every start.
+     * The persistence has the retained messages that are updated or erased after the snapshot,
+     * so call this function before set_persistence(). If the persistence is already set,
+     * its retained messages are restored again over the loaded ones.
+     *
+     * @param path snapshot file path
+     * @return the number of loaded messages. Expired messages are not counted.
+     */
+    std::size_t load_retained_snapshot(std::string const& path) {
+        auto now = std::chrono::system_clock::now();
+        std::size_t loaded = 0;
+        retained_snapshot::load(
+            path,
+            [&](buffer topic,
+                buffer contents,
+                v5::properties props,
+                qos qos_value,
+                optional<std::chrono::system_clock::time_point> expiry) {
+                optional<std::chrono::steady_clock::duration> message_expiry_interval;
+                if (expiry) {
+                    if (expiry.value() <= now) return;
+                    auto d = remaining_expiry(expiry.value(), now);
+                    set_property<v5::property::message_expiry_interval>(
+                        props,
+                        v5::property::message_expiry_interval(static_cast<uint32_t>(d.count()))
+                    );
+                    message_expiry_interval.emplace(d);
+                }
+                insert_retained(
+                    force_move(topic),
+                    force_move(contents),
+                    force_move(props),
+                    qos_value,
+                    message_expiry_interval
+                );
+                ++loaded;
+            }
+        );
+        MQTT_LOG("mqtt_broker", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "retained snapshot loaded. path:" << path
+            << " size:" << loaded;
+        if (persistence_) restore_retains();
+        return loaded;
+    }
+
 private:
+    void schedule_sys_publish() {
+        if (sys_publish_interval_ == std::chrono::steady_clock::duration::zero()) return;
+        tim_sys_publish_.expires_after(sys_publish_interval_);
+        tim_sys_publish_.async_wait(
+            [this](error_code ec) {
+                if (ec) return;
+                publish_sys_topics();
+                schedule_sys_publish();
+            }
+        );
+    }
+
     /**
      * @brief connect_proc Process an incoming CONNECT packet
      *
@@ -997,11 +1439,13 @@ private:
      *
      * @param clean_start - if the clean-start flag is set on the CONNECT message.
      * @param spep - varient of shared pointers to underlying connection type.
+     * @param sh - handle that is bound to the session_state of the connection.
      * @param client_id - the id that the client wants to use
      * @param will - the last-will-and-testiment of the connection, if any.
      */
     bool connect_handler(
         con_sp_t spep,
+        session_handle_sp const& sh,
         buffer client_id,
         optional<buffer> /*username*/,
         optional<buffer> /*password*/,
@@ -1024,213 +1468,338 @@ private:
          *  the Session Present flag in CONNACK is always set to 0 if Clean Start is set to 1.
          */
 
-        // Find any sessions that have the same client_id
-        std::lock_guard<mutex> g(mtx_sessions_);
-        auto& idx = sessions_.get<tag_cid>();
-        auto it = idx.lower_bound(client_id);
-        if (it == idx.end() || it->client_id() != client_id) {
-            // new connection
-            MQTT_LOG("mqtt_broker", trace)
-                << MQTT_ADD_VALUE(address, this)
-                << "cid:" << client_id
-                << " new connection inserted.";
-            it = idx.emplace_hint(
-                it,
-                timer_ioc_,
-                mtx_subs_map_,
-                subs_map_,
-                shared_targets_,
-                spep,
-                client_id,
-                force_move(will),
-                // will_sender
-                [this](auto&&... params) {
-                    do_publish(std::forward<decltype(params)>(params)...);
-                },
-                force_move(cp.will_expiry_interval),
-                force_move(cp.session_expiry_interval)
-            );
-            if (cp.response_topic_requested) {
-                // set_response_topic never modify key part
-                set_response_topic(const_cast<session_state&>(*it), connack_props);
+        auto session_expiry_interval = cp.session_expiry_interval;
+
+        // CONNECTs with the same client_id are processed one by one, so a session taken over by
+        // a later CONNECT has already sent its CONNACK. CONNECTs with other client_ids don't wait.
+        std::lock_guard<std::mutex> gc(
+            mtx_connects_[buffer_hasher()(client_id) % mtx_connects_.size()]
+        );
+
+        // The inherited session is attached to spep by takeover_session() after CONNACK is written.
+        bool session_present = false;
+        {
+            // Find any sessions that have the same client_id
+            // The sessions lock is held only while the session is looked up and updated.
+            std::lock_guard<mutex> g(mtx_sessions_);
+            auto& idx = sessions_.get<tag_cid>();
+            auto it = idx.find(client_id);
+            if (it == idx.end()) {
+                // new connection
+                MQTT_LOG("mqtt_broker", trace)
+                    << MQTT_ADD_VALUE(address, this)
+                    << "cid:" << client_id
+                    << " new connection inserted.";
+                it = idx.emplace(
+                    timer_ioc_,
+                    mtx_subs_map_,
+                    subs_map_,
+                    shared_targets_,
+                    metrics_,
+                    spep,
+                    sh,
+                    client_id,
+                    force_move(will),
+                    // will_sender
+                    [this](auto&&... params) {
+                        do_publish(std::forward<decltype(params)>(params)...);
+                    },
+                    force_move(cp.will_expiry_interval),
+                    force_move(cp.session_expiry_interval)
+                ).first;
+                // persist_session never modify key part
+                persist_session(const_cast<session_state&>(*it), ep, session_expiry_interval);
+                if (cp.response_topic_requested) {
+                    // set_response_topic never modify key part
+                    set_response_topic(const_cast<session_state&>(*it), connack_props);
+                }
             }
-            send_connack(ep, false, force_move(connack_props));
-        }
-        else if (it->online()) {
-            // online overwrite
-            if (close_proc_no_lock(it->con(), true, v5::disconnect_reason_code::session_taken_over)) {
-                // remain offline
+            else if (it->online()) {
+                // online overwrite
+                if (close_proc_no_lock(it->con(), true, v5::disconnect_reason_code::session_taken_over)) {
+                    // remain offline
+                    if (clean_start) {
+                        // discard offline session
+                        MQTT_LOG("mqtt_broker", trace)
+                            << MQTT_ADD_VALUE(address, this)
+                            << "cid:" << client_id
+                            << "online connection exists, discard old one due to new one's clean_start and renew";
+                        if (cp.response_topic_requested) {
+                            // set_response_topic never modify key part
+                            set_response_topic(const_cast<session_state&>(*it), connack_props);
+                        }
+                        idx.modify(
+                            it,
+                            [&](auto& e) {
+                                e.clean();
+                                e.update_will(timer_ioc_, force_move(will), cp.will_expiry_interval);
+                                // renew_session_expiry updates index
+                                e.renew_session_expiry(force_move(cp.session_expiry_interval));
+                                persist_session(e, ep, session_expiry_interval);
+                            },
+                            [](auto&) { BOOST_ASSERT(false); }
+                        );
+                    }
+                    else {
+                        // inherit online session if previous session's session exists
+                        MQTT_LOG("mqtt_broker", trace)
+                            << MQTT_ADD_VALUE(address, this)
+                            << "cid:" << client_id
+                            << "online connection exists, inherit old one and renew";
+                        // persist_session never modify key part
+                        persist_session(const_cast<session_state&>(*it), ep, session_expiry_interval);
+                        if (cp.response_topic_requested) {
+                            // set_response_topic never modify key part
+                            set_response_topic(const_cast<session_state&>(*it), connack_props);
+                        }
+                        session_present = true;
+                    }
+                }
+                else {
+                    // new connection
+                    MQTT_LOG("mqtt_broker", trace)
+                        << MQTT_ADD_VALUE(address, this)
+                        << "cid:" << client_id
+                        << "online connection exists, discard old one due to session_expiry and renew";
+                    bool inserted;
+                    std::tie(it, inserted) = idx.emplace(
+                        timer_ioc_,
+                        mtx_subs_map_,
+                        subs_map_,
+                        shared_targets_,
+                        metrics_,
+                        spep,
+                        sh,
+                        client_id,
+                        force_move(will),
+                        // will_sender
+                        [this](auto&&... params) {
+                            do_publish(std::forward<decltype(params)>(params)...);
+                        },
+                        force_move(cp.will_expiry_interval),
+                        force_move(cp.session_expiry_interval)
+                    );
+                    BOOST_ASSERT(inserted);
+                    // persist_session never modify key part
+                    persist_session(const_cast<session_state&>(*it), ep, session_expiry_interval);
+                    if (cp.response_topic_requested) {
+                        // set_response_topic never modify key part
+                        set_response_topic(const_cast<session_state&>(*it), connack_props);
+                    }
+                }
+            }
+            else {
+                // offline -> online
                 if (clean_start) {
                     // discard offline session
                     MQTT_LOG("mqtt_broker", trace)
                         << MQTT_ADD_VALUE(address, this)
                         << "cid:" << client_id
-                        << "online connection exists, discard old one due to new one's clean_start and renew";
+                        << "offline connection exists, discard old one due to new one's clean_start and renew";
                     if (cp.response_topic_requested) {
                         // set_response_topic never modify key part
                         set_response_topic(const_cast<session_state&>(*it), connack_props);
                     }
-                    send_connack(ep, false, force_move(connack_props));
                     idx.modify(
                         it,
                         [&](auto& e) {
                             e.clean();
+                            e.renew(spep, sh, clean_start);
                             e.update_will(timer_ioc_, force_move(will), cp.will_expiry_interval);
                             // renew_session_expiry updates index
                             e.renew_session_expiry(force_move(cp.session_expiry_interval));
+                            persist_session(e, ep, session_expiry_interval);
                         },
                         [](auto&) { BOOST_ASSERT(false); }
                     );
                 }
                 else {
-                    // inherit online session if previous session's session exists
+                    // inherit offline session
                     MQTT_LOG("mqtt_broker", trace)
                         << MQTT_ADD_VALUE(address, this)
                         << "cid:" << client_id
-                        << "online connection exists, inherit old one and renew";
+                        << "offline connection exists, inherit old one and renew";
+                    // persist_session never modify key part
+                    persist_session(const_cast<session_state&>(*it), ep, session_expiry_interval);
                     if (cp.response_topic_requested) {
                         // set_response_topic never modify key part
                         set_response_topic(const_cast<session_state&>(*it), connack_props);
                     }
-                    send_connack(
-                        ep,
-                        true,
-                        force_move(connack_props),
-                        [
-                            this,
-                            &idx,
-                            it,
-                            will = force_move(will),
-                            clean_start,
-                            spep,
-                            will_expiry_interval = cp.will_expiry_interval,
-                            session_expiry_interval = cp.session_expiry_interval
-                        ](error_code ec) mutable {
-                            if (ec) {
-                                MQTT_LOG("mqtt_broker", trace)
-                                    << MQTT_ADD_VALUE(address, this)
-                                    << ec.message();
-                                return;
-                            }
-                            idx.modify(
-                                it,
-                                [&](auto& e) {
-                                    e.renew(spep, clean_start);
-                                    e.update_will(timer_ioc_, force_move(will), will_expiry_interval);
-                                    // renew_session_expiry updates index
-                                    e.renew_session_expiry(force_move(session_expiry_interval));
-                                    e.send_inflight_messages();
-                                    e.send_all_offline_messages();
-                                },
-                                [](auto&) { BOOST_ASSERT(false); }
-                            );
-                        }
-                    );
-                }
-            }
-            else {
-                // new connection
-                MQTT_LOG("mqtt_broker", trace)
-                    << MQTT_ADD_VALUE(address, this)
-                    << "cid:" << client_id
-                    << "online connection exists, discard old one due to session_expiry and renew";
-                bool inserted;
-                std::tie(it, inserted) = idx.emplace(
-                    timer_ioc_,
-                    mtx_subs_map_,
-                    subs_map_,
-                    shared_targets_,
-                    spep,
-                    client_id,
-                    force_move(will),
-                    // will_sender
-                    [this](auto&&... params) {
-                        do_publish(std::forward<decltype(params)>(params)...);
-                    },
-                    force_move(cp.will_expiry_interval),
-                    force_move(cp.session_expiry_interval)
-                );
-                BOOST_ASSERT(inserted);
-                if (cp.response_topic_requested) {
-                    // set_response_topic never modify key part
-                    set_response_topic(const_cast<session_state&>(*it), connack_props);
+                    session_present = true;
                 }
-                send_connack(ep, false, force_move(connack_props));
             }
         }
-        else {
-            // offline -> online
-            if (clean_start) {
-                // discard offline session
-                MQTT_LOG("mqtt_broker", trace)
-                    << MQTT_ADD_VALUE(address, this)
-                    << "cid:" << client_id
-                    << "offline connection exists, discard old one due to new one's clean_start and renew";
-                if (cp.response_topic_requested) {
-                    // set_response_topic never modify key part
-                    set_response_topic(const_cast<session_state&>(*it), connack_props);
+
+        if (!session_present) {
+            send_connack(ep, false, force_move(connack_props));
+            return true;
+        }
+        send_connack(
+            ep,
+            true,
+            force_move(connack_props),
+            [
+                this,
+                client_id,
+                will = force_move(will),
+                clean_start,
+                spep,
+                sh = sh,
+                will_expiry_interval = cp.will_expiry_interval,
+                session_expiry_interval = cp.session_expiry_interval
+            ](error_code ec) mutable {
+                if (ec) {
+                    MQTT_LOG("mqtt_broker", trace)
+                        << MQTT_ADD_VALUE(address, this)
+                        << ec.message();
+                    return;
                 }
-                send_connack(ep, false, force_move(connack_props));
-                idx.modify(
-                    it,
-                    [&](auto& e) {
-                        e.clean();
-                        e.renew(spep, clean_start);
-                        e.update_will(timer_ioc_, force_move(will), cp.will_expiry_interval);
-                        // renew_session_expiry updates index
-                        e.renew_session_expiry(force_move(cp.session_expiry_interval));
-                    },
-                    [](auto&) { BOOST_ASSERT(false); }
+                takeover_session(
+                    force_move(spep),
+                    force_move(sh),
+                    client_id,
+                    force_move(will),
+                    clean_start,
+                    will_expiry_interval,
+                    force_move(session_expiry_interval)
                 );
             }
-            else {
-                // inherit offline session
+        );
+        return true;
+    }
+
+    /**
+     * @brief Attach the connection to the inherited session after CONNACK is written.
+     *
+     * The sessions lock is held only while the session is renewed. The inflight messages are
+     * sent at once because their packet ids are already registered, the offline messages are
+     * sent batch by batch by send_offline_messages_paced().
+     */
+    void takeover_session(
+        con_sp_t spep,
+        session_handle_sp sh,
+        buffer const& client_id,
+        optional<will> will,
+        bool clean_start,
+        optional<std::chrono::steady_clock::duration> will_expiry_interval,
+        optional<std::chrono::steady_clock::duration> session_expiry_interval
+    ) {
+        {
+            std::lock_guard<mutex> g(mtx_sessions_);
+            auto& idx = sessions_.get<tag_cid>();
+            auto it = idx.find(client_id);
+            if (it == idx.end()) {
                 MQTT_LOG("mqtt_broker", trace)
                     << MQTT_ADD_VALUE(address, this)
                     << "cid:" << client_id
-                    << "offline connection exists, inherit old one and renew";
-                if (cp.response_topic_requested) {
-                    // set_response_topic never modify key part
-                    set_response_topic(const_cast<session_state&>(*it), connack_props);
-                }
-                send_connack(
-                    ep,
-                    true,
-                    force_move(connack_props),
-                    [
-                        this,
-                        &idx,
-                        it,
-                        will = force_move(will),
-                        clean_start,
-                        spep,
-                        will_expiry_interval = cp.will_expiry_interval,
-                        session_expiry_interval = cp.session_expiry_interval
-                    ](error_code ec) mutable {
-                        if (ec) {
-                            MQTT_LOG("mqtt_broker", trace)
-                                << MQTT_ADD_VALUE(address, this)
-                                << ec.message();
-                            return;
-                        }
-                        idx.modify(
-                            it,
-                            [&](auto& e) {
-                                e.renew(spep, clean_start);
-                                e.update_will(timer_ioc_, force_move(will), will_expiry_interval);
-                                // renew_session_expiry updates index
-                                e.renew_session_expiry(force_move(session_expiry_interval));
-                                e.send_inflight_messages();
-                                e.send_all_offline_messages();
-                            },
-                            [](auto&) { BOOST_ASSERT(false); }
-                        );
-                    }
-                );
+                    << " session has been removed before takeover";
+                return;
             }
+            idx.modify(
+                it,
+                [&](auto& e) {
+                    e.renew(spep, sh, clean_start);
+                    e.update_will(timer_ioc_, force_move(will), will_expiry_interval);
+                    // renew_session_expiry updates index
+                    e.renew_session_expiry(force_move(session_expiry_interval));
+                },
+                [](auto&) { BOOST_ASSERT(false); }
+            );
+        }
+        {
+            std::shared_lock<mutex> g(mtx_sessions_);
+            auto& idx = sessions_.get<tag_con>();
+            auto it = idx.find(spep);
+            if (it == idx.end()) return;
+            // send_inflight_messages never modify key part
+            const_cast<session_state&>(*it).send_inflight_messages();
+        }
+        send_offline_messages_paced(force_move(spep));
+    }
+
+    /**
+     * @brief Send the next batch of the offline messages of the connection.
+     *        It is called again when the last message of the batch is written.
+     */
+    void send_offline_messages_paced(con_sp_t spep) {
+        std::shared_lock<mutex> g(mtx_sessions_);
+        auto& idx = sessions_.get<tag_con>();
+        auto it = idx.find(spep);
+        if (it == idx.end()) return;
+        // send_offline_messages_paced never modify key part
+        const_cast<session_state&>(*it).send_offline_messages_paced(
+            offline_message_batch_size_,
+            offline_messages_written_handler(spep)
+        );
+    }
+
+    /**
+     * @brief Make the handler that sends the next batch of the offline messages of the connection.
+     */
+    std::function<void(error_code)> offline_messages_written_handler(con_sp_t const& spep) {
+        return
+            [this, wp = con_wp_t(spep)]
+            (error_code ec) {
+                if (ec) return;
+                if (auto sp = wp.lock()) send_offline_messages_paced(force_move(sp));
+            };
+    }
+
+    /**
+     * @brief Start the keep alive timeout of the connection.
+     *
+     * http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718030
+     * If the Keep Alive value is non-zero and the Server does not receive a Control Packet from
+     * the Client within one and a half times the Keep Alive time period, it MUST disconnect the
+     * Network Connection to the Client as if the network had failed [MQTT-3.1.2-24].
+     */
+    static void start_keep_alive(timer_wheel& kaw, timer_wheel::entry_sp const& ka, std::uint16_t keep_alive) {
+        if (keep_alive == 0) return;
+        kaw.schedule(ka, std::chrono::milliseconds(std::uint64_t(keep_alive) * 1500));
+    }
+
+    /**
+     * @brief Get the keep alive timer wheel of the executor of a connection.
+     *
+     * Each io_context of the connections has its own wheel, so the wheel lock is shared only by
+     * the threads of one io_context, and the keep alive timeout is handled on the io_context of
+     * the connection. It is looked up once per accepted connection.
+     * The number of io_contexts is small, so the wheels are searched linearly.
+     */
+    timer_wheel& keep_alive_wheel(as::steady_timer::executor_type const& ex) {
+        std::lock_guard<mutex> g(mtx_keep_alive_wheels_);
+        for (auto const& e : keep_alive_wheels_) {
+            if (e.first == ex) return *e.second;
         }
+        keep_alive_wheels_.emplace_back(ex, std::make_unique<timer_wheel>(ex));
+        return *keep_alive_wheels_.back().second;
+    }
 
-        return true;
+    static void keep_alive_timeout(con_sp_t spep) {
+        MQTT_LOG("mqtt_broker", info)
+            << MQTT_ADD_VALUE(address, spep.get())
+            << "keep alive timeout";
+        disconnect_with_reason(force_move(spep), v5::disconnect_reason_code::keep_alive_timeout);
+    }
+
+    /**
+     * @brief Close the connection. On MQTT v5, DISCONNECT with the reason code is sent before that.
+     */
+    static void disconnect_with_reason(con_sp_t spep, v5::disconnect_reason_code rc) {
+        if (spep->get_protocol_version() == protocol_version::v5) {
+            auto p = spep.get();
+            p->async_disconnect(
+                rc,
+                v5::properties{},
+                [spep = force_move(spep)]
+                (error_code) {
+                    spep->async_force_disconnect();
+                }
+            );
+        }
+        else {
+            spep->async_force_disconnect();
+        }
     }
 
     struct connect_param {
@@ -1524,6 +2093,7 @@ private:
                     << "force_disconnect(async) cid:" << ss.client_id();
                 force_disconnect(spep);
             }
+            if (persistence_) persistence_->erase_session(ss.client_id());
             idx.erase(it);
             BOOST_ASSERT(sessions_.get<tag_con>().find(spep) == sessions_.get<tag_con>().end());
             return false;
@@ -1547,9 +2117,10 @@ private:
                     }
                     // become_offline updates index
                     ss.become_offline(
+                        session_expiry_wheel_,
                         [this]
-                        (std::shared_ptr<as::steady_timer> const& sp_tim) {
-                            sessions_.get<tag_tim>().erase(sp_tim);
+                        (buffer const& client_id) {
+                            erase_expired_session(client_id);
                         }
                     );
                 },
@@ -1578,26 +2149,293 @@ private:
         return close_proc_no_lock(force_move(spep), send_will, rc);
     }
 
+    void erase_expired_session(buffer const& client_id) {
+        std::lock_guard<mutex> g(mtx_sessions_);
+        auto& idx = sessions_.get<tag_cid>();
+        auto it = idx.find(client_id);
+        // The session could be renewed or replaced after the timeout is fired.
+        if (it == idx.end() || !it->expired()) return;
+        MQTT_LOG("mqtt_broker", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "cid:" << client_id
+            << " session expired";
+        if (persistence_) persistence_->erase_session(it->client_id());
+        idx.erase(it);
+    }
+
+    /**
+     * @brief persist_session Record the session to the persistence on CONNECT
+     *
+     * @param ss - session_state that is connected
+     * @param ep - endpoint that sent CONNECT
+     * @param session_expiry_interval - Session Expiry Interval of CONNECT
+     */
+    void persist_session(
+        session_state& ss,
+        endpoint_t const& ep,
+        optional<std::chrono::steady_clock::duration> const& session_expiry_interval
+    ) {
+        if (!persistence_) return;
+        bool persistent =
+            [&] {
+                if (ep.get_protocol_version() == protocol_version::v3_1_1) {
+                    return !ep.clean_session();
+                }
+                else {
+                    BOOST_ASSERT(ep.get_protocol_version() == protocol_version::v5);
+                    return
+                        session_expiry_interval &&
+                        session_expiry_interval.value() != std::chrono::steady_clock::duration::zero();
+                }
+            } ();
+        // clean_session() returns Clean Start flag on MQTT v5
+        if (ep.clean_session() || !persistent) {
+            persistence_->erase_session(ss.client_id());
+        }
+        if (persistent) {
+            persistence_->put_session(ss.client_id(), ep.get_protocol_version(), session_expiry_interval);
+        }
+        ss.set_persistence(persistent ? persistence_.get() : nullptr);
+    }
+
+    /**
+     * @brief Call f with the stats of each session.
+     *
+     * The buckets of the client id index are walked chunk_buckets at a time.
+     * The sessions lock is held only while the offline counters and the connections of a chunk
+     * are copied, and the stats of the connections are read after it is released.
+     * A session that connects or expires during the walk may or may not be included.
+     * If the index is rehashed between the chunks, the walk starts over.
+     *
+     * @param restart void() that is called when the walk starts over. The stats passed to f
+     *                before it should be dropped.
+     * @param f       void(session_stats)
+     */
+    template <typename RestartHandler, typename StatsHandler>
+    void for_each_session_stats(RestartHandler&& restart, StatsHandler&& f) const {
+        std::size_t const chunk_buckets = 256;
+        std::vector<session_stats> chunk;
+        std::vector<con_sp_t> cons;
+        std::size_t bucket = 0;
+        std::size_t bucket_count = 0;
+        while (true) {
+            {
+                std::shared_lock<mutex> g(mtx_sessions_);
+                auto const& idx = sessions_.get<tag_cid>();
+                if (idx.bucket_count() != bucket_count) {
+                    if (bucket != 0) restart();
+                    bucket = 0;
+                    bucket_count = idx.bucket_count();
+                }
+                if (bucket == bucket_count) break;
+                auto last = std::min(bucket + chunk_buckets, bucket_count);
+                for (; bucket != last; ++bucket) {
+                    for (auto it = idx.begin(bucket), end = idx.end(bucket); it != end; ++it) {
+                        auto const& ss = *it;
+                        chunk.emplace_back();
+                        auto& s = chunk.back();
+                        s.client_id = ss.client_id();
+                        s.online = ss.online();
+                        s.offline_messages = ss.offline_message_count();
+                        s.offline_bytes = ss.offline_message_bytes();
+                        s.inflight_messages = ss.inflight_message_count();
+                        cons.push_back(ss.con());
+                    }
+                }
+            }
+            for (std::size_t i = 0; i != chunk.size(); ++i) {
+                if (cons[i]) chunk[i].endpoint = cons[i]->get_stats();
+                f(force_move(chunk[i]));
+            }
+            chunk.clear();
+            cons.clear();
+        }
+    }
+
+    void restore_sessions() {
+        std::lock_guard<mutex> g(mtx_sessions_);
+        auto& idx = sessions_.get<tag_cid>();
+        auto now = std::chrono::system_clock::now();
+        std::vector<buffer> expired;
+        std::vector<std::pair<buffer, std::uint64_t>> expired_offline_messages;
+        persistence_->for_each_session(
+            [&](stored_session const& s) {
+                auto elapsed =
+                    s.offline_at ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(now - s.offline_at.value())
+                                 : std::chrono::steady_clock::duration::zero();
+                if (s.session_expiry_interval &&
+                    s.session_expiry_interval.value() != std::chrono::seconds(session_never_expire) &&
+                    s.session_expiry_interval.value() <= elapsed) {
+                    expired.push_back(s.client_id);
+                    return;
+                }
+                auto ret = idx.emplace(
+                    timer_ioc_,
+                    mtx_subs_map_,
+                    subs_map_,
+                    shared_targets_,
+                    metrics_,
+                    s.version,
+                    s.client_id,
+                    s.session_expiry_interval
+                );
+                if (!ret.second) return;
+                idx.modify(
+                    ret.first,
+                    [&](session_state& ss) {
+                        for (auto const& sub : s.subscriptions) {
+                            ss.subscribe(sub.share_name, sub.topic_filter, sub.subopts, [] {}, sub.sid);
+                        }
+                        for (auto const& m : s.inflight_messages) {
+                            ss.restore_inflight_message(m, elapsed);
+                        }
+                        ss.restore_qos2_publish_handled(s.qos2_publish_handled);
+                        for (auto const& e : s.offline_messages) {
+                            auto const& m = e.second;
+                            auto props = m.props;
+                            if (m.expiry) {
+                                if (m.expiry.value() <= now) {
+                                    expired_offline_messages.emplace_back(s.client_id, e.first);
+                                    continue;
+                                }
+                                set_property<v5::property::message_expiry_interval>(
+                                    props,
+                                    v5::property::message_expiry_interval(
+                                        static_cast<uint32_t>(remaining_expiry(m.expiry.value(), now).count())
+                                    )
+                                );
+                            }
+                            ss.restore_offline_message(m.topic, m.contents, m.pubopts, force_move(props), e.first);
+                        }
+                        // restore_session_expiry updates index
+                        ss.restore_session_expiry(
+                            elapsed,
+                            session_expiry_wheel_,
+                            [this]
+                            (buffer const& client_id) {
+                                erase_expired_session(client_id);
+                            }
+                        );
+                        ss.set_persistence(persistence_.get());
+                    },
+                    [](auto&) { BOOST_ASSERT(false); }
+                );
+            }
+        );
+        for (auto const& cid : expired) {
+            persistence_->erase_session(cid);
+        }
+        for (auto const& e : expired_offline_messages) {
+            persistence_->erase_offline_message(e.first, e.second);
+        }
+        MQTT_LOG("mqtt_broker", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "sessions restored. size:" << sessions_.get<tag_cid>().size()
+            << " expired:" << expired.size();
+    }
+
+    void restore_retains() {
+        std::vector<stored_message> msgs;
+        persistence_->for_each_retained(
+            [&](stored_message const& m) {
+                msgs.push_back(m);
+            }
+        );
+        auto now = std::chrono::system_clock::now();
+        std::size_t restored = 0;
+        for (auto& m : msgs) {
+            optional<std::chrono::steady_clock::duration> message_expiry_interval;
+            if (m.expiry) {
+                if (m.expiry.value() <= now) {
+                    persistence_->erase_retained(m.topic);
+                    continue;
+                }
+                auto d = remaining_expiry(m.expiry.value(), now);
+                set_property<v5::property::message_expiry_interval>(
+                    m.props,
+                    v5::property::message_expiry_interval(static_cast<uint32_t>(d.count()))
+                );
+                message_expiry_interval.emplace(d);
+            }
+            insert_retained(
+                force_move(m.topic),
+                force_move(m.contents),
+                force_move(m.props),
+                m.pubopts.get_qos(),
+                message_expiry_interval
+            );
+            ++restored;
+        }
+        // The retained messages that are erased after the snapshot was saved
+        std::size_t erased = 0;
+        {
+            std::lock_guard<mutex> g(mtx_retains_);
+            persistence_->for_each_erased_retained(
+                [&](buffer const& topic) {
+                    erased += retains_.erase(topic);
+                }
+            );
+        }
+        MQTT_LOG("mqtt_broker", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "retained messages restored. size:" << restored
+            << " expired:" << msgs.size() - restored
+            << " erased:" << erased;
+    }
+
+    /**
+     * @brief Get the remaining message expiry interval.
+     *        It is rounded up, so a message that expires in less than a second is not sent
+     *        with the interval 0.
+     */
+    static std::chrono::seconds remaining_expiry(
+        std::chrono::system_clock::time_point expiry,
+        std::chrono::system_clock::time_point now
+    ) {
+        auto d = std::chrono::duration_cast<std::chrono::seconds>(expiry - now);
+        if (d < expiry - now) ++d;
+        return d;
+    }
+
     bool publish_handler(
         con_sp_t spep,
+        session_handle const& sh,
         optional<packet_id_t> packet_id,
         publish_options pubopts,
         buffer topic_name,
         buffer contents,
         v5::properties props) {
+        MQTT_TRACE_STAMP(publish_handler);
 
         auto& ep = *spep;
 
-        std::shared_lock<mutex> g(mtx_sessions_);
-        auto& idx = sessions_.get<tag_con>();
-        auto it = idx.find(spep);
-
+        // The handle is bound to the session_state while the session is attached to spep.
+        // No sessions_ lookup and no sessions lock are required.
         // broker uses async_* APIs
         // If broker erase a connection, then async_force_disconnect()
         // and/or async_force_disconnect () is called.
-        // During async operation, spep is valid but it has already been
-        // erased from sessions_
-        if (it == idx.end()) return true;
+        // During async operation, spep is valid but the handle has already been
+        // unbound.
+        // The handle is locked only to copy the client id. If it were locked during the fan-out,
+        // a takeover would wait for the fan-out in unbind() while holding the sessions lock.
+        buffer source_client_id;
+        {
+            auto ss = sh.lock();
+            if (!ss) return true;
+            source_client_id = ss->client_id();
+            if (!source_client_id.has_life()) source_client_id = allocate_buffer(source_client_id);
+        }
+
+        // Scan the topic once. The result is used for the validation and the delivery.
+        // The endpoint has already checked that the topic name is well-formed UTF-8.
+        topic_levels levels(topic_name, false);
+        if (!levels.valid_topic_name()) {
+            MQTT_LOG("mqtt_broker", warning)
+                << MQTT_ADD_VALUE(address, &ep)
+                << "invalid topic name:" << topic_name;
+            disconnect_with_reason(force_move(spep), v5::disconnect_reason_code::topic_name_invalid);
+            return true;
+        }
 
         auto send_pubres =
             [&] {
@@ -1662,7 +2500,8 @@ private:
         }
 
         do_publish(
-            *it,
+            source_client_id,
+            levels,
             force_move(topic_name),
             force_move(contents),
             pubopts.get_qos() | pubopts.get_retain(), // remove dup flag
@@ -1675,49 +2514,46 @@ private:
 
     bool puback_handler(
         con_sp_t spep,
+        session_handle const& sh,
         packet_id_t packet_id,
         v5::puback_reason_code /*reason_code*/,
         v5::properties /*props*/) {
-        std::shared_lock<mutex> g(mtx_sessions_);
-        auto& idx = sessions_.get<tag_con>();
-        auto it = idx.find(spep);
-
+        // The handle is bound to the session_state while the session is attached to spep.
+        // No sessions_ lookup and no sessions lock are required.
         // broker uses async_* APIs
         // If broker erase a connection, then async_force_disconnect()
         // and/or async_force_disconnect () is called.
-        // During async operation, spep is valid but it has already been
-        // erased from sessions_
-        if (it == idx.end()) return true;
-
-        // const_cast is appropriate here
-        // See https://github.com/boostorg/multi_index/issues/50
-        auto& ss = const_cast<session_state&>(*it);
-        ss.erase_inflight_message_by_packet_id(packet_id);
-        ss.send_offline_messages_by_packet_id_release();
+        // During async operation, spep is valid but the handle has already been
+        // unbound.
+        auto ss = sh.lock();
+        if (!ss) return true;
+
+        ss->erase_inflight_message_by_packet_id(packet_id);
+        ss->send_offline_messages_by_packet_id_release(
+            offline_message_batch_size_,
+            offline_messages_written_handler(spep)
+        );
 
         return true;
     }
 
     bool pubrec_handler(
         con_sp_t spep,
+        session_handle const& sh,
         packet_id_t packet_id,
         v5::pubrec_reason_code reason_code,
         v5::properties /*props*/) {
-        std::shared_lock<mutex> g(mtx_sessions_);
-        auto& idx = sessions_.get<tag_con>();
-        auto it = idx.find(spep);
-
+        // The handle is bound to the session_state while the session is attached to spep.
+        // No sessions_ lookup and no sessions lock are required.
         // broker uses async_* APIs
         // If broker erase a connection, then async_force_disconnect()
         // and/or async_force_disconnect () is called.
-        // During async operation, spep is valid but it has already been
-        // erased from sessions_
-        if (it == idx.end()) return true;
+        // During async operation, spep is valid but the handle has already been
+        // unbound.
+        auto ss = sh.lock();
+        if (!ss) return true;
 
-        // const_cast is appropriate here
-        // See https://github.com/boostorg/multi_index/issues/50
-        auto& ss = const_cast<session_state&>(*it);
-        ss.erase_inflight_message_by_packet_id(packet_id);
+        ss->erase_inflight_message_by_packet_id(packet_id);
 
         if (is_error(reason_code)) return true;
 
@@ -1761,19 +2597,19 @@ private:
 
     bool pubrel_handler(
         con_sp_t spep,
+        session_handle const& sh,
         packet_id_t packet_id,
         v5::pubrel_reason_code reason_code,
         v5::properties /*props*/) {
-        std::shared_lock<mutex> g(mtx_sessions_);
-        auto& idx = sessions_.get<tag_con>();
-        auto it = idx.find(spep);
-
+        // The handle is bound to the session_state while the session is attached to spep.
+        // No sessions_ lookup and no sessions lock are required.
         // broker uses async_* APIs
         // If broker erase a connection, then async_force_disconnect()
         // and/or async_force_disconnect () is called.
-        // During async operation, spep is valid but it has already been
-        // erased from sessions_
-        if (it == idx.end()) return true;
+        // During async operation, spep is valid but the handle has already been
+        // unbound.
+        auto ss = sh.lock();
+        if (!ss) return true;
 
         auto& ep = *spep;
 
@@ -1816,29 +2652,37 @@ private:
 
     bool pubcomp_handler(
         con_sp_t spep,
+        session_handle const& sh,
         packet_id_t packet_id,
         v5::pubcomp_reason_code /*reason_code*/,
         v5::properties /*props*/){
-        std::shared_lock<mutex> g(mtx_sessions_);
-        auto& idx = sessions_.get<tag_con>();
-        auto it = idx.find(spep);
-
+        // The handle is bound to the session_state while the session is attached to spep.
+        // No sessions_ lookup and no sessions lock are required.
         // broker uses async_* APIs
         // If broker erase a connection, then async_force_disconnect()
         // and/or async_force_disconnect () is called.
-        // During async operation, spep is valid but it has already been
-        // erased from sessions_
-        if (it == idx.end()) return true;
-
-        // const_cast is appropriate here
-        // See https://github.com/boostorg/multi_index/issues/50
-        auto& ss = const_cast<session_state&>(*it);
-        ss.erase_inflight_message_by_packet_id(packet_id);
-        ss.send_offline_messages_by_packet_id_release();
+        // During async operation, spep is valid but the handle has already been
+        // unbound.
+        auto ss = sh.lock();
+        if (!ss) return true;
+
+        ss->erase_inflight_message_by_packet_id(packet_id);
+        ss->send_offline_messages_by_packet_id_release(
+            offline_message_batch_size_,
+            offline_messages_written_handler(spep)
+        );
 
         return true;
     }
 
+    /**
+     * @brief Check the topic filter of SUBSCRIBE. It is scanned once for all the rules.
+     *        The endpoint has already checked that it is well-formed UTF-8.
+     */
+    static bool valid_topic_filter(buffer const& topic_filter) {
+        return topic_levels(topic_filter, false).valid_topic_filter();
+    }
+
     bool subscribe_handler(
         con_sp_t spep,
         packet_id_t packet_id,
@@ -1914,6 +2758,10 @@ private:
             std::vector<suback_return_code> res;
             res.reserve(entries.size());
             for (auto& e : entries) {
+                if (!valid_topic_filter(e.topic_filter)) {
+                    res.emplace_back(suback_return_code::failure);
+                    continue;
+                }
                 res.emplace_back(qos_to_suback_return_code(e.subopts.get_qos())); // converts to granted_qos_x
                 ssr.get().subscribe(
                     force_move(e.share_name),
@@ -1958,6 +2806,10 @@ private:
             std::vector<v5::suback_reason_code> res;
             res.reserve(entries.size());
             for (auto& e : entries) {
+                if (!valid_topic_filter(e.topic_filter)) {
+                    res.emplace_back(v5::suback_reason_code::topic_filter_invalid);
+                    continue;
+                }
                 res.emplace_back(v5::qos_to_suback_reason_code(e.subopts.get_qos())); // converts to granted_qos_x
                 ssr.get().subscribe(
                     force_move(e.share_name),
@@ -2102,77 +2954,183 @@ private:
         publish_options pubopts,
         v5::properties props
     ) {
+        topic_levels levels(topic);
+        do_publish(
+            source_ss.client_id(),
+            levels,
+            force_move(topic),
+            force_move(contents),
+            pubopts,
+            force_move(props)
+        );
+    }
+
+    /**
+     * @param source_client_id - client id of the publisher
+     * @param levels - the scan result of topic. It refers to the characters of topic, which are
+     *                 kept while topic is moved.
+     */
+    void do_publish(
+        buffer const& source_client_id,
+        topic_levels const& levels,
+        buffer topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::properties props
+    ) {
+        metrics_.add(metrics::counter::publish_received);
+        if (h_publish_forward_) h_publish_forward_(topic, contents, pubopts, props);
+        do_publish_local(
+            &source_client_id,
+            levels,
+            force_move(topic),
+            force_move(contents),
+            pubopts,
+            force_move(props)
+        );
+    }
+
+    /**
+     * @brief Deliver the message to the subscribers of this broker and update the retained message.
+     * @param source_client_id - client id of the publisher for No Local.
+     *                           nullptr if the publisher is not connected to this broker.
+     * @param record_metrics - false if the message is originated by the broker itself, like $SYS.
+     *                         It is not counted in publish_sent, fan_out and match_latency.
+     */
+    void do_publish_local(
+        buffer const* source_client_id,
+        buffer topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::properties props,
+        bool record_metrics = true
+    ) {
+        // Only the levels are used.
+        topic_levels levels(topic, false);
+        do_publish_local(
+            source_client_id,
+            levels,
+            force_move(topic),
+            force_move(contents),
+            pubopts,
+            force_move(props),
+            record_metrics
+        );
+    }
+
+    /**
+     * @param levels - the scan result of topic. It is reused by subs_map_ and retains_.
+     *                 It refers to the characters of topic, which are kept while topic is moved.
+     */
+    void do_publish_local(
+        buffer const* source_client_id,
+        topic_levels const& levels,
+        buffer topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::properties props,
+        bool record_metrics = true
+    ) {
+        MQTT_TRACE_STAMP(match);
+
+        // The properties are the same for all subscribers except Subscription Identifier.
+        // Serialize them only once and share the bytes among subscribers.
+        auto shared_props = props.empty() ? v5::encoded_properties() : v5::encoded_properties(props);
 
         // publish the message to subscribers.
         // retain is delivered as the original only if rap_value is rap::retain.
         // On MQTT v3.1.1, rap_value is always rap::dont.
+        // The sessions lock is not held. A subscriber's session_state is kept alive by the
+        // shared lock of mtx_subs_map_, because ~session_state() removes its subscriptions
+        // under the exclusive lock before its members are destroyed.
+        std::size_t fan_out = 0;
         auto deliver =
             [&] (session_state& ss, subscription& sub) {
-                publish_options new_pubopts = std::min(pubopts.get_qos(), sub.subopts.get_qos());
-                if (sub.subopts.get_rap() == rap::retain && pubopts.get_retain() == MQTT_NS::retain::yes) {
-                    new_pubopts |= MQTT_NS::retain::yes;
-                }
+                profile::run(
+                    profile::deliver,
+                    [&] {
+                        ++fan_out;
+                        publish_options new_pubopts = std::min(pubopts.get_qos(), sub.subopts.get_qos());
+                        if (sub.subopts.get_rap() == rap::retain && pubopts.get_retain() == MQTT_NS::retain::yes) {
+                            new_pubopts |= MQTT_NS::retain::yes;
+                        }
 
-                if (sub.sid) {
-                    props.push_back(v5::property::subscription_identifier(sub.sid.value()));
-                    ss.deliver(
-                        timer_ioc_,
-                        topic,
-                        contents,
-                        new_pubopts,
-                        props
-                    );
-                    props.pop_back();
-                }
-                else {
-                    ss.deliver(
-                        timer_ioc_,
-                        topic,
-                        contents,
-                        new_pubopts,
-                        props
-                    );
-                }
+                        if (sub.sid) {
+                            ss.deliver(
+                                timer_ioc_,
+                                topic,
+                                contents,
+                                new_pubopts,
+                                shared_props,
+                                v5::properties { v5::property::subscription_identifier(sub.sid.value()) }
+                            );
+                        }
+                        else {
+                            ss.deliver(
+                                timer_ioc_,
+                                topic,
+                                contents,
+                                new_pubopts,
+                                shared_props,
+                                v5::properties {}
+                            );
+                        }
+                    }
+                );
             };
 
         //                  share_name   topic_filter
         std::set<std::tuple<string_view, string_view>> sent;
 
-        {
-            std::shared_lock<mutex> g{mtx_subs_map_};
-            subs_map_.modify(
-                topic,
-                [&](buffer const& /*key*/, subscription& sub) {
-                    if (sub.share_name.empty()) {
-                        // Non shared subscriptions
-
-                        // If NL (no local) subscription option is set and
-                        // publisher is the same as subscriber, then skip it.
-                        if (sub.subopts.get_nl() == nl::yes &&
-                            sub.ss.get().client_id() ==  source_ss.client_id()) return;
-                        deliver(sub.ss.get(), sub);
-                    }
-                    else {
-                        // Shared subscriptions
-                        bool inserted;
-                        std::tie(std::ignore, inserted) = sent.emplace(sub.share_name, sub.topic_filter);
-                        if (inserted) {
-                            if (auto ssr_opt = shared_targets_.get_target(sub.share_name, sub.topic_filter)) {
-                                deliver(ssr_opt.value().get(), sub);
+        auto match_begin = std::chrono::steady_clock::now();
+        profile::run(
+            profile::match,
+            [&] {
+                std::shared_lock<mutex> g{mtx_subs_map_};
+                subs_map_.modify(
+                    levels,
+                    [&](buffer const& /*key*/, subscription& sub) {
+                        if (sub.share_name.empty()) {
+                            // Non shared subscriptions
+
+                            // If NL (no local) subscription option is set and
+                            // publisher is the same as subscriber, then skip it.
+                            if (sub.subopts.get_nl() == nl::yes &&
+                                source_client_id &&
+                                sub.ss.get().client_id() == *source_client_id) return;
+                            deliver(sub.ss.get(), sub);
+                        }
+                        else {
+                            // Shared subscriptions
+                            bool inserted;
+                            std::tie(std::ignore, inserted) = sent.emplace(sub.share_name, sub.topic_filter);
+                            if (inserted) {
+                                if (auto ssr_opt = shared_targets_.get_target(sub.share_name, sub.topic_filter)) {
+                                    deliver(ssr_opt.value().get(), sub);
+                                }
                             }
                         }
                     }
-                }
+                );
+            }
+        );
+        if (record_metrics) {
+            metrics_.record(
+                metrics::histogram::match_latency,
+                static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - match_begin
+                    ).count()
+                )
             );
+            metrics_.record(metrics::histogram::fan_out, fan_out);
+            metrics_.add(metrics::counter::publish_sent, fan_out);
         }
 
+        // Only MQTT v5 publisher can set Message Expiry Interval. props is empty on v3.1.1.
         optional<std::chrono::steady_clock::duration> message_expiry_interval;
-        if (source_ss.get_protocol_version() == protocol_version::v5) {
-            auto v = get_property<v5::property::message_expiry_interval>(props);
-            if (v) {
-                message_expiry_interval.emplace(std::chrono::seconds(v.value().val()));
-            }
-
+        if (auto v = get_property<v5::property::message_expiry_interval>(props)) {
+            message_expiry_interval.emplace(std::chrono::seconds(v.value().val()));
         }
 
         /*
@@ -2199,57 +3157,140 @@ private:
         if (pubopts.get_retain() == MQTT_NS::retain::yes) {
             if (contents.empty()) {
                 std::lock_guard<mutex> g(mtx_retains_);
+                if (persistence_) persistence_->erase_retained(topic);
                 retains_.erase(topic);
             }
             else {
-                std::shared_ptr<as::steady_timer> tim_message_expiry;
-                if (message_expiry_interval) {
-                    tim_message_expiry = std::make_shared<as::steady_timer>(timer_ioc_, message_expiry_interval.value());
-                    tim_message_expiry->async_wait(
-                        [this, topic = topic, wp = std::weak_ptr<as::steady_timer>(tim_message_expiry)]
-                        (boost::system::error_code const& ec) {
-                            if (auto sp = wp.lock()) {
-                                if (!ec) {
-                                    retains_.erase(topic);
-                                }
-                            }
-                        }
-                    );
-                }
-
+                auto tim_message_expiry = retained_expiry_timer(topic, message_expiry_interval);
+                // The log has to record the same order of the updates as retains_
                 std::lock_guard<mutex> g(mtx_retains_);
+                if (persistence_) persistence_->put_retained(topic, contents, props, pubopts.get_qos());
                 retains_.insert_or_assign(
-                    topic,
+                    levels,
                     retain_t {
                         force_move(topic),
                         force_move(contents),
                         force_move(props),
                         pubopts.get_qos(),
-                        tim_message_expiry
+                        force_move(tim_message_expiry)
                     }
                 );
             }
         }
     }
 
+    void insert_retained(
+        buffer topic,
+        buffer contents,
+        v5::properties props,
+        qos qos_value,
+        optional<std::chrono::steady_clock::duration> message_expiry_interval
+    ) {
+        topic_levels levels(topic, false);
+        insert_retained(
+            levels,
+            force_move(topic),
+            force_move(contents),
+            force_move(props),
+            qos_value,
+            message_expiry_interval
+        );
+    }
+
+    /**
+     * @param levels - the scan result of topic. It refers to the characters of topic, which are
+     *                 kept while topic is moved.
+     */
+    void insert_retained(
+        topic_levels const& levels,
+        buffer topic,
+        buffer contents,
+        v5::properties props,
+        qos qos_value,
+        optional<std::chrono::steady_clock::duration> message_expiry_interval
+    ) {
+        auto tim_message_expiry = retained_expiry_timer(topic, message_expiry_interval);
+        std::lock_guard<mutex> g(mtx_retains_);
+        retains_.insert_or_assign(
+            levels,
+            retain_t {
+                force_move(topic),
+                force_move(contents),
+                force_move(props),
+                qos_value,
+                force_move(tim_message_expiry)
+            }
+        );
+    }
+
+    /**
+     * @brief Create the timer that erases the retained message of topic when it expires.
+     * @return the timer to store in retain_t. nullptr if message_expiry_interval is not set.
+     */
+    std::shared_ptr<as::steady_timer> retained_expiry_timer(
+        buffer const& topic,
+        optional<std::chrono::steady_clock::duration> message_expiry_interval
+    ) {
+        if (!message_expiry_interval) return nullptr;
+        auto tim_message_expiry = std::make_shared<as::steady_timer>(timer_ioc_, message_expiry_interval.value());
+        tim_message_expiry->async_wait(
+            [this, topic = topic, wp = std::weak_ptr<as::steady_timer>(tim_message_expiry)]
+            (boost::system::error_code const& ec) {
+                if (ec) return;
+                auto sp = wp.lock();
+                if (!sp) return;
+                std::lock_guard<mutex> g(mtx_retains_);
+                // A newer retained message could have replaced this one after the timer fired.
+                bool current = false;
+                retains_.find(
+                    topic,
+                    [&](retain_t const& r) {
+                        if (r.tim_message_expiry == sp) current = true;
+                    }
+                );
+                if (!current) return;
+                retains_.erase(topic);
+                if (persistence_) persistence_->erase_retained(topic);
+            }
+        );
+        return tim_message_expiry;
+    }
+
 private:
     as::io_context& timer_ioc_; ///< The boost asio context to run this broker on.
     as::steady_timer tim_disconnect_; ///< Used to delay disconnect handling for testing
+    as::steady_timer tim_sys_publish_; ///< Used to publish the metrics on $SYS topics periodically
+    std::chrono::steady_clock::duration sys_publish_interval_ = std::chrono::steady_clock::duration::zero();
     optional<std::chrono::steady_clock::duration> delay_disconnect_; ///< Used to delay disconnect handling for testing
 
+    /// session_state adds the offline messages to the gauges of metrics_, so it is declared before sessions_.
+    metrics metrics_; ///< Counters, gauges, and histograms of the broker.
+
     mutable mutex mtx_subs_map_;
     sub_con_map subs_map_;   /// subscription information
     shared_target shared_targets_; /// shared subscription targets
 
+    /// session_state has a pointer of session_expiry_wheel_, so it is declared before sessions_.
+    timer_wheel session_expiry_wheel_;
+
     ///< Map of active client id and connections
     /// session_state has references of subs_map_ and shared_targets_.
     /// because session_state (member of sessions_) has references of subs_map_ and shared_targets_.
     mutable mutex mtx_sessions_;
     session_states sessions_;
+    /// Serializes the CONNECTs with the same client id. Indexed by the hash of the client id.
+    std::array<std::mutex, 64> mtx_connects_;
 
     mutable mutex mtx_retains_;
     retained_messages retains_; ///< A list of messages retained so they can be sent to newly subscribed clients.
 
+    std::shared_ptr<persistence> persistence_; ///< Storage of persistent sessions and retained messages.
+    std::size_t offline_message_batch_size_ = 64; ///< The number of offline messages sent at once on reconnect.
+    bool auto_map_topic_alias_send_ = false; ///< Assign topic aliases to the PUBLISH packets to subscribers.
+    mutex mtx_keep_alive_wheels_;
+    /// Keep alive timeouts of the connections, one wheel per io_context of the connections.
+    std::vector<std::pair<as::steady_timer::executor_type, std::unique_ptr<timer_wheel>>> keep_alive_wheels_;
+
     // MQTTv5 members
     v5::properties connack_props_;
     v5::properties suback_props_;
@@ -2268,6 +3309,7 @@ private:
     std::function<void(v5::properties const&)> h_subscribe_props_;
     std::function<void(v5::properties const&)> h_unsubscribe_props_;
     std::function<void(v5::properties const&)> h_auth_props_;
+    publish_forward_handler h_publish_forward_;
     bool pingresp_ = true;
     bool connack_ = true;
 };
@@ -0,0 +1,218 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_BROKER_SHARDS_HPP)
+#define MQTT_BROKER_BROKER_SHARDS_HPP
+
+#include <mqtt/config.hpp>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include <mqtt/broker/broker_namespace.hpp>
+#include <mqtt/broker/broker.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+namespace as = boost::asio;
+
+/**
+ * @brief Shared nothing broker. Each io_context has its own broker_t shard.
+ *
+ * A connection is handled by the shard of the io_context that the connection runs on, so the
+ * sessions, the subscriptions and the retained messages of a shard are accessed only by the
+ * thread of the io_context, and the locks of broker_t are never contended.
+ * A message published to a shard is delivered to the local subscribers directly, and passed to
+ * each other shard through a lock-free single producer single consumer queue. The consumer
+ * shard drains all queued messages in one handler, so the messages are passed in batches.
+ *
+ * Requirements and limitations:
+ * - Each io_context must be run by exactly one thread.
+ * - Sessions are not shared between shards. A client that reconnects to another shard doesn't
+ *   inherit the session, and the same client id can be connected to two shards at once.
+ * - Retained messages are replicated to all shards.
+ * - Shared subscriptions are balanced within each shard, so a message can be delivered to one
+ *   subscriber per shard.
+ * - Persistence is not supported.
+ *
+ * Because sessions and shared subscriptions are per shard, the shards as a whole don't conform
+ * to the session takeover (MQTT-3.1.4-3) and the shared subscription delivery of MQTT.
+ * Use it only when the clients don't depend on them.
+ */
+class broker_shards {
+public:
+    /**
+     * @brief constructor
+     * @param iocs           io_contexts. One shard is created for each of them. They are also
+     *                       used as the timer io_context of the shards.
+     * @param queue_capacity capacity of each inter shard queue. When a queue is full, the messages
+     *                       are kept by the producer until the consumer drains the queue.
+     */
+    template <typename IoContexts>
+    explicit broker_shards(IoContexts& iocs, std::size_t queue_capacity = 4096) {
+        for (auto& ioc : iocs) {
+            shards_.push_back(std::make_unique<shard_entry>(ioc));
+        }
+        for (std::size_t from = 0; from != shards_.size(); ++from) {
+            auto& s = *shards_[from];
+            s.out.reserve(shards_.size());
+            for (std::size_t to = 0; to != shards_.size(); ++to) {
+                s.out.push_back(from == to ? nullptr : std::make_unique<channel>(queue_capacity));
+            }
+            s.b.set_publish_forward_handler(
+                [this, from]
+                (buffer const& topic, buffer const& contents, publish_options pubopts, v5::properties const& props) {
+                    forward(from, topic, contents, pubopts, props);
+                }
+            );
+        }
+    }
+
+    broker_shards(broker_shards const&) = delete;
+    broker_shards& operator=(broker_shards const&) = delete;
+
+    /**
+     * @brief Get the number of shards
+     * @return the number of shards
+     */
+    std::size_t size() const {
+        return shards_.size();
+    }
+
+    /**
+     * @brief Get the shard broker to configure it.
+     * @param i index of the shard. It is the same as the index of the io_context.
+     * @return broker
+     */
+    broker_t& shard(std::size_t i) {
+        return shards_.at(i)->b;
+    }
+
+    /**
+     * @brief Pass the accepted connection to the shard of its io_context.
+     * @param spep connection
+     */
+    void handle_accept(con_sp_t spep) {
+        auto exec = spep->socket().get_executor();
+        for (auto& s : shards_) {
+            if (exec == decltype(exec)(s->ioc.get_executor())) {
+                s->b.handle_accept(force_move(spep));
+                return;
+            }
+        }
+        MQTT_LOG("mqtt_broker", error)
+            << MQTT_ADD_VALUE(address, this)
+            << "the connection doesn't run on any io_context of the shards";
+        spep->async_force_disconnect();
+    }
+
+private:
+    struct forwarded_publish {
+        buffer topic;
+        buffer contents;
+        publish_options pubopts;
+        v5::properties props;
+    };
+    using forwarded_publish_sp = std::shared_ptr<forwarded_publish const>;
+
+    // from -> to
+    struct channel {
+        explicit channel(std::size_t capacity)
+            : queue(capacity) {}
+
+        boost::lockfree::spsc_queue<forwarded_publish_sp> queue;
+        std::atomic<bool> drain_scheduled { false };
+        std::atomic<bool> overflowed { false };
+        std::deque<forwarded_publish_sp> overflow; // accessed only by the producer
+    };
+
+    struct shard_entry {
+        explicit shard_entry(as::io_context& ioc)
+            : ioc(ioc), b(ioc) {}
+
+        as::io_context& ioc;
+        broker_t b;
+        std::vector<std::unique_ptr<channel>> out; // indexed by the consumer shard
+    };
+
+    // called on the thread of the shard from
+    void forward(
+        std::size_t from,
+        buffer const& topic,
+        buffer const& contents,
+        publish_options pubopts,
+        v5::properties const& props) {
+        if (shards_.size() == 1) return;
+        // All consumers share the same message. They only copy it.
+        auto msg = std::make_shared<forwarded_publish const>(
+            forwarded_publish { topic, contents, pubopts, props }
+        );
+        for (std::size_t to = 0; to != shards_.size(); ++to) {
+            if (to == from) continue;
+            auto& ch = *shards_[from]->out[to];
+            // keep the order of the messages after the overflow
+            if (!ch.overflow.empty() || !ch.queue.push(msg)) {
+                ch.overflow.push_back(msg);
+                ch.overflowed = true;
+            }
+            schedule_drain(from, to);
+        }
+    }
+
+    void schedule_drain(std::size_t from, std::size_t to) {
+        auto& ch = *shards_[from]->out[to];
+        if (ch.drain_scheduled.exchange(true)) return;
+        as::post(
+            shards_[to]->ioc,
+            [this, from, to] {
+                drain(from, to);
+            }
+        );
+    }
+
+    // called on the thread of the shard to
+    void drain(std::size_t from, std::size_t to) {
+        auto& ch = *shards_[from]->out[to];
+        // clear the flag first. A message pushed after that schedules the next drain.
+        ch.drain_scheduled = false;
+        auto& b = shards_[to]->b;
+        ch.queue.consume_all(
+            [&](forwarded_publish_sp const& m) {
+                b.publish_local(m->topic, m->contents, m->pubopts, m->props);
+            }
+        );
+        if (ch.overflowed) {
+            as::post(
+                shards_[from]->ioc,
+                [this, from, to] {
+                    flush_overflow(from, to);
+                }
+            );
+        }
+    }
+
+    // called on the thread of the shard from
+    void flush_overflow(std::size_t from, std::size_t to) {
+        auto& ch = *shards_[from]->out[to];
+        while (!ch.overflow.empty() && ch.queue.push(ch.overflow.front())) {
+            ch.overflow.pop_front();
+        }
+        if (ch.overflow.empty()) ch.overflowed = false;
+        schedule_drain(from, to);
+    }
+
+    std::vector<std::unique_ptr<shard_entry>> shards_;
+};
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_BROKER_SHARDS_HPP
@@ -12,9 +12,34 @@
 #include <mqtt/broker/broker_namespace.hpp>
 #include <mqtt/server.hpp>
 
+/**
+ * @brief The protocol version that the broker accepts.
+ *
+ * Define MQTT_BROKER_PROTOCOL_VERSION as v3_1_1 or v5 to build a broker that accepts only the
+ * version. The endpoint code for the other version is not compiled, and a CONNECT of the other
+ * version is rejected. If it is not defined, the version is decided on each CONNECT.
+ */
+#if !defined(MQTT_BROKER_PROTOCOL_VERSION)
+#define MQTT_BROKER_PROTOCOL_VERSION undetermined
+#endif // !defined(MQTT_BROKER_PROTOCOL_VERSION)
+
 MQTT_BROKER_NS_BEGIN
 
-using endpoint_t = server<>::endpoint_t;
+static constexpr protocol_version broker_protocol_version = protocol_version::MQTT_BROKER_PROTOCOL_VERSION;
+
+// The servers whose endpoints are passed to broker_t::handle_accept().
+using server_t = server<strand, std::mutex, std::lock_guard, 2, packet_id_manager, broker_protocol_version>;
+#if defined(MQTT_USE_TLS)
+using server_tls_t = server_tls<strand, std::mutex, std::lock_guard, 2, packet_id_manager, broker_protocol_version>;
+#endif // defined(MQTT_USE_TLS)
+#if defined(MQTT_USE_WS)
+using server_ws_t = server_ws<strand, std::mutex, std::lock_guard, 2, packet_id_manager, broker_protocol_version>;
+#if defined(MQTT_USE_TLS)
+using server_tls_ws_t = server_tls_ws<strand, std::mutex, std::lock_guard, 2, packet_id_manager, broker_protocol_version>;
+#endif // defined(MQTT_USE_TLS)
+#endif // defined(MQTT_USE_WS)
+
+using endpoint_t = server_t::endpoint_t;
 using con_sp_t = std::shared_ptr<endpoint_t>;
 using con_wp_t = std::weak_ptr<endpoint_t>;
 using packet_id_t = endpoint_t::packet_id_t;
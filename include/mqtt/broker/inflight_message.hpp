@@ -19,6 +19,7 @@
 #include <mqtt/visitor_util.hpp>
 
 #include <mqtt/broker/common_type.hpp>
+#include <mqtt/broker/metrics.hpp>
 #include <mqtt/broker/tags.hpp>
 #include <mqtt/broker/property_util.hpp>
 
@@ -100,6 +101,16 @@ private:
 
 class inflight_messages {
 public:
+    /**
+     * @param m metrics that the inflight messages are added to
+     */
+    explicit inflight_messages(metrics& m)
+        :metrics_(m) {}
+
+    ~inflight_messages() {
+        clear();
+    }
+
     void insert(
         store_message_variant msg,
         any life_keeper,
@@ -110,6 +121,15 @@ public:
             force_move(life_keeper),
             force_move(tim_message_expiry)
         );
+        metrics_.add(metrics::gauge::inflight_messages, 1);
+    }
+
+    void erase(packet_id_t packet_id) {
+        removed(messages_.get<tag_pid>().erase(packet_id));
+    }
+
+    void erase(std::shared_ptr<as::steady_timer> const& tim_message_expiry) {
+        removed(messages_.get<tag_tim>().erase(tim_message_expiry));
     }
 
     void send_all_messages(endpoint_t& ep) {
@@ -119,12 +139,12 @@ public:
     }
 
     void clear() {
+        removed(messages_.size());
         messages_.clear();
     }
 
-    template <typename Tag>
-    decltype(auto) get() {
-        return messages_.get<Tag>();
+    std::size_t size() const {
+        return messages_.size();
     }
 
     template <typename Tag>
@@ -133,6 +153,10 @@ public:
     }
 
 private:
+    void removed(std::size_t count) {
+        metrics_.add(metrics::gauge::inflight_messages, -static_cast<std::int64_t>(count));
+    }
+
     using mi_inflight_message = mi::multi_index_container<
         inflight_message,
         mi::indexed_by<
@@ -150,6 +174,7 @@ private:
         >
     >;
 
+    metrics& metrics_;
     mi_inflight_message messages_;
 };
 
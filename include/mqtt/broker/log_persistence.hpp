@@ -0,0 +1,771 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_LOG_PERSISTENCE_HPP)
+#define MQTT_BROKER_LOG_PERSISTENCE_HPP
+
+#include <mqtt/config.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <mqtt/broker/broker_namespace.hpp>
+
+#include <mqtt/buffer.hpp>
+#include <mqtt/encoded_properties.hpp>
+#include <mqtt/property_parse.hpp>
+#include <mqtt/exception.hpp>
+#include <mqtt/error_code.hpp>
+#include <mqtt/log.hpp>
+
+#include <mqtt/broker/persistence.hpp>
+#include <mqtt/append_log.hpp>
+#include <mqtt/broker/property_util.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+namespace as = boost::asio;
+
+/**
+ * @brief Configuration of log_persistence
+ */
+struct log_persistence_config {
+    /// The log is synced by the timer every sync.interval. If sync.bytes is 0, each record is
+    /// synced when it is written instead. Other values of sync.bytes are not used.
+    append_log::sync_policy sync;
+    /// the log is never compacted while it is smaller than this size
+    std::size_t compaction_min_bytes = 64 * 1024 * 1024;
+    /// compact when the log grows to this ratio of the last compacted size
+    std::size_t compaction_ratio = 2;
+};
+
+/**
+ * @brief persistence implementation that is backed by an append only log file.
+ *
+ * Each update is appended to the log as a record. The records are synced to the storage
+ * periodically by a timer on the given io_context. So the updates in the last sync interval
+ * could be lost on crash.
+ *
+ * log_persistence keeps an index of the current state in memory: the sessions and their
+ * subscriptions, and the log offsets of the offline states, the offline messages, and the retained
+ * messages. The contents of the messages are not kept. They are read from the log again to restore
+ * the broker and to compact the log. When the log grows to compaction_ratio times larger than
+ * the last compacted size (and at least compaction_min_bytes), the log is rewritten
+ * with the current state only.
+ *
+ * The broker calls the update functions from its handlers, sometimes while it holds its own
+ * locks. So they only append to the stdio buffer. The fsync and the compaction are done by the
+ * timer handler.
+ */
+class log_persistence : public persistence {
+public:
+    using config = log_persistence_config;
+
+    /**
+     * @brief Open the log and load the state from it.
+     * @param timer_ioc io_context for the periodic sync timer
+     * @param path      log file path
+     * @param c         config
+     */
+    log_persistence(as::io_context& timer_ioc, std::string path, config c = config())
+        : config_(force_move(c)),
+          log_(force_move(path), config_.sync),
+          tim_sync_(timer_ioc)
+    {
+        bool complete = log_.replay(
+            [this](std::uint8_t type, buffer payload, std::size_t offset) {
+                apply(static_cast<record>(type), force_move(payload), offset);
+            }
+        );
+        MQTT_LOG("mqtt_broker", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "log_persistence loaded"
+            << " path:" << log_.path()
+            << " size:" << log_.size()
+            << " sessions:" << sessions_.size()
+            << " retained:" << retains_.size()
+            << " complete:" << complete;
+        // A broken record at the tail must be removed before appending.
+        if (!complete || log_.size() >= config_.compaction_min_bytes) {
+            compact_no_lock();
+        }
+        compacted_size_ = log_.size();
+        set_sync_timer();
+    }
+
+    ~log_persistence() {
+        tim_sync_.cancel();
+    }
+
+    void put_session(
+        buffer const& client_id,
+        protocol_version version,
+        optional<std::chrono::steady_clock::duration> session_expiry_interval) override {
+        std::string s;
+        encode_session(s, client_id, version, session_expiry_interval);
+        write(record::put_session, force_move(s));
+    }
+
+    void erase_session(buffer const& client_id) override {
+        std::lock_guard<std::mutex> g(mtx_);
+        if (sessions_.find(client_id) == sessions_.end()) return;
+        std::string s;
+        put_str(s, client_id);
+        write_no_lock(record::erase_session, force_move(s));
+    }
+
+    void session_offline(
+        buffer const& client_id,
+        std::vector<buffer> inflight_messages,
+        std::set<packet_id_t> const& qos2_publish_handled) override {
+        std::string s;
+        encode_offline(
+            s,
+            client_id,
+            std::chrono::system_clock::now(),
+            inflight_messages,
+            qos2_publish_handled
+        );
+        write(record::session_offline, force_move(s));
+    }
+
+    void session_online(buffer const& client_id) override {
+        std::string s;
+        put_str(s, client_id);
+        write(record::session_online, force_move(s));
+    }
+
+    void put_subscription(
+        buffer const& client_id,
+        buffer const& share_name,
+        buffer const& topic_filter,
+        subscribe_options subopts,
+        optional<std::size_t> sid) override {
+        std::string s;
+        encode_subscription(s, client_id, share_name, topic_filter, subopts, sid);
+        write(record::put_subscription, force_move(s));
+    }
+
+    void erase_subscription(
+        buffer const& client_id,
+        buffer const& share_name,
+        buffer const& topic_filter) override {
+        std::string s;
+        put_str(s, client_id);
+        put_str(s, share_name);
+        put_str(s, topic_filter);
+        write(record::erase_subscription, force_move(s));
+    }
+
+    std::uint64_t push_offline_message(
+        buffer const& client_id,
+        buffer const& topic,
+        buffer const& contents,
+        publish_options pubopts,
+        v5::properties const& props) override {
+        std::lock_guard<std::mutex> g(mtx_);
+        auto id = next_offline_id_;
+        std::string s;
+        put_str(s, client_id);
+        put_uint(s, id, 8);
+        encode_message(s, topic, contents, pubopts, props, expiry(props));
+        write_no_lock(record::push_offline_message, force_move(s));
+        return id;
+    }
+
+    void erase_offline_message(buffer const& client_id, std::uint64_t id) override {
+        std::string s;
+        put_str(s, client_id);
+        put_uint(s, id, 8);
+        write(record::erase_offline_message, force_move(s));
+    }
+
+    void put_retained(
+        buffer const& topic,
+        buffer const& contents,
+        v5::properties const& props,
+        qos qos_value) override {
+        std::string s;
+        encode_message(s, topic, contents, qos_value | MQTT_NS::retain::yes, props, expiry(props));
+        write(record::put_retained, force_move(s));
+    }
+
+    void erase_retained(buffer const& topic) override {
+        std::lock_guard<std::mutex> g(mtx_);
+        if (retains_.find(topic) == retains_.end() &&
+            erased_retains_.find(topic) != erased_retains_.end()) return;
+        std::string s;
+        put_str(s, topic);
+        put_uint(s, next_tombstone_seq_, 8);
+        write_no_lock(record::erase_retained, force_move(s));
+    }
+
+    std::uint64_t retained_snapshot_mark() override {
+        std::lock_guard<std::mutex> g(mtx_);
+        return next_tombstone_seq_;
+    }
+
+    void retained_snapshot_saved(std::uint64_t mark) override {
+        std::string s;
+        put_uint(s, mark, 8);
+        write(record::retained_snapshot_saved, force_move(s));
+    }
+
+    void for_each_session(std::function<void(stored_session const&)> const& f) override {
+        std::lock_guard<std::mutex> g(mtx_);
+        auto now = std::chrono::system_clock::now();
+        for (auto const& e : sessions_) {
+            auto const& si = e.second;
+            stored_session ss;
+            ss.client_id = si.client_id;
+            ss.version = si.version;
+            ss.session_expiry_interval = si.session_expiry_interval;
+            ss.subscriptions = si.subscriptions;
+            if (si.offline_offset) {
+                reader r(read(record::session_offline, si.offline_offset.value()));
+                r.get_str(); // client_id
+                ss.offline_at = r.get_time_point();
+                for (auto n = r.get_uint(4); n != 0; --n) {
+                    ss.inflight_messages.push_back(r.get_str());
+                }
+                for (auto n = r.get_uint(4); n != 0; --n) {
+                    ss.qos2_publish_handled.insert(static_cast<packet_id_t>(r.get_uint(4)));
+                }
+            }
+            for (auto const& om : si.offline_messages) {
+                if (expired(om.second, now)) continue;
+                reader r(read(record::push_offline_message, om.second.offset));
+                r.get_str(); // client_id
+                r.get_uint(8); // id
+                ss.offline_messages.emplace(om.first, r.get_message());
+            }
+            f(ss);
+        }
+    }
+
+    void for_each_retained(std::function<void(stored_message const&)> const& f) override {
+        std::lock_guard<std::mutex> g(mtx_);
+        auto now = std::chrono::system_clock::now();
+        for (auto const& e : retains_) {
+            if (expired(e.second, now)) continue;
+            reader r(read(record::put_retained, e.second.offset));
+            f(r.get_message());
+        }
+    }
+
+    void for_each_erased_retained(std::function<void(buffer const&)> const& f) override {
+        std::lock_guard<std::mutex> g(mtx_);
+        for (auto const& e : erased_retains_) {
+            f(e.first);
+        }
+    }
+
+    /**
+     * @brief Sync the appended records to the storage.
+     */
+    void sync() {
+        std::lock_guard<std::mutex> g(mtx_);
+        log_.sync();
+    }
+
+    /**
+     * @brief Rewrite the log with the current state.
+     */
+    void compact() {
+        std::lock_guard<std::mutex> g(mtx_);
+        compact_no_lock();
+    }
+
+    /**
+     * @brief Get the size of the log file
+     * @return size in bytes
+     */
+    std::size_t log_size() const {
+        std::lock_guard<std::mutex> g(mtx_);
+        return log_.size();
+    }
+
+private:
+    /// index of a message record
+    struct message_index {
+        std::size_t offset;
+        optional<std::chrono::system_clock::time_point> expiry;
+    };
+
+    /// index of a session. The strings are copied from the records.
+    struct session_index {
+        buffer client_id;
+        protocol_version version = protocol_version::undetermined;
+        optional<std::chrono::steady_clock::duration> session_expiry_interval;
+        std::vector<stored_subscription> subscriptions;
+        /// offset of the session_offline record. nullopt while the session is online.
+        optional<std::size_t> offline_offset;
+        /// key is the id of the offline message
+        std::map<std::uint64_t, message_index> offline_messages;
+    };
+
+    enum class record : std::uint8_t {
+        put_session = 1,
+        erase_session,
+        session_offline,
+        session_online,
+        put_subscription,
+        erase_subscription,
+        push_offline_message,
+        erase_offline_message,
+        put_retained,
+        erase_retained,
+        retained_snapshot_saved,
+    };
+
+    // encoders
+
+    static void put_uint(std::string& s, std::uint64_t v, std::size_t bytes) {
+        for (std::size_t i = bytes; i != 0; --i) {
+            s.push_back(static_cast<char>(v >> ((i - 1) * 8)));
+        }
+    }
+
+    static void put_str(std::string& s, string_view v) {
+        put_uint(s, v.size(), 4);
+        s.append(v.data(), v.size());
+    }
+
+    static void put_opt(std::string& s, optional<std::int64_t> v) {
+        if (v) {
+            s.push_back(1);
+            put_uint(s, static_cast<std::uint64_t>(v.value()), 8);
+        }
+        else {
+            s.push_back(0);
+        }
+    }
+
+    static optional<std::int64_t> to_ms(optional<std::chrono::system_clock::time_point> tp) {
+        if (!tp) return nullopt;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(tp.value().time_since_epoch()).count();
+    }
+
+    static optional<std::int64_t> to_ms(optional<std::chrono::steady_clock::duration> d) {
+        if (!d) return nullopt;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(d.value()).count();
+    }
+
+    static void encode_session(
+        std::string& s,
+        buffer const& client_id,
+        protocol_version version,
+        optional<std::chrono::steady_clock::duration> session_expiry_interval) {
+        put_str(s, client_id);
+        s.push_back(static_cast<char>(version));
+        put_opt(s, to_ms(session_expiry_interval));
+    }
+
+    static void encode_offline(
+        std::string& s,
+        buffer const& client_id,
+        std::chrono::system_clock::time_point offline_at,
+        std::vector<buffer> const& inflight_messages,
+        std::set<packet_id_t> const& qos2_publish_handled) {
+        put_str(s, client_id);
+        put_opt(s, to_ms(offline_at));
+        put_uint(s, inflight_messages.size(), 4);
+        for (auto const& m : inflight_messages) put_str(s, m);
+        put_uint(s, qos2_publish_handled.size(), 4);
+        for (auto pid : qos2_publish_handled) put_uint(s, pid, 4);
+    }
+
+    static void encode_subscription(
+        std::string& s,
+        buffer const& client_id,
+        buffer const& share_name,
+        buffer const& topic_filter,
+        subscribe_options subopts,
+        optional<std::size_t> sid) {
+        put_str(s, client_id);
+        put_str(s, share_name);
+        put_str(s, topic_filter);
+        s.push_back(static_cast<char>(static_cast<std::uint8_t>(subopts)));
+        put_opt(s, sid ? optional<std::int64_t>(static_cast<std::int64_t>(sid.value())) : nullopt);
+    }
+
+    static void encode_message(
+        std::string& s,
+        buffer const& topic,
+        buffer const& contents,
+        publish_options pubopts,
+        v5::properties const& props,
+        optional<std::chrono::system_clock::time_point> expiry) {
+        put_str(s, topic);
+        put_str(s, contents);
+        s.push_back(static_cast<char>(static_cast<std::uint8_t>(pubopts)));
+        put_str(s, props.empty() ? buffer() : v5::encoded_properties(props).bytes());
+        put_opt(s, to_ms(expiry));
+    }
+
+    static optional<std::chrono::system_clock::time_point> expiry(v5::properties const& props) {
+        if (auto v = get_property<v5::property::message_expiry_interval>(props)) {
+            return std::chrono::system_clock::now() + std::chrono::seconds(v.value().val());
+        }
+        return nullopt;
+    }
+
+    static bool expired(stored_message const& m, std::chrono::system_clock::time_point now) {
+        return m.expiry && m.expiry.value() <= now;
+    }
+
+    static bool expired(message_index const& m, std::chrono::system_clock::time_point now) {
+        return m.expiry && m.expiry.value() <= now;
+    }
+
+    // decoder
+
+    class reader {
+    public:
+        explicit reader(buffer buf) : buf_(force_move(buf)) {}
+
+        std::uint64_t get_uint(std::size_t bytes) {
+            if (buf_.size() < bytes) throw malformed_packet_error();
+            std::uint64_t v = 0;
+            for (std::size_t i = 0; i != bytes; ++i) {
+                v = (v << 8) | static_cast<std::uint8_t>(buf_[i]);
+            }
+            buf_.remove_prefix(bytes);
+            return v;
+        }
+
+        buffer get_str() {
+            auto len = static_cast<std::size_t>(get_uint(4));
+            if (buf_.size() < len) throw malformed_packet_error();
+            auto ret = buf_.substr(0, len);
+            buf_.remove_prefix(len);
+            return ret;
+        }
+
+        optional<std::int64_t> get_opt() {
+            if (get_uint(1) == 0) return nullopt;
+            return static_cast<std::int64_t>(get_uint(8));
+        }
+
+        optional<std::chrono::system_clock::time_point> get_time_point() {
+            if (auto v = get_opt()) {
+                return std::chrono::system_clock::time_point(
+                    std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                        std::chrono::milliseconds(v.value())
+                    )
+                );
+            }
+            return nullopt;
+        }
+
+        /**
+         * @brief Skip the message fields except expiry
+         * @return expiry of the message
+         */
+        optional<std::chrono::system_clock::time_point> get_message_expiry() {
+            get_str(); // topic
+            get_str(); // contents
+            get_uint(1); // pubopts
+            get_str(); // props
+            return get_time_point();
+        }
+
+        stored_message get_message() {
+            stored_message m;
+            m.topic = get_str();
+            m.contents = get_str();
+            m.pubopts = publish_options(static_cast<std::uint8_t>(get_uint(1)));
+            m.props = v5::property::parse(get_str());
+            m.expiry = get_time_point();
+            return m;
+        }
+
+    private:
+        buffer buf_;
+    };
+
+    void write(record type, std::string payload) {
+        std::lock_guard<std::mutex> g(mtx_);
+        write_no_lock(type, force_move(payload));
+    }
+
+    void write_no_lock(record type, std::string payload) {
+        auto offset = log_.append(static_cast<std::uint8_t>(type), payload);
+        // apply() copies the fields that the index keeps, so the payload is not allocated.
+        apply(type, buffer(string_view(payload)), offset);
+        if (config_.sync.bytes == 0) log_.sync();
+    }
+
+    /**
+     * @brief Sync the log, and compact it if it has grown enough. Called by the sync timer.
+     */
+    void maintain() {
+        std::lock_guard<std::mutex> g(mtx_);
+        log_.sync();
+        if (log_.size() >= config_.compaction_min_bytes &&
+            log_.size() >= compacted_size_ * config_.compaction_ratio) {
+            compact_no_lock();
+        }
+    }
+
+    /**
+     * @brief Read the record at the offset that is indexed as type
+     */
+    buffer read(record type, std::size_t offset) const {
+        auto r = log_.read(offset);
+        if (static_cast<record>(r.first) != type) throw malformed_packet_error();
+        return force_move(r.second);
+    }
+
+    /**
+     * @brief Update the index by the record.
+     * @param payload the payload of the record. The index doesn't refer to it.
+     * @param offset  the offset of the record in the log
+     */
+    void apply(record type, buffer payload, std::size_t offset) {
+        reader r(force_move(payload));
+        switch (type) {
+        case record::put_session: {
+            auto cid = allocate_buffer(r.get_str());
+            auto& ss = sessions_[cid];
+            ss.client_id = force_move(cid);
+            ss.version = static_cast<protocol_version>(r.get_uint(1));
+            if (auto v = r.get_opt()) {
+                ss.session_expiry_interval.emplace(std::chrono::milliseconds(v.value()));
+            }
+            else {
+                ss.session_expiry_interval = nullopt;
+            }
+        } break;
+        case record::erase_session:
+            sessions_.erase(r.get_str());
+            break;
+        case record::session_offline: {
+            auto it = sessions_.find(r.get_str());
+            if (it == sessions_.end()) break;
+            it->second.offline_offset.emplace(offset);
+        } break;
+        case record::session_online: {
+            auto it = sessions_.find(r.get_str());
+            if (it == sessions_.end()) break;
+            it->second.offline_offset = nullopt;
+        } break;
+        case record::put_subscription: {
+            auto it = sessions_.find(r.get_str());
+            if (it == sessions_.end()) break;
+            auto& subs = it->second.subscriptions;
+            stored_subscription sub;
+            sub.share_name = allocate_buffer(r.get_str());
+            sub.topic_filter = allocate_buffer(r.get_str());
+            sub.subopts = subscribe_options(static_cast<std::uint8_t>(r.get_uint(1)));
+            if (auto v = r.get_opt()) sub.sid.emplace(static_cast<std::size_t>(v.value()));
+            auto sit = std::find_if(
+                subs.begin(),
+                subs.end(),
+                [&](stored_subscription const& e) {
+                    return e.share_name == sub.share_name && e.topic_filter == sub.topic_filter;
+                }
+            );
+            if (sit == subs.end()) {
+                subs.push_back(force_move(sub));
+            }
+            else {
+                *sit = force_move(sub);
+            }
+        } break;
+        case record::erase_subscription: {
+            auto it = sessions_.find(r.get_str());
+            if (it == sessions_.end()) break;
+            auto& subs = it->second.subscriptions;
+            auto share_name = r.get_str();
+            auto topic_filter = r.get_str();
+            subs.erase(
+                std::remove_if(
+                    subs.begin(),
+                    subs.end(),
+                    [&](stored_subscription const& e) {
+                        return e.share_name == share_name && e.topic_filter == topic_filter;
+                    }
+                ),
+                subs.end()
+            );
+        } break;
+        case record::push_offline_message: {
+            auto cid = r.get_str();
+            auto id = r.get_uint(8);
+            if (id >= next_offline_id_) next_offline_id_ = id + 1;
+            auto it = sessions_.find(cid);
+            if (it == sessions_.end()) break;
+            it->second.offline_messages[id] = message_index { offset, r.get_message_expiry() };
+        } break;
+        case record::erase_offline_message: {
+            auto it = sessions_.find(r.get_str());
+            if (it == sessions_.end()) break;
+            it->second.offline_messages.erase(r.get_uint(8));
+        } break;
+        case record::put_retained: {
+            auto expiry = reader(r).get_message_expiry();
+            auto topic = r.get_str();
+            erased_retains_.erase(topic);
+            auto it = retains_.find(topic);
+            if (it == retains_.end()) {
+                retains_.emplace(allocate_buffer(topic), message_index { offset, expiry });
+            }
+            else {
+                it->second = message_index { offset, expiry };
+            }
+        } break;
+        case record::erase_retained: {
+            auto topic = r.get_str();
+            auto seq = r.get_uint(8);
+            if (seq >= next_tombstone_seq_) next_tombstone_seq_ = seq + 1;
+            retains_.erase(topic);
+            auto it = erased_retains_.find(topic);
+            if (it == erased_retains_.end()) {
+                erased_retains_.emplace(allocate_buffer(topic), seq);
+            }
+            else {
+                it->second = seq;
+            }
+        } break;
+        case record::retained_snapshot_saved: {
+            auto mark = r.get_uint(8);
+            if (mark > next_tombstone_seq_) next_tombstone_seq_ = mark;
+            for (auto it = erased_retains_.begin(); it != erased_retains_.end();) {
+                if (it->second < mark) {
+                    it = erased_retains_.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        } break;
+        default:
+            MQTT_LOG("mqtt_broker", warning)
+                << MQTT_ADD_VALUE(address, this)
+                << "unknown record type:" << static_cast<int>(type);
+            break;
+        }
+    }
+
+    void compact_no_lock() {
+        auto now = std::chrono::system_clock::now();
+        // The offsets in the new log. They are applied to the index after the rewrite succeeds.
+        std::vector<std::size_t> offsets;
+        log_.rewrite(
+            [&](auto&& append) {
+                std::string s;
+                auto write_record =
+                    [&](record type) {
+                        append(static_cast<std::uint8_t>(type), s);
+                        s.clear();
+                    };
+                auto copy_record =
+                    [&](record type, std::size_t offset) {
+                        offsets.push_back(append(static_cast<std::uint8_t>(type), read(type, offset)));
+                    };
+                for (auto const& e : sessions_) {
+                    auto const& ss = e.second;
+                    encode_session(s, ss.client_id, ss.version, ss.session_expiry_interval);
+                    write_record(record::put_session);
+                    for (auto const& sub : ss.subscriptions) {
+                        encode_subscription(s, ss.client_id, sub.share_name, sub.topic_filter, sub.subopts, sub.sid);
+                        write_record(record::put_subscription);
+                    }
+                    if (ss.offline_offset) {
+                        copy_record(record::session_offline, ss.offline_offset.value());
+                    }
+                    for (auto const& om : ss.offline_messages) {
+                        if (expired(om.second, now)) continue;
+                        copy_record(record::push_offline_message, om.second.offset);
+                    }
+                }
+                for (auto const& e : retains_) {
+                    if (expired(e.second, now)) {
+                        // The snapshot could have an older message of the topic.
+                        put_str(s, e.first);
+                        put_uint(s, next_tombstone_seq_, 8);
+                        write_record(record::erase_retained);
+                        continue;
+                    }
+                    copy_record(record::put_retained, e.second.offset);
+                }
+                for (auto const& e : erased_retains_) {
+                    put_str(s, e.first);
+                    put_uint(s, e.second, 8);
+                    write_record(record::erase_retained);
+                }
+            }
+        );
+
+        auto it = offsets.begin();
+        for (auto& e : sessions_) {
+            auto& ss = e.second;
+            if (ss.offline_offset) ss.offline_offset.emplace(*it++);
+            for (auto om = ss.offline_messages.begin(); om != ss.offline_messages.end();) {
+                if (expired(om->second, now)) {
+                    om = ss.offline_messages.erase(om);
+                }
+                else {
+                    om->second.offset = *it++;
+                    ++om;
+                }
+            }
+        }
+        bool tombstoned = false;
+        for (auto rm = retains_.begin(); rm != retains_.end();) {
+            if (expired(rm->second, now)) {
+                erased_retains_[rm->first] = next_tombstone_seq_;
+                tombstoned = true;
+                rm = retains_.erase(rm);
+            }
+            else {
+                rm->second.offset = *it++;
+                ++rm;
+            }
+        }
+        BOOST_ASSERT(it == offsets.end());
+        if (tombstoned) ++next_tombstone_seq_;
+
+        compacted_size_ = log_.size();
+        MQTT_LOG("mqtt_broker", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "log_persistence compacted"
+            << " size:" << compacted_size_;
+    }
+
+    void set_sync_timer() {
+        tim_sync_.expires_after(config_.sync.interval);
+        tim_sync_.async_wait(
+            [this](error_code ec) {
+                if (ec) return;
+                maintain();
+                set_sync_timer();
+            }
+        );
+    }
+
+private:
+    config config_;
+    mutable std::mutex mtx_;
+    append_log log_;
+    as::steady_timer tim_sync_;
+    std::map<buffer, session_index> sessions_;
+    std::map<buffer, message_index> retains_;
+    /// tombstones of the erased retained messages. value is the sequence number of the tombstone.
+    std::map<buffer, std::uint64_t> erased_retains_;
+    std::uint64_t next_tombstone_seq_ = 0;
+    std::uint64_t next_offline_id_ = 1;
+    std::size_t compacted_size_ = 0;
+};
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_LOG_PERSISTENCE_HPP
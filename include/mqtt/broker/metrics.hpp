@@ -0,0 +1,204 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_METRICS_HPP)
+#define MQTT_BROKER_METRICS_HPP
+
+#include <mqtt/config.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include <mqtt/broker/broker_namespace.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+/**
+ * @brief Snapshot of a histogram.
+ *
+ * Values are kept in log-linear buckets like HdrHistogram. Each power of two range is split
+ * into 8 buckets, so the reported values are within 12.5% of the recorded ones.
+ */
+class histogram_snapshot {
+public:
+    static constexpr std::size_t sub_bucket_bits = 3;
+    static constexpr std::size_t sub_buckets = 1 << sub_bucket_bits;
+    static constexpr std::size_t buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+    static std::size_t bucket_index(std::uint64_t v) {
+        if (v < sub_buckets) return static_cast<std::size_t>(v);
+        std::size_t msb = 63;
+        while (!(v >> msb)) --msb;
+        auto sub = static_cast<std::size_t>(v >> (msb - sub_bucket_bits)) & (sub_buckets - 1);
+        return (msb - sub_bucket_bits + 1) * sub_buckets + sub;
+    }
+
+    // The smallest value of the bucket
+    static std::uint64_t bucket_value(std::size_t index) {
+        if (index < sub_buckets) return index;
+        auto msb = index / sub_buckets + sub_bucket_bits - 1;
+        auto sub = index % sub_buckets;
+        return (std::uint64_t(1) << msb) | (std::uint64_t(sub) << (msb - sub_bucket_bits));
+    }
+
+    std::uint64_t count() const {
+        return count_;
+    }
+
+    /**
+     * @brief Add count values to the bucket.
+     */
+    void add(std::size_t bucket, std::uint64_t count) {
+        counts_[bucket] += count;
+        count_ += count;
+    }
+
+    /**
+     * @brief Get the value at the percentile.
+     * @param percentile 0.0 to 100.0
+     * @return the smallest value of the bucket that contains the percentile. 0 if empty.
+     */
+    std::uint64_t value_at_percentile(double percentile) const {
+        if (count_ == 0) return 0;
+        auto target = static_cast<std::uint64_t>(static_cast<double>(count_) * percentile / 100.0);
+        if (target == 0) target = 1;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i != buckets; ++i) {
+            seen += counts_[i];
+            if (seen >= target) return bucket_value(i);
+        }
+        return max();
+    }
+
+    std::uint64_t max() const {
+        for (std::size_t i = buckets; i != 0; --i) {
+            if (counts_[i - 1] != 0) return bucket_value(i - 1);
+        }
+        return 0;
+    }
+
+private:
+    std::array<std::uint64_t, buckets> counts_ {};
+    std::uint64_t count_ = 0;
+};
+
+/**
+ * @brief Broker metrics registry.
+ *
+ * Counters and histograms only grow. Gauges are the current amount of a resource,
+ * they are added when the resource is taken and subtracted when it is released.
+ *
+ * Recording is wait-free. Each thread writes to one of a fixed number of cache line aligned
+ * stripes with relaxed atomic additions, so threads rarely share a cache line.
+ * Reading sums up all stripes, so it is slower and meant to be called periodically.
+ */
+class metrics {
+public:
+    enum class counter : std::size_t {
+        publish_received,   ///< PUBLISH packets received from clients
+        publish_sent,       ///< messages delivered to subscribers, including offline ones
+        num_of_counters
+    };
+
+    enum class histogram : std::size_t {
+        fan_out,            ///< number of subscribers that a PUBLISH is delivered to
+        match_latency,      ///< subscription match and delivery time of a PUBLISH (nanoseconds)
+        num_of_histograms
+    };
+
+    enum class gauge : std::size_t {
+        connected_clients,  ///< sessions that have a connection
+        offline_messages,   ///< messages stored for offline sessions
+        offline_bytes,      ///< topic and payload bytes of the messages stored for offline sessions
+        inflight_messages,  ///< inflight messages kept for offline sessions
+        num_of_gauges
+    };
+
+    metrics()
+        :stripes_(new stripe[num_of_stripes]) {}
+
+    void add(counter c, std::uint64_t v = 1) noexcept {
+        local().counters[static_cast<std::size_t>(c)].fetch_add(v, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Add v to the gauge. Pass a negative value to subtract.
+     *        The increment and the decrement can be recorded on different stripes,
+     *        so only the sum of the stripes is meaningful.
+     */
+    void add(gauge g, std::int64_t v) noexcept {
+        local().gauges[static_cast<std::size_t>(g)].fetch_add(v, std::memory_order_relaxed);
+    }
+
+    void record(histogram h, std::uint64_t v) noexcept {
+        local().histograms[static_cast<std::size_t>(h)][histogram_snapshot::bucket_index(v)]
+            .fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::uint64_t get(counter c) const {
+        std::uint64_t sum = 0;
+        for (std::size_t i = 0; i != num_of_stripes; ++i) {
+            sum += stripes_[i].counters[static_cast<std::size_t>(c)].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    std::int64_t get(gauge g) const {
+        std::int64_t sum = 0;
+        for (std::size_t i = 0; i != num_of_stripes; ++i) {
+            sum += stripes_[i].gauges[static_cast<std::size_t>(g)].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    histogram_snapshot get(histogram h) const {
+        histogram_snapshot s;
+        for (std::size_t i = 0; i != num_of_stripes; ++i) {
+            auto const& buckets = stripes_[i].histograms[static_cast<std::size_t>(h)];
+            for (std::size_t b = 0; b != histogram_snapshot::buckets; ++b) {
+                s.add(b, buckets[b].load(std::memory_order_relaxed));
+            }
+        }
+        return s;
+    }
+
+private:
+    static constexpr std::size_t num_of_stripes = 16;
+    static constexpr std::size_t num_of_counters = static_cast<std::size_t>(counter::num_of_counters);
+    static constexpr std::size_t num_of_histograms = static_cast<std::size_t>(histogram::num_of_histograms);
+    static constexpr std::size_t num_of_gauges = static_cast<std::size_t>(gauge::num_of_gauges);
+
+    // The padding keeps the counters of neighbouring stripes on different cache lines.
+    // alignas is not used because operator new ignores over-alignment before C++17.
+    struct stripe {
+        char padding[64];
+        std::array<std::atomic<std::uint64_t>, num_of_counters> counters {};
+        std::array<std::atomic<std::int64_t>, num_of_gauges> gauges {};
+        std::array<
+            std::array<std::atomic<std::uint64_t>, histogram_snapshot::buckets>,
+            num_of_histograms
+        > histograms {};
+    };
+
+    stripe& local() noexcept {
+        return stripes_[stripe_index()];
+    }
+
+    // Each thread gets a stripe in round robin when it records first.
+    static std::size_t stripe_index() noexcept {
+        static std::atomic<std::size_t> next { 0 };
+        thread_local std::size_t index = next.fetch_add(1, std::memory_order_relaxed) % num_of_stripes;
+        return index;
+    }
+
+    std::unique_ptr<stripe[]> stripes_;
+};
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_METRICS_HPP
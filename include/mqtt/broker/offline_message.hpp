@@ -21,6 +21,7 @@
 
 #include <mqtt/broker/broker_namespace.hpp>
 #include <mqtt/broker/common_type.hpp>
+#include <mqtt/broker/metrics.hpp>
 #include <mqtt/broker/tags.hpp>
 #include <mqtt/broker/property_util.hpp>
 
@@ -41,15 +42,31 @@ public:
         buffer contents,
         publish_options pubopts,
         v5::properties props,
-        std::shared_ptr<as::steady_timer> tim_message_expiry)
+        std::shared_ptr<as::steady_timer> tim_message_expiry,
+        std::uint64_t persistence_id = 0)
         : topic_(force_move(topic)),
           contents_(force_move(contents)),
           pubopts_(pubopts),
           props_(force_move(props)),
-          tim_message_expiry_(force_move(tim_message_expiry))
+          tim_message_expiry_(force_move(tim_message_expiry)),
+          persistence_id_(persistence_id)
     { }
 
-    bool send(endpoint_t& ep) {
+    /**
+     * @brief Get the id that is returned by persistence::push_offline_message()
+     * @return id. 0 means the message is not persisted.
+     */
+    std::uint64_t persistence_id() const {
+        return persistence_id_;
+    }
+
+    /**
+     * @brief Send the message
+     * @param ep         endpoint to send
+     * @param on_written handler that is called when the message is written to the socket
+     * @return true if the message is sent, false if packet_id is exhausted
+     */
+    bool send(endpoint_t& ep, std::function<void(error_code)> on_written = {}) {
         auto props = props_;
         if (tim_message_expiry_) {
             auto d =
@@ -75,24 +92,20 @@ public:
                     pubopts_,
                     force_move(props),
                     any{},
-                    [sp = ep.shared_from_this()]
-                    (error_code ec) {
-                        if (ec) {
-                            MQTT_LOG("mqtt_broker", warning)
-                                << MQTT_ADD_VALUE(address, sp.get())
-                                << ec.message();
-                        }
-                    }
+                    make_written_handler(ep, force_move(on_written))
                 );
                 return true;
             }
         }
         else {
-            ep.publish(
-                topic_,
-                contents_,
+            ep.async_publish(
+                0,
+                force_move(topic_),
+                force_move(contents_),
                 pubopts_,
-                force_move(props)
+                force_move(props),
+                any{},
+                make_written_handler(ep, force_move(on_written))
             );
             return true;
         }
@@ -102,16 +115,54 @@ public:
 private:
     friend class offline_messages;
 
+    static std::function<void(error_code)> make_written_handler(
+        endpoint_t& ep,
+        std::function<void(error_code)> on_written) {
+        return
+            [sp = ep.shared_from_this(), on_written = force_move(on_written)]
+            (error_code ec) {
+                if (ec) {
+                    MQTT_LOG("mqtt_broker", warning)
+                        << MQTT_ADD_VALUE(address, sp.get())
+                        << ec.message();
+                }
+                if (on_written) on_written(ec);
+            };
+    }
+
     buffer topic_;
     buffer contents_;
+    std::size_t size_ = topic_.size() + contents_.size(); ///< kept after topic_ and contents_ are sent
     publish_options pubopts_;
     v5::properties props_;
     std::shared_ptr<as::steady_timer> tim_message_expiry_;
+    std::uint64_t persistence_id_;
 };
 
 class offline_messages {
 public:
+    /**
+     * @param m metrics that the offline messages and their bytes are added to
+     */
+    explicit offline_messages(metrics& m)
+        :metrics_(m) {}
+
+    ~offline_messages() {
+        clear();
+    }
+
     void send_until_fail(endpoint_t& ep) {
+        send_until_fail(ep, [](offline_message const&) {});
+    }
+
+    /**
+     * @brief Send messages from the front until the packet id is exhausted.
+     * @param ep      endpoint to send
+     * @param on_sent void(offline_message const&) that is called for each sent message
+     *                before it is removed.
+     */
+    template <typename SentHandler>
+    void send_until_fail(endpoint_t& ep, SentHandler&& on_sent) {
         auto& idx = messages_.get<tag_seq>();
         while (!idx.empty()) {
             auto it = idx.begin();
@@ -120,6 +171,8 @@ public:
             // See https://github.com/boostorg/multi_index/issues/50
             auto& m = const_cast<offline_message&>(*it);
             if (m.send(ep)) {
+                on_sent(m);
+                removed(1, m.size_);
                 idx.pop_front();
             }
             else {
@@ -128,7 +181,45 @@ public:
         }
     }
 
+    /**
+     * @brief Send at most max_count messages from the front until the packet id is exhausted.
+     * @param ep         endpoint to send
+     * @param on_sent    void(offline_message const&) that is called for each sent message
+     *                   before it is removed.
+     * @param max_count  the maximum number of messages to send. 0 means unlimited.
+     * @param on_written handler that is called when the last sent message is written to the socket
+     * @return true if on_written will be called, false if no message is sent
+     *         or packet_id is exhausted before max_count messages are sent
+     */
+    template <typename SentHandler>
+    bool send_until_fail(
+        endpoint_t& ep,
+        SentHandler&& on_sent,
+        std::size_t max_count,
+        std::function<void(error_code)> on_written) {
+        auto& idx = messages_.get<tag_seq>();
+        std::size_t count = 0;
+        while (!idx.empty() && (max_count == 0 || count != max_count)) {
+            auto it = idx.begin();
+            bool last = count + 1 == max_count || std::next(it) == idx.end();
+
+            // const_cast is appropriate here
+            // See https://github.com/boostorg/multi_index/issues/50
+            auto& m = const_cast<offline_message&>(*it);
+            if (!m.send(ep, last ? force_move(on_written) : std::function<void(error_code)>())) {
+                return false;
+            }
+            on_sent(m);
+            removed(1, m.size_);
+            idx.pop_front();
+            ++count;
+            if (last) return true;
+        }
+        return false;
+    }
+
     void clear() {
+        removed(messages_.size(), bytes_);
         messages_.clear();
     }
 
@@ -136,12 +227,24 @@ public:
         return messages_.empty();
     }
 
+    std::size_t size() const {
+        return messages_.size();
+    }
+
+    /**
+     * @brief Get the total size of the topics and the payloads of the stored messages.
+     */
+    std::size_t bytes() const {
+        return bytes_;
+    }
+
     void push_back(
         as::io_context& timer_ioc,
         buffer pub_topic,
         buffer contents,
         publish_options pubopts,
-        v5::properties props) {
+        v5::properties props,
+        std::uint64_t persistence_id = 0) {
         optional<std::chrono::steady_clock::duration> message_expiry_interval;
 
         auto v = get_property<v5::property::message_expiry_interval>(props);
@@ -156,24 +259,41 @@ public:
                 [this, wp = std::weak_ptr<as::steady_timer>(tim_message_expiry)](error_code ec) mutable {
                     if (auto sp = wp.lock()) {
                         if (!ec) {
-                            messages_.get<tag_tim>().erase(sp);
+                            auto& idx = messages_.get<tag_tim>();
+                            auto r = idx.equal_range(sp);
+                            for (auto it = r.first; it != r.second; ++it) removed(1, it->size_);
+                            idx.erase(r.first, r.second);
                         }
                     }
                 }
             );
         }
 
+        added(pub_topic.size() + contents.size());
         auto& seq_idx = messages_.get<tag_seq>();
         seq_idx.emplace_back(
             force_move(pub_topic),
             force_move(contents),
             pubopts,
             force_move(props),
-            force_move(tim_message_expiry)
+            force_move(tim_message_expiry),
+            persistence_id
         );
     }
 
 private:
+    void added(std::size_t bytes) {
+        bytes_ += bytes;
+        metrics_.add(metrics::gauge::offline_messages, 1);
+        metrics_.add(metrics::gauge::offline_bytes, static_cast<std::int64_t>(bytes));
+    }
+
+    void removed(std::size_t count, std::size_t bytes) {
+        bytes_ -= bytes;
+        metrics_.add(metrics::gauge::offline_messages, -static_cast<std::int64_t>(count));
+        metrics_.add(metrics::gauge::offline_bytes, -static_cast<std::int64_t>(bytes));
+    }
+
     using mi_offline_message = mi::multi_index_container<
         offline_message,
         mi::indexed_by<
@@ -187,7 +307,9 @@ private:
         >
     >;
 
+    metrics& metrics_;
     mi_offline_message messages_;
+    std::size_t bytes_ = 0;
 };
 
 MQTT_BROKER_NS_END
@@ -0,0 +1,188 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_PERSISTENCE_HPP)
+#define MQTT_BROKER_PERSISTENCE_HPP
+
+#include <mqtt/config.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <mqtt/broker/broker_namespace.hpp>
+
+#include <mqtt/buffer.hpp>
+#include <mqtt/optional.hpp>
+#include <mqtt/protocol_version.hpp>
+#include <mqtt/publish.hpp>
+#include <mqtt/subscribe_options.hpp>
+#include <mqtt/property_variant.hpp>
+
+#include <mqtt/broker/common_type.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+/**
+ * @brief Persisted subscription of a session
+ */
+struct stored_subscription {
+    buffer share_name;
+    buffer topic_filter;
+    subscribe_options subopts { std::uint8_t(0) };
+    optional<std::size_t> sid;
+};
+
+/**
+ * @brief Persisted PUBLISH message. It is used for offline messages and retained messages.
+ */
+struct stored_message {
+    buffer topic;
+    buffer contents;
+    publish_options pubopts;
+    v5::properties props;
+    /// The time when the message expires. It is calculated from Message Expiry Interval.
+    optional<std::chrono::system_clock::time_point> expiry;
+};
+
+/**
+ * @brief Persisted session state
+ */
+struct stored_session {
+    buffer client_id;
+    protocol_version version;
+    optional<std::chrono::steady_clock::duration> session_expiry_interval;
+    /// The time when the session became offline. nullopt while the session is online.
+    optional<std::chrono::system_clock::time_point> offline_at;
+    std::vector<stored_subscription> subscriptions;
+    /// key is the id returned by persistence::push_offline_message(). Ordered by the delivery order.
+    std::map<std::uint64_t, stored_message> offline_messages;
+    /// Serialized PUBLISH and PUBREL messages that are not acknowledged yet.
+    std::vector<buffer> inflight_messages;
+    std::set<packet_id_t> qos2_publish_handled;
+};
+
+/**
+ * @brief Storage interface of the broker's persistent state
+ *
+ * The broker calls the following functions when persistent sessions or retained messages are
+ * updated. Sessions that are discarded at disconnection are not reported.
+ * The functions could be called from multiple threads concurrently.
+ *
+ * At broker_t::set_persistence(), the broker restores its state via for_each_session(),
+ * for_each_retained(), and for_each_erased_retained().
+ *
+ * The retained messages that are loaded from a retained snapshot are not written to the persistence.
+ * So the persistence keeps the topics of the erased retained messages as tombstones that override
+ * the snapshot, until a newer snapshot is saved.
+ */
+class persistence {
+public:
+    virtual ~persistence() = default;
+
+    /**
+     * @brief Store the session. If the session already exists, then update it
+     *        and keep its subscriptions and messages.
+     */
+    virtual void put_session(
+        buffer const& client_id,
+        protocol_version version,
+        optional<std::chrono::steady_clock::duration> session_expiry_interval) = 0;
+
+    /**
+     * @brief Erase the session and all its subscriptions and messages.
+     */
+    virtual void erase_session(buffer const& client_id) = 0;
+
+    /**
+     * @brief Record that the session became offline.
+     * @param inflight_messages     Serialized inflight messages taken over from the endpoint
+     * @param qos2_publish_handled  QoS2 packet ids that are received but PUBREL is not received yet
+     */
+    virtual void session_offline(
+        buffer const& client_id,
+        std::vector<buffer> inflight_messages,
+        std::set<packet_id_t> const& qos2_publish_handled) = 0;
+
+    /**
+     * @brief Record that the session became online. The inflight messages are handed to the endpoint.
+     */
+    virtual void session_online(buffer const& client_id) = 0;
+
+    virtual void put_subscription(
+        buffer const& client_id,
+        buffer const& share_name,
+        buffer const& topic_filter,
+        subscribe_options subopts,
+        optional<std::size_t> sid) = 0;
+
+    virtual void erase_subscription(
+        buffer const& client_id,
+        buffer const& share_name,
+        buffer const& topic_filter) = 0;
+
+    /**
+     * @brief Append the offline message to the session
+     * @return id of the message. It is passed to erase_offline_message().
+     */
+    virtual std::uint64_t push_offline_message(
+        buffer const& client_id,
+        buffer const& topic,
+        buffer const& contents,
+        publish_options pubopts,
+        v5::properties const& props) = 0;
+
+    virtual void erase_offline_message(buffer const& client_id, std::uint64_t id) = 0;
+
+    virtual void put_retained(
+        buffer const& topic,
+        buffer const& contents,
+        v5::properties const& props,
+        qos qos_value) = 0;
+
+    /**
+     * @brief Erase the retained message and keep the topic as a tombstone.
+     *        The message could be loaded from the retained snapshot that is not in the persistence.
+     */
+    virtual void erase_retained(buffer const& topic) = 0;
+
+    /**
+     * @brief Get the mark of the tombstones. The broker calls it while it writes a retained snapshot.
+     * @return mark that is passed to retained_snapshot_saved()
+     */
+    virtual std::uint64_t retained_snapshot_mark() = 0;
+
+    /**
+     * @brief Record that the retained snapshot that was written at the mark is saved.
+     *        The tombstones before the mark are not needed anymore.
+     */
+    virtual void retained_snapshot_saved(std::uint64_t mark) = 0;
+
+    /**
+     * @brief Call f for each stored session. Expired messages are not included.
+     *        f must not call the other functions of the persistence.
+     */
+    virtual void for_each_session(std::function<void(stored_session const&)> const& f) = 0;
+
+    /**
+     * @brief Call f for each stored retained message. Expired messages are not included.
+     *        f must not call the other functions of the persistence.
+     */
+    virtual void for_each_retained(std::function<void(stored_message const&)> const& f) = 0;
+
+    /**
+     * @brief Call f for each topic of the tombstones.
+     *        f must not call the other functions of the persistence.
+     */
+    virtual void for_each_erased_retained(std::function<void(buffer const&)> const& f) = 0;
+};
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_PERSISTENCE_HPP
@@ -0,0 +1,277 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_RETAINED_SNAPSHOT_HPP)
+#define MQTT_BROKER_RETAINED_SNAPSHOT_HPP
+
+#include <mqtt/config.hpp>
+
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <io.h>
+#else  // defined(_WIN32)
+#include <unistd.h>
+#endif // defined(_WIN32)
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <mqtt/broker/broker_namespace.hpp>
+
+#include <mqtt/buffer.hpp>
+#include <mqtt/shared_ptr_array.hpp>
+#include <mqtt/string_view.hpp>
+#include <mqtt/optional.hpp>
+#include <mqtt/move.hpp>
+#include <mqtt/subscribe_options.hpp>
+#include <mqtt/property_variant.hpp>
+#include <mqtt/property_parse.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+/**
+ * @brief Snapshot file of retained messages.
+ *
+ * The file layout is as follows (all integers are big endian):
+ *   header : magic "MQTTRTN1" (8 bytes) | number of entries (8 bytes)
+ *   entry  : topic length (2 bytes) | topic
+ *            | contents length (4 bytes) | contents
+ *            | qos (1 byte)
+ *            | properties length (4 bytes) | properties (without the property length)
+ *            | expiry (8 bytes, milliseconds since the system_clock epoch, 0 means never expire)
+ *
+ * load() maps the file into memory. The topics, contents, and properties of the loaded entries
+ * are buffers that refer to the mapped region directly. The mapping is kept alive until
+ * the last buffer is released.
+ */
+class retained_snapshot {
+public:
+    /**
+     * @brief Write retained messages to the snapshot file.
+     *        The entries are written to a temporary file and the file is renamed to path
+     *        on commit(), so the previous snapshot is kept if the writing is interrupted.
+     */
+    class writer {
+    public:
+        /**
+         * @brief Create the temporary snapshot file.
+         * @param path snapshot file path
+         */
+        explicit writer(std::string path)
+            : path_(force_move(path)),
+              tmp_path_(path_ + ".tmp"),
+              fp_(std::fopen(tmp_path_.c_str(), "wb"))
+        {
+            if (!fp_) throw_errno("open " + tmp_path_);
+            // The number of entries is fixed up on commit().
+            put(magic().data(), magic().size());
+            put_uint(std::uint64_t(0), 8);
+        }
+
+        writer(writer const&) = delete;
+        writer& operator=(writer const&) = delete;
+
+        ~writer() {
+            if (fp_) {
+                std::fclose(fp_);
+                std::remove(tmp_path_.c_str());
+            }
+        }
+
+        /**
+         * @brief Write one retained message.
+         * @param topic     topic name
+         * @param contents  payload
+         * @param props     properties
+         * @param qos_value QoS
+         * @param expiry    expiry time point. nullopt means never expire
+         */
+        void add(
+            string_view topic,
+            string_view contents,
+            v5::properties const& props,
+            qos qos_value,
+            optional<std::chrono::system_clock::time_point> expiry) {
+            if (topic.size() > 0xffff) throw std::runtime_error("Retained snapshot topic is too long");
+            put_uint(topic.size(), 2);
+            put(topic.data(), topic.size());
+            put_uint(contents.size(), 4);
+            put(contents.data(), contents.size());
+            put_uint(static_cast<std::uint8_t>(qos_value), 1);
+
+            std::size_t props_size = 0;
+            for (auto const& p : props) props_size += v5::size(p);
+            put_uint(props_size, 4);
+            if (props_size != 0) {
+                std::string s(props_size, '\0');
+                auto it = s.begin();
+                for (auto const& p : props) {
+                    v5::fill(p, it, s.end());
+                    it += static_cast<std::string::difference_type>(v5::size(p));
+                }
+                put(s.data(), s.size());
+            }
+
+            put_uint(
+                expiry
+                ? static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        expiry.value().time_since_epoch()
+                    ).count()
+                )
+                : std::uint64_t(0),
+                8
+            );
+            ++count_;
+        }
+
+        /**
+         * @brief Write the number of entries, sync the file, and replace the snapshot file.
+         * @return the number of entries
+         */
+        std::size_t commit() {
+            if (std::fseek(fp_, static_cast<long>(magic().size()), SEEK_SET) != 0) {
+                throw_errno("seek " + tmp_path_);
+            }
+            put_uint(count_, 8);
+            if (std::fflush(fp_) != 0) throw_errno("flush " + tmp_path_);
+#if defined(_WIN32)
+            if (_commit(_fileno(fp_)) != 0) throw_errno("sync " + tmp_path_);
+#else  // defined(_WIN32)
+            if (::fsync(fileno(fp_)) != 0) throw_errno("sync " + tmp_path_);
+#endif // defined(_WIN32)
+            std::fclose(fp_);
+            fp_ = nullptr;
+#if defined(_WIN32)
+            std::remove(path_.c_str());
+#endif // defined(_WIN32)
+            if (std::rename(tmp_path_.c_str(), path_.c_str()) != 0) throw_errno("rename " + tmp_path_);
+            return count_;
+        }
+
+    private:
+        void put(char const* p, std::size_t size) {
+            if (size != 0 && std::fwrite(p, 1, size, fp_) != size) throw_errno("write " + tmp_path_);
+        }
+
+        void put_uint(std::uint64_t v, std::size_t bytes) {
+            char b[8];
+            for (std::size_t i = 0; i != bytes; ++i) {
+                b[i] = static_cast<char>((v >> (8 * (bytes - i - 1))) & 0xff);
+            }
+            put(b, bytes);
+        }
+
+        std::string path_;
+        std::string tmp_path_;
+        std::FILE* fp_;
+        std::size_t count_ = 0;
+    };
+
+    /**
+     * @brief Map the snapshot file and call f for each entry.
+     *        f is called as f(buffer topic, buffer contents, v5::properties props,
+     *        qos qos_value, optional<std::chrono::system_clock::time_point> expiry).
+     *        The buffers and the properties refer to the mapped region.
+     * @param path snapshot file path
+     * @param f    callback
+     * @return the number of entries
+     */
+    template <typename F>
+    static std::size_t load(std::string const& path, F&& f) {
+        namespace bi = boost::interprocess;
+        auto region = std::make_shared<bi::mapped_region>(
+            bi::file_mapping(path.c_str(), bi::read_only),
+            bi::read_only
+        );
+        auto top = static_cast<char const*>(region->get_address());
+        auto size = region->get_size();
+        if (size < header_size ||
+            string_view(top, magic().size()) != magic()) {
+            throw std::runtime_error("Retained snapshot invalid header");
+        }
+
+        // All buffers share the ownership of the mapped region.
+        buffer all(
+            string_view(top, size),
+            const_shared_ptr_array(top, [region](char const*) mutable { region.reset(); })
+        );
+
+        std::size_t pos = magic().size();
+        auto count = get_uint(all, pos, 8);
+        for (std::uint64_t i = 0; i != count; ++i) {
+            auto topic_len = get_uint(all, pos, 2);
+            auto topic = get_buffer(all, pos, topic_len);
+            auto contents_len = get_uint(all, pos, 4);
+            auto contents = get_buffer(all, pos, contents_len);
+            auto qos_byte = get_uint(all, pos, 1);
+            if (qos_byte > static_cast<std::uint8_t>(qos::exactly_once)) {
+                throw std::runtime_error("Retained snapshot invalid qos");
+            }
+            auto qos_value = static_cast<qos>(qos_byte);
+            auto props_len = get_uint(all, pos, 4);
+            auto props = v5::property::parse(get_buffer(all, pos, props_len));
+            auto expiry_ms = get_uint(all, pos, 8);
+            optional<std::chrono::system_clock::time_point> expiry;
+            if (expiry_ms != 0) {
+                expiry.emplace(std::chrono::milliseconds(expiry_ms));
+            }
+            std::forward<F>(f)(
+                force_move(topic),
+                force_move(contents),
+                force_move(props),
+                qos_value,
+                expiry
+            );
+        }
+        return static_cast<std::size_t>(count);
+    }
+
+private:
+    static string_view magic() { return string_view("MQTTRTN1", 8); }
+    static constexpr std::size_t header_size = 16; // magic and number of entries
+
+    static std::uint64_t get_uint(buffer const& all, std::size_t& pos, std::size_t bytes) {
+        if (all.size() - pos < bytes) throw_truncated();
+        std::uint64_t v = 0;
+        for (std::size_t i = 0; i != bytes; ++i) {
+            v = (v << 8) | static_cast<std::uint8_t>(all[pos + i]);
+        }
+        pos += bytes;
+        return v;
+    }
+
+    static buffer get_buffer(buffer const& all, std::size_t& pos, std::uint64_t size) {
+        if (all.size() - pos < size) throw_truncated();
+        auto b = all.substr(pos, static_cast<std::size_t>(size));
+        pos += static_cast<std::size_t>(size);
+        return b;
+    }
+
+    static void throw_truncated() {
+        throw std::runtime_error("Retained snapshot is truncated");
+    }
+
+    [[noreturn]]
+    static void throw_errno(std::string const& what) {
+        throw boost::system::system_error(
+            boost::system::error_code(errno, boost::system::generic_category()),
+            what
+        );
+    }
+};
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_RETAINED_SNAPSHOT_HPP
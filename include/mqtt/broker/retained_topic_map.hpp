@@ -19,7 +19,7 @@
 #include <mqtt/optional.hpp>
 #include <mqtt/buffer.hpp>
 
-#include <mqtt/broker/topic_filter_tokenizer.hpp>
+#include <mqtt/broker/topic_levels.hpp>
 
 MQTT_BROKER_NS_BEGIN
 
@@ -99,7 +99,9 @@ class retained_topic_map {
 
     direct_const_iterator root;
 
-    direct_const_iterator create_topic(string_view topic) {
+    // Topic is string_view or topic_levels
+    template<typename Topic>
+    direct_const_iterator create_topic(Topic const& topic) {
          direct_const_iterator parent = root;
 
         topic_filter_tokenizer(
@@ -132,7 +134,8 @@ class retained_topic_map {
         return parent;
     }
 
-    std::vector<direct_const_iterator> find_topic(string_view topic) {
+    template<typename Topic>
+    std::vector<direct_const_iterator> find_topic(Topic const& topic) {
         std::vector<direct_const_iterator> path;
         direct_const_iterator parent = root;
 
@@ -297,15 +300,8 @@ class retained_topic_map {
         next_node_id = root_node_id + 1;
     }
 
-public:
-    retained_topic_map()
-    {
-        init_map();
-    }
-
-    // Insert a value at the specified topic
-    template<typename V>
-    std::size_t insert_or_assign(string_view topic, V&& value) {
+    template<typename Topic, typename V>
+    std::size_t insert_or_assign_impl(Topic const& topic, V&& value) {
         auto& direct_index = map.template get<direct_index_tag>();
         auto path = this->find_topic(topic);
 
@@ -328,12 +324,40 @@ public:
         return 0;
     }
 
+public:
+    retained_topic_map()
+    {
+        init_map();
+    }
+
+    // Insert a value at the specified topic
+    template<typename V>
+    std::size_t insert_or_assign(string_view topic, V&& value) {
+        return insert_or_assign_impl(topic, std::forward<V>(value));
+    }
+
+    template<typename V>
+    std::size_t insert_or_assign(topic_levels const& topic, V&& value) {
+        return insert_or_assign_impl(topic, std::forward<V>(value));
+    }
+
     // Find all stored topics that math the specified topic_filter
     template<typename Output>
     void find(string_view topic_filter, Output&& callback) const {
         find_match(topic_filter, std::forward<Output>(callback));
     }
 
+    // Call the callback for all stored values including system topics
+    template<typename Output>
+    void for_each(Output&& callback) const {
+        auto const& direct_index = map.template get<direct_index_tag>();
+        for (auto const& i : direct_index) {
+            if (i.value) {
+                callback(*i.value);
+            }
+        }
+    }
+
     // Remove a stored value at the specified topic
     std::size_t erase(string_view topic) {
         auto result = erase_topic(topic);
@@ -0,0 +1,100 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_SESSION_HANDLE_HPP)
+#define MQTT_BROKER_SESSION_HANDLE_HPP
+
+#include <mqtt/config.hpp>
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+#include <boost/assert.hpp>
+
+#include <mqtt/broker/broker_namespace.hpp>
+#include <mqtt/broker/session_state_fwd.hpp>
+#include <mqtt/broker/mutex.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+/**
+ * @brief Handle from a connection to the session_state that the connection is bound to.
+ *
+ * Each connection has its own handle. The session_state binds the handle when the connection
+ * is attached to it, and unbinds it when the session becomes offline, is taken over by another
+ * connection, or is destroyed. So the packet handlers of the connection can access the session
+ * without looking up the sessions and without the broker wide sessions lock.
+ * unbind() waits until all locked objects are released, so the session_state is alive while
+ * a locked object refers to it.
+ * The broker calls unbind() on a takeover while it holds the sessions lock, so hold a locked
+ * object only while the fields of the session are accessed. Copy what is needed (e.g. the client
+ * id of the publisher) and release it before a long operation such as the delivery to subscribers.
+ */
+class session_handle {
+public:
+    /**
+     * @brief Shared locked reference to the bound session_state
+     */
+    class locked {
+    public:
+        explicit operator bool() const {
+            return ss_ != nullptr;
+        }
+
+        session_state& operator*() const {
+            BOOST_ASSERT(ss_);
+            return *ss_;
+        }
+
+        session_state* operator->() const {
+            BOOST_ASSERT(ss_);
+            return ss_;
+        }
+
+    private:
+        friend class session_handle;
+
+        explicit locked(session_handle const& h)
+            : g_(h.mtx_),
+              ss_(h.ss_) {}
+
+        std::shared_lock<mutex> g_;
+        session_state* ss_;
+    };
+
+    session_handle() = default;
+    session_handle(session_handle const&) = delete;
+    session_handle& operator=(session_handle const&) = delete;
+
+    /**
+     * @brief Lock the handle and get the bound session_state
+     * @return locked reference. It is false if no session_state is bound.
+     */
+    locked lock() const {
+        return locked(*this);
+    }
+
+    void bind(session_state& ss) {
+        std::lock_guard<mutex> g(mtx_);
+        ss_ = &ss;
+    }
+
+    void unbind() {
+        std::lock_guard<mutex> g(mtx_);
+        ss_ = nullptr;
+    }
+
+private:
+    mutable mutex mtx_;
+    session_state* ss_ = nullptr;
+};
+
+using session_handle_sp = std::shared_ptr<session_handle>;
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_SESSION_HANDLE_HPP
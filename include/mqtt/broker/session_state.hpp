@@ -14,8 +14,13 @@
 #include <boost/asio/io_context.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/member.hpp>
 
+#include <mqtt/encoded_properties.hpp>
+#include <mqtt/control_packet_type.hpp>
+#include <mqtt/exception.hpp>
+
 #include <mqtt/broker/broker_namespace.hpp>
 
 #include <mqtt/broker/common_type.hpp>
@@ -25,7 +30,11 @@
 #include <mqtt/broker/tags.hpp>
 #include <mqtt/broker/inflight_message.hpp>
 #include <mqtt/broker/offline_message.hpp>
+#include <mqtt/broker/metrics.hpp>
 #include <mqtt/broker/mutex.hpp>
+#include <mqtt/broker/persistence.hpp>
+#include <mqtt/broker/timer_wheel.hpp>
+#include <mqtt/broker/session_handle.hpp>
 
 MQTT_BROKER_NS_BEGIN
 
@@ -67,7 +76,9 @@ struct session_state {
         mutex& mtx_subs_map,
         sub_con_map& subs_map,
         shared_target& shared_targets,
+        metrics& broker_metrics,
         con_sp_t con,
+        session_handle_sp handle,
         buffer client_id,
         optional<will> will,
         will_sender_t will_sender,
@@ -77,7 +88,9 @@ struct session_state {
          mtx_subs_map_(mtx_subs_map),
          subs_map_(subs_map),
          shared_targets_(shared_targets),
+         metrics_(broker_metrics),
          con_(force_move(con)),
+         handle_(force_move(handle)),
          version_(con_->get_protocol_version()),
          client_id_(force_move(client_id)),
          session_expiry_interval_(force_move(session_expiry_interval)),
@@ -97,56 +110,83 @@ struct session_state {
             } ()
          )
     {
+        metrics_.add(metrics::gauge::connected_clients, 1);
         update_will(timer_ioc, will, will_expiry_interval);
+        handle_->bind(*this);
+    }
+
+    /**
+     * @brief Create offline session_state that is restored from persistence.
+     */
+    session_state(
+        as::io_context& timer_ioc,
+        mutex& mtx_subs_map,
+        sub_con_map& subs_map,
+        shared_target& shared_targets,
+        metrics& broker_metrics,
+        protocol_version version,
+        buffer client_id,
+        optional<std::chrono::steady_clock::duration> session_expiry_interval)
+        :timer_ioc_(timer_ioc),
+         mtx_subs_map_(mtx_subs_map),
+         subs_map_(subs_map),
+         shared_targets_(shared_targets),
+         metrics_(broker_metrics),
+         version_(version),
+         client_id_(force_move(client_id)),
+         session_expiry_interval_(force_move(session_expiry_interval)),
+         tim_will_delay_(timer_ioc_),
+         remain_after_close_(true)
+    {
     }
 
     ~session_state() {
         MQTT_LOG("mqtt_broker", trace)
             << MQTT_ADD_VALUE(address, this)
             << "session destroy";
+        unbind_handle();
         send_will_impl();
         clean();
+        cancel_session_expiry();
+        if (con_) metrics_.add(metrics::gauge::connected_clients, -1);
     }
 
     bool online() const {
         return bool(con_);
     }
 
+    /**
+     * @brief Make the session offline and start the session expiry timeout.
+     * @param session_expiry_wheel timer wheel for the session expiry
+     * @param h                    handler that is called with the client id when the session is expired
+     */
     template <typename SessionExpireHandler>
-    void become_offline(SessionExpireHandler&& h) {
+    void become_offline(timer_wheel& session_expiry_wheel, SessionExpireHandler&& h) {
         BOOST_ASSERT(con_);
-        con_->for_each_store_with_life_keeper(
-            [this] (store_message_variant msg, any life_keeper) {
+        unbind_handle();
+        // Detach con_ first. deliver() reads con_ without the sessions lock, so a message that
+        // is delivered after this point goes to the offline messages. The messages that were
+        // published before are in the store of the endpoint, and taken below.
+        con_sp_t con;
+        persistence* ps;
+        {
+            std::lock_guard<mutex> g(mtx_offline_messages_);
+            con.swap(con_);
+            ps = persistence_;
+        }
+        metrics_.add(metrics::gauge::connected_clients, -1);
+        std::vector<buffer> serialized;
+        con->for_each_store_with_life_keeper(
+            [this, ps, &serialized] (store_message_variant msg, any life_keeper) {
                 MQTT_LOG("mqtt_broker", trace)
                     << MQTT_ADD_VALUE(address, this)
                     << "store inflight message";
 
-                std::shared_ptr<as::steady_timer> tim_message_expiry;
-
-                MQTT_NS::visit(
-                    make_lambda_visitor(
-                        [&](v5::basic_publish_message<sizeof(packet_id_t)> const& m) {
-                            auto v = get_property<v5::property::message_expiry_interval>(m.props());
-                            if (v) {
-                                tim_message_expiry =
-                                    std::make_shared<as::steady_timer>(timer_ioc_, std::chrono::seconds(v.value().val()));
-                                tim_message_expiry->async_wait(
-                                    [this, wp = std::weak_ptr<as::steady_timer>(tim_message_expiry)]
-                                    (error_code ec) {
-                                        if (auto sp = wp.lock()) {
-                                            if (!ec) {
-                                                erase_inflight_message_by_expiry(sp);
-                                            }
-                                        }
-                                    }
-                                );
-                            }
-                        },
-                        [&](auto const&) {}
-                    ),
-                    msg
-                );
+                if (ps) {
+                    serialized.push_back(allocate_buffer(continuous_buffer(msg)));
+                }
 
+                auto tim_message_expiry = make_inflight_message_expiry_timer(msg);
                 insert_inflight_message(
                     force_move(msg),
                     force_move(life_keeper),
@@ -154,9 +194,36 @@ struct session_state {
                 );
             }
         );
-        qos2_publish_handled_ = con_->get_qos2_publish_handled_pids();
-        con_.reset();
+        auto pids = con->get_qos2_publish_handled_pids();
+        {
+            std::lock_guard<mutex> g(mtx_offline_messages_);
+            qos2_publish_handled_ = pids;
+        }
+        if (ps) {
+            ps->session_offline(client_id_, force_move(serialized), pids);
+        }
+
+        restore_session_expiry(
+            std::chrono::steady_clock::duration::zero(),
+            session_expiry_wheel,
+            std::forward<SessionExpireHandler>(h)
+        );
+    }
 
+    /**
+     * @brief Set the session expiry timeout of the offline session.
+     * @param elapsed              the duration that has already elapsed since the session became offline
+     * @param session_expiry_wheel timer wheel for the session expiry
+     * @param h                    handler that is called with the client id when the session is expired.
+     *                             It is called on the timer io_context without any lock, so the handler
+     *                             should find the session by the client id and check expired().
+     */
+    template <typename SessionExpireHandler>
+    void restore_session_expiry(
+        std::chrono::steady_clock::duration elapsed,
+        timer_wheel& session_expiry_wheel,
+        SessionExpireHandler&& h) {
+        BOOST_ASSERT(!con_);
         if (session_expiry_interval_ &&
             session_expiry_interval_.value() != std::chrono::seconds(session_never_expire)) {
 
@@ -164,20 +231,16 @@ struct session_state {
                 << MQTT_ADD_VALUE(address, this)
                 << "session expiry interval timer set";
 
-            tim_session_expiry_ = std::make_shared<as::steady_timer>(timer_ioc_, session_expiry_interval_.value());
-            tim_session_expiry_->async_wait(
-                [this, wp = std::weak_ptr<as::steady_timer>(tim_session_expiry_), h = std::forward<SessionExpireHandler>(h)]
-                (error_code ec) {
-                    if (auto sp = wp.lock()) {
-                        if (!ec) {
-                            MQTT_LOG("mqtt_broker", info)
-                                << MQTT_ADD_VALUE(address, this)
-                                << "session expired";
-                            h(sp);
-                        }
-                    }
+            cancel_session_expiry();
+            auto remain = std::max(session_expiry_interval_.value() - elapsed, std::chrono::steady_clock::duration::zero());
+            session_expiry_at_ = std::chrono::steady_clock::now() + remain;
+            session_expiry_wheel_ = &session_expiry_wheel;
+            session_expiry_entry_ = timer_wheel::make_entry(
+                [cid = client_id_, h = std::forward<SessionExpireHandler>(h)] {
+                    h(cid);
                 }
             );
+            session_expiry_wheel.schedule(session_expiry_entry_, remain);
         }
     }
 
@@ -186,7 +249,18 @@ struct session_state {
             << MQTT_ADD_VALUE(address, this)
             << "renew_session expiry";
         session_expiry_interval_ = force_move(v);
-        tim_session_expiry_.reset();
+        cancel_session_expiry();
+    }
+
+    /**
+     * @brief Check the offline session has been expired.
+     * @return true if the session is offline and its session expiry interval has elapsed.
+     */
+    bool expired() const {
+        return
+            !con_ &&
+            session_expiry_at_ &&
+            session_expiry_at_.value() <= std::chrono::steady_clock::now();
     }
 
     void publish(
@@ -195,88 +269,100 @@ struct session_state {
         buffer contents,
         publish_options pubopts,
         v5::properties props) {
+        publish(
+            timer_ioc,
+            force_move(pub_topic),
+            force_move(contents),
+            pubopts,
+            v5::encoded_properties(),
+            force_move(props)
+        );
+    }
 
-        BOOST_ASSERT(online());
-
+    /**
+     * @brief Publish the message using shared serialized properties.
+     *        The properties on the wire are shared_props followed by props.
+     * @param timer_ioc    io_context for the message expiry timer
+     * @param pub_topic    topic
+     * @param contents     contents
+     * @param pubopts      publish options
+     * @param shared_props properties shared with the other subscribers
+     * @param props        per subscriber properties
+     */
+    void publish(
+        as::io_context& timer_ioc,
+        buffer pub_topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::encoded_properties const& shared_props,
+        v5::properties props) {
         std::lock_guard<mutex> g(mtx_offline_messages_);
-        if (offline_messages_.empty()) {
-            auto qos_value = pubopts.get_qos();
-            if (qos_value == qos::at_least_once ||
-                qos_value == qos::exactly_once) {
-                if (auto pid = con_->acquire_unique_packet_id_no_except()) {
-                    con_->async_publish(
-                        pid.value(),
-                        force_move(pub_topic),
-                        force_move(contents),
-                        pubopts,
-                        force_move(props),
-                        any{},
-                        [con = con_]
-                        (error_code ec) {
-                            if (ec) {
-                                MQTT_LOG("mqtt_broker", warning)
-                                    << MQTT_ADD_VALUE(address, con.get())
-                                    << ec.message();
-                            }
-                        }
-                    );
-                    return;
-                }
-            }
-            else {
-                con_->async_publish(
-                    force_move(pub_topic),
-                    force_move(contents),
-                    pubopts,
-                    force_move(props),
-                    any{},
-                    [con = con_]
-                    (error_code ec) {
-                        if (ec) {
-                            MQTT_LOG("mqtt_broker", warning)
-                                << MQTT_ADD_VALUE(address, con.get())
-                                << ec.message();
-                        }
-                    }
-                );
-                return;
-            }
-        }
+        publish_no_lock(
+            timer_ioc,
+            force_move(pub_topic),
+            force_move(contents),
+            pubopts,
+            shared_props,
+            force_move(props)
+        );
+    }
 
-        // offline_messages_ is not empty or packet_id_exhausted
-        offline_messages_.push_back(
+    void deliver(
+        as::io_context& timer_ioc,
+        buffer pub_topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::properties props) {
+        deliver(
             timer_ioc,
             force_move(pub_topic),
             force_move(contents),
             pubopts,
+            v5::encoded_properties(),
             force_move(props)
         );
     }
 
+    /**
+     * @brief Deliver the message using shared serialized properties.
+     *        If the session is offline, the message is stored as the offline message.
+     * @param timer_ioc    io_context for the message expiry timer
+     * @param pub_topic    topic
+     * @param contents     contents
+     * @param pubopts      publish options
+     * @param shared_props properties shared with the other subscribers
+     * @param props        per subscriber properties
+     */
     void deliver(
         as::io_context& timer_ioc,
         buffer pub_topic,
         buffer contents,
         publish_options pubopts,
+        v5::encoded_properties const& shared_props,
         v5::properties props) {
+        MQTT_TRACE_STAMP(deliver);
 
-        if (online()) {
-            publish(
+        // The sessions lock is not held on the PUBLISH path.
+        // con_ is checked and used under mtx_offline_messages_ because renew() and
+        // become_offline() update it under the same lock.
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        if (con_) {
+            publish_no_lock(
                 timer_ioc,
                 force_move(pub_topic),
                 force_move(contents),
                 pubopts,
+                shared_props,
                 force_move(props)
             );
         }
         else {
-            std::lock_guard<mutex> g(mtx_offline_messages_);
-            offline_messages_.push_back(
+            push_offline_message(
                 timer_ioc,
                 force_move(pub_topic),
                 force_move(contents),
                 pubopts,
-                force_move(props)
+                shared_props.merge(force_move(props))
             );
         }
     }
@@ -321,6 +407,9 @@ struct session_state {
             << " topic_filter:" << topic_filter
             << " qos:" << subopts.get_qos();
 
+        if (persistence_) {
+            persistence_->put_subscription(client_id_, share_name, topic_filter, subopts, sid);
+        }
         subscription sub {*this, force_move(share_name), topic_filter, subopts, sid };
         auto handle_ret =
             [&] {
@@ -357,6 +446,9 @@ struct session_state {
     }
 
     void unsubscribe(buffer const& share_name, buffer const& topic_filter) {
+        if (persistence_) {
+            persistence_->erase_subscription(client_id_, share_name, topic_filter);
+        }
         if (!share_name.empty()) {
             shared_targets_.erase(share_name, topic_filter, *this);
         }
@@ -370,6 +462,10 @@ struct session_state {
 
     void unsubscribe_all() {
         {
+            // The exclusive lock is taken even if handles_ is empty.
+            // Subscribers are delivered to under the shared lock without the sessions lock,
+            // so ~session_state() (via clean()) waits here for the deliveries in progress.
+            // After that, neither subs_map_ nor shared_targets_ refers to this session.
             std::lock_guard<mutex> g{mtx_subs_map_};
             for (auto const& h : handles_) {
                 subs_map_.erase(h, client_id_);
@@ -462,25 +558,131 @@ struct session_state {
 
     void erase_inflight_message_by_expiry(std::shared_ptr<as::steady_timer> const& sp) {
         std::lock_guard<mutex> g(mtx_inflight_messages_);
-        inflight_messages_.get<tag_tim>().erase(sp);
+        inflight_messages_.erase(sp);
     }
 
     void erase_inflight_message_by_packet_id(packet_id_t packet_id) {
         std::lock_guard<mutex> g(mtx_inflight_messages_);
-        auto& idx = inflight_messages_.get<tag_pid>();
-        idx.erase(packet_id);
+        inflight_messages_.erase(packet_id);
     }
 
     void send_all_offline_messages() {
         BOOST_ASSERT(con_);
         std::lock_guard<mutex> g(mtx_offline_messages_);
-        offline_messages_.send_until_fail(*con_);
+        send_offline_messages_no_lock();
     }
 
-    void send_offline_messages_by_packet_id_release() {
+    /**
+     * @brief Send at most batch_size offline messages.
+     *        on_written is called when the last one of them is written to the socket.
+     *        The caller can send the next batch from on_written, so that a large number of
+     *        offline messages doesn't occupy the io_context and the send buffer at once.
+     * @param batch_size the maximum number of messages to send. 0 means unlimited.
+     * @param on_written handler that is called when the last sent message is written
+     * @return true if on_written will be called
+     */
+    bool send_offline_messages_paced(std::size_t batch_size, std::function<void(error_code)> on_written) {
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        if (!con_) return false;
+        return send_offline_messages_paced_no_lock(batch_size, force_move(on_written));
+    }
+
+    /**
+     * @brief Resume sending the offline messages after a packet id is released.
+     *        If a batch is being written, nothing is sent. The next batch is sent by its on_written.
+     * @param batch_size the maximum number of messages to send. 0 means unlimited.
+     * @param on_written handler that is called when the last sent message is written
+     */
+    void send_offline_messages_by_packet_id_release(std::size_t batch_size, std::function<void(error_code)> on_written) {
         BOOST_ASSERT(con_);
         std::lock_guard<mutex> g(mtx_offline_messages_);
-        offline_messages_.send_until_fail(*con_);
+        if (offline_messages_sending_) return;
+        send_offline_messages_paced_no_lock(batch_size, force_move(on_written));
+    }
+
+    /**
+     * @brief Restore the offline message from persistence.
+     */
+    void restore_offline_message(
+        buffer pub_topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::properties props,
+        std::uint64_t persistence_id) {
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        offline_messages_.push_back(
+            timer_ioc_,
+            force_move(pub_topic),
+            force_move(contents),
+            pubopts,
+            force_move(props),
+            persistence_id
+        );
+    }
+
+    /**
+     * @brief Restore the serialized inflight message from persistence.
+     * @param serialized serialized PUBLISH or PUBREL message
+     * @param elapsed    the duration that has already elapsed since the session became offline
+     */
+    void restore_inflight_message(buffer serialized, std::chrono::steady_clock::duration elapsed) {
+        if (serialized.empty()) return;
+        auto cpt_opt = get_control_packet_type_with_check(static_cast<std::uint8_t>(serialized.front()));
+        if (!cpt_opt) throw malformed_packet_error();
+
+        auto msg_opt =
+            [&] () -> optional<store_message_variant> {
+                if (version_ == protocol_version::v3_1_1) {
+                    if (cpt_opt.value() == control_packet_type::publish) {
+                        return store_message_variant(v3_1_1::basic_publish_message<sizeof(packet_id_t)>(serialized));
+                    }
+                    if (cpt_opt.value() == control_packet_type::pubrel) {
+                        return store_message_variant(v3_1_1::basic_pubrel_message<sizeof(packet_id_t)>(serialized));
+                    }
+                }
+                else {
+                    BOOST_ASSERT(version_ == protocol_version::v5);
+                    if (cpt_opt.value() == control_packet_type::publish) {
+                        v5::basic_publish_message<sizeof(packet_id_t)> m(serialized);
+                        if (auto v = get_property<v5::property::message_expiry_interval>(m.props())) {
+                            auto remain =
+                                std::chrono::seconds(v.value().val()) -
+                                std::chrono::duration_cast<std::chrono::seconds>(elapsed);
+                            if (remain <= std::chrono::seconds::zero()) return nullopt;
+                            m.update_prop(v5::property::message_expiry_interval(static_cast<uint32_t>(remain.count())));
+                        }
+                        return store_message_variant(force_move(m));
+                    }
+                    if (cpt_opt.value() == control_packet_type::pubrel) {
+                        return store_message_variant(v5::basic_pubrel_message<sizeof(packet_id_t)>(serialized));
+                    }
+                }
+                throw protocol_error();
+            } ();
+
+        // expired
+        if (!msg_opt) return;
+
+        auto tim_message_expiry = make_inflight_message_expiry_timer(msg_opt.value());
+        insert_inflight_message(
+            force_move(msg_opt.value()),
+            force_move(serialized),
+            force_move(tim_message_expiry)
+        );
+    }
+
+    void restore_qos2_publish_handled(std::set<packet_id_t> pids) {
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        qos2_publish_handled_ = force_move(pids);
+    }
+
+    /**
+     * @brief Set the persistence that records the updates of this session.
+     * @param ps persistence. nullptr means the session is not persisted.
+     */
+    void set_persistence(persistence* ps) {
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        persistence_ = ps;
     }
 
     protocol_version get_protocol_version() const {
@@ -491,19 +693,32 @@ struct session_state {
         return client_id_;
     }
 
-    void renew(con_sp_t con, bool clean_start) {
+    void renew(con_sp_t con, session_handle_sp handle, bool clean_start) {
+        unbind_handle();
         tim_will_delay_.cancel();
         if (clean_start) {
             // send previous will
             send_will_impl();
-            qos2_publish_handled_.clear();
         }
         else {
             // cancel will
             clear_will();
-            con->restore_qos2_publish_handled_pids(qos2_publish_handled_);
         }
-        con_ = force_move(con);
+        {
+            std::lock_guard<mutex> g(mtx_offline_messages_);
+            if (clean_start) {
+                qos2_publish_handled_.clear();
+            }
+            else {
+                con->restore_qos2_publish_handled_pids(qos2_publish_handled_);
+                // inflight messages are handed to the endpoint
+                if (persistence_) persistence_->session_online(client_id_);
+            }
+            if (!con_) metrics_.add(metrics::gauge::connected_clients, 1);
+            con_ = force_move(con);
+        }
+        handle_ = force_move(handle);
+        handle_->bind(*this);
     }
 
     con_sp_t const& con() const {
@@ -522,7 +737,185 @@ struct session_state {
         return response_topic_;
     }
 
+    std::size_t offline_message_count() const {
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        return offline_messages_.size();
+    }
+
+    /**
+     * @brief Get the total size of the topics and the payloads of the offline messages.
+     */
+    std::size_t offline_message_bytes() const {
+        std::lock_guard<mutex> g(mtx_offline_messages_);
+        return offline_messages_.bytes();
+    }
+
+    std::size_t inflight_message_count() const {
+        std::lock_guard<mutex> g(mtx_inflight_messages_);
+        return inflight_messages_.size();
+    }
+
 private:
+    void publish_no_lock(
+        as::io_context& timer_ioc,
+        buffer pub_topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::encoded_properties const& shared_props,
+        v5::properties props) {
+        BOOST_ASSERT(online());
+
+        if (offline_messages_.empty()) {
+            auto qos_value = pubopts.get_qos();
+            if (qos_value == qos::at_least_once ||
+                qos_value == qos::exactly_once) {
+                if (auto pid = con_->acquire_unique_packet_id_no_except()) {
+                    con_->async_publish(
+                        pid.value(),
+                        force_move(pub_topic),
+                        force_move(contents),
+                        pubopts,
+                        shared_props,
+                        force_move(props),
+                        any{},
+                        [con = con_]
+                        (error_code ec) {
+                            if (ec) {
+                                MQTT_LOG("mqtt_broker", warning)
+                                    << MQTT_ADD_VALUE(address, con.get())
+                                    << ec.message();
+                            }
+                        }
+                    );
+                    return;
+                }
+            }
+            else {
+                con_->async_publish(
+                    0,
+                    force_move(pub_topic),
+                    force_move(contents),
+                    pubopts,
+                    shared_props,
+                    force_move(props),
+                    any{},
+                    [con = con_]
+                    (error_code ec) {
+                        if (ec) {
+                            MQTT_LOG("mqtt_broker", warning)
+                                << MQTT_ADD_VALUE(address, con.get())
+                                << ec.message();
+                        }
+                    }
+                );
+                return;
+            }
+        }
+
+        // offline_messages_ is not empty or packet_id_exhausted
+        push_offline_message(
+            timer_ioc,
+            force_move(pub_topic),
+            force_move(contents),
+            pubopts,
+            shared_props.merge(force_move(props))
+        );
+    }
+
+    void push_offline_message(
+        as::io_context& timer_ioc,
+        buffer pub_topic,
+        buffer contents,
+        publish_options pubopts,
+        v5::properties props) {
+        std::uint64_t persistence_id =
+            persistence_ ? persistence_->push_offline_message(client_id_, pub_topic, contents, pubopts, props)
+                         : 0;
+        offline_messages_.push_back(
+            timer_ioc,
+            force_move(pub_topic),
+            force_move(contents),
+            pubopts,
+            force_move(props),
+            persistence_id
+        );
+    }
+
+    /**
+     * @brief Unbind the handle of the current connection.
+     *        It waits until the packet handlers of the connection release the session.
+     */
+    void unbind_handle() {
+        if (handle_) {
+            handle_->unbind();
+            handle_.reset();
+        }
+    }
+
+    void cancel_session_expiry() {
+        if (session_expiry_entry_) {
+            session_expiry_wheel_->cancel(*session_expiry_entry_);
+            session_expiry_entry_.reset();
+        }
+        session_expiry_at_ = nullopt;
+    }
+
+    bool send_offline_messages_paced_no_lock(std::size_t batch_size, std::function<void(error_code)> on_written) {
+        offline_messages_sending_ = offline_messages_.send_until_fail(
+            *con_,
+            [this](offline_message const& m) {
+                if (persistence_ && m.persistence_id() != 0) {
+                    persistence_->erase_offline_message(client_id_, m.persistence_id());
+                }
+            },
+            batch_size,
+            force_move(on_written)
+        );
+        return offline_messages_sending_;
+    }
+
+    void send_offline_messages_no_lock() {
+        offline_messages_.send_until_fail(
+            *con_,
+            [this](offline_message const& m) {
+                if (persistence_ && m.persistence_id() != 0) {
+                    persistence_->erase_offline_message(client_id_, m.persistence_id());
+                }
+            }
+        );
+    }
+
+    std::shared_ptr<as::steady_timer> make_inflight_message_expiry_timer(store_message_variant const& msg) {
+        std::shared_ptr<as::steady_timer> tim_message_expiry;
+
+        MQTT_NS::visit(
+            make_lambda_visitor(
+                [&](v5::basic_publish_message<sizeof(packet_id_t)> const& m) {
+                    // Message Expiry Interval is usually in the properties shared among subscribers
+                    auto v = get_property<v5::property::message_expiry_interval>(m.shared_props().props());
+                    if (!v) v = get_property<v5::property::message_expiry_interval>(m.props());
+                    if (v) {
+                        tim_message_expiry =
+                            std::make_shared<as::steady_timer>(timer_ioc_, std::chrono::seconds(v.value().val()));
+                        tim_message_expiry->async_wait(
+                            [this, wp = std::weak_ptr<as::steady_timer>(tim_message_expiry)]
+                            (error_code ec) {
+                                if (auto sp = wp.lock()) {
+                                    if (!ec) {
+                                        erase_inflight_message_by_expiry(sp);
+                                    }
+                                }
+                            }
+                        );
+                    }
+                },
+                [&](auto const&) {}
+            ),
+            msg
+        );
+        return tim_message_expiry;
+    }
+
     void send_will_impl() {
         if (!will_value_) return;
 
@@ -569,18 +962,23 @@ private:
     mutex& mtx_subs_map_;
     sub_con_map& subs_map_;
     shared_target& shared_targets_;
+    metrics& metrics_;
     con_sp_t con_;
+    session_handle_sp handle_;
     protocol_version version_;
     buffer client_id_;
 
     optional<std::chrono::steady_clock::duration> session_expiry_interval_;
-    std::shared_ptr<as::steady_timer> tim_session_expiry_;
+    optional<std::chrono::steady_clock::time_point> session_expiry_at_;
+    timer_wheel* session_expiry_wheel_ = nullptr;
+    timer_wheel::entry_sp session_expiry_entry_;
 
     mutable mutex mtx_inflight_messages_;
-    inflight_messages inflight_messages_;
+    inflight_messages inflight_messages_ { metrics_ };
 
     mutable mutex mtx_offline_messages_;
-    offline_messages offline_messages_;
+    offline_messages offline_messages_ { metrics_ };
+    bool offline_messages_sending_ = false; // a paced batch is being written
 
     std::set<sub_con_map::handle> handles_; // to efficient remove
 
@@ -592,6 +990,7 @@ private:
 
     optional<std::string> response_topic_;
     std::function<void()> clean_handler_;
+    persistence* persistence_ = nullptr;
 };
 
 class session_states {
@@ -610,9 +1009,17 @@ public:
         entries_.clear();
     }
 
+    std::size_t size() const {
+        return entries_.size();
+    }
+
 private:
     // The mi_session_online container holds the relevant data about an active connection with the broker.
-    // It can be queried either with the clientid, or with the shared pointer to the mqtt endpoint object
+    // It can be queried either with the clientid, or with the shared pointer to the mqtt endpoint object.
+    // The client id index is hashed because it is never iterated in order.
+    // The connection index stays ordered. All offline sessions share the null key, and a hashed
+    // index keeps equal keys in one group that is scanned linearly when a session goes offline.
+    // The session expiry is driven by the broker's timer_wheel, so it has no index.
     using mi_session_state = mi::multi_index_container<
         session_state,
         mi::indexed_by<
@@ -621,13 +1028,10 @@ private:
                 mi::tag<tag_con>,
                 BOOST_MULTI_INDEX_MEMBER(session_state, con_sp_t, con_)
             >,
-            mi::ordered_unique<
+            mi::hashed_unique<
                 mi::tag<tag_cid>,
-                BOOST_MULTI_INDEX_MEMBER(session_state, buffer, client_id_)
-            >,
-            mi::ordered_non_unique<
-                mi::tag<tag_tim>,
-                BOOST_MULTI_INDEX_MEMBER(session_state, std::shared_ptr<as::steady_timer>, tim_session_expiry_)
+                BOOST_MULTI_INDEX_MEMBER(session_state, buffer, client_id_),
+                buffer_hasher
             >
         >
     >;
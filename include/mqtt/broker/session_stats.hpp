@@ -0,0 +1,101 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_SESSION_STATS_HPP)
+#define MQTT_BROKER_SESSION_STATS_HPP
+
+#include <mqtt/config.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <mqtt/broker/broker_namespace.hpp>
+#include <mqtt/buffer.hpp>
+#include <mqtt/endpoint_stats.hpp>
+#include <mqtt/move.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+/**
+ * @brief Resource usage of a session. See broker_t::get_session_stats().
+ */
+struct session_stats {
+    /**
+     * @brief The value to compare sessions by. See value().
+     */
+    enum class key {
+        queued_bytes,           ///< endpoint.queued_bytes
+        queued_packets,         ///< endpoint.queued_packets
+        stored_messages,        ///< endpoint.stored_messages
+        publish_send_queue,     ///< endpoint.publish_send_queue_size
+        offline_messages,       ///< offline_messages
+        offline_bytes,          ///< offline_bytes
+        inflight_messages,      ///< inflight_messages
+        packets_received,       ///< endpoint.total_packets_received()
+        packets_sent,           ///< endpoint.total_packets_sent()
+        bytes_received,         ///< endpoint.total_bytes_received
+        bytes_sent,             ///< endpoint.total_bytes_sent
+        dispatch_time,          ///< endpoint.dispatch_time in nanoseconds
+    };
+
+    buffer client_id;
+    bool online = false;
+    std::size_t offline_messages = 0;   ///< messages stored while the session is offline
+    std::size_t offline_bytes = 0;      ///< topic and payload bytes of them
+    std::size_t inflight_messages = 0;  ///< inflight messages kept for the offline session
+    /// Stats of the current connection. All zero if the session is offline.
+    /// The counters start from zero on each connection.
+    endpoint_stats endpoint;
+
+    std::uint64_t value(key k) const {
+        switch (k) {
+        case key::queued_bytes:       return endpoint.queued_bytes;
+        case key::queued_packets:     return endpoint.queued_packets;
+        case key::stored_messages:    return endpoint.stored_messages;
+        case key::publish_send_queue: return endpoint.publish_send_queue_size;
+        case key::offline_messages:   return offline_messages;
+        case key::offline_bytes:      return offline_bytes;
+        case key::inflight_messages:  return inflight_messages;
+        case key::packets_received:   return endpoint.total_packets_received();
+        case key::packets_sent:       return endpoint.total_packets_sent();
+        case key::bytes_received:     return endpoint.total_bytes_received;
+        case key::bytes_sent:         return endpoint.total_bytes_sent;
+        case key::dispatch_time:      return static_cast<std::uint64_t>(endpoint.dispatch_time.count());
+        }
+        return 0;
+    }
+};
+
+/**
+ * @brief Select the sessions that have the largest values.
+ *        Call it on a snapshot for each key to get the top sessions of each resource.
+ * @param stats snapshot of the sessions
+ * @param k     the value to compare
+ * @param n     the maximum number of sessions to select
+ * @return the sessions in descending order of the value
+ */
+inline std::vector<session_stats> select_top_sessions(
+    std::vector<session_stats> stats,
+    session_stats::key k,
+    std::size_t n
+) {
+    auto middle = stats.begin() + static_cast<std::ptrdiff_t>(std::min(n, stats.size()));
+    std::partial_sort(
+        stats.begin(),
+        middle,
+        stats.end(),
+        [k](session_stats const& lhs, session_stats const& rhs) {
+            return lhs.value(k) > rhs.value(k);
+        }
+    );
+    stats.erase(middle, stats.end());
+    return stats;
+}
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_SESSION_STATS_HPP
@@ -18,7 +18,7 @@
 #include <mqtt/optional.hpp>
 #include <mqtt/buffer.hpp>
 
-#include <mqtt/broker/topic_filter_tokenizer.hpp>
+#include <mqtt/broker/topic_levels.hpp>
 
 MQTT_BROKER_NS_BEGIN
 
@@ -342,8 +342,9 @@ protected:
         }
     }
 
-    template <typename ThisType, typename Output>
-    static void find_match_impl(ThisType& self, string_view topic, Output&& callback) {
+    // Topic is string_view or topic_levels
+    template <typename ThisType, typename Topic, typename Output>
+    static void find_match_impl(ThisType& self, Topic const& topic, Output&& callback) {
         using iterator_type = decltype(self.map.end()); // const_iterator or iterator depends on self
 
         std::vector<iterator_type> entries;
@@ -396,12 +397,22 @@ protected:
         find_match_impl(*this, topic, std::forward<Output>(callback));
     }
 
+    template<typename Output>
+    void find_match(topic_levels const& topic, Output&& callback) const {
+        find_match_impl(*this, topic, std::forward<Output>(callback));
+    }
+
     // Find all topic filters and allow modification
     template<typename Output>
     void modify_match(string_view topic, Output&& callback) {
         find_match_impl(*this, topic, std::forward<Output>(callback));
     }
 
+    template<typename Output>
+    void modify_match(topic_levels const& topic, Output&& callback) {
+        find_match_impl(*this, topic, std::forward<Output>(callback));
+    }
+
     template<typename ThisType, typename Output>
     static void handle_to_iterators(ThisType& self, handle const &h, Output&& output) {
         auto i = h;
@@ -704,6 +715,36 @@ public:
     // Find all topic filters that match the specified topic
     template<typename Output>
     void find(string_view topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+    template<typename Output>
+    void find(topic_levels const& topic, Output&& callback) const {
+        find_impl(topic, std::forward<Output>(callback));
+    }
+
+    // Find all topic filters that match and allow modification
+    template<typename Output>
+    void modify(string_view topic, Output&& callback) {
+        modify_impl(topic, std::forward<Output>(callback));
+    }
+
+    template<typename Output>
+    void modify(topic_levels const& topic, Output&& callback) {
+        modify_impl(topic, std::forward<Output>(callback));
+    }
+
+    template<typename Output>
+    void dump(Output &out) {
+        out << "Root node id: " << this->root_node_id << std::endl;
+        for (auto const& i: this->get_map()) {
+            out << "(" << i.first.first << ", " << i.first.second << "): id: " << i.second.id << ", size: " << i.second.value.size() << ", value: " << i.second.count.value << std::endl;
+        }
+    }
+
+private:
+    template<typename Topic, typename Output>
+    void find_impl(Topic const& topic, Output&& callback) const {
         this->find_match(
             topic,
             [&callback]( Cont const &values ) {
@@ -714,9 +755,8 @@ public:
         );
     }
 
-    // Find all topic filters that match and allow modification
-    template<typename Output>
-    void modify(string_view topic, Output&& callback) {
+    template<typename Topic, typename Output>
+    void modify_impl(Topic const& topic, Output&& callback) {
         this->modify_match(
             topic,
             [&callback]( Cont &values ) {
@@ -726,15 +766,6 @@ public:
             }
         );
     }
-
-    template<typename Output>
-    void dump(Output &out) {
-        out << "Root node id: " << this->root_node_id << std::endl;
-        for (auto const& i: this->get_map()) {
-            out << "(" << i.first.first << ", " << i.first.second << "): id: " << i.second.id << ", size: " << i.second.value.size() << ", value: " << i.second.count.value << std::endl;
-        }
-    }
-
 };
 
 MQTT_BROKER_NS_END
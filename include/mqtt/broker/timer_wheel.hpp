@@ -0,0 +1,251 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_TIMER_WHEEL_HPP)
+#define MQTT_BROKER_TIMER_WHEEL_HPP
+
+#include <mqtt/config.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <mqtt/error_code.hpp>
+#include <mqtt/move.hpp>
+
+#include <mqtt/broker/broker_namespace.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+namespace as = boost::asio;
+
+/**
+ * @brief Coarse timer wheel that drives many inactivity timeouts with one steady_timer.
+ *
+ * An entry expires when it is not touched for its timeout. touch() only stores the current tick
+ * to the entry without locking, so it can be called for each received packet.
+ * The wheel has one slot per tick. On each tick, the entries in the current slot are checked.
+ * An entry that has been touched meanwhile is moved to the slot of its new deadline,
+ * otherwise its handler is called. So the handler is called between timeout and timeout + 2 ticks
+ * after the last touch.
+ * The steady_timer runs only while there are scheduled entries.
+ */
+class timer_wheel {
+public:
+    class entry;
+    using entry_sp = std::shared_ptr<entry>;
+    using expire_handler = std::function<void()>;
+
+    class entry {
+    public:
+        explicit entry(expire_handler h)
+            : h_(force_move(h)) {}
+
+    private:
+        friend class timer_wheel;
+        std::atomic<std::uint64_t> last_tick_ { 0 };
+        std::uint64_t timeout_ticks_ = 0;
+        std::size_t slot_ = 0;
+        bool scheduled_ = false;
+        std::list<entry_sp>::iterator it_;
+        expire_handler h_;
+    };
+
+    /**
+     * @brief constructor
+     * @param ioc       io_context for the steady_timer. Expire handlers are called on it.
+     * @param tick      resolution of the timeouts
+     * @param num_slots number of slots. Entries whose timeout is longer than num_slots * tick are
+     *                  checked once per revolution.
+     */
+    timer_wheel(
+        as::io_context& ioc,
+        std::chrono::steady_clock::duration tick = std::chrono::seconds(1),
+        std::size_t num_slots = 1024)
+        : tim_(ioc),
+          tick_(tick),
+          slots_(num_slots)
+    {}
+
+    /**
+     * @brief constructor
+     * @param ex        executor for the steady_timer. Expire handlers are called on it.
+     * @param tick      resolution of the timeouts
+     * @param num_slots number of slots. Entries whose timeout is longer than num_slots * tick are
+     *                  checked once per revolution.
+     */
+    timer_wheel(
+        as::steady_timer::executor_type ex,
+        std::chrono::steady_clock::duration tick = std::chrono::seconds(1),
+        std::size_t num_slots = 1024)
+        : tim_(force_move(ex)),
+          tick_(tick),
+          slots_(num_slots)
+    {}
+
+    timer_wheel(timer_wheel const&) = delete;
+    timer_wheel& operator=(timer_wheel const&) = delete;
+
+    /**
+     * @brief Create an entry. It is not scheduled yet.
+     * @param h handler that is called when the entry expires
+     * @return entry
+     */
+    static entry_sp make_entry(expire_handler h) {
+        return std::make_shared<entry>(force_move(h));
+    }
+
+    /**
+     * @brief Schedule or reschedule the entry.
+     * @param e       entry
+     * @param timeout the entry expires when it is not touched for this duration
+     */
+    void schedule(entry_sp const& e, std::chrono::steady_clock::duration timeout) {
+        std::lock_guard<std::mutex> g(mtx_);
+        if (e->scheduled_) unlink(*e);
+        // The current tick can be up to one tick older than the real time of touch(),
+        // so one more tick is added not to expire early.
+        auto ticks = (timeout.count() + tick_.count() - 1) / tick_.count();
+        e->timeout_ticks_ = static_cast<std::uint64_t>(ticks > 0 ? ticks : 0) + 1;
+        auto now = now_tick_.load(std::memory_order_relaxed);
+        e->last_tick_.store(now, std::memory_order_relaxed);
+        link(e, now + e->timeout_ticks_);
+        if (!running_) start();
+    }
+
+    /**
+     * @brief Cancel the entry. The handler is not called after that.
+     * @param e entry
+     */
+    void cancel(entry& e) {
+        std::lock_guard<std::mutex> g(mtx_);
+        if (!e.scheduled_) return;
+        unlink(e);
+        if (size_ == 0 && running_) stop();
+    }
+
+    /**
+     * @brief Restart the timeout of the entry.
+     *        It is a relaxed atomic store, the entry is moved lazily when its slot is checked.
+     * @param e entry
+     */
+    void touch(entry& e) noexcept {
+        e.last_tick_.store(now_tick_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the number of scheduled entries
+     * @return the number of scheduled entries
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> g(mtx_);
+        return size_;
+    }
+
+private:
+    void link(entry_sp const& e, std::uint64_t deadline) {
+        e->slot_ = static_cast<std::size_t>(deadline % slots_.size());
+        auto& s = slots_[e->slot_];
+        e->it_ = s.insert(s.end(), e);
+        e->scheduled_ = true;
+        ++size_;
+    }
+
+    void unlink(entry& e) {
+        // erasing the list element may destroy e, so clear the flag before that.
+        e.scheduled_ = false;
+        --size_;
+        slots_[e.slot_].erase(e.it_);
+    }
+
+    void start() {
+        running_ = true;
+        next_expiry_ = std::chrono::steady_clock::now() + tick_;
+        set_timer();
+    }
+
+    void stop() {
+        running_ = false;
+        ++generation_;
+        tim_.cancel();
+    }
+
+    void set_timer() {
+        tim_.expires_at(next_expiry_);
+        tim_.async_wait(
+            [this, generation = generation_]
+            (error_code ec) {
+                if (ec) return;
+                on_tick(generation);
+            }
+        );
+    }
+
+    void on_tick(std::uint64_t generation) {
+        std::vector<entry_sp> expired;
+        {
+            std::lock_guard<std::mutex> g(mtx_);
+            // the wheel has been stopped after this handler was posted
+            if (generation != generation_) return;
+            auto now = now_tick_.load(std::memory_order_relaxed) + 1;
+            now_tick_.store(now, std::memory_order_relaxed);
+            auto idx = static_cast<std::size_t>(now % slots_.size());
+            auto& s = slots_[idx];
+            for (auto it = s.begin(); it != s.end();) {
+                auto next = std::next(it);
+                auto& e = *it;
+                auto deadline = e->last_tick_.load(std::memory_order_relaxed) + e->timeout_ticks_;
+                if (deadline <= now) {
+                    e->scheduled_ = false;
+                    --size_;
+                    expired.push_back(force_move(e));
+                    s.erase(it);
+                }
+                else {
+                    auto new_idx = static_cast<std::size_t>(deadline % slots_.size());
+                    if (new_idx != idx) {
+                        e->slot_ = new_idx;
+                        slots_[new_idx].splice(slots_[new_idx].end(), s, it);
+                    }
+                }
+                it = next;
+            }
+            if (size_ == 0) {
+                running_ = false;
+            }
+            else {
+                next_expiry_ += tick_;
+                set_timer();
+            }
+        }
+        for (auto& e : expired) {
+            if (e->h_) e->h_();
+        }
+    }
+
+private:
+    mutable std::mutex mtx_;
+    as::steady_timer tim_;
+    std::chrono::steady_clock::duration tick_;
+    std::vector<std::list<entry_sp>> slots_;
+    std::atomic<std::uint64_t> now_tick_ { 0 };
+    std::size_t size_ = 0;
+    bool running_ = false;
+    std::uint64_t generation_ = 0;
+    std::chrono::steady_clock::time_point next_expiry_;
+};
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_TIMER_WHEEL_HPP
@@ -0,0 +1,198 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_TOPIC_LEVELS_HPP)
+#define MQTT_BROKER_TOPIC_LEVELS_HPP
+
+#include <cstdint>
+#include <limits>
+
+#include <boost/assert.hpp>
+#include <boost/container/small_vector.hpp>
+
+#include <mqtt/broker/broker_namespace.hpp>
+#include <mqtt/string_view.hpp>
+#include <mqtt/utf8encoded_strings.hpp>
+
+#include <mqtt/broker/topic_filter_tokenizer.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+/**
+ * @brief The result of scanning a topic name or a topic filter once.
+ *
+ * The level boundaries, the wildcard placement, the null character and the UTF-8 validity
+ * are collected in a single pass. Printable ASCII is checked 16 bytes at a time using SSE2
+ * if available. The result can be passed to subscription_map and retained_topic_map instead
+ * of the topic, so the topic is not scanned again.
+ *
+ * topic_levels refers to the characters of the topic. The topic must outlive it.
+ */
+class topic_levels {
+public:
+    /**
+     * @param topic         topic name or topic filter
+     * @param validate_utf8 false if the topic has already been validated, e.g. by the endpoint
+     *                      that received it. utf8() returns well_formed then.
+     */
+    explicit topic_levels(string_view topic, bool validate_utf8 = true)
+        :topic_(topic)
+    {
+        auto p = topic.data();
+        auto size = topic.size();
+        std::size_t first_non_printable = size;
+        bool find_non_printable = validate_utf8;
+        std::size_t i = 0;
+#if defined(MQTT_UTF8_SSE2)
+        auto const sep = _mm_set1_epi8(topic_filter_separator);
+        auto const plus = _mm_set1_epi8('+');
+        auto const hash = _mm_set1_epi8('#');
+        auto const null = _mm_setzero_si128();
+        auto const lower = _mm_set1_epi8(0x1f);
+        auto const upper = _mm_set1_epi8(0x7f);
+        for (; i + 16 <= size; i += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + i));
+            auto special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, sep), _mm_cmpeq_epi8(v, plus)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, hash), _mm_cmpeq_epi8(v, null))
+            );
+            if (find_non_printable) {
+                auto printable = _mm_and_si128(_mm_cmpgt_epi8(v, lower), _mm_cmplt_epi8(v, upper));
+                auto printable_mask = static_cast<unsigned>(_mm_movemask_epi8(printable));
+                if (printable_mask != 0xffff) {
+                    first_non_printable = i + utf8string::detail::count_trailing_ones(printable_mask);
+                    find_non_printable = false;
+                }
+            }
+            auto special_mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+            while (special_mask != 0) {
+                on_special(i + utf8string::detail::count_trailing_zeros(special_mask));
+                special_mask &= special_mask - 1;
+            }
+        }
+#endif // defined(MQTT_UTF8_SSE2)
+        for (; i != size; ++i) {
+            switch (p[i]) {
+            case topic_filter_separator:
+            case '+':
+            case '#':
+            case '\0':
+                on_special(i);
+                break;
+            default:
+                break;
+            }
+            if (find_non_printable &&
+                !utf8string::detail::is_printable_ascii(static_cast<unsigned char>(p[i]))) {
+                first_non_printable = i;
+                find_non_printable = false;
+            }
+        }
+        ends_.push_back(static_cast<std::uint32_t>(size));
+
+        // The bytes before first_non_printable are single byte characters,
+        // so the rest starts at a character boundary.
+        if (first_non_printable != size) {
+            utf8_ = utf8string::validate_contents(topic.substr(first_non_printable));
+        }
+    }
+
+    string_view topic() const {
+        return topic_;
+    }
+
+    /**
+     * @brief Get the number of levels. "a/b" and "a/" have 2 levels.
+     */
+    std::size_t size() const {
+        return ends_.size();
+    }
+
+    string_view level(std::size_t index) const {
+        auto begin = index == 0 ? 0 : ends_[index - 1] + 1;
+        return topic_.substr(begin, ends_[index] - begin);
+    }
+
+    bool has_wildcard() const {
+        return has_wildcard_;
+    }
+
+    bool has_null() const {
+        return has_null_;
+    }
+
+    utf8string::validation utf8() const {
+        return utf8_;
+    }
+
+    /**
+     * @brief Same rules as validate_topic_name() in broker.hpp.
+     */
+    bool valid_topic_name() const {
+        return valid_length() && !has_null_ && !has_wildcard_;
+    }
+
+    /**
+     * @brief Same rules as validate_topic_filter() in broker.hpp.
+     */
+    bool valid_topic_filter() const {
+        return valid_length() && !has_null_ && !wildcard_misplaced_;
+    }
+
+private:
+    bool valid_length() const {
+        return !topic_.empty() && topic_.size() <= std::numeric_limits<std::uint16_t>::max();
+    }
+
+    bool is_separator_or_edge(std::size_t pos) const {
+        return pos >= topic_.size() || topic_[pos] == topic_filter_separator;
+    }
+
+    void on_special(std::size_t pos) {
+        switch (topic_[pos]) {
+        case topic_filter_separator:
+            ends_.push_back(static_cast<std::uint32_t>(pos));
+            break;
+        case '+':
+            // must occupy an entire level
+            has_wildcard_ = true;
+            if ((pos != 0 && !is_separator_or_edge(pos - 1)) || !is_separator_or_edge(pos + 1)) {
+                wildcard_misplaced_ = true;
+            }
+            break;
+        case '#':
+            // must occupy an entire level and must be the last character
+            has_wildcard_ = true;
+            if ((pos != 0 && !is_separator_or_edge(pos - 1)) || pos + 1 != topic_.size()) {
+                wildcard_misplaced_ = true;
+            }
+            break;
+        default:
+            BOOST_ASSERT(topic_[pos] == '\0');
+            has_null_ = true;
+            break;
+        }
+    }
+
+    string_view topic_;
+    // The end offset of each level. The last one is the size of the topic.
+    boost::container::small_vector<std::uint32_t, 16> ends_;
+    bool has_wildcard_ = false;
+    bool wildcard_misplaced_ = false;
+    bool has_null_ = false;
+    utf8string::validation utf8_ = utf8string::validation::well_formed;
+};
+
+template<typename Output>
+inline void topic_filter_tokenizer(topic_levels const& levels, Output write) {
+    for (std::size_t i = 0; i != levels.size(); ++i) {
+        if (!write(levels.level(i))) return;
+    }
+}
+
+MQTT_BROKER_NS_END
+
+#endif // MQTT_BROKER_TOPIC_LEVELS_HPP
@@ -0,0 +1,151 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BROKER_TRACE_SINK_HPP)
+#define MQTT_BROKER_TRACE_SINK_HPP
+
+#include <mqtt/config.hpp>
+
+#if defined(MQTT_USE_TRACE)
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+
+#include <mqtt/trace.hpp>
+
+#include <mqtt/broker/broker_namespace.hpp>
+#include <mqtt/broker/metrics.hpp>
+
+MQTT_BROKER_NS_BEGIN
+
+/**
+ * @brief trace_sink that aggregates the latency of each stage into histograms.
+ *
+ * The latency of a stage is the time from its stamp to the next stamped stage.
+ * The stages that are not stamped (e.g. match and deliver on a client) are skipped.
+ * Recording the histograms is wait-free.
+ *
+ * The latest traces can also be kept and exported in the Chrome trace event format, which
+ * chrome://tracing and Perfetto can open.
+ */
+class histogram_trace_sink : public trace_sink {
+public:
+    static constexpr std::size_t num_of_stages = trace_context::num_of_stages;
+
+    /**
+     * @param max_traces the number of the latest traces kept for write_chrome_trace().
+     *                   0 means no trace is kept and on_trace() takes no lock.
+     */
+    explicit histogram_trace_sink(std::size_t max_traces = 0)
+        :max_traces_(max_traces) {}
+
+    void on_trace(trace_context const& ctx) override {
+        std::int64_t prev = 0;
+        std::size_t prev_stage = 0;
+        for (std::size_t i = 0; i != num_of_stages; ++i) {
+            auto t = ctx.get(static_cast<trace_stage>(i));
+            if (t == 0) continue;
+            if (prev != 0) record(stages_[prev_stage], t - prev);
+            prev = t;
+            prev_stage = i;
+        }
+        auto first = ctx.get(trace_stage::read);
+        auto last = ctx.get(trace_stage::done);
+        if (first != 0 && last != 0) record(total_, last - first);
+
+        if (max_traces_ != 0) {
+            std::lock_guard<std::mutex> g(mtx_traces_);
+            if (traces_.size() == max_traces_) traces_.pop_front();
+            traces_.push_back(ctx);
+        }
+    }
+
+    /**
+     * @brief Get the latency histogram of the stage in nanoseconds.
+     */
+    histogram_snapshot get(trace_stage stage) const {
+        return snapshot(stages_[static_cast<std::size_t>(stage)]);
+    }
+
+    /**
+     * @brief Get the histogram of the time from read to done in nanoseconds.
+     */
+    histogram_snapshot get_total() const {
+        return snapshot(total_);
+    }
+
+    /**
+     * @brief Write the kept traces in the Chrome trace event format (JSON).
+     *
+     * Each stage is a complete event ("ph":"X"). The events of the same incoming PUBLISH
+     * share the tid, so each row of the viewer shows a message.
+     */
+    void write_chrome_trace(std::ostream& os) const {
+        std::lock_guard<std::mutex> g(mtx_traces_);
+        auto flags = os.flags();
+        auto precision = os.precision();
+        os << std::fixed << std::setprecision(3);
+        os << "{\"traceEvents\":[";
+        bool first_event = true;
+        for (auto const& ctx : traces_) {
+            std::int64_t prev = 0;
+            std::size_t prev_stage = 0;
+            for (std::size_t i = 0; i != num_of_stages; ++i) {
+                auto t = ctx.get(static_cast<trace_stage>(i));
+                if (t == 0) continue;
+                if (prev != 0) {
+                    if (!first_event) os << ',';
+                    first_event = false;
+                    // ts and dur are microseconds
+                    os << "{\"name\":\"" << trace_stage_to_str(static_cast<trace_stage>(prev_stage)) << '"'
+                       << ",\"cat\":\"mqtt\",\"ph\":\"X\""
+                       << ",\"ts\":" << static_cast<double>(prev) / 1000.0
+                       << ",\"dur\":" << static_cast<double>(t - prev) / 1000.0
+                       << ",\"pid\":1,\"tid\":" << ctx.id() << '}';
+                }
+                prev = t;
+                prev_stage = i;
+            }
+        }
+        os << "],\"displayTimeUnit\":\"ns\"}";
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+private:
+    using buckets_t = std::array<std::atomic<std::uint64_t>, histogram_snapshot::buckets>;
+
+    static void record(buckets_t& buckets, std::int64_t ns) {
+        if (ns < 0) ns = 0;
+        buckets[histogram_snapshot::bucket_index(static_cast<std::uint64_t>(ns))]
+            .fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static histogram_snapshot snapshot(buckets_t const& buckets) {
+        histogram_snapshot s;
+        for (std::size_t i = 0; i != histogram_snapshot::buckets; ++i) {
+            s.add(i, buckets[i].load(std::memory_order_relaxed));
+        }
+        return s;
+    }
+
+    std::array<buckets_t, num_of_stages> stages_ {};
+    buckets_t total_ {};
+
+    std::size_t max_traces_;
+    mutable std::mutex mtx_traces_;
+    std::deque<trace_context> traces_;
+};
+
+MQTT_BROKER_NS_END
+
+#endif // defined(MQTT_USE_TRACE)
+
+#endif // MQTT_BROKER_TRACE_SINK_HPP
@@ -0,0 +1,128 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_ENCODED_PROPERTIES_HPP)
+#define MQTT_ENCODED_PROPERTIES_HPP
+
+#include <memory>
+#include <numeric>
+#include <string>
+#include <iterator>
+#include <algorithm>
+
+#include <mqtt/namespace.hpp>
+#include <mqtt/buffer.hpp>
+#include <mqtt/move.hpp>
+#include <mqtt/property_variant.hpp>
+
+namespace MQTT_NS {
+
+namespace v5 {
+
+/**
+ * @brief Properties that are serialized once and shared by many PUBLISH packets.
+ *
+ * When one message is delivered to many subscribers, the properties are identical
+ * for all of them except a few per subscriber ones (e.g. Subscription Identifier and Topic Alias).
+ * encoded_properties serializes the common part only once. Copying encoded_properties
+ * only increments reference counts, so it can be passed to each endpoint cheaply.
+ * The endpoint sends the shared bytes as one buffer and appends per subscriber properties.
+ */
+class encoded_properties {
+public:
+    /**
+     * @brief Create empty encoded_properties
+     */
+    encoded_properties() = default;
+
+    /**
+     * @brief Create encoded_properties
+     * @param props properties to be serialized
+     */
+    explicit encoded_properties(properties props)
+        : props_(std::make_shared<properties const>(force_move(props))),
+          size_(
+              std::accumulate(
+                  props_->begin(),
+                  props_->end(),
+                  std::size_t(0U),
+                  [](std::size_t total, property_variant const& pv) {
+                      return total + v5::size(pv);
+                  }
+              )
+          )
+    {
+        if (size_ == 0) return;
+        std::string s(size_, '\0');
+        auto it = s.begin();
+        auto end = s.end();
+        for (auto const& p : *props_) {
+            v5::fill(p, it, end);
+            it += static_cast<std::string::difference_type>(v5::size(p));
+        }
+        bytes_ = allocate_buffer(s);
+    }
+
+    /**
+     * @brief Get the original properties
+     * @return properties
+     */
+    properties const& props() const {
+        static properties const empty;
+        if (!props_) return empty;
+        return *props_;
+    }
+
+    /**
+     * @brief Get serialized properties
+     * @return serialized bytes. It doesn't contain the property length.
+     */
+    buffer const& bytes() const {
+        return bytes_;
+    }
+
+    /**
+     * @brief Get the size of serialized properties
+     * @return size
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    /**
+     * @brief Get the number of properties
+     * @return number of properties
+     */
+    std::size_t count() const {
+        if (!props_) return 0;
+        return props_->size();
+    }
+
+    /**
+     * @brief Get properties that contains the shared properties followed by props
+     * @param props properties to append
+     * @return properties
+     */
+    properties merge(properties props) const {
+        if (count() == 0) return props;
+        properties merged;
+        merged.reserve(count() + props.size());
+        std::copy(props_->begin(), props_->end(), std::back_inserter(merged));
+        std::move(props.begin(), props.end(), std::back_inserter(merged));
+        return merged;
+    }
+
+private:
+    std::shared_ptr<properties const> props_;
+    std::size_t size_ = 0;
+    buffer bytes_;
+};
+
+} // namespace v5
+
+} // namespace MQTT_NS
+
+#endif // MQTT_ENCODED_PROPERTIES_HPP
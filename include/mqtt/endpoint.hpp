@@ -17,6 +17,8 @@
 #include <memory>
 #include <mutex>
 #include <atomic>
+#include <array>
+#include <chrono>
 #include <algorithm>
 
 #include <boost/any.hpp>
@@ -29,6 +31,7 @@
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 #include <boost/multi_index/composite_key.hpp>
+#include <boost/container/flat_set.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/assert.hpp>
 
@@ -55,6 +58,7 @@
 #include <mqtt/packet_id_type.hpp>
 #include <mqtt/optional.hpp>
 #include <mqtt/property_variant.hpp>
+#include <mqtt/encoded_properties.hpp>
 #include <mqtt/protocol_version.hpp>
 #include <mqtt/reason_code.hpp>
 #include <mqtt/buffer.hpp>
@@ -65,12 +69,16 @@
 #include <mqtt/deprecated_msg.hpp>
 #include <mqtt/error_code.hpp>
 #include <mqtt/log.hpp>
+#include <mqtt/trace.hpp>
+#include <mqtt/profile.hpp>
+#include <mqtt/endpoint_stats.hpp>
 #include <mqtt/variant_visit.hpp>
 #include <mqtt/topic_alias_send.hpp>
 #include <mqtt/topic_alias_recv.hpp>
 #include <mqtt/subscribe_entry.hpp>
 #include <mqtt/shared_subscriptions.hpp>
 #include <mqtt/packet_id_manager.hpp>
+#include <mqtt/bitmap_packet_id_manager.hpp>
 
 #if defined(MQTT_USE_WS)
 #include <mqtt/ws_endpoint.hpp>
@@ -167,9 +175,30 @@ constexpr bool should_generate_packet_id(Params const& ... params) {
 namespace as = boost::asio;
 namespace mi = boost::multi_index;
 
-template <typename Mutex = std::mutex, template<typename...> class LockGuard = std::lock_guard, std::size_t PacketIdBytes = 2>
-class endpoint : public std::enable_shared_from_this<endpoint<Mutex, LockGuard, PacketIdBytes>> {
-    using this_type = endpoint<Mutex, LockGuard, PacketIdBytes>;
+/**
+ * @brief MQTT endpoint
+ * @tparam Mutex           mutex type that protects the internal state
+ * @tparam LockGuard       lock guard type for Mutex
+ * @tparam PacketIdBytes   packet identifier size. 2 is standard, 4 is extended for inter broker communication.
+ * @tparam PacketIdManager packet identifier allocator. packet_id_manager keeps free id intervals,
+ *                         bitmap_packet_id_manager keeps a bitmap and is faster when many ids are
+ *                         in flight and released out of order.
+ * @tparam Version         protocol version that the endpoint is specialized for.
+ *                         protocol_version::undetermined (default) supports both v3.1.1 and v5
+ *                         and decides the version at runtime.
+ *                         If v3_1_1 or v5 is set, the version is a compile time constant, so the
+ *                         per packet version branches and the code for the other version are
+ *                         removed by the compiler. CONNECT with the other version is rejected.
+ */
+template <
+    typename Mutex = std::mutex,
+    template<typename...> class LockGuard = std::lock_guard,
+    std::size_t PacketIdBytes = 2,
+    template<typename> class PacketIdManager = packet_id_manager,
+    protocol_version Version = protocol_version::undetermined
+>
+class endpoint : public std::enable_shared_from_this<endpoint<Mutex, LockGuard, PacketIdBytes, PacketIdManager, Version>> {
+    using this_type = endpoint<Mutex, LockGuard, PacketIdBytes, PacketIdManager, Version>;
     using this_type_sp = std::shared_ptr<this_type>;
 
 public:
@@ -190,10 +219,11 @@ public:
      */
     endpoint(as::io_context& ioc, protocol_version version = protocol_version::undetermined, bool async_operation = false)
         :async_operation_{async_operation},
-         version_(version),
+         version_(Version == protocol_version::undetermined ? version : Version),
          tim_pingresp_(ioc),
          tim_shutdown_(ioc)
     {
+        BOOST_ASSERT(Version == protocol_version::undetermined || version == protocol_version::undetermined || version == Version);
         MQTT_LOG("mqtt_api", info)
             << MQTT_ADD_VALUE(address, this)
             << "create"
@@ -218,10 +248,11 @@ public:
         :socket_(force_move(socket)),
          connected_(true),
          async_operation_{async_operation},
-         version_(version),
+         version_(Version == protocol_version::undetermined ? version : Version),
          tim_pingresp_(ioc),
          tim_shutdown_(ioc)
     {
+        BOOST_ASSERT(Version == protocol_version::undetermined || version == protocol_version::undetermined || version == Version);
         MQTT_LOG("mqtt_api", info)
             << MQTT_ADD_VALUE(address, this)
             << "create"
@@ -874,7 +905,7 @@ public:
      * @return The total bytes received on the socket.
      */
     std::size_t get_total_bytes_received() const {
-        return total_bytes_received_;
+        return total_bytes_received_.load(std::memory_order_relaxed);
     }
 
     /**
@@ -882,7 +913,35 @@ public:
      * @return The total bytes sent on the socket.
      */
     std::size_t get_total_bytes_sent() const {
-        return total_bytes_sent_;
+        return total_bytes_sent_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the resource usage of this endpoint.
+     *        It can be called from any thread. The locks of the store and the publish send queue
+     *        are held only while their sizes are read.
+     * @return The snapshot of the stats.
+     */
+    endpoint_stats get_stats() const {
+        endpoint_stats s;
+        s.queued_bytes = queued_bytes_.load(std::memory_order_relaxed);
+        s.queued_packets = queued_packets_.load(std::memory_order_relaxed);
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            s.stored_messages = store_.size();
+        }
+        {
+            LockGuard<Mutex> lck (publish_send_queue_mtx_);
+            s.publish_send_queue_size = publish_send_queue_.size();
+        }
+        s.total_bytes_sent = total_bytes_sent_.load(std::memory_order_relaxed);
+        s.total_bytes_received = total_bytes_received_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i != endpoint_stats::num_of_packet_types; ++i) {
+            s.packets_received[i] = packets_received_[i].load(std::memory_order_relaxed);
+            s.packets_sent[i] = packets_sent_[i].load(std::memory_order_relaxed);
+        }
+        s.dispatch_time = std::chrono::nanoseconds(dispatch_time_ns_.load(std::memory_order_relaxed));
+        return s;
     }
 
     /**
@@ -2712,6 +2771,85 @@ public:
             force_move(func)
         );
     }
+    /**
+     * @brief Publish with a manual set packet identifier and shared serialized properties
+     * @param packet_id
+     *        packet identifier. It should be acquired by acquire_unique_packet_id, or register_packet_id.
+     *        The ownership of  the packet_id moves to the library.
+     *        If qos == qos::at_most_once, packet_id must be 0. But not checked in release mode due to performance.
+     * @param topic_name
+     *        A topic name to publish
+     * @param contents
+     *        The contents or the range of the contents to publish
+     * @param pubopts
+     *        qos, retain flag, and dup flag.
+     * @param shared_props
+     *        Properties that have already been serialized. They are typically shared by many endpoints
+     *        that receive the same message. It is ignored on MQTT v3.1.1.<BR>
+     *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
+     *        3.3.2.3 PUBLISH Properties
+     * @param props
+     *        Properties for this endpoint only. They are sent after shared_props.
+     * @param life_keeper
+     *        An object that stays alive as long as the library holds a reference to any other parameters.
+     *        If topic_name, contents, or props do not have built-in lifetime management, (e.g. buffer)
+     *        use this parameter to manage their lifetime.
+     * @param func
+     *        functor object who's operator() will be called when the async operation completes.
+     */
+    template <typename BufferSequence>
+    typename std::enable_if<
+        is_buffer_sequence<BufferSequence>::value
+    >::type
+    async_publish(
+        packet_id_t packet_id,
+        buffer topic_name,
+        BufferSequence contents,
+        publish_options pubopts,
+        v5::encoded_properties const& shared_props,
+        v5::properties props,
+        any life_keeper = {},
+        async_handler_t func = {}
+    ) {
+        MQTT_LOG("mqtt_api", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "async_publish"
+            << " pid:" << packet_id
+            << " topic:" << topic_name
+            << " qos:" << pubopts.get_qos()
+            << " retain:" << pubopts.get_retain()
+            << " dup:" << pubopts.get_dup();
+
+        BOOST_ASSERT((pubopts.get_qos() == qos::at_most_once && packet_id == 0) || (pubopts.get_qos() != qos::at_most_once && packet_id != 0));
+
+        auto topic_name_buf = as::buffer(topic_name);
+
+        std::vector<as::const_buffer> cbs;
+        {
+            auto b = MQTT_NS::buffer_sequence_begin(contents);
+            auto e = MQTT_NS::buffer_sequence_end(contents);
+            cbs.reserve(static_cast<std::size_t>(std::distance(b, e)));
+            for (; b != e; ++b) {
+                cbs.emplace_back(as::buffer(*b));
+            }
+        }
+
+        async_send_publish(
+            packet_id,
+            topic_name_buf,
+            force_move(cbs),
+            pubopts,
+            force_move(props),
+            std::make_tuple(
+                force_move(life_keeper),
+                force_move(topic_name),
+                force_move(contents)
+            ),
+            force_move(func),
+            shared_props
+        );
+    }
+
     /**
      * @brief Subscribe
      * @param packet_id
@@ -4374,7 +4512,14 @@ public:
      * @return set of packet_ids
      */
     std::set<packet_id_t> get_qos2_publish_handled_pids() const {
-        return qos2_publish_handled_;
+        std::set<packet_id_t> pids;
+        qos2_publish_handled_.for_each(
+            [&](packet_id_t pid) {
+                // ascending order, so each insertion is amortized constant time with the end hint.
+                pids.emplace_hint(pids.end(), pid);
+            }
+        );
+        return pids;
     }
 
     /**
@@ -4383,7 +4528,8 @@ public:
      * @param pids packet ids
      */
     void restore_qos2_publish_handled_pids(std::set<packet_id_t> pids) {
-        qos2_publish_handled_ = force_move(pids);
+        qos2_publish_handled_.clear();
+        for (auto pid : pids) qos2_publish_handled_.insert(pid);
     }
 
     // manual packet_id management for advanced users
@@ -4446,7 +4592,7 @@ public:
     template <typename Iterator>
     std::enable_if_t< std::is_convertible<typename Iterator::value_type, char>::value >
     restore_serialized_message(Iterator b, Iterator e) {
-        BOOST_ASSERT(version_ == protocol_version::v3_1_1);
+        BOOST_ASSERT(current_version() == protocol_version::v3_1_1);
         static_assert(
             std::is_same<
                 typename std::iterator_traits<Iterator>::iterator_category,
@@ -4509,7 +4655,7 @@ public:
      *        An object that stays alive (but is moved with force_move()) until the stored message is sent.
      */
     void restore_serialized_message(basic_publish_message<PacketIdBytes> msg, any life_keeper = {}) {
-        BOOST_ASSERT(version_ == protocol_version::v3_1_1);
+        BOOST_ASSERT(current_version() == protocol_version::v3_1_1);
         auto packet_id = msg.packet_id();
         qos qos_value = msg.get_qos();
         LockGuard<Mutex> lck (store_mtx_);
@@ -4547,7 +4693,7 @@ public:
      * @param msg pubrel message.
      */
     void restore_serialized_message(basic_pubrel_message<PacketIdBytes> msg, any life_keeper = {}) {
-        BOOST_ASSERT(version_ == protocol_version::v3_1_1);
+        BOOST_ASSERT(current_version() == protocol_version::v3_1_1);
         auto packet_id = msg.packet_id();
         LockGuard<Mutex> lck (store_mtx_);
         if (pid_man_.register_id(packet_id)) {
@@ -4586,7 +4732,7 @@ public:
     template <typename Iterator>
     std::enable_if_t< std::is_convertible<typename Iterator::value_type, char>::value >
     restore_v5_serialized_message(Iterator b, Iterator e) {
-        BOOST_ASSERT(version_ == protocol_version::v5);
+        BOOST_ASSERT(current_version() == protocol_version::v5);
         if (b == e) return;
 
         auto fixed_header = static_cast<std::uint8_t>(*b);
@@ -4631,7 +4777,7 @@ public:
      *        An object that stays alive (but is moved with force_move()) until the stored message is sent.
      */
     void restore_v5_serialized_message(v5::basic_publish_message<PacketIdBytes> msg, any life_keeper = {}) {
-        BOOST_ASSERT(version_ == protocol_version::v5);
+        BOOST_ASSERT(current_version() == protocol_version::v5);
         BOOST_ASSERT(!msg.topic().empty());
         auto packet_id = msg.packet_id();
         auto qos = msg.get_qos();
@@ -4672,7 +4818,7 @@ public:
      *        An object that stays alive (but is moved with force_move()) until the stored message is sent.
      */
     void restore_v5_serialized_message(v5::basic_pubrel_message<PacketIdBytes> msg, any life_keeper = {}) {
-        BOOST_ASSERT(version_ == protocol_version::v5);
+        BOOST_ASSERT(current_version() == protocol_version::v5);
         auto packet_id = msg.packet_id();
         LockGuard<Mutex> lck (store_mtx_);
         if (pid_man_.register_id(packet_id)) {
@@ -5001,7 +5147,7 @@ public:
     }
 
     protocol_version get_protocol_version() const {
-        return version_;
+        return current_version();
     }
 
     MQTT_NS::socket const& socket() const {
@@ -5072,7 +5218,7 @@ protected:
             [this, self = this->shared_from_this(), session_life_keeper = force_move(session_life_keeper)](
                 error_code ec,
                 std::size_t bytes_transferred) mutable {
-                this->total_bytes_received_ += bytes_transferred;
+                this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                 if (!check_error_and_transferred_length(ec, bytes_transferred, 1)) return;
                 handle_control_packet_type(force_move(session_life_keeper), force_move(self));
             }
@@ -5123,6 +5269,7 @@ protected:
     }
 
     void set_protocol_version(protocol_version version) {
+        BOOST_ASSERT(Version == protocol_version::undetermined || version == Version);
         version_ = version;
     }
 
@@ -5133,6 +5280,7 @@ protected:
     }
 
     void set_client_id(protocol_version version) {
+        BOOST_ASSERT(Version == protocol_version::undetermined || version == Version);
         version_ = version;
     }
 
@@ -5142,6 +5290,12 @@ private:
         server
     };
 
+    // If the endpoint is specialized for a version, it is a constant and the branches for the
+    // other version are removed.
+    MQTT_ALWAYS_INLINE protocol_version current_version() const {
+        return Version == protocol_version::undetermined ? version_ : Version;
+    }
+
     void update_values_and_props_on_start_connection(v5::properties& props) {
         // Check properties and overwrite the values by properties
         std::size_t topic_alias_maximum_count = 0;
@@ -5575,6 +5729,14 @@ private:
 
     void handle_control_packet_type(any session_life_keeper, this_type_sp self) {
         fixed_header_ = static_cast<std::uint8_t>(buf_.front());
+#if defined(MQTT_USE_TRACE)
+        if (get_control_packet_type(fixed_header_) == control_packet_type::publish && get_trace_sink()) {
+            trace_ctx_ = trace_context::start();
+        }
+        else {
+            trace_ctx_.clear();
+        }
+#endif // defined(MQTT_USE_TRACE)
         remaining_length_ = 0;
         remaining_length_multiplier_ = 1;
         socket_->async_read(
@@ -5582,7 +5744,7 @@ private:
             [this, self = force_move(self), session_life_keeper = force_move(session_life_keeper)] (
                 error_code ec,
                 std::size_t bytes_transferred) mutable {
-                this->total_bytes_received_ += bytes_transferred;
+                this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                 if (!check_error_and_transferred_length(ec, bytes_transferred, 1)) return;
                 handle_remaining_length(force_move(session_life_keeper), force_move(self));
             }
@@ -5606,7 +5768,7 @@ private:
                 [this, self = force_move(self), session_life_keeper = force_move(session_life_keeper)](
                     error_code ec,
                     std::size_t bytes_transferred) mutable {
-                    this->total_bytes_received_ += bytes_transferred;
+                    this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                     if (handle_close_or_error(ec)) {
                         return;
                     }
@@ -5627,7 +5789,7 @@ private:
             auto cpt = cpt_opt.value();
             auto check =
                 [&]() -> bool {
-                    switch (version_) {
+                    switch (current_version()) {
                     case protocol_version::v3_1_1:
                         switch (cpt) {
                         case control_packet_type::connect:
@@ -5689,6 +5851,50 @@ private:
     }
 
     void process_payload(any session_life_keeper, this_type_sp self) {
+        packets_received_[fixed_header_ >> 4].fetch_add(1, std::memory_order_relaxed);
+        parse_step(
+            self,
+            [&] {
+                dispatch_payload(force_move(session_life_keeper), self);
+            }
+        );
+    }
+
+    /**
+     * @brief Run a step of parsing the payload of the received packet.
+     *        dispatch_payload() only starts reading the payload. The rest of the packet is
+     *        parsed, and its handler is called, in the read completions. Each of them runs f
+     *        via this function, so the time and the profile::parse phase cover all of them.
+     * @param self kept while f runs, because the handler can release the last reference to
+     *             this endpoint.
+     * @param f    function object without arguments
+     */
+    template <typename F>
+    void parse_step(this_type_sp const& self, F&& f) {
+        if (parsing_) {
+            // called synchronously from another step
+            std::forward<F>(f)();
+            return;
+        }
+        auto keep = self;
+        struct parsing_guard {
+            ~parsing_guard() { parsing = false; }
+            bool& parsing;
+        } g { parsing_ };
+        parsing_ = true;
+        auto begin = std::chrono::steady_clock::now();
+        profile::run(profile::parse, std::forward<F>(f));
+        dispatch_time_ns_.fetch_add(
+            static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - begin
+                ).count()
+            ),
+            std::memory_order_relaxed
+        );
+    }
+
+    void dispatch_payload(any session_life_keeper, this_type_sp self) {
         auto control_packet_type = get_control_packet_type(fixed_header_);
         switch (control_packet_type) {
         case control_packet_type::connect:
@@ -5855,13 +6061,18 @@ private:
                 ]
                 (error_code ec,
                  std::size_t bytes_transferred) mutable {
-                    this->total_bytes_received_ += bytes_transferred;
+                    this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                     if (!check_error_and_transferred_length(ec, bytes_transferred, buf.size())) return;
-                    handler(
-                        force_move(self),
-                        force_move(session_life_keeper),
-                        force_move(buf),
-                        buffer()
+                    parse_step(
+                        self,
+                        [&] {
+                            handler(
+                                force_move(self),
+                                force_move(session_life_keeper),
+                                force_move(buf),
+                                buffer()
+                            );
+                        }
                     );
                 }
             );
@@ -5905,16 +6116,21 @@ private:
                 ]
                 (error_code ec,
                  std::size_t bytes_transferred) mutable {
-                    this->total_bytes_received_ += bytes_transferred;
+                    this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                     if (!check_error_and_transferred_length(ec, bytes_transferred, Bytes)) return;
-                    handler(
-                        force_move(self),
-                        force_move(session_life_keeper),
-                        make_two_or_four_byte<Bytes>::apply(
-                            buf_.data(),
-                            std::next(buf_.data(), boost::numeric_cast<buffer::difference_type>(Bytes))
-                        ),
-                        buffer()
+                    parse_step(
+                        self,
+                        [&] {
+                            handler(
+                                force_move(self),
+                                force_move(session_life_keeper),
+                                make_two_or_four_byte<Bytes>::apply(
+                                    buf_.data(),
+                                    std::next(buf_.data(), boost::numeric_cast<buffer::difference_type>(Bytes))
+                                ),
+                                buffer()
+                            );
+                        }
                     );
                 }
             );
@@ -6021,15 +6237,20 @@ private:
                 ]
                 (error_code ec,
                  std::size_t bytes_transferred) mutable {
-                    this->total_bytes_received_ += bytes_transferred;
+                    this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                     if (!check_error_and_transferred_length(ec, bytes_transferred, 1)) return;
-                    proc(
-                        force_move(self),
-                        force_move(session_life_keeper),
-                        buffer(string_view(buf_.data(), 1)), // buf_'s lifetime is handled by `self`
-                        force_move(handler),
-                        size,
-                        multiplier
+                    parse_step(
+                        self,
+                        [&] {
+                            proc(
+                                force_move(self),
+                                force_move(session_life_keeper),
+                                buffer(string_view(buf_.data(), 1)), // buf_'s lifetime is handled by `self`
+                                force_move(handler),
+                                size,
+                                multiplier
+                            );
+                        }
                     );
                 }
             );
@@ -6207,15 +6428,20 @@ private:
                             result
                         ]
                         (error_code ec, std::size_t bytes_transferred) mutable {
-                            this->total_bytes_received_ += bytes_transferred;
+                            this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                             if (!check_error_and_transferred_length(ec, bytes_transferred, result.len)) return;
-                            process_property_id(
-                                force_move(self),
-                                force_move(session_life_keeper),
-                                buffer(string_view(result.address, result.len), result.spa),
-                                property_length,
-                                v5::properties(),
-                                force_move(handler)
+                            parse_step(
+                                self,
+                                [&] {
+                                    process_property_id(
+                                        force_move(self),
+                                        force_move(session_life_keeper),
+                                        buffer(string_view(result.address, result.len), result.spa),
+                                        property_length,
+                                        v5::properties(),
+                                        force_move(handler)
+                                    );
+                                }
                             );
                         }
                     );
@@ -6267,16 +6493,21 @@ private:
                 ]
                 (error_code ec,
                  std::size_t bytes_transferred) mutable {
-                    this->total_bytes_received_ += bytes_transferred;
+                    this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                     if (!check_error_and_transferred_length(ec, bytes_transferred, 1)) return;
-                    process_property_body(
-                        force_move(self),
-                        force_move(session_life_keeper),
-                        buffer(),
-                        static_cast<v5::property::id>(buf_.front()),
-                        property_length_rest - 1,
-                        force_move(props),
-                        force_move(handler)
+                    parse_step(
+                        self,
+                        [&] {
+                            process_property_body(
+                                force_move(self),
+                                force_move(session_life_keeper),
+                                buffer(),
+                                static_cast<v5::property::id>(buf_.front()),
+                                property_length_rest - 1,
+                                force_move(props),
+                                force_move(handler)
+                            );
+                        }
                     );
                 }
             );
@@ -7217,13 +7448,18 @@ private:
                     handler = force_move(handler)
                 ]
                 (error_code ec, std::size_t bytes_transferred) mutable {
-                    this->total_bytes_received_ += bytes_transferred;
+                    this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                     if (!check_error_and_transferred_length(ec, bytes_transferred, remaining_length_)) return;
-                    handler(
-                        force_move(self),
-                        force_move(session_life_keeper),
-                        force_move(buf),
-                        buffer()
+                    parse_step(
+                        self,
+                        [&] {
+                            handler(
+                                force_move(self),
+                                force_move(session_life_keeper),
+                                force_move(buf),
+                                buffer()
+                            );
+                        }
                     );
                 }
             );
@@ -7251,13 +7487,18 @@ private:
             ]
             (error_code ec,
              std::size_t bytes_transferred) mutable {
-                this->total_bytes_received_ += bytes_transferred;
+                this->total_bytes_received_.fetch_add(bytes_transferred, std::memory_order_relaxed);
                 if (!check_error_and_transferred_length(ec, bytes_transferred, header_len)) return;
-                handler(
-                    force_move(self),
-                    force_move(session_life_keeper),
-                    buffer(string_view(buf_.data(), header_len)),
-                    buffer()
+                parse_step(
+                    self,
+                    [&] {
+                        handler(
+                            force_move(self),
+                            force_move(session_life_keeper),
+                            buffer(string_view(buf_.data(), header_len)),
+                            buffer()
+                        );
+                    }
                 );
             }
         );
@@ -7329,7 +7570,7 @@ private:
                     ep_.clean_start_ = connect_flags::has_clean_start(connect_flag_);
 
                     buf.remove_prefix(header_len_); // consume buffer
-                    if (ep_.version_ == protocol_version::v5) {
+                    if (ep_.current_version() == protocol_version::v5) {
                         // properties
                         ep_.process_properties(
                             force_move(spep),
@@ -7359,7 +7600,7 @@ private:
                 );
                 client_id_ = force_move(variant_get<buffer>(var));
                 if (connect_flags::has_will_flag(connect_flag_)) {
-                    if (ep_.version_ == protocol_version::v5) {
+                    if (ep_.current_version() == protocol_version::v5) {
                         // will properties
                         yield ep_.process_properties(
                             force_move(spep),
@@ -7433,7 +7674,7 @@ private:
                     }
                 }
                 if (!ep_.set_values_from_props_on_connection(connection_type::server, props_)) return;
-                switch (ep_.version_) {
+                switch (ep_.current_version()) {
                 case protocol_version::v3_1_1:
                     if (ep_.on_connect(
                             force_move(client_id_),
@@ -7557,7 +7798,7 @@ private:
                 yield {
                     auto& buf = variant_get<buffer>(var);
                     session_present_ = is_session_present(buf[0]);
-                    switch (ep_.version_) {
+                    switch (ep_.current_version()) {
                     case protocol_version::v3_1_1:
                         reason_code_ = static_cast<connect_return_code>(buf[1]);
                         break;
@@ -7568,7 +7809,7 @@ private:
                         BOOST_ASSERT(false);
                     }
                     buf.remove_prefix(header_len_); // consume buffer
-                    if (ep_.version_ == protocol_version::v5) {
+                    if (ep_.current_version() == protocol_version::v5) {
                         // properties
                         ep_.process_properties(
                             force_move(spep),
@@ -7603,7 +7844,7 @@ private:
                     auto connack_proc =
                         [this]
                         (any&& session_life_keeper) mutable {
-                            switch (ep_.version_) {
+                            switch (ep_.current_version()) {
                             case protocol_version::v3_1_1:
                                 if (ep_.on_connack(
                                         session_present_,
@@ -7801,7 +8042,7 @@ private:
                     );
                     packet_id_ = force_move(variant_get<packet_id_t>(var));
                 }
-                if (ep_.version_ == protocol_version::v5) {
+                if (ep_.current_version() == protocol_version::v5) {
                     yield ep_.process_properties(
                         force_move(spep),
                         force_move(session_life_keeper),
@@ -7826,6 +8067,11 @@ private:
                 {
                     auto handler_call =
                         [&] {
+#if defined(MQTT_USE_TRACE)
+                            // The broker stamps the later stages through the current context.
+                            if (ep_.trace_ctx_) ep_.trace_ctx_.stamp(trace_stage::parse);
+                            trace_scope ts(ep_.trace_ctx_);
+#endif // defined(MQTT_USE_TRACE)
                             auto check_full =
                                 [&] {
                                     LockGuard<Mutex> lck (ep_.publish_received_mtx_);
@@ -7835,7 +8081,7 @@ private:
                                     ep_.publish_received_.insert(*packet_id_);
                                     return false;
                                 };
-                            switch (ep_.version_) {
+                            switch (ep_.current_version()) {
                             case protocol_version::v3_1_1:
                                 return ep_.on_publish(
                                     packet_id_,
@@ -8010,7 +8256,7 @@ private:
                         }
                         break;
                     case qos::exactly_once:
-                        if (ep_.qos2_publish_handled_.find(*packet_id_) == ep_.qos2_publish_handled_.end()) {
+                        if (!ep_.qos2_publish_handled_.contains(*packet_id_)) {
                             if (handler_call()) {
                                 ep_.on_mqtt_message_processed(
                                     force_move(
@@ -8021,7 +8267,7 @@ private:
                                         )
                                     )
                                 );
-                                ep_.qos2_publish_handled_.emplace(*packet_id_);
+                                ep_.qos2_publish_handled_.insert(*packet_id_);
                                 ep_.auto_pub_response(
                                     [this] {
                                         if (ep_.connected_) {
@@ -8192,7 +8438,7 @@ private:
                         return true;
                     } ();
                 if (erased) ep_.on_serialize_remove(packet_id_);
-                switch (ep_.version_) {
+                switch (ep_.current_version()) {
                 case protocol_version::v3_1_1:
                     if (ep_.on_puback(packet_id_)) {
                         ep_.on_mqtt_message_processed(
@@ -8389,7 +8635,7 @@ private:
                                 }
                             );
                         };
-                    switch (ep_.version_) {
+                    switch (ep_.current_version()) {
                     case protocol_version::v3_1_1:
                         if (ep_.on_pubrec(packet_id_)) {
                             res();
@@ -8552,7 +8798,7 @@ private:
                             );
                         };
                     ep_.qos2_publish_handled_.erase(packet_id_);
-                    switch (ep_.version_) {
+                    switch (ep_.current_version()) {
                     case protocol_version::v3_1_1:
                         if (ep_.on_pubrel(packet_id_)) {
                             res();
@@ -8700,7 +8946,7 @@ private:
                         return true;
                     } ();
                 if (erased) ep_.on_serialize_remove(packet_id_);
-                switch (ep_.version_) {
+                switch (ep_.current_version()) {
                 case protocol_version::v3_1_1:
                     if (ep_.on_pubcomp(packet_id_)) {
                         ep_.on_mqtt_message_processed(
@@ -8799,7 +9045,7 @@ private:
                 );
                 packet_id_ = force_move(variant_get<packet_id_t>(var));
 
-                if (ep_.version_ == protocol_version::v5) {
+                if (ep_.current_version() == protocol_version::v5) {
                     // properties
                     yield ep_.process_properties(
                         force_move(spep),
@@ -8862,7 +9108,7 @@ private:
                     );
 
                     if (ep_.remaining_length_ == 0) {
-                        switch (ep_.version_) {
+                        switch (ep_.current_version()) {
                         case protocol_version::v3_1_1:
                             if (ep_.on_subscribe(packet_id_, force_move(entries_))) {
                                 ep_.on_mqtt_message_processed(
@@ -8961,7 +9207,7 @@ private:
                 );
                 packet_id_ = force_move(variant_get<packet_id_t>(var));
 
-                if (ep_.version_ == protocol_version::v5) {
+                if (ep_.current_version() == protocol_version::v5) {
                     // properties
                     yield ep_.process_properties(
                         force_move(spep),
@@ -8992,7 +9238,7 @@ private:
                     ep_.pid_man_.release_id(packet_id_);
                     ep_.sub_unsub_inflight_.erase(packet_id_);
                 }
-                switch (ep_.version_) {
+                switch (ep_.current_version()) {
                 case protocol_version::v3_1_1:
                     {
                         // TODO: We can avoid an allocation by casting the raw bytes of the
@@ -9130,7 +9376,7 @@ private:
                 );
                 packet_id_ = force_move(variant_get<packet_id_t>(var));
 
-                if (ep_.version_ == protocol_version::v5) {
+                if (ep_.current_version() == protocol_version::v5) {
                     // properties
                     yield ep_.process_properties(
                         force_move(spep),
@@ -9173,7 +9419,7 @@ private:
                     );
 
                     if (ep_.remaining_length_ == 0) {
-                        switch (ep_.version_) {
+                        switch (ep_.current_version()) {
                         case protocol_version::v3_1_1:
                             if (ep_.on_unsubscribe(packet_id_, force_move(entries_))) {
                                 ep_.on_mqtt_message_processed(
@@ -9271,7 +9517,7 @@ private:
                 );
                 packet_id_ = force_move(variant_get<packet_id_t>(var));
 
-                if (ep_.version_ == protocol_version::v5) {
+                if (ep_.current_version() == protocol_version::v5) {
                     // properties
                     yield ep_.process_properties(
                         force_move(spep),
@@ -9312,7 +9558,7 @@ private:
                     ep_.pid_man_.release_id(packet_id_);
                     ep_.sub_unsub_inflight_.erase(packet_id_);
                 }
-                switch (ep_.version_) {
+                switch (ep_.current_version()) {
                 case protocol_version::v3_1_1:
                     if (ep_.on_unsuback(packet_id_)) {
                         ep_.on_mqtt_message_processed(
@@ -9412,7 +9658,7 @@ private:
         ) {
             reenter(this) {
                 if (ep_.remaining_length_ > 0) {
-                    if (ep_.version_ != protocol_version::v5) {
+                    if (ep_.current_version() != protocol_version::v5) {
                         ep_.call_protocol_error_handlers();
                         return;
                     }
@@ -9456,7 +9702,7 @@ private:
                         );
                         props_ = force_move(variant_get<v5::properties>(var));
                     }
-                    switch (ep_.version_) {
+                    switch (ep_.current_version()) {
                     case protocol_version::v3_1_1:
                         ep_.on_disconnect();
                         break;
@@ -9481,7 +9727,7 @@ private:
                     );
                     return;
                 }
-                switch (ep_.version_) {
+                switch (ep_.current_version()) {
                 case protocol_version::v3_1_1:
                     ep_.on_disconnect();
                     break;
@@ -9535,7 +9781,7 @@ private:
             buffer remain_buf = buffer()
         ) {
             reenter(this) {
-                if (ep_.version_ != protocol_version::v5) {
+                if (ep_.current_version() != protocol_version::v5) {
                     ep_.call_protocol_error_handlers();
                     return;
                 }
@@ -9575,7 +9821,7 @@ private:
                         }
                     );
                     props_ = force_move(variant_get<v5::properties>(var));
-                    BOOST_ASSERT(ep_.version_ == protocol_version::v5);
+                    BOOST_ASSERT(ep_.current_version() == protocol_version::v5);
                     if (ep_.on_v5_auth(reason_code_, force_move(props_))) {
                         ep_.on_mqtt_message_processed(
                             force_move(
@@ -9589,7 +9835,7 @@ private:
                     }
                     return;
                 }
-                BOOST_ASSERT(ep_.version_ == protocol_version::v5);
+                BOOST_ASSERT(ep_.current_version() == protocol_version::v5);
                 if (ep_.on_v5_auth(reason_code_, force_move(props_))) {
                     ep_.on_mqtt_message_processed(
                         force_move(
@@ -9629,7 +9875,7 @@ private:
         v5::properties props
     ) {
         shutdown_requested_ = false;
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             do_sync_write(
                 v3_1_1::connect_message(
@@ -9667,7 +9913,7 @@ private:
         variant<connect_return_code, v5::connect_reason_code> reason_code,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::connack_message(
                 session_present,
@@ -9908,7 +10154,7 @@ private:
                 }
             };
 
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             do_send_publish(
                 v3_1_1::basic_publish_message<PacketIdBytes>(
@@ -9956,7 +10202,7 @@ private:
         v5::puback_reason_code reason,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_puback_message<PacketIdBytes>(packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -9985,7 +10231,7 @@ private:
         v5::pubrec_reason_code reason,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_pubrec_message<PacketIdBytes>(packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10061,7 +10307,7 @@ private:
                 do_sync_write(force_move(msg));
             };
 
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             impl(
                 v3_1_1::basic_pubrel_message<PacketIdBytes>(packet_id),
@@ -10108,7 +10354,7 @@ private:
                 (this->*serialize)(msg);
             };
 
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             impl(
                 v3_1_1::basic_pubrel_message<PacketIdBytes>(packet_id),
@@ -10132,7 +10378,7 @@ private:
         v5::pubcomp_reason_code reason,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_pubcomp_message<PacketIdBytes>(packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10169,7 +10415,7 @@ private:
                 std::get<1>(p).get_qos() == qos::exactly_once
             );
         }
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_subscribe_message<PacketIdBytes>(force_move(params), packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10211,7 +10457,7 @@ private:
         packet_id_t packet_id,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_suback_message<PacketIdBytes>(
                 force_move(variant_get<std::vector<suback_return_code>>(params)),
@@ -10244,7 +10490,7 @@ private:
         packet_id_t packet_id,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_unsubscribe_message<PacketIdBytes>(force_move(params), packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10284,7 +10530,7 @@ private:
     void send_unsuback(
         packet_id_t packet_id
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_unsuback_message<PacketIdBytes>(packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10306,7 +10552,7 @@ private:
         packet_id_t packet_id,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             BOOST_ASSERT(false);
             break;
@@ -10324,7 +10570,7 @@ private:
     }
 
     void send_pingreq() {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::pingreq_message();
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10348,7 +10594,7 @@ private:
     }
 
     void send_pingresp() {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::pingresp_message();
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10373,7 +10619,7 @@ private:
         v5::auth_reason_code reason,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             BOOST_ASSERT(false);
             break;
@@ -10394,7 +10640,7 @@ private:
         v5::disconnect_reason_code reason,
         v5::properties props
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::disconnect_message();
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10496,7 +10742,15 @@ private:
         boost::system::error_code ec;
         if (can_send()) {
             on_pre_send();
-            total_bytes_sent_ += socket_->write(const_buffer_sequence<PacketIdBytes>(mv), ec);
+            // The buffers can refer to a temporary message variant converted from mv,
+            // so they need to be written in the same full-expression.
+            total_bytes_sent_.fetch_add(
+                socket_->write(
+                    count_sent_packet(const_buffer_sequence<PacketIdBytes>(mv)),
+                    ec
+                ),
+                std::memory_order_relaxed
+            );
             // If ec is set as error, the error will be handled by async_read.
             // If `handle_error(ec);` is called here, error_handler would be called twice.
         }
@@ -10513,7 +10767,7 @@ private:
         async_handler_t func
     ) {
         shutdown_requested_ = false;
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             do_async_write(
                 v3_1_1::connect_message(
@@ -10554,7 +10808,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::connack_message(
                 session_present,
@@ -10610,7 +10864,8 @@ private:
         publish_options pubopts,
         v5::properties props,
         any life_keeper,
-        async_handler_t func
+        async_handler_t func,
+        optional<v5::encoded_properties> shared_props = nullopt
     ) {
         auto do_async_send_publish =
             [&](auto msg, auto&& serialize_publish, auto&& receive_maximum_proc) {
@@ -10643,55 +10898,69 @@ private:
                 }
             };
 
-        switch (version_) {
-        case protocol_version::v3_1_1:
-            do_async_send_publish(
-                v3_1_1::basic_publish_message<PacketIdBytes>(
-                    packet_id,
-                    topic_name,
-                    force_move(payloads),
-                    pubopts
-                ),
-                &endpoint::on_serialize_publish_message,
-                [] (auto&&) { return true; }
-            );
-            break;
-        case protocol_version::v5:
-            do_async_send_publish(
-                v5::basic_publish_message<PacketIdBytes>(
-                    packet_id,
-                    topic_name,
-                    force_move(payloads),
-                    pubopts,
-                    force_move(props)
-                ),
-                &endpoint::on_serialize_v5_publish_message,
-                [this, func] (v5::basic_publish_message<PacketIdBytes>&& msg) mutable {
-                    if (publish_send_count_.load() == publish_send_max_) {
-                        {
-                            LockGuard<Mutex> lck (publish_send_queue_mtx_);
-                            publish_send_queue_.emplace_back(force_move(msg), true);
-                        }
-                        socket_->post(
-                            [func = force_move(func)] {
-                                // message has already been stored so func should be called with success here
-                                if (func) func(boost::system::errc::make_error_code(boost::system::errc::success));
+        profile::run(
+            profile::encode,
+            [&] {
+                switch (current_version()) {
+                case protocol_version::v3_1_1:
+                    do_async_send_publish(
+                        v3_1_1::basic_publish_message<PacketIdBytes>(
+                            packet_id,
+                            topic_name,
+                            force_move(payloads),
+                            pubopts
+                        ),
+                        &endpoint::on_serialize_publish_message,
+                        [] (auto&&) { return true; }
+                    );
+                    break;
+                case protocol_version::v5:
+                    do_async_send_publish(
+                        shared_props
+                        ? v5::basic_publish_message<PacketIdBytes>(
+                            packet_id,
+                            topic_name,
+                            force_move(payloads),
+                            pubopts,
+                            shared_props.value(),
+                            force_move(props)
+                        )
+                        : v5::basic_publish_message<PacketIdBytes>(
+                            packet_id,
+                            topic_name,
+                            force_move(payloads),
+                            pubopts,
+                            force_move(props)
+                        ),
+                        &endpoint::on_serialize_v5_publish_message,
+                        [this, func] (v5::basic_publish_message<PacketIdBytes>&& msg) mutable {
+                            if (publish_send_count_.load() == publish_send_max_) {
+                                {
+                                    LockGuard<Mutex> lck (publish_send_queue_mtx_);
+                                    publish_send_queue_.emplace_back(force_move(msg), true);
+                                }
+                                socket_->post(
+                                    [func = force_move(func)] {
+                                        // message has already been stored so func should be called with success here
+                                        if (func) func(boost::system::errc::make_error_code(boost::system::errc::success));
+                                    }
+                                );
+                                return false;
                             }
-                        );
-                        return false;
-                    }
-                    MQTT_LOG("mqtt_impl", trace)
-                        << MQTT_ADD_VALUE(address, this)
-                        << "increment publish_send_count_:" << publish_send_count_.load();
-                    ++publish_send_count_;
-                    return true;
+                            MQTT_LOG("mqtt_impl", trace)
+                                << MQTT_ADD_VALUE(address, this)
+                                << "increment publish_send_count_:" << publish_send_count_.load();
+                            ++publish_send_count_;
+                            return true;
+                        }
+                    );
+                    break;
+                default:
+                    BOOST_ASSERT(false);
+                    break;
                 }
-            );
-            break;
-        default:
-            BOOST_ASSERT(false);
-            break;
-        }
+            }
+        );
     }
 
     void async_send_puback(
@@ -10700,7 +10969,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_puback_message<PacketIdBytes>(packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10752,7 +11021,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_pubrec_message<PacketIdBytes>(packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10861,7 +11130,7 @@ private:
                 );
             };
 
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             impl(
                 v3_1_1::basic_pubrel_message<PacketIdBytes>(packet_id),
@@ -10886,7 +11155,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_pubcomp_message<PacketIdBytes>(packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10937,7 +11206,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_subscribe_message<PacketIdBytes>(force_move(params), packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -10996,7 +11265,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_suback_message<PacketIdBytes>(
                 force_move(variant_get<std::vector<suback_return_code>>(params)),
@@ -11046,7 +11315,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_unsubscribe_message<PacketIdBytes>(force_move(params), packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -11103,7 +11372,7 @@ private:
         packet_id_t packet_id,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::basic_unsuback_message<PacketIdBytes>(packet_id);
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -11134,7 +11403,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             BOOST_ASSERT(false);
             break;
@@ -11160,7 +11429,7 @@ private:
     }
 
     void async_send_pingreq(async_handler_t func) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::pingreq_message();
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -11194,7 +11463,7 @@ private:
     }
 
     void async_send_pingresp(async_handler_t func) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::pingresp_message();
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -11230,7 +11499,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1:
             BOOST_ASSERT(false);
             break;
@@ -11257,7 +11526,7 @@ private:
         v5::properties props,
         async_handler_t func
     ) {
-        switch (version_) {
+        switch (current_version()) {
         case protocol_version::v3_1_1: {
             auto msg = v3_1_1::disconnect_message();
             if (maximum_packet_size_send_ < size<PacketIdBytes>(msg)) {
@@ -11403,6 +11672,16 @@ private:
             async_handler_t h = {})
             : mv_(force_move(mv))
             , handler_(force_move(h)) {}
+#if defined(MQTT_USE_TRACE)
+        async_packet(
+            basic_message_variant<PacketIdBytes> mv,
+            async_handler_t h,
+            trace_context trace)
+            : mv_(force_move(mv))
+            , handler_(force_move(h))
+            , trace_(trace) {}
+        trace_context const& trace() const { return trace_; }
+#endif // defined(MQTT_USE_TRACE)
         basic_message_variant<PacketIdBytes> const& message() const {
             return mv_;
         }
@@ -11414,6 +11693,9 @@ private:
     private:
         basic_message_variant<PacketIdBytes> mv_;
         async_handler_t handler_;
+#if defined(MQTT_USE_TRACE)
+        trace_context trace_;
+#endif // defined(MQTT_USE_TRACE)
     };
 
     struct write_completion_handler {
@@ -11436,14 +11718,14 @@ private:
         void operator()(error_code ec) const {
             func_(ec);
             for (std::size_t i = 0; i != num_of_messages_; ++i) {
-                self_->queue_.pop_front();
+                self_->pop_queue_front();
             }
             if (ec || // Error is handled by async_read.
                 !self_->connected_) {
                 while (!self_->queue_.empty()) {
                     // Handlers for outgoing packets need not be valid.
                     if (auto&& h = self_->queue_.front().handler()) h(ec);
-                    self_->queue_.pop_front();
+                    self_->pop_queue_front();
                 }
                 return;
             }
@@ -11455,16 +11737,16 @@ private:
             error_code ec,
             std::size_t bytes_transferred) const {
             func_(ec);
-            self_->total_bytes_sent_ += bytes_transferred;
+            self_->total_bytes_sent_.fetch_add(bytes_transferred, std::memory_order_relaxed);
             for (std::size_t i = 0; i != num_of_messages_; ++i) {
-                self_->queue_.pop_front();
+                self_->pop_queue_front();
             }
             if (ec || // Error is handled by async_read.
                 !self_->connected_) {
                 while (!self_->queue_.empty()) {
                     // Handlers for outgoing packets need not be valid.
                     if(auto&& h = self_->queue_.front().handler()) h(ec);
-                    self_->queue_.pop_front();
+                    self_->pop_queue_front();
                 }
                 return;
             }
@@ -11472,7 +11754,7 @@ private:
                 while (!self_->queue_.empty()) {
                     // Handlers for outgoing packets need not be valid.
                     if(auto&& h = self_->queue_.front().handler()) h(ec);
-                    self_->queue_.pop_front();
+                    self_->pop_queue_front();
                 }
                 throw write_bytes_transferred_error(bytes_to_transfer_, bytes_transferred);
             }
@@ -11487,6 +11769,15 @@ private:
     };
 
     void do_async_write() {
+        profile::run(
+            profile::write,
+            [&] {
+                write_queued_messages();
+            }
+        );
+    }
+
+    void write_queued_messages() {
         // Only attempt to send up to the user specified maximum items
         using difference_t = typename decltype(queue_)::difference_type;
         std::size_t iterator_count = (max_queue_send_count_ == 0)
@@ -11515,6 +11806,9 @@ private:
 
         std::vector<as::const_buffer> buf;
         std::vector<async_handler_t> handlers;
+#if defined(MQTT_USE_TRACE)
+        std::vector<trace_context> traces;
+#endif // defined(MQTT_USE_TRACE)
 
         buf.reserve(total_const_buffer_sequence);
         handlers.reserve(iterator_count);
@@ -11522,9 +11816,15 @@ private:
         for (auto it = start; it != end; ++it) {
             auto const& elem = *it;
             auto const& mv = elem.message();
-            auto const& cbs = const_buffer_sequence(mv);
+            auto const& cbs = count_sent_packet(const_buffer_sequence(mv));
             std::copy(cbs.begin(), cbs.end(), std::back_inserter(buf));
             handlers.emplace_back(elem.handler());
+#if defined(MQTT_USE_TRACE)
+            if (elem.trace()) {
+                traces.push_back(elem.trace());
+                traces.back().stamp(trace_stage::write);
+            }
+#endif // defined(MQTT_USE_TRACE)
         }
 
         on_pre_send();
@@ -11533,11 +11833,27 @@ private:
             force_move(buf),
             write_completion_handler(
                 this->shared_from_this(),
-                [handlers = force_move(handlers)]
-                (error_code ec) {
+                [
+                    handlers = force_move(handlers)
+#if defined(MQTT_USE_TRACE)
+                    ,
+                    traces = force_move(traces)
+#endif // defined(MQTT_USE_TRACE)
+                ]
+                (error_code ec) mutable {
                     for (auto const& h : handlers) {
                         if (h) h(ec);
                     }
+#if defined(MQTT_USE_TRACE)
+                    if (!ec && !traces.empty()) {
+                        if (auto sink = get_trace_sink()) {
+                            for (auto& t : traces) {
+                                t.stamp(trace_stage::done);
+                                sink->on_trace(t);
+                            }
+                        }
+                    }
+#endif // defined(MQTT_USE_TRACE)
                 },
                 iterator_count,
                 total_bytes
@@ -11546,12 +11862,49 @@ private:
     }
 
     void do_async_write(basic_message_variant<PacketIdBytes> mv, async_handler_t func) {
+#if defined(MQTT_USE_TRACE)
+        // Each outgoing PUBLISH that is sent while an incoming PUBLISH is processed gets
+        // a copy of its trace context.
+        trace_context trace;
+        if (auto ctx = current_trace_context()) {
+            auto is_publish = MQTT_NS::visit(
+                make_lambda_visitor(
+                    [](auto const& m) {
+                        using msg_t = std::decay_t<decltype(m)>;
+                        return
+                            std::is_same<msg_t, v3_1_1::basic_publish_message<PacketIdBytes>>::value ||
+                            std::is_same<msg_t, v5::basic_publish_message<PacketIdBytes>>::value;
+                    }
+                ),
+                mv
+            );
+            if (is_publish) {
+                trace = *ctx;
+                trace.stamp(trace_stage::queue);
+            }
+        }
+#endif // defined(MQTT_USE_TRACE)
         // Move this job to the socket's strand so that it can be queued without mutexes.
         socket_->post(
-            [this, self = this->shared_from_this(), mv = force_move(mv), func = force_move(func)]
+            [
+                this,
+                self = this->shared_from_this(),
+                mv = force_move(mv),
+                func = force_move(func)
+#if defined(MQTT_USE_TRACE)
+                ,
+                trace
+#endif // defined(MQTT_USE_TRACE)
+            ]
             () mutable {
                 if (can_send()) {
+                    queued_bytes_.fetch_add(MQTT_NS::size<PacketIdBytes>(mv), std::memory_order_relaxed);
+                    queued_packets_.fetch_add(1, std::memory_order_relaxed);
+#if defined(MQTT_USE_TRACE)
+                    queue_.emplace_back(force_move(mv), force_move(func), trace);
+#else  // defined(MQTT_USE_TRACE)
                     queue_.emplace_back(force_move(mv), force_move(func));
+#endif // defined(MQTT_USE_TRACE)
                     // Only need to start async writes if there was nothing in the queue before the above item.
                     if (queue_.size() > 1) return;
                     do_async_write();
@@ -11565,6 +11918,20 @@ private:
         );
     }
 
+    void pop_queue_front() {
+        queued_bytes_.fetch_sub(MQTT_NS::size<PacketIdBytes>(queue_.front().message()), std::memory_order_relaxed);
+        queued_packets_.fetch_sub(1, std::memory_order_relaxed);
+        queue_.pop_front();
+    }
+
+    // The first byte of the packet is the fixed header.
+    std::vector<as::const_buffer> count_sent_packet(std::vector<as::const_buffer> cbs) {
+        BOOST_ASSERT(!cbs.empty() && cbs.front().size() != 0);
+        auto fixed_header = static_cast<std::uint8_t>(*static_cast<char const*>(cbs.front().data()));
+        packets_sent_[fixed_header >> 4].fetch_add(1, std::memory_order_relaxed);
+        return cbs;
+    }
+
     static constexpr std::uint16_t make_uint16_t(char b1, char b2) {
         return
             static_cast<std::uint16_t>(
@@ -11576,12 +11943,10 @@ private:
     void clean_sub_unsub_inflight() {
         LockGuard<Mutex> lck_store (store_mtx_);
         LockGuard<Mutex> lck_sub_unsub (sub_unsub_inflight_mtx_);
-        auto it = sub_unsub_inflight_.begin();
-        auto end = sub_unsub_inflight_.end();
-        while (it != end) {
-            pid_man_.release_id(*it);
-            it = sub_unsub_inflight_.erase(it);
+        for (auto pid : sub_unsub_inflight_) {
+            pid_man_.release_id(pid);
         }
+        sub_unsub_inflight_.clear();
     }
 
     void clean_sub_unsub_inflight_on_error(error_code ec) {
@@ -11707,15 +12072,18 @@ private:
     std::size_t remaining_length_;
     std::vector<char> payload_;
 
-    Mutex store_mtx_;
+    mutable Mutex store_mtx_;
     mi_store store_;
-    std::set<packet_id_t> qos2_publish_handled_;
+    // Packet ids are chosen by the peer and released in any order, so a bitmap is used.
+    detail::packet_id_set<packet_id_t> qos2_publish_handled_;
     std::deque<async_packet> queue_;
 
-    packet_id_manager<packet_id_t> pid_man_;
+    PacketIdManager<packet_id_t> pid_man_;
 
     Mutex sub_unsub_inflight_mtx_;
-    std::set<packet_id_t> sub_unsub_inflight_;
+    // The number of elements is bounded by receive maximum, and packet ids are usually inserted
+    // at the end because they are acquired in ascending order, so a sorted vector is used.
+    boost::container::flat_set<packet_id_t> sub_unsub_inflight_;
     bool auto_pub_response_{true};
     bool async_operation_{ false };
     bool async_read_on_message_processed_ { true };
@@ -11723,11 +12091,21 @@ private:
     bool connect_requested_{false};
     std::size_t max_queue_send_count_{1};
     std::size_t max_queue_send_size_{0};
+#if defined(MQTT_USE_TRACE)
+    trace_context trace_ctx_; ///< trace of the PUBLISH packet being read
+#endif // defined(MQTT_USE_TRACE)
     protocol_version version_{protocol_version::undetermined};
     std::size_t packet_bulk_read_limit_ = 256;
     std::size_t props_bulk_read_limit_ = packet_bulk_read_limit_;
-    std::size_t total_bytes_sent_ = 0;
-    std::size_t total_bytes_received_ = 0;
+    // Counters of get_stats(). They are read from other threads.
+    std::atomic<std::size_t> total_bytes_sent_{0};
+    std::atomic<std::size_t> total_bytes_received_{0};
+    std::atomic<std::size_t> queued_bytes_{0};
+    std::atomic<std::size_t> queued_packets_{0};
+    std::array<std::atomic<std::uint64_t>, endpoint_stats::num_of_packet_types> packets_received_ {};
+    std::array<std::atomic<std::uint64_t>, endpoint_stats::num_of_packet_types> packets_sent_ {};
+    std::atomic<std::uint64_t> dispatch_time_ns_{0};
+    bool parsing_ = false; // in parse_step()
     static constexpr std::uint8_t variable_length_continue_flag = 0b10000000;
 
     std::chrono::steady_clock::duration pingresp_timeout_ = std::chrono::steady_clock::duration::zero();
@@ -11751,7 +12129,7 @@ private:
     receive_maximum_t publish_send_max_ = receive_maximum_max;
     receive_maximum_t publish_recv_max_ = receive_maximum_max;
     Mutex publish_received_mtx_;
-    std::set<packet_id_t> publish_received_;
+    detail::packet_id_set<packet_id_t> publish_received_;
     struct publish_send_queue_elem {
         publish_send_queue_elem(
             basic_message_variant<PacketIdBytes> message,
@@ -11765,7 +12143,7 @@ private:
         any life_keeper;
         bool async;
     };
-    Mutex publish_send_queue_mtx_;
+    mutable Mutex publish_send_queue_mtx_;
     std::deque<publish_send_queue_elem> publish_send_queue_;
     std::set<packet_id_t> resend_pubrel_;
 };
@@ -0,0 +1,65 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_ENDPOINT_STATS_HPP)
+#define MQTT_ENDPOINT_STATS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <mqtt/namespace.hpp>
+#include <mqtt/control_packet_type.hpp>
+
+namespace MQTT_NS {
+
+/**
+ * @brief Resource usage of an endpoint. See endpoint::get_stats().
+ *
+ * The values are read one by one without stopping the endpoint, so they are not
+ * necessarily consistent with each other.
+ */
+struct endpoint_stats {
+    /// The number of the control packet types including the reserved ones
+    static constexpr std::size_t num_of_packet_types = 16;
+
+    std::size_t queued_bytes = 0;               ///< bytes of the packets waiting to be written
+    std::size_t queued_packets = 0;             ///< packets waiting to be written
+    std::size_t stored_messages = 0;            ///< QoS1/2 packets waiting for the response (store)
+    std::size_t publish_send_queue_size = 0;    ///< PUBLISH packets waiting for the receive maximum quota
+    std::size_t total_bytes_sent = 0;
+    std::size_t total_bytes_received = 0;
+    std::array<std::uint64_t, num_of_packet_types> packets_received {}; ///< indexed by control_packet_type
+    std::array<std::uint64_t, num_of_packet_types> packets_sent {};     ///< indexed by control_packet_type
+    /// Time spent parsing the received packets in the read completions, including the
+    /// handlers that are called synchronously. Handlers that do the broker work dominate it.
+    std::chrono::nanoseconds dispatch_time { 0 };
+
+    std::uint64_t received(control_packet_type type) const {
+        return packets_received[static_cast<std::size_t>(type) >> 4];
+    }
+
+    std::uint64_t sent(control_packet_type type) const {
+        return packets_sent[static_cast<std::size_t>(type) >> 4];
+    }
+
+    std::uint64_t total_packets_received() const {
+        std::uint64_t ret = 0;
+        for (auto v : packets_received) ret += v;
+        return ret;
+    }
+
+    std::uint64_t total_packets_sent() const {
+        std::uint64_t ret = 0;
+        for (auto v : packets_sent) ret += v;
+        return ret;
+    }
+};
+
+} // namespace MQTT_NS
+
+#endif // MQTT_ENDPOINT_STATS_HPP
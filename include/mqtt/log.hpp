@@ -68,7 +68,46 @@ inline constexpr null_log const& operator<<(null_log const& o, T const&) { retur
 
 } // namespace detail
 
-#if defined(MQTT_USE_LOG)
+#define MQTT_GET_LOG_SEV_NUM(lv) BOOST_PP_CAT(MQTT_, lv)
+
+// Use can set preprocessor macro MQTT_LOG_SEV.
+// For example, -DMQTT_LOG_SEV=info, greater or equal to info log is generated at
+// compiling time.
+
+#if !defined(MQTT_LOG_SEV)
+#define MQTT_LOG_SEV trace
+#endif // !defined(MQTT_LOG_SEV)
+
+#define MQTT_trace   0
+#define MQTT_debug   1
+#define MQTT_info    2
+#define MQTT_warning 3
+#define MQTT_error   4
+#define MQTT_fatal   5
+
+#if defined(MQTT_USE_BINARY_LOG)
+
+// User can define custom MQTT_LOG implementation
+// By default MQTT_BINARY_LOG in binary_log.hpp is used
+
+#if !defined(MQTT_LOG)
+
+#define MQTT_LOG(chan, sev)                                             \
+    BOOST_PP_IF(                                                        \
+        BOOST_PP_GREATER_EQUAL(MQTT_GET_LOG_SEV_NUM(sev), MQTT_GET_LOG_SEV_NUM(MQTT_LOG_SEV)), \
+        MQTT_BINARY_LOG(chan, sev),                                     \
+        MQTT_NS::detail::null_log(chan, MQTT_NS::severity_level::sev)   \
+    )
+
+#endif // !defined(MQTT_LOG)
+
+#if !defined(MQTT_ADD_VALUE)
+
+#define MQTT_ADD_VALUE(name, val) MQTT_BINARY_ADD_VALUE(name, val)
+
+#endif // !defined(MQTT_ADD_VALUE)
+
+#elif defined(MQTT_USE_LOG)
 
 // template arguments are defined in MQTT_NS
 // filter and formatter can distinguish mqtt_cpp's channel and severity by their types
@@ -92,23 +131,6 @@ BOOST_LOG_ATTRIBUTE_KEYWORD(address, "MqttAddress", void const*)
     << boost::log::add_value(MQTT_NS::line, __LINE__)                   \
     << boost::log::add_value(MQTT_NS::function, BOOST_CURRENT_FUNCTION)
 
-#define MQTT_GET_LOG_SEV_NUM(lv) BOOST_PP_CAT(MQTT_, lv)
-
-// Use can set preprocessor macro MQTT_LOG_SEV.
-// For example, -DMQTT_LOG_SEV=info, greater or equal to info log is generated at
-// compiling time.
-
-#if !defined(MQTT_LOG_SEV)
-#define MQTT_LOG_SEV trace
-#endif // !defined(MQTT_LOG_SEV)
-
-#define MQTT_trace   0
-#define MQTT_debug   1
-#define MQTT_info    2
-#define MQTT_warning 3
-#define MQTT_error   4
-#define MQTT_fatal   5
-
 // User can define custom MQTT_LOG implementation
 // By default MQTT_LOG_FP is used
 
@@ -130,13 +152,17 @@ BOOST_LOG_ATTRIBUTE_KEYWORD(address, "MqttAddress", void const*)
 
 #endif // !defined(MQTT_ADD_VALUE)
 
-#else  // defined(MQTT_USE_LOG)
+#else  // defined(MQTT_USE_BINARY_LOG)
 
 #define MQTT_LOG(chan, sev) MQTT_NS::detail::null_log(chan, MQTT_NS::severity_level::sev)
 #define MQTT_ADD_VALUE(name, val) val
 
-#endif // defined(MQTT_USE_LOG)
+#endif // defined(MQTT_USE_BINARY_LOG)
 
 } // namespace MQTT_NS
 
+#if defined(MQTT_USE_BINARY_LOG)
+#include <mqtt/binary_log.hpp>
+#endif // defined(MQTT_USE_BINARY_LOG)
+
 #endif // MQTT_LOG_HPP
@@ -0,0 +1,366 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_LOOPBACK_ENDPOINT_HPP)
+#define MQTT_LOOPBACK_ENDPOINT_HPP
+
+#include <mqtt/config.hpp>
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <mqtt/namespace.hpp>
+#include <mqtt/type_erased_socket.hpp>
+#include <mqtt/move.hpp>
+#include <mqtt/optional.hpp>
+#include <mqtt/strand.hpp>
+#include <mqtt/attributes.hpp>
+#include <mqtt/log.hpp>
+
+namespace MQTT_NS {
+
+namespace as = boost::asio;
+
+namespace detail {
+
+/**
+ * @brief One direction of a loopback connection.
+ *
+ * The bytes are copied into a fixed capacity ring buffer. A write that doesn't fit waits until
+ * the reader consumes the buffer, like a full TCP send buffer. The reader and the writer can
+ * be on different threads.
+ * Completions are called outside of the lock, so they can start the next operation.
+ */
+class loopback_pipe {
+public:
+    using completion_t = std::function<void(error_code, std::size_t)>;
+
+    explicit loopback_pipe(std::size_t capacity)
+        :ring_(capacity) {}
+
+    void async_read(as::mutable_buffer buf, completion_t c) {
+        completions_t done;
+        {
+            std::lock_guard<std::mutex> g(mtx_);
+            BOOST_ASSERT(!read_);
+            read_.emplace(read_op{ buf, 0, force_move(c) });
+            progress(done);
+        }
+        for (auto& f : done) f();
+    }
+
+    void async_write(std::vector<as::const_buffer> bufs, completion_t c) {
+        completions_t done;
+        {
+            std::lock_guard<std::mutex> g(mtx_);
+            BOOST_ASSERT(!write_);
+            write_.emplace(write_op{ force_move(bufs), 0, 0, 0, force_move(c) });
+            progress(done);
+        }
+        for (auto& f : done) f();
+    }
+
+    /**
+     * @brief Write all bytes without waiting for the reader.
+     *        The ring buffer grows if the bytes don't fit, because the reader might be
+     *        processed on the calling thread.
+     */
+    std::size_t write(std::vector<as::const_buffer> const& bufs, error_code& ec) {
+        completions_t done;
+        std::size_t written = 0;
+        {
+            std::lock_guard<std::mutex> g(mtx_);
+            if (closed_) {
+                ec = as::error::broken_pipe;
+                return 0;
+            }
+            std::size_t total = 0;
+            for (auto const& b : bufs) total += b.size();
+            if (ring_.size() - size_ < total) grow(size_ + total);
+            for (auto const& b : bufs) {
+                push(static_cast<char const*>(b.data()), b.size());
+                written += b.size();
+            }
+            progress(done);
+        }
+        for (auto& f : done) f();
+        ec = error_code();
+        return written;
+    }
+
+    /**
+     * @brief Close the pipe. The bytes in the ring buffer can still be read.
+     *        After that, the read completes with eof. The write completes with broken_pipe.
+     */
+    void close() {
+        completions_t done;
+        {
+            std::lock_guard<std::mutex> g(mtx_);
+            closed_ = true;
+            progress(done);
+        }
+        for (auto& f : done) f();
+    }
+
+private:
+    using completions_t = std::vector<std::function<void()>>;
+
+    struct read_op {
+        as::mutable_buffer buf;
+        std::size_t transferred;
+        completion_t completion;
+    };
+
+    struct write_op {
+        std::vector<as::const_buffer> bufs;
+        std::size_t index;          // current buffer of bufs
+        std::size_t offset;         // consumed bytes of the current buffer
+        std::size_t transferred;
+        completion_t completion;
+    };
+
+    void progress(completions_t& done) {
+        while (true) {
+            bool moved = false;
+            if (read_ && size_ != 0) {
+                auto n = std::min(size_, read_->buf.size() - read_->transferred);
+                if (n != 0) {
+                    pop(static_cast<char*>(read_->buf.data()) + read_->transferred, n);
+                    read_->transferred += n;
+                    moved = true;
+                }
+            }
+            if (write_ && !closed_) {
+                while (write_->index != write_->bufs.size() && size_ != ring_.size()) {
+                    auto const& b = write_->bufs[write_->index];
+                    auto n = std::min(b.size() - write_->offset, ring_.size() - size_);
+                    push(static_cast<char const*>(b.data()) + write_->offset, n);
+                    write_->offset += n;
+                    write_->transferred += n;
+                    if (write_->offset == b.size()) {
+                        ++write_->index;
+                        write_->offset = 0;
+                    }
+                    moved = true;
+                }
+            }
+            if (!moved) break;
+        }
+
+        if (read_ && (read_->transferred == read_->buf.size() || closed_)) {
+            auto ec = read_->transferred == read_->buf.size() ? error_code() : error_code(as::error::eof);
+            done.emplace_back(
+                [c = force_move(read_->completion), ec, n = read_->transferred] {
+                    c(ec, n);
+                }
+            );
+            read_ = nullopt;
+        }
+        if (write_ && (write_->index == write_->bufs.size() || closed_)) {
+            auto ec = write_->index == write_->bufs.size() ? error_code() : error_code(as::error::broken_pipe);
+            done.emplace_back(
+                [c = force_move(write_->completion), ec, n = write_->transferred] {
+                    c(ec, n);
+                }
+            );
+            write_ = nullopt;
+        }
+    }
+
+    void push(char const* p, std::size_t n) {
+        auto tail = (head_ + size_) % ring_.size();
+        auto first = std::min(n, ring_.size() - tail);
+        std::memcpy(&ring_[tail], p, first);
+        std::memcpy(&ring_[0], p + first, n - first);
+        size_ += n;
+    }
+
+    void pop(char* p, std::size_t n) {
+        auto first = std::min(n, ring_.size() - head_);
+        std::memcpy(p, &ring_[head_], first);
+        std::memcpy(p + first, &ring_[0], n - first);
+        head_ = (head_ + n) % ring_.size();
+        size_ -= n;
+    }
+
+    void grow(std::size_t capacity) {
+        std::vector<char> r(std::max(capacity, ring_.size() * 2));
+        auto size = size_;
+        pop(r.data(), size);
+        ring_ = force_move(r);
+        head_ = 0;
+        size_ = size;
+    }
+
+    std::mutex mtx_;
+    std::vector<char> ring_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+    bool closed_ = false;
+    optional<read_op> read_;
+    optional<write_op> write_;
+};
+
+} // namespace detail
+
+/**
+ * @brief In-memory socket. Two loopback_endpoints made by make_loopback_pair() are connected
+ *        to each other without the kernel.
+ *
+ * It is meant to drive an endpoint (e.g. the broker side of a connection) from the same process
+ * in benchmarks and tests. lowest_layer() returns a TCP socket that is never opened, so the
+ * socket options can't be applied.
+ */
+template <typename Strand = strand>
+class loopback_endpoint : public socket {
+public:
+    loopback_endpoint(
+        as::io_context& ioc,
+        std::shared_ptr<detail::loopback_pipe> in,
+        std::shared_ptr<detail::loopback_pipe> out)
+        :ioc_(ioc),
+         tcp_(ioc),
+#if defined(MQTT_NO_TS_EXECUTORS)
+         strand_(ioc.get_executor()),
+#else
+         strand_(ioc),
+#endif
+         in_(force_move(in)),
+         out_(force_move(out))
+    {}
+
+    ~loopback_endpoint() {
+        close();
+    }
+
+    MQTT_ALWAYS_INLINE void async_read(
+        as::mutable_buffer buffers,
+        std::function<void(error_code, std::size_t)> handler
+    ) override final {
+        in_->async_read(buffers, bind(force_move(handler)));
+    }
+
+    MQTT_ALWAYS_INLINE void async_write(
+        std::vector<as::const_buffer> buffers,
+        std::function<void(error_code, std::size_t)> handler
+    ) override final {
+        out_->async_write(force_move(buffers), bind(force_move(handler)));
+    }
+
+    MQTT_ALWAYS_INLINE std::size_t write(
+        std::vector<as::const_buffer> buffers,
+        boost::system::error_code& ec
+    ) override final {
+        return out_->write(buffers, ec);
+    }
+
+    MQTT_ALWAYS_INLINE void post(std::function<void()> handler) override final {
+        as::post(
+            strand_,
+            force_move(handler)
+        );
+    }
+
+    MQTT_ALWAYS_INLINE as::ip::tcp::socket::lowest_layer_type& lowest_layer() override final {
+        return tcp_.lowest_layer();
+    }
+
+    MQTT_ALWAYS_INLINE any native_handle() override final {
+        return any();
+    }
+
+    MQTT_ALWAYS_INLINE void clean_shutdown_and_close(boost::system::error_code& ec) override final {
+        close();
+        ec = boost::system::error_code();
+    }
+
+    MQTT_ALWAYS_INLINE void async_clean_shutdown_and_close(std::function<void(error_code)> handler) override final {
+        post(
+            [this, handler = force_move(handler)] () mutable {
+                close();
+                force_move(handler)(error_code());
+            }
+        );
+    }
+
+    MQTT_ALWAYS_INLINE void force_shutdown_and_close(boost::system::error_code& ec) override final {
+        close();
+        ec = boost::system::error_code();
+    }
+
+#if BOOST_VERSION < 107400 || defined(BOOST_ASIO_USE_TS_EXECUTOR_AS_DEFAULT)
+    MQTT_ALWAYS_INLINE as::executor get_executor() override final {
+        return lowest_layer().get_executor();
+    }
+#else  // BOOST_VERSION < 107400 || defined(BOOST_ASIO_USE_TS_EXECUTOR_AS_DEFAULT)
+    MQTT_ALWAYS_INLINE as::any_io_executor get_executor() override final {
+        return lowest_layer().get_executor();
+    }
+#endif // BOOST_VERSION < 107400 || defined(BOOST_ASIO_USE_TS_EXECUTOR_AS_DEFAULT)
+
+private:
+    void close() {
+        MQTT_LOG("mqtt_impl", trace)
+            << MQTT_ADD_VALUE(address, this)
+            << "loopback close";
+        in_->close();
+        out_->close();
+    }
+
+    // The pipe completes on the thread of the peer. Post the handler to the own strand.
+    // The strand is captured by copy because the pipe can complete after this is destroyed.
+    // The pending operation keeps the io_context running like an operation on a real socket.
+    detail::loopback_pipe::completion_t bind(std::function<void(error_code, std::size_t)> handler) {
+        return
+            [strand = strand_,
+             work = std::make_shared<work_guard_t>(ioc_.get_executor()),
+             handler = force_move(handler)]
+            (error_code ec, std::size_t bytes_transferred) mutable {
+                as::post(
+                    strand,
+                    [handler = force_move(handler), ec, bytes_transferred] {
+                        handler(ec, bytes_transferred);
+                    }
+                );
+                work.reset();
+            };
+    }
+
+    using work_guard_t = as::executor_work_guard<as::io_context::executor_type>;
+
+    as::io_context& ioc_;
+    as::ip::tcp::socket tcp_;
+    Strand strand_;
+    std::shared_ptr<detail::loopback_pipe> in_;
+    std::shared_ptr<detail::loopback_pipe> out_;
+};
+
+/**
+ * @brief Make two connected loopback_endpoints.
+ * @param ioc1 io_context of the first endpoint
+ * @param ioc2 io_context of the second endpoint. It can be the same as ioc1.
+ * @param capacity the buffer size of each direction in bytes
+ * @return the pair of the endpoints. The bytes written to one are read from the other.
+ */
+template <typename Strand = strand>
+inline std::pair<std::shared_ptr<loopback_endpoint<Strand>>, std::shared_ptr<loopback_endpoint<Strand>>>
+make_loopback_pair(as::io_context& ioc1, as::io_context& ioc2, std::size_t capacity = 64 * 1024) {
+    auto p1 = std::make_shared<detail::loopback_pipe>(capacity);
+    auto p2 = std::make_shared<detail::loopback_pipe>(capacity);
+    return {
+        std::make_shared<loopback_endpoint<Strand>>(ioc1, p1, p2),
+        std::make_shared<loopback_endpoint<Strand>>(ioc2, p2, p1)
+    };
+}
+
+} // namespace MQTT_NS
+
+#endif // MQTT_LOOPBACK_ENDPOINT_HPP
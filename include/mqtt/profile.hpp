@@ -0,0 +1,172 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_PROFILE_HPP)
+#define MQTT_PROFILE_HPP
+
+// Annotations for sampling profilers.
+//
+// If MQTT_USE_PROFILE is defined, the major phases of the PUBLISH path run inside out of line
+// functions, MQTT_NS::profile::parse, match, deliver, encode, and write. Each phase is a
+// readable frame in perf and in flame graphs, no matter how deep the templated endpoint,
+// coroutine, and lambda frames around it are. The phases nest as they are called, e.g. match
+// is under parse when the broker handles a PUBLISH synchronously.
+// If MQTT_USE_ITT is also defined, each phase is an ITT task as well, so VTune shows the
+// phases on the timeline. ittnotify needs to be linked in that case.
+//
+// MQTT_PROFILE_PHASE_HOOK(name) can be defined before including this header to run code in
+// each phase, e.g. to feed another profiler. It is expanded at the beginning of the phase
+// function, so an object that it defines lives until the end of the phase.
+//
+// If MQTT_USE_PROFILE is not defined, profile::run() calls the function inline.
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <mqtt/namespace.hpp>
+#include <mqtt/attributes.hpp>
+#include <mqtt/optional.hpp>
+#include <mqtt/move.hpp>
+
+#if defined(MQTT_USE_PROFILE) && defined(MQTT_USE_ITT)
+#include <ittnotify.h>
+#endif // defined(MQTT_USE_PROFILE) && defined(MQTT_USE_ITT)
+
+#if defined(MQTT_USE_PROFILE)
+
+#if defined(_MSC_VER)
+#define MQTT_PROFILE_NOINLINE __declspec(noinline)
+#else  // defined(_MSC_VER)
+#define MQTT_PROFILE_NOINLINE __attribute__((noinline))
+#endif // defined(_MSC_VER)
+
+#else  // defined(MQTT_USE_PROFILE)
+
+#define MQTT_PROFILE_NOINLINE
+
+#endif // defined(MQTT_USE_PROFILE)
+
+namespace MQTT_NS {
+
+namespace profile {
+
+namespace detail {
+
+using invoker_t = void (*)(void*);
+
+template <typename F>
+void invoke(void* f) {
+    (*static_cast<F*>(f))();
+}
+
+// Keep the caller's frame. Otherwise the call to the invoker can be a tail call,
+// and the phase disappears from the call stack.
+MQTT_ALWAYS_INLINE inline void keep_frame() {
+#if !defined(_MSC_VER)
+    asm volatile("" ::: "memory");
+#endif // !defined(_MSC_VER)
+}
+
+#if defined(MQTT_USE_PROFILE) && defined(MQTT_USE_ITT)
+
+inline __itt_domain* itt_domain() {
+    static __itt_domain* d = __itt_domain_create("mqtt_cpp");
+    return d;
+}
+
+class itt_task {
+public:
+    explicit itt_task(__itt_string_handle* name) {
+        __itt_task_begin(itt_domain(), __itt_null, __itt_null, name);
+    }
+    ~itt_task() {
+        __itt_task_end(itt_domain());
+    }
+    itt_task(itt_task const&) = delete;
+    itt_task& operator=(itt_task const&) = delete;
+};
+
+#define MQTT_PROFILE_ITT_TASK(name) \
+    static __itt_string_handle* itt_name = __itt_string_handle_create(#name); \
+    detail::itt_task itt(itt_name)
+
+#else  // defined(MQTT_USE_PROFILE) && defined(MQTT_USE_ITT)
+
+#define MQTT_PROFILE_ITT_TASK(name)
+
+#endif // defined(MQTT_USE_PROFILE) && defined(MQTT_USE_ITT)
+
+} // namespace detail
+
+#if !defined(MQTT_PROFILE_PHASE_HOOK)
+#define MQTT_PROFILE_PHASE_HOOK(name)
+#endif // !defined(MQTT_PROFILE_PHASE_HOOK)
+
+#define MQTT_PROFILE_DEFINE_PHASE(name)                                             \
+    MQTT_PROFILE_NOINLINE inline void name(detail::invoker_t invoker, void* f) {   \
+        MQTT_PROFILE_ITT_TASK(name);                                                \
+        MQTT_PROFILE_PHASE_HOOK(name);                                              \
+        invoker(f);                                                                 \
+        detail::keep_frame();                                                       \
+    }
+
+/// @brief Reading the fixed header is done, the rest of the packet is parsed and the handler is called
+MQTT_PROFILE_DEFINE_PHASE(parse)
+/// @brief The broker matches the topic against the subscriptions
+MQTT_PROFILE_DEFINE_PHASE(match)
+/// @brief The broker delivers the message to a subscriber's session
+MQTT_PROFILE_DEFINE_PHASE(deliver)
+/// @brief The outgoing PUBLISH is built and queued
+MQTT_PROFILE_DEFINE_PHASE(encode)
+/// @brief The queued packets are gathered and passed to the socket
+MQTT_PROFILE_DEFINE_PHASE(write)
+
+#undef MQTT_PROFILE_DEFINE_PHASE
+#undef MQTT_PROFILE_ITT_TASK
+
+using phase_t = void (*)(detail::invoker_t, void*);
+
+#if defined(MQTT_USE_PROFILE)
+
+/**
+ * @brief Call f in the phase.
+ * @param phase one of the phase functions, e.g. profile::parse
+ * @param f function object without arguments
+ * @return the return value of f
+ */
+template <typename F>
+MQTT_ALWAYS_INLINE inline auto run(phase_t phase, F&& f)
+-> std::enable_if_t<std::is_void<decltype(f())>::value> {
+    phase(
+        &detail::invoke<std::remove_reference_t<F>>,
+        const_cast<void*>(static_cast<void const*>(std::addressof(f)))
+    );
+}
+
+template <typename F>
+MQTT_ALWAYS_INLINE inline auto run(phase_t phase, F&& f)
+-> std::enable_if_t<!std::is_void<decltype(f())>::value, decltype(f())> {
+    optional<decltype(f())> ret;
+    auto g = [&] { ret.emplace(f()); };
+    phase(&detail::invoke<decltype(g)>, &g);
+    return force_move(ret.value());
+}
+
+#else  // defined(MQTT_USE_PROFILE)
+
+template <typename F>
+MQTT_ALWAYS_INLINE inline decltype(auto) run(phase_t, F&& f) {
+    return std::forward<F>(f)();
+}
+
+#endif // defined(MQTT_USE_PROFILE)
+
+} // namespace profile
+
+} // namespace MQTT_NS
+
+#endif // MQTT_PROFILE_HPP
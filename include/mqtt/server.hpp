@@ -25,10 +25,16 @@ namespace MQTT_NS {
 
 namespace as = boost::asio;
 
-template <typename Mutex, template<typename...> class LockGuard, std::size_t PacketIdBytes>
-class server_endpoint : public endpoint<Mutex, LockGuard, PacketIdBytes> {
+template <
+    typename Mutex,
+    template<typename...> class LockGuard,
+    std::size_t PacketIdBytes,
+    template<typename> class PacketIdManager = packet_id_manager,
+    protocol_version Version = protocol_version::undetermined
+>
+class server_endpoint : public endpoint<Mutex, LockGuard, PacketIdBytes, PacketIdManager, Version> {
 public:
-    using endpoint<Mutex, LockGuard, PacketIdBytes>::endpoint;
+    using endpoint<Mutex, LockGuard, PacketIdBytes, PacketIdManager, Version>::endpoint;
 protected:
     void on_pre_send() noexcept override {}
     void on_close() noexcept override {}
@@ -41,12 +47,14 @@ template <
     typename Strand = strand,
     typename Mutex = std::mutex,
     template<typename...> class LockGuard = std::lock_guard,
-    std::size_t PacketIdBytes = 2
+    std::size_t PacketIdBytes = 2,
+    template<typename> class PacketIdManager = packet_id_manager,
+    protocol_version Version = protocol_version::undetermined
 >
 class server {
 public:
     using socket_t = tcp_endpoint<as::ip::tcp::socket, Strand>;
-    using endpoint_t = callable_overlay<server_endpoint<Mutex, LockGuard, PacketIdBytes>>;
+    using endpoint_t = callable_overlay<server_endpoint<Mutex, LockGuard, PacketIdBytes, PacketIdManager, Version>>;
 
     /**
      * @brief Accept handler
@@ -205,12 +213,14 @@ template <
     typename Strand = strand,
     typename Mutex = std::mutex,
     template<typename...> class LockGuard = std::lock_guard,
-    std::size_t PacketIdBytes = 2
+    std::size_t PacketIdBytes = 2,
+    template<typename> class PacketIdManager = packet_id_manager,
+    protocol_version Version = protocol_version::undetermined
 >
 class server_tls {
 public:
     using socket_t = tcp_endpoint<tls::stream<as::ip::tcp::socket>, Strand>;
-    using endpoint_t = callable_overlay<server_endpoint<Mutex, LockGuard, PacketIdBytes>>;
+    using endpoint_t = callable_overlay<server_endpoint<Mutex, LockGuard, PacketIdBytes, PacketIdManager, Version>>;
 
     /**
      * @brief Accept handler
@@ -437,12 +447,14 @@ template <
     typename Strand = strand,
     typename Mutex = std::mutex,
     template<typename...> class LockGuard = std::lock_guard,
-    std::size_t PacketIdBytes = 2
+    std::size_t PacketIdBytes = 2,
+    template<typename> class PacketIdManager = packet_id_manager,
+    protocol_version Version = protocol_version::undetermined
 >
 class server_ws {
 public:
     using socket_t = ws_endpoint<as::ip::tcp::socket, Strand>;
-    using endpoint_t = callable_overlay<server_endpoint<Mutex, LockGuard, PacketIdBytes>>;
+    using endpoint_t = callable_overlay<server_endpoint<Mutex, LockGuard, PacketIdBytes, PacketIdManager, Version>>;
 
     /**
      * @brief Accept handler
@@ -707,12 +719,14 @@ template <
     typename Strand = strand,
     typename Mutex = std::mutex,
     template<typename...> class LockGuard = std::lock_guard,
-    std::size_t PacketIdBytes = 2
+    std::size_t PacketIdBytes = 2,
+    template<typename> class PacketIdManager = packet_id_manager,
+    protocol_version Version = protocol_version::undetermined
 >
 class server_tls_ws {
 public:
     using socket_t = ws_endpoint<tls::stream<as::ip::tcp::socket>, Strand>;
-    using endpoint_t = callable_overlay<server_endpoint<Mutex, LockGuard, PacketIdBytes>>;
+    using endpoint_t = callable_overlay<server_endpoint<Mutex, LockGuard, PacketIdBytes, PacketIdManager, Version>>;
 
     /**
      * @brief Accept handler
@@ -23,7 +23,7 @@
 
 namespace MQTT_NS {
 
-#if defined(MQTT_USE_LOG)
+#if defined(MQTT_USE_LOG) && !defined(MQTT_USE_BINARY_LOG)
 
 /**
  * @brief Setup logging
@@ -126,12 +126,45 @@ void setup_log(severity_level threshold = severity_level::warning) {
     );
 }
 
-#else  // defined(MQTT_USE_LOG)
+#elif defined(MQTT_USE_BINARY_LOG) // defined(MQTT_USE_LOG) && !defined(MQTT_USE_BINARY_LOG)
+
+/**
+ * @brief Setup logging
+ * @param threshold
+ *        Set threshold severity_level by channel
+ *        If the log severity_level >= threshold then log message outputs.
+ *        The records are formatted on a background thread and written to std::clog.
+ */
+inline
+void setup_log(std::map<std::string, severity_level> threshold) {
+    binary_log::set_threshold(force_move(threshold));
+    binary_log::start();
+}
+
+/**
+ * @brief Setup logging
+ * @param threshold
+ *        Set threshold severity_level for all channels
+ *        If the log severity_level >= threshold then log message outputs.
+ */
+inline
+void setup_log(severity_level threshold = severity_level::warning) {
+    setup_log(
+        {
+            { "mqtt_api", threshold },
+            { "mqtt_cb", threshold },
+            { "mqtt_impl", threshold },
+            { "mqtt_broker", threshold },
+        }
+    );
+}
+
+#else  // defined(MQTT_USE_BINARY_LOG)
 
 template <typename... Params>
 void setup_log(Params&&...) {}
 
-#endif // defined(MQTT_USE_LOG)
+#endif // defined(MQTT_USE_BINARY_LOG)
 
 } // namespace MQTT_NS
 
@@ -0,0 +1,332 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_STORE_LOG_HPP)
+#define MQTT_STORE_LOG_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <mqtt/namespace.hpp>
+#include <mqtt/append_log.hpp>
+#include <mqtt/buffer.hpp>
+#include <mqtt/error_code.hpp>
+#include <mqtt/exception.hpp>
+#include <mqtt/log.hpp>
+#include <mqtt/move.hpp>
+#include <mqtt/packet_id_type.hpp>
+#include <mqtt/protocol_version.hpp>
+#include <mqtt/string_view.hpp>
+
+namespace MQTT_NS {
+
+namespace as = boost::asio;
+
+/**
+ * @brief Configuration of basic_store_log
+ */
+struct store_log_config {
+    /// group commit policy of the log
+    append_log::sync_policy sync;
+    /// the log is never compacted while it is smaller than this size
+    std::size_t compaction_min_bytes = 1024 * 1024;
+    /// compact when the log grows to this ratio of the last compacted size
+    std::size_t compaction_ratio = 2;
+};
+
+/**
+ * @brief Write ahead log of the endpoint's stored (not acknowledged yet) messages.
+ *
+ * attach() sets the serialize handlers of the endpoint. After that, PUBLISH (QoS1, QoS2) and
+ * PUBREL messages are appended to the log when the endpoint stores them, and tombstones are
+ * appended when the endpoint removes them (PUBACK, PUBCOMP received).
+ * The records are not synced one by one. They are synced to the storage in groups according
+ * to store_log_config::sync, and also periodically by a timer on the given io_context.
+ * So the messages in the last sync interval could be lost on crash.
+ *
+ * After restart, call restore() before connect to restore the messages to the endpoint.
+ * The endpoint resends them after the connection is established.
+ *
+ * The messages are not kept in memory, because the endpoint has them. Only the log offsets
+ * of the stored messages are kept, and restore() and compaction read the messages from the log.
+ *
+ * @tparam PacketIdBytes packet identifier size of the endpoint
+ */
+template <std::size_t PacketIdBytes>
+class basic_store_log {
+public:
+    using packet_id_t = typename packet_id_type<PacketIdBytes>::type;
+    using config = store_log_config;
+
+    /**
+     * @brief Open the log and load the stored messages from it.
+     * @param timer_ioc io_context for the periodic sync timer
+     * @param path      log file path
+     * @param c         config
+     */
+    basic_store_log(as::io_context& timer_ioc, std::string path, config c = config())
+        : config_(force_move(c)),
+          log_(force_move(path), config_.sync),
+          tim_sync_(timer_ioc)
+    {
+        bool complete = log_.replay(
+            [this](std::uint8_t type, buffer payload, std::size_t offset) {
+                apply(static_cast<record>(type), force_move(payload), offset);
+            }
+        );
+        MQTT_LOG("mqtt_api", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "store_log loaded"
+            << " path:" << log_.path()
+            << " size:" << log_.size()
+            << " messages:" << messages_.size()
+            << " complete:" << complete;
+        // A broken record at the tail must be removed before appending.
+        if (!complete || log_.size() >= config_.compaction_min_bytes) {
+            compact_no_lock();
+        }
+        compacted_size_ = log_.size();
+        set_sync_timer();
+    }
+
+    ~basic_store_log() {
+        tim_sync_.cancel();
+    }
+
+    basic_store_log(basic_store_log const&) = delete;
+    basic_store_log& operator=(basic_store_log const&) = delete;
+
+    /**
+     * @brief Set the serialize handlers of the endpoint to record its stored messages.
+     *        The log must outlive the endpoint, or detach it by ep.set_serialize_handlers().
+     * @param ep endpoint
+     */
+    template <typename Endpoint>
+    void attach(Endpoint& ep) {
+        static_assert(sizeof(typename Endpoint::packet_id_t) == PacketIdBytes, "PacketIdBytes mismatch");
+        auto h_put =
+            [this](packet_id_t packet_id, char const* data, std::size_t size) {
+                put(packet_id, string_view(data, size));
+            };
+        auto h_remove =
+            [this](packet_id_t packet_id) {
+                remove(packet_id);
+            };
+        ep.set_serialize_handlers(h_put, h_put, h_remove);
+        ep.set_v5_serialize_handlers(h_put, h_put, h_remove);
+    }
+
+    /**
+     * @brief Restore the logged messages to the endpoint in the stored order.
+     *        This function should be called before connect.
+     * @param ep endpoint
+     */
+    template <typename Endpoint>
+    void restore(Endpoint& ep) const {
+        std::vector<std::string> msgs;
+        {
+            std::lock_guard<std::mutex> g(mtx_);
+            for (auto const& e : ordered_messages_no_lock()) {
+                auto payload = read_no_lock(e->second.offset);
+                msgs.emplace_back(payload.data() + PacketIdBytes, payload.size() - PacketIdBytes);
+            }
+        }
+        for (auto const& m : msgs) {
+            if (ep.get_protocol_version() == protocol_version::v5) {
+                ep.restore_v5_serialized_message(m.begin(), m.end());
+            }
+            else {
+                ep.restore_serialized_message(m.begin(), m.end());
+            }
+        }
+    }
+
+    /**
+     * @brief Record the stored message. The message that has the same packet_id is replaced.
+     * @param packet_id packet identifier
+     * @param serialized serialized PUBLISH or PUBREL message
+     */
+    void put(packet_id_t packet_id, string_view serialized) {
+        std::string s;
+        s.reserve(PacketIdBytes + serialized.size());
+        add_packet_id_to_buf<PacketIdBytes>::apply(s, packet_id);
+        s.append(serialized.data(), serialized.size());
+        write(record::put, force_move(s));
+    }
+
+    /**
+     * @brief Record the removal of the stored message.
+     * @param packet_id packet identifier
+     */
+    void remove(packet_id_t packet_id) {
+        std::string s;
+        add_packet_id_to_buf<PacketIdBytes>::apply(s, packet_id);
+        write(record::remove, force_move(s));
+    }
+
+    /**
+     * @brief Sync the appended records to the storage.
+     */
+    void sync() {
+        std::lock_guard<std::mutex> g(mtx_);
+        log_.sync();
+    }
+
+    /**
+     * @brief Rewrite the log with the current stored messages only.
+     */
+    void compact() {
+        std::lock_guard<std::mutex> g(mtx_);
+        compact_no_lock();
+    }
+
+    /**
+     * @brief Get the number of the stored messages
+     * @return the number of the stored messages
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> g(mtx_);
+        return messages_.size();
+    }
+
+    /**
+     * @brief Get the size of the log file
+     * @return size in bytes
+     */
+    std::size_t log_size() const {
+        std::lock_guard<std::mutex> g(mtx_);
+        return log_.size();
+    }
+
+private:
+    struct message_index {
+        /// the stored order
+        std::uint64_t seq;
+        /// offset of the put record of the message
+        std::size_t offset;
+    };
+
+    /// key is packet_id
+    using messages_t = std::map<packet_id_t, message_index>;
+
+    enum class record : std::uint8_t {
+        put = 1,
+        remove,
+    };
+
+    void write(record type, std::string payload) {
+        std::lock_guard<std::mutex> g(mtx_);
+        auto offset = log_.append(static_cast<std::uint8_t>(type), payload);
+        apply(type, buffer(string_view(payload)), offset);
+        // group commit
+        if (log_.sync_due()) log_.sync();
+        if (log_.size() >= config_.compaction_min_bytes &&
+            log_.size() >= compacted_size_ * config_.compaction_ratio) {
+            compact_no_lock();
+        }
+    }
+
+    void apply(record type, buffer const& payload, std::size_t offset) {
+        if (payload.size() < PacketIdBytes) return;
+        auto packet_id = make_packet_id<PacketIdBytes>::apply(payload.begin(), payload.begin() + PacketIdBytes);
+        switch (type) {
+        case record::put: {
+            auto it = messages_.find(packet_id);
+            if (it == messages_.end()) {
+                messages_.emplace(packet_id, message_index { next_seq_++, offset });
+            }
+            else {
+                // PUBREL replaces PUBLISH but keeps its position in the resend order.
+                it->second.offset = offset;
+            }
+        } break;
+        case record::remove:
+            messages_.erase(packet_id);
+            break;
+        }
+    }
+
+    /**
+     * @brief Read the payload of the put record at the offset
+     */
+    buffer read_no_lock(std::size_t offset) const {
+        auto r = log_.read(offset);
+        if (static_cast<record>(r.first) != record::put || r.second.size() < PacketIdBytes) {
+            throw malformed_packet_error();
+        }
+        return force_move(r.second);
+    }
+
+    void compact_no_lock() {
+        auto ordered = ordered_messages_no_lock();
+        // The offsets in the new log. They are applied after the rewrite succeeds.
+        std::vector<std::size_t> offsets;
+        offsets.reserve(ordered.size());
+        log_.rewrite(
+            [&](auto&& write_record) {
+                for (auto const& e : ordered) {
+                    offsets.push_back(
+                        write_record(static_cast<std::uint8_t>(record::put), read_no_lock(e->second.offset))
+                    );
+                }
+            }
+        );
+        for (std::size_t i = 0; i != ordered.size(); ++i) {
+            messages_.at(ordered[i]->first).offset = offsets[i];
+        }
+        compacted_size_ = log_.size();
+        MQTT_LOG("mqtt_api", info)
+            << MQTT_ADD_VALUE(address, this)
+            << "store_log compacted"
+            << " size:" << compacted_size_;
+    }
+
+    std::vector<typename messages_t::const_iterator> ordered_messages_no_lock() const {
+        std::vector<typename messages_t::const_iterator> its;
+        its.reserve(messages_.size());
+        for (auto it = messages_.begin(); it != messages_.end(); ++it) its.push_back(it);
+        std::sort(
+            its.begin(),
+            its.end(),
+            [](auto const& lhs, auto const& rhs) { return lhs->second.seq < rhs->second.seq; }
+        );
+        return its;
+    }
+
+    void set_sync_timer() {
+        tim_sync_.expires_after(config_.sync.interval);
+        tim_sync_.async_wait(
+            [this](error_code ec) {
+                if (ec) return;
+                sync();
+                set_sync_timer();
+            }
+        );
+    }
+
+private:
+    config config_;
+    mutable std::mutex mtx_;
+    append_log log_;
+    as::steady_timer tim_sync_;
+    messages_t messages_;
+    std::uint64_t next_seq_ = 0;
+    std::size_t compacted_size_ = 0;
+};
+
+using store_log = basic_store_log<2>;
+using store_log_32 = basic_store_log<4>;
+
+} // namespace MQTT_NS
+
+#endif // MQTT_STORE_LOG_HPP
@@ -12,7 +12,8 @@
 #include <array>
 
 #include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 
@@ -22,7 +23,6 @@
 #include <mqtt/type.hpp>
 #include <mqtt/move.hpp>
 #include <mqtt/log.hpp>
-#include <mqtt/time_point_t.hpp>
 #include <mqtt/optional.hpp>
 #include <mqtt/value_allocator.hpp>
 
@@ -43,22 +43,30 @@ public:
             << " alias:" << alias;
         BOOST_ASSERT(!topic.empty() && alias >= min_ && alias <= max_);
         va_.use(alias);
+
+        // The topic is mapped to only one alias.
+        auto& topic_idx = aliases_.get<tag_topic_name>();
+        auto topic_it = topic_idx.find(topic);
+        if (topic_it != topic_idx.end() && topic_it->alias != alias) {
+            va_.deallocate(topic_it->alias);
+            topic_idx.erase(topic_it);
+        }
+
         auto& idx = aliases_.get<tag_alias>();
-        auto it = idx.lower_bound(alias);
-        if (it == idx.end() || it->alias != alias) {
-            idx.emplace_hint(it, std::string(topic), alias, std::chrono::steady_clock::now());
+        auto it = idx.find(alias);
+        if (it == idx.end()) {
+            it = idx.emplace(std::string(topic), alias).first;
         }
-        else {
+        else if (it->topic != topic) {
             idx.modify(
                 it,
                 [&](entry& e) {
                     e.topic = std::string{topic};
-                    e.tp = std::chrono::steady_clock::now();
                 },
                 [](auto&) { BOOST_ASSERT(false); }
             );
-
         }
+        touch(it);
     }
 
     std::string find(topic_alias_t alias) {
@@ -72,13 +80,7 @@ public:
         auto it = idx.find(alias);
         if (it == idx.end()) return std::string();
 
-        idx.modify(
-            it,
-            [&](entry& e) {
-                e.tp = std::chrono::steady_clock::now();
-            },
-            [](auto&) { BOOST_ASSERT(false); }
-        );
+        touch(it);
         return it->topic;
     }
 
@@ -107,8 +109,8 @@ public:
         if (auto alias_opt = va_.first_vacant()) {
             return alias_opt.value();
         }
-        auto& idx = aliases_.get<tag_tp>();
-        return idx.begin()->alias;
+        auto& idx = aliases_.get<tag_lru>();
+        return idx.front().alias;
     }
 
     topic_alias_t max() const { return max_; }
@@ -118,8 +120,8 @@ private:
     topic_alias_t max_;
 
     struct entry {
-        entry(std::string topic, topic_alias_t alias, time_point_t tp)
-            : topic{force_move(topic)}, alias{alias}, tp{force_move(tp)} {}
+        entry(std::string topic, topic_alias_t alias)
+            : topic{force_move(topic)}, alias{alias} {}
 
         string_view get_topic_as_view() const {
             return topic;
@@ -127,29 +129,35 @@ private:
 
         std::string topic;
         topic_alias_t alias;
-        time_point_t tp;
     };
-    struct tag_tp {};
+    struct tag_lru {};
     struct tag_alias {};
     struct tag_topic_name {};
+
+    // All indexes are O(1). tag_lru keeps the least recently used entry at the front.
     using mi_topic_alias = mi::multi_index_container<
         entry,
         mi::indexed_by<
-            mi::ordered_unique<
+            mi::hashed_unique<
                 mi::tag<tag_alias>,
                 BOOST_MULTI_INDEX_MEMBER(entry, topic_alias_t, alias)
             >,
-            mi::ordered_unique<
+            mi::hashed_unique<
                 mi::tag<tag_topic_name>,
                 BOOST_MULTI_INDEX_CONST_MEM_FUN(entry, string_view, get_topic_as_view)
             >,
-            mi::ordered_non_unique<
-                mi::tag<tag_tp>,
-                BOOST_MULTI_INDEX_MEMBER(entry, time_point_t, tp)
+            mi::sequenced<
+                mi::tag<tag_lru>
             >
         >
     >;
 
+    template <typename Iterator>
+    void touch(Iterator it) {
+        auto& lru_idx = aliases_.get<tag_lru>();
+        lru_idx.relocate(lru_idx.end(), aliases_.project<tag_lru>(it));
+    }
+
     mi_topic_alias aliases_;
     value_allocator<topic_alias_t> va_;
 };
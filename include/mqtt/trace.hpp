@@ -0,0 +1,206 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TRACE_HPP)
+#define MQTT_TRACE_HPP
+
+// Per-packet latency tracing.
+//
+// If MQTT_USE_TRACE is defined, a PUBLISH packet read by an endpoint gets a trace_context.
+// The context is stamped with a monotonic timestamp at each stage while the packet is
+// processed. When the packet is delivered to other endpoints, each outgoing PUBLISH gets a
+// copy of the context, and the copy is passed to the trace_sink when its write completes.
+//
+// If MQTT_USE_TRACE is not defined, the macros expand to nothing and no member is added.
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(MQTT_USE_TRACE)
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#endif // defined(MQTT_USE_TRACE)
+
+#include <mqtt/namespace.hpp>
+
+namespace MQTT_NS {
+
+/**
+ * @brief The stages of a PUBLISH packet. Each stage lasts until the next stamped stage.
+ */
+enum class trace_stage : std::uint8_t {
+    read,            ///< the fixed header is received
+    parse,           ///< the whole packet is received and parsed, and the publish handler is called
+    publish_handler, ///< the broker's publish handler is entered
+    match,           ///< the broker starts matching the subscriptions
+    deliver,         ///< session_state::deliver() is called for a subscriber
+    queue,           ///< the outgoing PUBLISH is queued in the endpoint of the subscriber
+    write,           ///< async_write of the outgoing PUBLISH is started
+    done,            ///< async_write is completed
+    num_of_stages
+};
+
+constexpr char const* trace_stage_to_str(trace_stage v) {
+    char const * const str[] = {
+        "read",
+        "parse",
+        "publish_handler",
+        "match",
+        "deliver",
+        "queue",
+        "write",
+        "done"
+    };
+    return
+        static_cast<std::size_t>(v) < static_cast<std::size_t>(trace_stage::num_of_stages)
+        ? str[static_cast<std::size_t>(v)]
+        : "unknown_trace_stage";
+}
+
+#if defined(MQTT_USE_TRACE)
+
+/**
+ * @brief Timestamps of a PUBLISH packet.
+ */
+class trace_context {
+public:
+    static constexpr std::size_t num_of_stages = static_cast<std::size_t>(trace_stage::num_of_stages);
+
+    /**
+     * @brief Start a new trace. The read stage is stamped.
+     */
+    static trace_context start() {
+        static std::atomic<std::uint64_t> next_id { 1 };
+        trace_context ctx;
+        ctx.id_ = next_id.fetch_add(1, std::memory_order_relaxed);
+        ctx.stamp(trace_stage::read);
+        return ctx;
+    }
+
+    /**
+     * @brief id of the trace. 0 means not started.
+     *        The copies for the outgoing packets have the same id as the incoming packet.
+     */
+    std::uint64_t id() const {
+        return id_;
+    }
+
+    explicit operator bool() const {
+        return id_ != 0;
+    }
+
+    void stamp(trace_stage s) {
+        stamps_[static_cast<std::size_t>(s)] = now();
+    }
+
+    /**
+     * @brief Get the timestamp of the stage in nanoseconds from the steady_clock epoch.
+     *        0 means the stage is not stamped.
+     */
+    std::int64_t get(trace_stage s) const {
+        return stamps_[static_cast<std::size_t>(s)];
+    }
+
+    void clear() {
+        id_ = 0;
+        stamps_.fill(0);
+    }
+
+private:
+    static std::int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+    }
+
+    std::uint64_t id_ = 0;
+    std::array<std::int64_t, num_of_stages> stamps_ {};
+};
+
+/**
+ * @brief Receives the completed traces.
+ *
+ * on_trace() is called on the thread that completes async_write, so it should be fast and
+ * thread safe.
+ */
+class trace_sink {
+public:
+    virtual ~trace_sink() = default;
+    virtual void on_trace(trace_context const& ctx) = 0;
+};
+
+namespace detail {
+
+inline std::atomic<trace_sink*>& trace_sink_ptr() {
+    static std::atomic<trace_sink*> p { nullptr };
+    return p;
+}
+
+inline trace_context*& current_trace_context() {
+    thread_local trace_context* p = nullptr;
+    return p;
+}
+
+} // namespace detail
+
+/**
+ * @brief Set the sink of the traces.
+ * @param sink - the sink. It must outlive the endpoints. nullptr stops tracing.
+ */
+inline void set_trace_sink(trace_sink* sink) {
+    detail::trace_sink_ptr().store(sink, std::memory_order_release);
+}
+
+inline trace_sink* get_trace_sink() {
+    return detail::trace_sink_ptr().load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Get the trace context of the packet that is processed on the calling thread.
+ * @return nullptr if no packet is processed.
+ */
+inline trace_context* current_trace_context() {
+    return detail::current_trace_context();
+}
+
+/**
+ * @brief Make ctx the current trace context of the calling thread while this object lives.
+ */
+class trace_scope {
+public:
+    explicit trace_scope(trace_context& ctx)
+        :prev_(detail::current_trace_context()) {
+        detail::current_trace_context() = ctx ? &ctx : nullptr;
+    }
+    ~trace_scope() {
+        detail::current_trace_context() = prev_;
+    }
+    trace_scope(trace_scope const&) = delete;
+    trace_scope& operator=(trace_scope const&) = delete;
+private:
+    trace_context* prev_;
+};
+
+// Stamp the current trace context of the calling thread if exists.
+#define MQTT_TRACE_STAMP(stage)                                         \
+    do {                                                                \
+        if (auto mqtt_trace_ctx = MQTT_NS::current_trace_context()) {   \
+            mqtt_trace_ctx->stamp(MQTT_NS::trace_stage::stage);         \
+        }                                                               \
+    } while (false)
+
+#else  // defined(MQTT_USE_TRACE)
+
+#define MQTT_TRACE_STAMP(stage) do {} while (false)
+
+#endif // defined(MQTT_USE_TRACE)
+
+} // namespace MQTT_NS
+
+#endif // MQTT_TRACE_HPP
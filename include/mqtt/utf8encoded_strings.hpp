@@ -7,9 +7,22 @@
 #if !defined(MQTT_UTF8ENCODED_STRINGS_HPP)
 #define MQTT_UTF8ENCODED_STRINGS_HPP
 
+#include <cstddef>
+
 #include <mqtt/namespace.hpp>
 #include <mqtt/string_view.hpp>
 
+#if defined(MQTT_USE_STR_CHECK) && !defined(MQTT_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MQTT_UTF8_SSE2
+#include <emmintrin.h>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MQTT_UTF8_AVX2
+#include <immintrin.h>
+#endif // (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#endif // defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#endif // defined(MQTT_USE_STR_CHECK) && !defined(MQTT_NO_SIMD)
+
 namespace MQTT_NS {
 
 namespace utf8string {
@@ -43,98 +56,115 @@ is_valid_length(string_view str) {
     return str.size() <= 0xffff;
 }
 
+namespace detail {
+
+/**
+ * @brief Validate the character at it.
+ *        This code is based on https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
+ * @param it     the first byte of the character. It must not be end.
+ * @param end    the end of the string
+ * @param result it is set to well_formed_with_non_charactor if the character is
+ *               a control character or a non-character.
+ * @return the length of the character. 0 if it is ill formed.
+ */
+template <typename Iterator>
+constexpr std::size_t
+validate_character(Iterator it, Iterator end, validation& result) {
+    if (static_cast<unsigned char>(*(it + 0)) < 0b1000'0000) {
+        // 0xxxxxxxxx
+        if (static_cast<unsigned char>(*(it + 0)) == 0x00) {
+            return 0;
+        }
+        if ((static_cast<unsigned char>(*(it + 0)) >= 0x01 &&
+             static_cast<unsigned char>(*(it + 0)) <= 0x1f) ||
+            static_cast<unsigned char>(*(it + 0)) == 0x7f) {
+            result = validation::well_formed_with_non_charactor;
+        }
+        return 1;
+    }
+    if ((static_cast<unsigned char>(*(it + 0)) & 0b1110'0000) == 0b1100'0000) {
+        // 110XXXXx 10xxxxxx
+        if (it + 1 >= end) {
+            return 0;
+        }
+        if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 0)) & 0b1111'1110) == 0b1100'0000) { // overlong
+            return 0;
+        }
+        if (static_cast<unsigned char>(*(it + 0)) == 0b1100'0010 &&
+            static_cast<unsigned char>(*(it + 1)) >= 0b1000'0000 &&
+            static_cast<unsigned char>(*(it + 1)) <= 0b1001'1111) {
+            result = validation::well_formed_with_non_charactor;
+        }
+        return 2;
+    }
+    if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'0000) == 0b1110'0000) {
+        // 1110XXXX 10Xxxxxx 10xxxxxx
+        if (it + 2 >= end) {
+            return 0;
+        }
+        if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 0)) == 0b1110'0000 &&
+             (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1000'0000) || // overlong?
+            (static_cast<unsigned char>(*(it + 0)) == 0b1110'1101 &&
+             (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1010'0000)) { // surrogate?
+            return 0;
+        }
+        if (static_cast<unsigned char>(*(it + 0)) == 0b1110'1111 &&
+            static_cast<unsigned char>(*(it + 1)) == 0b1011'1111 &&
+            (static_cast<unsigned char>(*(it + 2)) & 0b1111'1110) == 0b1011'1110) {
+            // U+FFFE or U+FFFF?
+            result = validation::well_formed_with_non_charactor;
+        }
+        return 3;
+    }
+    if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'1000) == 0b1111'0000) {
+        // 11110XXX 10XXxxxx 10xxxxxx 10xxxxxx
+        if (it + 3 >= end) {
+            return 0;
+        }
+        if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 3)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 0)) == 0b1111'0000 &&
+             (static_cast<unsigned char>(*(it + 1)) & 0b1111'0000) == 0b1000'0000) ||    // overlong?
+            (static_cast<unsigned char>(*(it + 0)) == 0b1111'0100 &&
+             static_cast<unsigned char>(*(it + 1)) > 0b1000'1111) ||
+            static_cast<unsigned char>(*(it + 0)) > 0b1111'0100) { // > U+10FFFF?
+            return 0;
+        }
+        if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'1111) == 0b1000'1111 &&
+            static_cast<unsigned char>(*(it + 2)) == 0b1011'1111 &&
+            (static_cast<unsigned char>(*(it + 3)) & 0b1111'1110) == 0b1011'1110) {
+            // U+nFFFE or U+nFFFF?
+            result = validation::well_formed_with_non_charactor;
+        }
+        return 4;
+    }
+    return 0;
+}
+
+} // namespace detail
+
+/**
+ * @brief Validate the contents one character at a time.
+ *        validate_contents() returns the same result. This version is kept as the reference
+ *        and for constant expressions.
+ * @param str string to validate
+ * @return validation result
+ */
 constexpr validation
-validate_contents(string_view str) {
-    // This code is based on https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
+validate_contents_scalar(string_view str) {
     auto result = validation::well_formed;
 #if defined(MQTT_USE_STR_CHECK)
     auto it = str.begin();
     auto end = str.end();
 
     while (it != end) {
-        if (static_cast<unsigned char>(*(it + 0)) < 0b1000'0000) {
-            // 0xxxxxxxxx
-            if (static_cast<unsigned char>(*(it + 0)) == 0x00) {
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 0)) >= 0x01 &&
-                 static_cast<unsigned char>(*(it + 0)) <= 0x1f) ||
-                static_cast<unsigned char>(*(it + 0)) == 0x7f) {
-                result = validation::well_formed_with_non_charactor;
-            }
-            ++it;
-        }
-        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1110'0000) == 0b1100'0000) {
-            // 110XXXXx 10xxxxxx
-            if (it + 1 >= end) {
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 0)) & 0b1111'1110) == 0b1100'0000) { // overlong
-                result = validation::ill_formed;
-                break;
-            }
-            if (static_cast<unsigned char>(*(it + 0)) == 0b1100'0010 &&
-                static_cast<unsigned char>(*(it + 1)) >= 0b1000'0000 &&
-                static_cast<unsigned char>(*(it + 1)) <= 0b1001'1111) {
-                result = validation::well_formed_with_non_charactor;
-            }
-            it += 2;
-        }
-        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'0000) == 0b1110'0000) {
-            // 1110XXXX 10Xxxxxx 10xxxxxx
-            if (it + 2 >= end) {
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 0)) == 0b1110'0000 &&
-                 (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1000'0000) || // overlong?
-                (static_cast<unsigned char>(*(it + 0)) == 0b1110'1101 &&
-                 (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1010'0000)) { // surrogate?
-                result = validation::ill_formed;
-                break;
-            }
-            if (static_cast<unsigned char>(*(it + 0)) == 0b1110'1111 &&
-                static_cast<unsigned char>(*(it + 1)) == 0b1011'1111 &&
-                (static_cast<unsigned char>(*(it + 2)) & 0b1111'1110) == 0b1011'1110) {
-                // U+FFFE or U+FFFF?
-                result = validation::well_formed_with_non_charactor;
-            }
-            it += 3;
-        }
-        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'1000) == 0b1111'0000) {
-            // 11110XXX 10XXxxxx 10xxxxxx 10xxxxxx
-            if (it + 3 >= end) {
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 3)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 0)) == 0b1111'0000 &&
-                 (static_cast<unsigned char>(*(it + 1)) & 0b1111'0000) == 0b1000'0000) ||    // overlong?
-                (static_cast<unsigned char>(*(it + 0)) == 0b1111'0100 &&
-                 static_cast<unsigned char>(*(it + 1)) > 0b1000'1111) ||
-                static_cast<unsigned char>(*(it + 0)) > 0b1111'0100) { // > U+10FFFF?
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'1111) == 0b1000'1111 &&
-                static_cast<unsigned char>(*(it + 2)) == 0b1011'1111 &&
-                (static_cast<unsigned char>(*(it + 3)) & 0b1111'1110) == 0b1011'1110) {
-                // U+nFFFE or U+nFFFF?
-                result = validation::well_formed_with_non_charactor;
-            }
-            it += 4;
-        }
-        else {
-            result = validation::ill_formed;
-            break;
-        }
+        auto len = detail::validate_character(it, end, result);
+        if (len == 0) return validation::ill_formed;
+        it += static_cast<std::ptrdiff_t>(len);
     }
 #else // MQTT_USE_STR_CHECK
     static_cast<void>(str);
@@ -142,6 +172,134 @@ validate_contents(string_view str) {
     return result;
 }
 
+namespace detail {
+
+// Printable ASCII (0x20-0x7e) is well formed and is not a non-character.
+constexpr bool is_printable_ascii(unsigned char c) {
+    return c >= 0x20 && c <= 0x7e;
+}
+
+// The following functions return the number of leading printable ASCII bytes.
+
+inline std::size_t printable_ascii_run_scalar(char const* b, std::size_t size) {
+    std::size_t i = 0;
+    while (i != size && is_printable_ascii(static_cast<unsigned char>(b[i]))) ++i;
+    return i;
+}
+
+#if defined(MQTT_UTF8_SSE2)
+
+// mask must not be 0.
+inline unsigned count_trailing_zeros(unsigned mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#else  // defined(__GNUC__) || defined(__clang__)
+    unsigned n = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        ++n;
+    }
+    return n;
+#endif // defined(__GNUC__) || defined(__clang__)
+}
+
+inline unsigned count_trailing_ones(unsigned mask) {
+    return count_trailing_zeros(~mask);
+}
+
+inline std::size_t printable_ascii_run_sse2(char const* b, std::size_t size) {
+    // Bytes >= 0x80 are negative as signed char, so two signed comparisons cover the range.
+    auto const lower = _mm_set1_epi8(0x1f);
+    auto const upper = _mm_set1_epi8(0x7f);
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i));
+        auto ok = _mm_and_si128(_mm_cmpgt_epi8(v, lower), _mm_cmplt_epi8(v, upper));
+        auto mask = static_cast<unsigned>(_mm_movemask_epi8(ok));
+        if (mask != 0xffff) return i + count_trailing_ones(mask);
+    }
+    return i + printable_ascii_run_scalar(b + i, size - i);
+}
+
+#endif // defined(MQTT_UTF8_SSE2)
+
+#if defined(MQTT_UTF8_AVX2)
+
+__attribute__((target("avx2")))
+inline std::size_t printable_ascii_run_avx2(char const* b, std::size_t size) {
+    auto const lower = _mm256_set1_epi8(0x1f);
+    auto const upper = _mm256_set1_epi8(0x7f);
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + i));
+        auto ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lower), _mm256_cmpgt_epi8(upper, v));
+        auto mask = static_cast<unsigned>(_mm256_movemask_epi8(ok));
+        if (mask != 0xffffffff) return i + count_trailing_ones(mask);
+    }
+    return i + printable_ascii_run_sse2(b + i, size - i);
+}
+
+#endif // defined(MQTT_UTF8_AVX2)
+
+using printable_ascii_run_t = std::size_t (*)(char const*, std::size_t);
+
+inline printable_ascii_run_t select_printable_ascii_run() {
+#if defined(MQTT_UTF8_AVX2)
+    if (__builtin_cpu_supports("avx2")) return &printable_ascii_run_avx2;
+#endif // defined(MQTT_UTF8_AVX2)
+#if defined(MQTT_UTF8_SSE2)
+    return &printable_ascii_run_sse2;
+#else  // defined(MQTT_UTF8_SSE2)
+    return &printable_ascii_run_scalar;
+#endif // defined(MQTT_UTF8_SSE2)
+}
+
+/**
+ * @brief Validate the contents using run to skip printable ASCII.
+ *        When run stops, the characters are validated one at a time up to the next printable
+ *        ASCII, so a non-ASCII text costs one run per stretch rather than per character.
+ *        A printable ASCII byte is never a part of a multi-byte character, so the stretch ends
+ *        at a character boundary of a well formed string.
+ */
+inline validation
+validate_contents_with(string_view str, printable_ascii_run_t run) {
+    auto result = validation::well_formed;
+    auto it = str.data();
+    auto end = it + str.size();
+    while (true) {
+        it += run(it, static_cast<std::size_t>(end - it));
+        if (it == end) break;
+        do {
+            auto len = validate_character(it, end, result);
+            if (len == 0) return validation::ill_formed;
+            it += len;
+        } while (it != end && !is_printable_ascii(static_cast<unsigned char>(*it)));
+    }
+    return result;
+}
+
+} // namespace detail
+
+/**
+ * @brief Validate the contents.
+ *        Printable ASCII is skipped by SSE2 or AVX2 that is selected at runtime, if available.
+ *        Define MQTT_NO_SIMD to use the scalar validation only.
+ *        It is not constexpr because of the runtime selection. Use validate_contents_scalar()
+ *        in constant expressions.
+ * @param str string to validate
+ * @return validation result
+ */
+inline validation
+validate_contents(string_view str) {
+#if defined(MQTT_USE_STR_CHECK)
+    static auto const run = detail::select_printable_ascii_run();
+    return detail::validate_contents_with(str, run);
+#else  // defined(MQTT_USE_STR_CHECK)
+    static_cast<void>(str);
+    return validation::well_formed;
+#endif // defined(MQTT_USE_STR_CHECK)
+}
+
 } // namespace utf8string
 
 } // namespace MQTT_NS
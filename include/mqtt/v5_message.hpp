@@ -33,6 +33,7 @@
 #include <mqtt/property.hpp>
 #include <mqtt/property_variant.hpp>
 #include <mqtt/property_parse.hpp>
+#include <mqtt/encoded_properties.hpp>
 #include <mqtt/reason_code.hpp>
 #include <mqtt/packet_id_type.hpp>
 #include <mqtt/move.hpp>
@@ -626,6 +627,45 @@ public:
         }
     }
 
+    /**
+     * @brief Create publish message that shares serialized properties with other messages.
+     * @param packet_id packet identifier
+     * @param topic_name topic name
+     * @param payloads payloads
+     * @param pubopts publish options
+     * @param shared_props properties that are serialized once and shared. They are placed first.
+     *                     The message refers to them, so they are not copied per message.
+     * @param props properties for this message only. They are placed after shared_props.
+     */
+    template <
+        typename ConstBufferSequence,
+        typename std::enable_if<
+            as::is_const_buffer_sequence<ConstBufferSequence>::value,
+            std::nullptr_t
+        >::type = nullptr
+    >
+    basic_publish_message(
+        typename packet_id_type<PacketIdBytes>::type packet_id,
+        as::const_buffer topic_name,
+        ConstBufferSequence payloads,
+        publish_options pubopts,
+        encoded_properties const& shared_props,
+        properties props
+    )
+        : basic_publish_message(
+            packet_id,
+            topic_name,
+            force_move(payloads),
+            pubopts,
+            force_move(props)
+        )
+    {
+        if (shared_props.count() == 0) return;
+        shared_props_ = shared_props;
+        set_property_length(property_length_ + shared_props_.size());
+        num_of_const_buffer_sequence_ += 1; // shared properties
+    }
+
     basic_publish_message(buffer buf) {
         if (buf.empty())  throw remaining_length_error();
         fixed_header_ = static_cast<std::uint8_t>(buf.front());
@@ -725,6 +765,9 @@ public:
         }
 
         ret.emplace_back(as::buffer(property_length_buf_.data(), property_length_buf_.size()));
+        if (shared_props_.count() != 0) {
+            ret.emplace_back(as::buffer(shared_props_.bytes()));
+        }
         for (auto const& p : props_) {
             v5::add_const_buffer_sequence(ret, p);
         }
@@ -773,9 +816,10 @@ public:
         ret.append(packet_id_.data(), packet_id_.size());
 
         ret.append(property_length_buf_.data(), property_length_buf_.size());
+        ret.append(shared_props_.bytes().data(), shared_props_.bytes().size());
 
         auto it = ret.end();
-        ret.resize(ret.size() + property_length_);
+        ret.resize(ret.size() + property_length_ - shared_props_.size());
         auto end = ret.end();
         for (auto const& p : props_) {
             v5::fill(p, it, end);
@@ -881,12 +925,23 @@ public:
 
     /**
      * @brief Get properties
+     *        If the message is created with shared properties, they are not included.
+     *        See shared_props().
      * @return properties
      */
     properties const& props() const {
         return props_;
     }
 
+    /**
+     * @brief Get the properties that are shared with other messages
+     *        They are sent before props().
+     * @return shared properties. It is empty if the message doesn't share properties.
+     */
+    encoded_properties const& shared_props() const {
+        return shared_props_;
+    }
+
     /**
      * @brief Add property
      * @param p property to add
@@ -921,10 +976,12 @@ public:
         std::is_base_of<property::detail::n_bytes_property<4>, Property>::value
     >
     update_prop(Property update_prop) {
+        // The shared serialized bytes can't be updated
+        if (has_shared_prop<Property>()) release_shared_props();
         for (auto& p : props_) {
             MQTT_NS::visit(
                 make_lambda_visitor(
-                    [&update_prop](Property& t) { t = std::forward<Property>(update_prop); },
+                    [&](Property& t) { t = std::forward<Property>(update_prop); },
                     [](auto&) { }
                 ),
                 p
@@ -937,6 +994,7 @@ public:
      * @param id property::id to remove
      */
     void remove_prop(v5::property::id id) {
+        if (has_shared_prop(id)) release_shared_props();
         std::size_t removed_size = 0;
         auto it = props_.begin();
         auto end = props_.begin();
@@ -992,6 +1050,69 @@ public:
         }
     }
 
+private:
+    template <typename Property>
+    bool has_shared_prop() const {
+        bool found = false;
+        for (auto const& p : shared_props_.props()) {
+            MQTT_NS::visit(
+                make_lambda_visitor(
+                    [&](Property const&) { found = true; },
+                    [](auto const&) { }
+                ),
+                p
+            );
+        }
+        return found;
+    }
+
+    bool has_shared_prop(v5::property::id id) const {
+        auto const& shared = shared_props_.props();
+        return std::any_of(
+            shared.begin(),
+            shared.end(),
+            [id](property_variant const& pv) { return v5::id(pv) == id; }
+        );
+    }
+
+    /**
+     * @brief Stop using the shared serialized properties.
+     *        The shared properties are copied in front of props_ and serialized individually.
+     */
+    void release_shared_props() {
+        if (shared_props_.count() == 0) return;
+        num_of_const_buffer_sequence_ =
+            num_of_const_buffer_sequence_
+            - 1 // shared properties
+            + std::accumulate(
+                shared_props_.props().begin(),
+                shared_props_.props().end(),
+                std::size_t(0U),
+                [](std::size_t total, property_variant const& pv) {
+                    return total + v5::num_of_const_buffer_sequence(pv);
+                }
+            );
+        props_ = shared_props_.merge(force_move(props_));
+        shared_props_ = encoded_properties();
+    }
+
+    void set_property_length(std::size_t property_length) {
+        remaining_length_ -= property_length_buf_.size() + property_length_;
+        property_length_ = property_length;
+        property_length_buf_.clear();
+        auto pb = variable_bytes(property_length_);
+        for (auto e : pb) {
+            property_length_buf_.push_back(e);
+        }
+        remaining_length_ += property_length_buf_.size() + property_length_;
+
+        remaining_length_buf_.clear();
+        auto rb = remaining_bytes(remaining_length_);
+        for (auto e : rb) {
+            remaining_length_buf_.push_back(e);
+        }
+    }
+
 private:
     std::uint8_t fixed_header_;
     as::const_buffer topic_name_;
@@ -1000,6 +1121,8 @@ private:
     std::size_t property_length_;
     boost::container::static_vector<char, 4> property_length_buf_;
     properties props_;
+    // sent before props_
+    encoded_properties shared_props_;
     std::vector<as::const_buffer> payloads_;
     std::size_t remaining_length_;
     boost::container::static_vector<char, 4> remaining_length_buf_;
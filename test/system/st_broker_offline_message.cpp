@@ -787,4 +787,197 @@ BOOST_AUTO_TEST_CASE( offline_pubsub_v5_timeout ) {
     th.join();
 }
 
+namespace {
+
+void check_offline_pubsub_paced_v3_1_1(std::size_t batch_size) {
+
+    //
+    // c1 ---- broker ----- c2 (CleanSession: false)
+    //
+    // offline message batch size: batch_size (0 means unlimited)
+    //
+    // 1. c2 subscribe t1 QoS1
+    // 2. c2 disconnect
+    // 3. c1 publish t1 QoS1 5 times
+    // 4. c2 connect again
+    //   Receive all offline messages in order
+    //
+
+    clear_ordered();
+    boost::asio::io_context iocb;
+    MQTT_NS::broker::broker_t b(iocb);
+    b.set_offline_message_batch_size(batch_size);
+    MQTT_NS::optional<test_server_no_tls> s;
+    std::promise<void> p;
+    auto f = p.get_future();
+    std::thread th(
+        [&] {
+            s.emplace(iocb, b);
+            p.set_value();
+            iocb.run();
+        }
+    );
+    f.wait();
+    auto finish =
+        [&] {
+            as::post(
+                iocb,
+                [&] {
+                    s->close();
+                }
+            );
+        };
+
+    boost::asio::io_context ioc;
+
+    auto c1 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port);
+    c1->set_clean_session(true);
+    c1->set_client_id("cid1");
+
+    auto c2 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port);
+    c2->set_clean_session(false);
+    c2->set_client_id("cid2");
+
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+
+    std::size_t const num = 5;
+    std::size_t pubacks = 0;
+    std::size_t received = 0;
+
+    checker chk = {
+        cont("c1_h_connack"),
+        cont("c2_h_connack1"),
+        cont("c2_h_suback"),
+        cont("c2_h_close1"),
+        cont("c1_h_puback"),
+        cont("c2_h_connack2"),
+        cont("c2_h_publish"),
+        cont("c1_h_close"),
+        cont("c2_h_close2"),
+    };
+
+    c1->set_connack_handler(
+        [&chk, &c2]
+        (bool sp, MQTT_NS::connect_return_code connack_return_code) {
+            MQTT_CHK("c1_h_connack");
+            BOOST_TEST(sp == false);
+            BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+            c2->connect();
+            return true;
+        }
+    );
+    c2->set_connack_handler(
+        [&chk, &c2]
+        (bool sp, MQTT_NS::connect_return_code connack_return_code) {
+            auto ret = MQTT_ORDERED(
+                [&] {
+                    MQTT_CHK("c2_h_connack1");
+                    BOOST_TEST(sp == false);
+                    BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+                    c2->subscribe("topic1", MQTT_NS::qos::at_least_once);
+                },
+                [&] {
+                    MQTT_CHK("c2_h_connack2");
+                    BOOST_TEST(sp == true);
+                    BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+                }
+            );
+            BOOST_TEST(ret);
+            return true;
+        }
+    );
+    c2->set_suback_handler(
+        [&chk, &c2]
+        (packet_id_t, std::vector<MQTT_NS::suback_return_code> results) {
+            MQTT_CHK("c2_h_suback");
+            BOOST_TEST(results.size() == 1U);
+            BOOST_TEST(results[0] == MQTT_NS::suback_return_code::success_maximum_qos_1);
+            c2->disconnect();
+            return true;
+        }
+    );
+    c2->set_close_handler(
+        [&chk, &c1, &finish]
+        () {
+            auto ret = MQTT_ORDERED(
+                [&] {
+                    MQTT_CHK("c2_h_close1");
+                    for (std::size_t i = 0; i != num; ++i) {
+                        c1->publish("topic1", "topic1_contents" + std::to_string(i), MQTT_NS::qos::at_least_once);
+                    }
+                },
+                [&] {
+                    MQTT_CHK("c2_h_close2");
+                    finish();
+                }
+            );
+            BOOST_TEST(ret);
+        }
+    );
+    c1->set_puback_handler(
+        [&chk, &c2, &pubacks, num]
+        (std::uint16_t) {
+            if (++pubacks == num) {
+                MQTT_CHK("c1_h_puback");
+                c2->connect();
+            }
+            return true;
+        }
+    );
+    c2->set_publish_handler(
+        [&chk, &c1, &received, num]
+        (MQTT_NS::optional<packet_id_t> packet_id,
+         MQTT_NS::publish_options pubopts,
+         MQTT_NS::buffer topic,
+         MQTT_NS::buffer contents) {
+            BOOST_TEST(pubopts.get_qos() == MQTT_NS::qos::at_least_once);
+            BOOST_CHECK(packet_id);
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(contents == "topic1_contents" + std::to_string(received));
+            if (++received == num) {
+                MQTT_CHK("c2_h_publish");
+                c1->disconnect();
+            }
+            return true;
+        }
+    );
+    c1->set_close_handler(
+        [&chk, &c2]
+        () {
+            MQTT_CHK("c1_h_close");
+            c2->disconnect();
+        }
+    );
+
+    // error cases
+    c1->set_error_handler(
+        []
+        (MQTT_NS::error_code) {
+            BOOST_CHECK(false);
+        }
+    );
+    c2->set_error_handler(
+        []
+        (MQTT_NS::error_code) {
+            BOOST_CHECK(false);
+        }
+    );
+
+    c1->connect();
+
+    ioc.run();
+    BOOST_TEST(chk.all());
+    th.join();
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( offline_pubsub_paced_v3_1_1 ) {
+    check_offline_pubsub_paced_v3_1_1(2);
+}
+
+BOOST_AUTO_TEST_CASE( offline_pubsub_paced_unlimited_v3_1_1 ) {
+    check_offline_pubsub_paced_v3_1_1(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,280 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+#include "ordered_caller.hpp"
+#include "test_util.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <cstdio>
+
+#include <mqtt/broker/log_persistence.hpp>
+
+BOOST_AUTO_TEST_SUITE(st_broker_persistence)
+
+using namespace MQTT_NS::literals;
+
+BOOST_AUTO_TEST_CASE( restart_v3_1_1 ) {
+
+    //
+    // c1 ---- broker ----- c2 (CleanSession: false)
+    //
+    // 1. c2 subscribe t1 QoS1
+    // 2. c2 disconnect
+    // 3. c1 publish t1 QoS1
+    // 4. c1 publish t2 QoS0 retain
+    // 5. restart broker
+    // 6. c2 connect again
+    //   Receive the offline message
+    // 7. c2 subscribe t2
+    //   Receive the retained message
+    //
+
+    std::string path("st_broker_persistence_restart_v3_1_1.log");
+    std::remove(path.c_str());
+
+    // The periodic sync timer of the persistence is not used in this test.
+    boost::asio::io_context iocp;
+
+    auto run_broker =
+        [&](auto&& clients) {
+            boost::asio::io_context iocb;
+            MQTT_NS::broker::broker_t b(iocb);
+            b.set_persistence(std::make_shared<MQTT_NS::broker::log_persistence>(iocp, path));
+            MQTT_NS::optional<test_server_no_tls> s;
+            std::promise<void> p;
+            auto f = p.get_future();
+            std::thread th(
+                [&] {
+                    s.emplace(iocb, b);
+                    p.set_value();
+                    iocb.run();
+                }
+            );
+            f.wait();
+            auto finish =
+                [&] {
+                    as::post(
+                        iocb,
+                        [&] {
+                            s->close();
+                        }
+                    );
+                };
+            clients(finish);
+            th.join();
+        };
+
+    // before restart
+    run_broker(
+        [&](auto const& finish) {
+            boost::asio::io_context ioc;
+
+            auto c1 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port);
+            c1->set_clean_session(true);
+            c1->set_client_id("cid1");
+
+            auto c2 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port);
+            c2->set_clean_session(false);
+            c2->set_client_id("cid2");
+
+            using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+
+            checker chk = {
+                cont("c2_h_connack"),
+                cont("c2_h_suback"),
+                cont("c2_h_close"),
+                cont("c1_h_connack"),
+                cont("c1_h_puback"),
+                cont("c1_h_close"),
+            };
+
+            c2->set_connack_handler(
+                [&chk, &c2]
+                (bool sp, MQTT_NS::connect_return_code connack_return_code) {
+                    MQTT_CHK("c2_h_connack");
+                    BOOST_TEST(sp == false);
+                    BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+                    c2->subscribe("topic1", MQTT_NS::qos::at_least_once);
+                    return true;
+                }
+            );
+            c2->set_suback_handler(
+                [&chk, &c2]
+                (packet_id_t, std::vector<MQTT_NS::suback_return_code> results) {
+                    MQTT_CHK("c2_h_suback");
+                    BOOST_TEST(results.size() == 1U);
+                    BOOST_TEST(results[0] == MQTT_NS::suback_return_code::success_maximum_qos_1);
+                    c2->disconnect();
+                    return true;
+                }
+            );
+            c2->set_close_handler(
+                [&chk, &c1]
+                () {
+                    MQTT_CHK("c2_h_close");
+                    c1->connect();
+                }
+            );
+            c1->set_connack_handler(
+                [&chk, &c1]
+                (bool sp, MQTT_NS::connect_return_code connack_return_code) {
+                    MQTT_CHK("c1_h_connack");
+                    BOOST_TEST(sp == false);
+                    BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+                    c1->publish("topic1", "topic1_contents", MQTT_NS::qos::at_least_once);
+                    return true;
+                }
+            );
+            c1->set_puback_handler(
+                [&chk, &c1]
+                (packet_id_t) {
+                    MQTT_CHK("c1_h_puback");
+                    c1->publish("topic2", "topic2_contents", MQTT_NS::qos::at_most_once | MQTT_NS::retain::yes);
+                    c1->disconnect();
+                    return true;
+                }
+            );
+            c1->set_close_handler(
+                [&chk, &finish]
+                () {
+                    MQTT_CHK("c1_h_close");
+                    finish();
+                }
+            );
+
+            c2->connect();
+
+            ioc.run();
+            BOOST_TEST(chk.all());
+        }
+    );
+
+    // after restart
+    run_broker(
+        [&](auto const& finish) {
+            boost::asio::io_context ioc;
+
+            auto c2 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port);
+            c2->set_clean_session(false);
+            c2->set_client_id("cid2");
+
+            using packet_id_t = typename std::remove_reference_t<decltype(*c2)>::packet_id_t;
+
+            checker chk = {
+                cont("c2_h_connack"),
+                cont("c2_h_publish1"),
+                cont("c2_h_suback"),
+                cont("c2_h_publish2"),
+                cont("c2_h_close"),
+            };
+
+            c2->set_connack_handler(
+                [&chk]
+                (bool sp, MQTT_NS::connect_return_code connack_return_code) {
+                    MQTT_CHK("c2_h_connack");
+                    BOOST_TEST(sp == true);
+                    BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+                    return true;
+                }
+            );
+            c2->set_publish_handler(
+                [&chk, &c2]
+                (MQTT_NS::optional<packet_id_t> packet_id,
+                 MQTT_NS::publish_options pubopts,
+                 MQTT_NS::buffer topic,
+                 MQTT_NS::buffer contents) {
+                    auto ret = MQTT_ORDERED(
+                        [&] {
+                            MQTT_CHK("c2_h_publish1");
+                            BOOST_TEST(pubopts.get_qos() == MQTT_NS::qos::at_least_once);
+                            BOOST_TEST(pubopts.get_retain() == MQTT_NS::retain::no);
+                            BOOST_CHECK(packet_id);
+                            BOOST_TEST(topic == "topic1");
+                            BOOST_TEST(contents == "topic1_contents");
+                            c2->subscribe("topic2", MQTT_NS::qos::at_most_once);
+                        },
+                        [&] {
+                            MQTT_CHK("c2_h_publish2");
+                            BOOST_TEST(pubopts.get_qos() == MQTT_NS::qos::at_most_once);
+                            BOOST_TEST(pubopts.get_retain() == MQTT_NS::retain::yes);
+                            BOOST_CHECK(!packet_id);
+                            BOOST_TEST(topic == "topic2");
+                            BOOST_TEST(contents == "topic2_contents");
+                            c2->disconnect();
+                        }
+                    );
+                    BOOST_TEST(ret);
+                    return true;
+                }
+            );
+            c2->set_suback_handler(
+                [&chk]
+                (packet_id_t, std::vector<MQTT_NS::suback_return_code> results) {
+                    MQTT_CHK("c2_h_suback");
+                    BOOST_TEST(results.size() == 1U);
+                    BOOST_TEST(results[0] == MQTT_NS::suback_return_code::success_maximum_qos_0);
+                    return true;
+                }
+            );
+            c2->set_close_handler(
+                [&chk, &finish]
+                () {
+                    MQTT_CHK("c2_h_close");
+                    finish();
+                }
+            );
+
+            c2->connect();
+
+            ioc.run();
+            BOOST_TEST(chk.all());
+        }
+    );
+
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE( retained_expiry_erases_persistence ) {
+    std::string path("st_broker_persistence_retained_expiry.log");
+    std::remove(path.c_str());
+
+    struct recording_persistence : MQTT_NS::broker::log_persistence {
+        using log_persistence::log_persistence;
+        void erase_retained(MQTT_NS::buffer const& topic) override {
+            erased.emplace_back(topic);
+            log_persistence::erase_retained(topic);
+        }
+        std::vector<std::string> erased;
+    };
+
+    boost::asio::io_context iocp;
+    auto ps = std::make_shared<recording_persistence>(iocp, path);
+    ps->put_retained(
+        "t1"_mb,
+        "contents"_mb,
+        MQTT_NS::v5::properties { MQTT_NS::v5::property::message_expiry_interval(1) },
+        MQTT_NS::qos::at_most_once
+    );
+
+    boost::asio::io_context iocb;
+    MQTT_NS::broker::broker_t b(iocb);
+    b.set_persistence(ps);
+    iocb.run_for(std::chrono::seconds(3));
+
+    BOOST_TEST(ps->erased.size() == 1);
+    BOOST_TEST(ps->erased.front() == "t1");
+
+    std::size_t retains = 0;
+    ps->for_each_retained([&](MQTT_NS::broker::stored_message const&) { ++retains; });
+    BOOST_TEST(retains == 0);
+
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
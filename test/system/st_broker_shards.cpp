@@ -0,0 +1,179 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+#include "ordered_caller.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <mqtt/broker/broker_shards.hpp>
+
+BOOST_AUTO_TEST_SUITE(st_broker_shards)
+
+using namespace MQTT_NS::literals;
+
+BOOST_AUTO_TEST_CASE( cross_shard ) {
+
+    //
+    // shard0: c1, c3
+    // shard1: c2
+    //
+    // 1. c1 subscribe topic1
+    // 2. c2 publish topic1 retain
+    //   c1 receives it through the queue from shard1 to shard0
+    // 3. c3 subscribe topic1
+    //   c3 receives the retained message that is replicated to shard0
+    //
+
+    std::vector<as::io_context> iocs(2);
+    std::vector<as::executor_work_guard<as::io_context::executor_type>> guards;
+    for (auto& ioc : iocs) guards.emplace_back(ioc.get_executor());
+    MQTT_NS::broker::broker_shards bs(iocs);
+    BOOST_TEST(bs.size() == 2);
+
+    boost::asio::io_context ioc;
+
+    // connections are assigned to the shards in round robin
+    std::size_t next = 0;
+    MQTT_NS::server<> server(
+        as::ip::tcp::endpoint(as::ip::tcp::v4(), broker_notls_port),
+        ioc,
+        [&]() -> as::io_context& {
+            return iocs[next++ % iocs.size()];
+        },
+        [](auto& acceptor) {
+            acceptor.set_option(as::ip::tcp::acceptor::reuse_address(true));
+        }
+    );
+    server.set_error_handler([](MQTT_NS::error_code) {});
+    server.set_accept_handler(
+        [&](con_sp_t spep) {
+            bs.handle_accept(MQTT_NS::force_move(spep));
+        }
+    );
+    server.listen();
+
+    std::vector<std::thread> ths;
+    for (auto& shard_ioc : iocs) {
+        ths.emplace_back([&shard_ioc] { shard_ioc.run(); });
+    }
+
+    auto c1 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port);
+    c1->set_clean_session(true);
+    c1->set_client_id("cid1");
+    auto c2 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port);
+    c2->set_clean_session(true);
+    c2->set_client_id("cid2");
+    auto c3 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port);
+    c3->set_clean_session(true);
+    c3->set_client_id("cid3");
+
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+
+    checker chk = {
+        cont("c1_h_connack"),
+        cont("c1_h_suback"),
+        cont("c2_h_connack"),
+        cont("c1_h_publish"),
+        cont("c3_h_connack"),
+        cont("c3_h_suback"),
+        cont("c3_h_publish"),
+    };
+
+    std::size_t closed = 0;
+    auto finish =
+        [&] {
+            if (++closed != 3) return;
+            server.close();
+        };
+
+    c1->set_connack_handler(
+        [&]
+        (bool, MQTT_NS::connect_return_code connack_return_code) {
+            MQTT_CHK("c1_h_connack");
+            BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+            c1->subscribe("topic1", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    c1->set_suback_handler(
+        [&]
+        (packet_id_t, std::vector<MQTT_NS::suback_return_code>) {
+            MQTT_CHK("c1_h_suback");
+            c2->connect();
+            return true;
+        }
+    );
+    c1->set_publish_handler(
+        [&]
+        (MQTT_NS::optional<packet_id_t>,
+         MQTT_NS::publish_options pubopts,
+         MQTT_NS::buffer topic,
+         MQTT_NS::buffer contents) {
+            MQTT_CHK("c1_h_publish");
+            BOOST_TEST(pubopts.get_retain() == MQTT_NS::retain::no);
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(contents == "topic1_contents");
+            c3->connect();
+            return true;
+        }
+    );
+    c2->set_connack_handler(
+        [&]
+        (bool, MQTT_NS::connect_return_code connack_return_code) {
+            MQTT_CHK("c2_h_connack");
+            BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+            c2->publish("topic1", "topic1_contents", MQTT_NS::qos::at_most_once | MQTT_NS::retain::yes);
+            return true;
+        }
+    );
+    c3->set_connack_handler(
+        [&]
+        (bool, MQTT_NS::connect_return_code connack_return_code) {
+            MQTT_CHK("c3_h_connack");
+            BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+            c3->subscribe("topic1", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    c3->set_suback_handler(
+        [&]
+        (packet_id_t, std::vector<MQTT_NS::suback_return_code>) {
+            MQTT_CHK("c3_h_suback");
+            return true;
+        }
+    );
+    c3->set_publish_handler(
+        [&]
+        (MQTT_NS::optional<packet_id_t>,
+         MQTT_NS::publish_options pubopts,
+         MQTT_NS::buffer topic,
+         MQTT_NS::buffer contents) {
+            MQTT_CHK("c3_h_publish");
+            BOOST_TEST(pubopts.get_retain() == MQTT_NS::retain::yes);
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(contents == "topic1_contents");
+            c1->disconnect();
+            c2->disconnect();
+            c3->disconnect();
+            return true;
+        }
+    );
+    for (auto c : { c1, c2, c3 }) {
+        c->set_close_handler(finish);
+        c->set_error_handler([](MQTT_NS::error_code) { BOOST_CHECK(false); });
+    }
+
+    c1->connect();
+    ioc.run();
+    BOOST_TEST(chk.all());
+
+    for (auto& g : guards) g.reset();
+    for (auto& th : ths) th.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -314,6 +314,73 @@ BOOST_AUTO_TEST_CASE( keep_alive_and_send_control_packet ) {
     do_combi_test_sync(test);
 }
 
+BOOST_AUTO_TEST_CASE( keep_alive_timeout ) {
+    auto test = [](boost::asio::io_context& ioc, auto& cs, auto finish, auto& /*b*/) {
+        auto& c = cs[0];
+        clear_ordered();
+        c->set_client_id("cid1");
+        c->set_clean_session(true);
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // broker disconnects after 1.5 * keep alive
+            cont("h_closed"),
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        switch (c->get_protocol_version()) {
+        case MQTT_NS::protocol_version::v3_1_1:
+            c->set_connack_handler(
+                [&chk]
+                (bool sp, MQTT_NS::connect_return_code connack_return_code) {
+                    MQTT_CHK("h_connack");
+                    BOOST_TEST(sp == false);
+                    BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+                    return true;
+                });
+            break;
+        case MQTT_NS::protocol_version::v5:
+            c->set_v5_connack_handler(
+                [&chk]
+                (bool sp, MQTT_NS::v5::connect_reason_code connect_reason_code, MQTT_NS::v5::properties /*props*/) {
+                    MQTT_CHK("h_connack");
+                    BOOST_TEST(sp == false);
+                    BOOST_TEST(connect_reason_code == MQTT_NS::v5::connect_reason_code::success);
+                    return true;
+                });
+            c->set_v5_disconnect_handler(
+                []
+                (MQTT_NS::v5::disconnect_reason_code disconnect_reason_code, MQTT_NS::v5::properties /*props*/) {
+                    BOOST_TEST(disconnect_reason_code == MQTT_NS::v5::disconnect_reason_code::keep_alive_timeout);
+                });
+            break;
+        default:
+            BOOST_CHECK(false);
+            break;
+        }
+
+        auto closed =
+            [&] {
+                MQTT_CHK("h_closed");
+                BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(1500));
+                finish();
+            };
+        c->set_close_handler(closed);
+        c->set_error_handler(
+            [&]
+            (MQTT_NS::error_code) {
+                closed();
+            });
+        // doesn't send PINGREQ
+        c->set_keep_alive_sec(1, std::chrono::seconds(0));
+        c->connect();
+        ioc.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
 
 BOOST_AUTO_TEST_CASE( pingresp_timeout ) {
     auto test = [](boost::asio::io_context& ioc, auto& cs, auto finish, auto& b) {
@@ -2049,4 +2116,100 @@ BOOST_AUTO_TEST_CASE( session_taken_over ) {
     do_combi_test_sync(test, 3);
 }
 
+BOOST_AUTO_TEST_CASE( session_expired ) {
+    auto test = [](boost::asio::io_context& ioc, auto& cs, auto finish, auto& /*b*/) {
+        auto& c = cs[0];
+        clear_ordered();
+        if (c->get_protocol_version() != MQTT_NS::protocol_version::v5) {
+            finish();
+            return;
+        }
+        c->set_client_id("cid1");
+        c->set_clean_start(false);
+
+        checker chk = {
+            // connect
+            cont("h_connack1"),
+            // disconnect
+            cont("h_close1"),
+            // connect before the session expires
+            cont("h_connack2"),
+            // disconnect
+            cont("h_close2"),
+            // connect after the session expired
+            cont("h_connack3"),
+            // disconnect
+            cont("h_close3"),
+        };
+
+        auto connect =
+            [&] {
+                c->connect(
+                    MQTT_NS::v5::properties{
+                        MQTT_NS::v5::property::session_expiry_interval(1)
+                    }
+                );
+            };
+
+        boost::asio::steady_timer tim(ioc);
+        int count = 0;
+        c->set_v5_connack_handler(
+            [&]
+            (bool sp, MQTT_NS::v5::connect_reason_code connect_reason_code, MQTT_NS::v5::properties /*props*/) {
+                switch (count) {
+                case 0:
+                    MQTT_CHK("h_connack1");
+                    BOOST_TEST(sp == false);
+                    break;
+                case 1:
+                    MQTT_CHK("h_connack2");
+                    BOOST_TEST(sp == true);
+                    break;
+                case 2:
+                    MQTT_CHK("h_connack3");
+                    BOOST_TEST(sp == false);
+                    break;
+                }
+                BOOST_TEST(connect_reason_code == MQTT_NS::v5::connect_reason_code::success);
+                c->disconnect();
+                return true;
+            }
+        );
+        c->set_close_handler(
+            [&] {
+                switch (count++) {
+                case 0:
+                    MQTT_CHK("h_close1");
+                    connect();
+                    break;
+                case 1:
+                    MQTT_CHK("h_close2");
+                    tim.expires_after(std::chrono::seconds(2));
+                    tim.async_wait(
+                        [&](MQTT_NS::error_code ec) {
+                            BOOST_TEST(!ec);
+                            connect();
+                        }
+                    );
+                    break;
+                case 2:
+                    MQTT_CHK("h_close3");
+                    finish();
+                    break;
+                }
+            }
+        );
+        c->set_error_handler(
+            []
+            (MQTT_NS::error_code) {
+                BOOST_CHECK(false);
+            }
+        );
+        connect();
+        ioc.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
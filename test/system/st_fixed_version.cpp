@@ -0,0 +1,247 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// The broker in this test accepts only MQTT v5.
+#define MQTT_BROKER_PROTOCOL_VERSION v5
+
+#include "../common/test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+#include "ordered_caller.hpp"
+#include "test_server_no_tls.hpp"
+#include "../common/global_fixture.hpp"
+
+BOOST_AUTO_TEST_SUITE(st_fixed_version)
+
+using namespace MQTT_NS::literals;
+
+BOOST_AUTO_TEST_CASE( v5_only_server ) {
+
+    //
+    // The server endpoint is specialized for v5.
+    //
+    // 1. c5 (v5) connects and is accepted
+    // 2. c3 (v3.1.1) connects and is rejected
+    //
+
+    boost::asio::io_context ioc;
+
+    using server_t = MQTT_NS::server<
+        MQTT_NS::strand,
+        std::mutex,
+        std::lock_guard,
+        2,
+        MQTT_NS::packet_id_manager,
+        MQTT_NS::protocol_version::v5
+    >;
+    using con_t = server_t::endpoint_t;
+    using con_sp_t = std::shared_ptr<con_t>;
+
+    server_t server(
+        as::ip::tcp::endpoint(as::ip::tcp::v4(), broker_notls_port),
+        ioc,
+        [](auto& acceptor) {
+            acceptor.set_option(as::ip::tcp::acceptor::reuse_address(true));
+        }
+    );
+    server.set_error_handler([](MQTT_NS::error_code) {});
+
+    auto c5 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port, MQTT_NS::protocol_version::v5);
+    c5->set_clean_start(true);
+    c5->set_client_id("cid5");
+    auto c3 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port, MQTT_NS::protocol_version::v3_1_1);
+    c3->set_clean_session(true);
+    c3->set_client_id("cid3");
+
+    checker chk = {
+        cont("s_h_connect"),
+        cont("c5_h_connack"),
+        cont("c5_h_close"),
+        cont("c3_h_error"),
+    };
+
+    server.set_accept_handler(
+        [&](con_sp_t spep) {
+            // the version is a compile time constant, so it is determined before CONNECT
+            BOOST_TEST(spep->get_protocol_version() == MQTT_NS::protocol_version::v5);
+            std::weak_ptr<con_t> wp(spep);
+            spep->set_v5_connect_handler(
+                [&, wp]
+                (MQTT_NS::buffer client_id,
+                 MQTT_NS::optional<MQTT_NS::buffer>,
+                 MQTT_NS::optional<MQTT_NS::buffer>,
+                 MQTT_NS::optional<MQTT_NS::will>,
+                 bool,
+                 std::uint16_t,
+                 MQTT_NS::v5::properties) {
+                    MQTT_CHK("s_h_connect");
+                    BOOST_TEST(client_id == "cid5");
+                    auto sp = wp.lock();
+                    BOOST_ASSERT(sp);
+                    sp->connack(false, MQTT_NS::v5::connect_reason_code::success);
+                    return true;
+                }
+            );
+            spep->set_v5_disconnect_handler(
+                [wp]
+                (MQTT_NS::v5::disconnect_reason_code, MQTT_NS::v5::properties) {
+                    auto sp = wp.lock();
+                    BOOST_ASSERT(sp);
+                    sp->force_disconnect();
+                }
+            );
+            spep->set_error_handler([](MQTT_NS::error_code) {});
+            auto& ep = *spep;
+            ep.start_session(MQTT_NS::force_move(spep));
+        }
+    );
+    server.listen();
+
+    c5->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code reason_code, MQTT_NS::v5::properties) {
+            MQTT_CHK("c5_h_connack");
+            BOOST_TEST(reason_code == MQTT_NS::v5::connect_reason_code::success);
+            c5->disconnect();
+            return true;
+        }
+    );
+    c5->set_close_handler(
+        [&] {
+            MQTT_CHK("c5_h_close");
+            c3->connect();
+        }
+    );
+    c5->set_error_handler([](MQTT_NS::error_code) { BOOST_CHECK(false); });
+
+    c3->set_connack_handler(
+        [&]
+        (bool, MQTT_NS::connect_return_code) {
+            BOOST_CHECK(false);
+            return true;
+        }
+    );
+    c3->set_close_handler(
+        [&] {
+            BOOST_CHECK(false);
+            server.close();
+        }
+    );
+    c3->set_error_handler(
+        [&](MQTT_NS::error_code) {
+            MQTT_CHK("c3_h_error");
+            server.close();
+        }
+    );
+
+    c5->connect();
+    ioc.run();
+    BOOST_TEST(chk.all());
+}
+
+BOOST_AUTO_TEST_CASE( v5_only_broker ) {
+
+    //
+    // The broker is built with MQTT_BROKER_PROTOCOL_VERSION v5.
+    //
+    // 1. c5 (v5) connects, subscribes topic1 and publishes to it
+    // 2. c5 receives the message
+    // 3. c3 (v3.1.1) connects and is rejected
+    //
+
+    boost::asio::io_context ioc;
+    MQTT_NS::broker::broker_t b(ioc);
+    test_server_no_tls s(ioc, b);
+
+    static_assert(
+        MQTT_NS::broker::broker_protocol_version == MQTT_NS::protocol_version::v5,
+        "the broker must be specialized for v5"
+    );
+
+    auto c5 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port, MQTT_NS::protocol_version::v5);
+    c5->set_clean_start(true);
+    c5->set_client_id("cid5");
+    auto c3 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port, MQTT_NS::protocol_version::v3_1_1);
+    c3->set_clean_session(true);
+    c3->set_client_id("cid3");
+
+    using packet_id_t = typename std::remove_reference_t<decltype(*c5)>::packet_id_t;
+
+    checker chk = {
+        cont("c5_h_connack"),
+        cont("c5_h_suback"),
+        cont("c5_h_publish"),
+        cont("c5_h_close"),
+        cont("c3_h_error"),
+    };
+
+    c5->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code reason_code, MQTT_NS::v5::properties) {
+            MQTT_CHK("c5_h_connack");
+            BOOST_TEST(reason_code == MQTT_NS::v5::connect_reason_code::success);
+            c5->subscribe("topic1", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    c5->set_v5_suback_handler(
+        [&]
+        (packet_id_t, std::vector<MQTT_NS::v5::suback_reason_code> reasons, MQTT_NS::v5::properties) {
+            MQTT_CHK("c5_h_suback");
+            BOOST_TEST(reasons.size() == 1U);
+            BOOST_TEST(reasons[0] == MQTT_NS::v5::suback_reason_code::granted_qos_0);
+            c5->publish("topic1", "topic1_contents", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    c5->set_v5_publish_handler(
+        [&]
+        (MQTT_NS::optional<packet_id_t>,
+         MQTT_NS::publish_options,
+         MQTT_NS::buffer topic,
+         MQTT_NS::buffer contents,
+         MQTT_NS::v5::properties) {
+            MQTT_CHK("c5_h_publish");
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(contents == "topic1_contents");
+            c5->disconnect();
+            return true;
+        }
+    );
+    c5->set_close_handler(
+        [&] {
+            MQTT_CHK("c5_h_close");
+            c3->connect();
+        }
+    );
+    c5->set_error_handler([](MQTT_NS::error_code) { BOOST_CHECK(false); });
+
+    c3->set_connack_handler(
+        [&]
+        (bool, MQTT_NS::connect_return_code) {
+            BOOST_CHECK(false);
+            return true;
+        }
+    );
+    c3->set_close_handler(
+        [&] {
+            BOOST_CHECK(false);
+            s.close();
+        }
+    );
+    c3->set_error_handler(
+        [&](MQTT_NS::error_code) {
+            MQTT_CHK("c3_h_error");
+            s.close();
+        }
+    );
+
+    c5->connect();
+    ioc.run();
+    BOOST_TEST(chk.all());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
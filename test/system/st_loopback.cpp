@@ -0,0 +1,399 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "checker.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/broker/broker.hpp>
+
+BOOST_AUTO_TEST_SUITE(st_loopback)
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+
+// The client side is a plain endpoint on the other end of the loopback connection.
+using client_t = MQTT_NS::server<>::endpoint_t;
+
+namespace {
+
+std::shared_ptr<client_t> connect_loopback(
+    as::io_context& ioc,
+    MQTT_NS::broker::broker_t& b,
+    std::size_t capacity) {
+    auto sockets = MQTT_NS::make_loopback_pair(ioc, ioc, capacity);
+    b.handle_accept(std::make_shared<MQTT_NS::broker::endpoint_t>(ioc, sockets.first));
+    auto c = std::make_shared<client_t>(ioc, sockets.second, MQTT_NS::protocol_version::v5);
+    c->set_async_operation(true);
+    return c;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( pipe ) {
+    auto p = std::make_shared<MQTT_NS::detail::loopback_pipe>(4);
+    std::string written = "0123456789";
+    std::string read(10, '\0');
+    std::vector<std::string> events;
+
+    p->async_write(
+        { as::buffer(written) },
+        [&](MQTT_NS::error_code ec, std::size_t n) {
+            BOOST_TEST(!ec);
+            BOOST_TEST(n == 10U);
+            events.push_back("write");
+        }
+    );
+    // Only 4 bytes fit into the pipe until it is read
+    BOOST_TEST(events.empty());
+    p->async_read(
+        as::buffer(&read[0], 10),
+        [&](MQTT_NS::error_code ec, std::size_t n) {
+            BOOST_TEST(!ec);
+            BOOST_TEST(n == 10U);
+            events.push_back("read");
+        }
+    );
+    BOOST_TEST(read == written);
+    BOOST_TEST(events.size() == 2U);
+
+    // The bytes written before close can be read, and then eof
+    MQTT_NS::error_code ec;
+    BOOST_TEST(p->write({ as::buffer("abcdef", 6) }, ec) == 6U);
+    BOOST_TEST(!ec);
+    p->close();
+    p->async_read(
+        as::buffer(&read[0], 10),
+        [&](MQTT_NS::error_code ec, std::size_t n) {
+            BOOST_TEST(ec == as::error::eof);
+            BOOST_TEST(n == 6U);
+            events.push_back("eof");
+        }
+    );
+    BOOST_TEST(read.substr(0, 6) == "abcdef");
+    BOOST_TEST(p->write({ as::buffer("abcdef", 6) }, ec) == 0U);
+    BOOST_TEST(ec == as::error::broken_pipe);
+    BOOST_TEST(events.size() == 3U);
+}
+
+BOOST_AUTO_TEST_CASE( broker_pubsub ) {
+
+    //
+    // c1 ---- broker ---- c2   (loopback, 1KB buffers)
+    //
+    // 1. c1 subscribes topic1 QoS1
+    // 2. c2 publishes a 100KB payload to topic1 QoS1
+    // 3. c1 receives it and both clients disconnect
+    //
+
+    as::io_context ioc;
+    MQTT_NS::broker::broker_t b(ioc);
+
+    auto c1 = connect_loopback(ioc, b, 1024);
+    auto c2 = connect_loopback(ioc, b, 1024);
+    std::string payload(100 * 1024, 'x');
+    for (std::size_t i = 0; i != payload.size(); ++i) payload[i] = static_cast<char>('a' + i % 26);
+
+    checker chk = {
+        cont("c1_h_connack"),
+        cont("c1_h_suback"),
+        cont("c2_h_connack"),
+        cont("c2_h_puback"),
+        cont("c1_h_publish"),
+        deps("c1_h_close", "c1_h_publish"),
+        deps("c2_h_close", "c2_h_puback"),
+    };
+
+    std::size_t closed = 0;
+    auto on_close = [&] {
+        // The broker keeps its timers, so stop the io_context explicitly.
+        if (++closed == 2) ioc.stop();
+    };
+
+    c1->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code reason_code, MQTT_NS::v5::properties) {
+            MQTT_CHK("c1_h_connack");
+            BOOST_TEST(reason_code == MQTT_NS::v5::connect_reason_code::success);
+            c1->async_subscribe("topic1", MQTT_NS::qos::at_least_once);
+            return true;
+        }
+    );
+    c1->set_v5_suback_handler(
+        [&]
+        (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+            MQTT_CHK("c1_h_suback");
+            c2->start_session(c2);
+            c2->async_connect("cid2"_mb, MQTT_NS::nullopt, MQTT_NS::nullopt, MQTT_NS::nullopt, 0);
+            return true;
+        }
+    );
+    c1->set_v5_publish_handler(
+        [&]
+        (MQTT_NS::optional<std::uint16_t>,
+         MQTT_NS::publish_options pubopts,
+         MQTT_NS::buffer topic_name,
+         MQTT_NS::buffer contents,
+         MQTT_NS::v5::properties) {
+            MQTT_CHK("c1_h_publish");
+            BOOST_TEST(pubopts.get_qos() == MQTT_NS::qos::at_least_once);
+            BOOST_TEST(topic_name == "topic1");
+            BOOST_TEST(contents == payload);
+            c1->async_disconnect();
+            return true;
+        }
+    );
+    c1->set_close_handler(
+        [&] {
+            MQTT_CHK("c1_h_close");
+            on_close();
+        }
+    );
+    c1->set_error_handler([](MQTT_NS::error_code) { BOOST_CHECK(false); });
+
+    c2->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+            MQTT_CHK("c2_h_connack");
+            c2->async_publish("topic1", payload, MQTT_NS::qos::at_least_once);
+            return true;
+        }
+    );
+    c2->set_v5_puback_handler(
+        [&]
+        (std::uint16_t, MQTT_NS::v5::puback_reason_code, MQTT_NS::v5::properties) {
+            MQTT_CHK("c2_h_puback");
+            c2->async_disconnect();
+            return true;
+        }
+    );
+    c2->set_close_handler(
+        [&] {
+            MQTT_CHK("c2_h_close");
+            on_close();
+        }
+    );
+    c2->set_error_handler([](MQTT_NS::error_code) { BOOST_CHECK(false); });
+
+    c1->start_session(c1);
+    c1->async_connect("cid1"_mb, MQTT_NS::nullopt, MQTT_NS::nullopt, MQTT_NS::nullopt, 0);
+    ioc.run();
+    BOOST_TEST(chk.all());
+}
+
+BOOST_AUTO_TEST_CASE( broker_deliver_while_disconnecting ) {
+
+    //
+    // sub ---- broker ---- pub   (loopback, sub and pub on their own threads)
+    //
+    // 1. sub subscribes topic1 QoS1 with a session that never expires
+    // 2. pub publishes QoS1 messages to topic1
+    // 3. sub is disconnected while the messages are delivered
+    // 4. sub connects again and receives the rest as inflight or offline messages
+    //
+    // Every message must be received, before or after the reconnection.
+    //
+
+    constexpr std::size_t num_of_messages = 1000;
+    constexpr std::size_t num_of_rounds = 50;
+
+    as::io_context ioc_sub;
+    as::io_context ioc_pub;
+    auto guard_sub = as::make_work_guard(ioc_sub);
+    auto guard_pub = as::make_work_guard(ioc_pub);
+    std::thread th_sub([&] { ioc_sub.run(); });
+    std::thread th_pub([&] { ioc_pub.run(); });
+
+    MQTT_NS::broker::broker_t b(ioc_pub);
+
+    auto connect_on =
+        [&](as::io_context& ioc) {
+            auto sockets = MQTT_NS::make_loopback_pair(ioc, ioc);
+            b.handle_accept(std::make_shared<MQTT_NS::broker::endpoint_t>(ioc, sockets.first));
+            auto c = std::make_shared<client_t>(ioc, sockets.second, MQTT_NS::protocol_version::v5);
+            c->set_async_operation(true);
+            return c;
+        };
+
+    for (std::size_t round = 0; round != num_of_rounds; ++round) {
+        auto cid = MQTT_NS::allocate_buffer("cid_sub" + std::to_string(round));
+        std::string topic = "topic" + std::to_string(round);
+
+        std::mutex mtx;
+        std::set<std::string> received;
+        auto on_publish =
+            [&]
+            (MQTT_NS::optional<std::uint16_t>,
+             MQTT_NS::publish_options,
+             MQTT_NS::buffer,
+             MQTT_NS::buffer contents,
+             MQTT_NS::v5::properties) {
+                std::lock_guard<std::mutex> g(mtx);
+                received.emplace(contents);
+                return true;
+            };
+
+        // 1. subscribe
+        std::promise<void> subscribed;
+        auto sub = connect_on(ioc_sub);
+        sub->set_v5_connack_handler(
+            [&]
+            (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+                sub->async_subscribe(topic, MQTT_NS::qos::at_least_once);
+                return true;
+            }
+        );
+        sub->set_v5_suback_handler(
+            [&]
+            (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+                subscribed.set_value();
+                return true;
+            }
+        );
+        std::promise<void> sub_closed;
+        sub->set_v5_publish_handler(
+            [&, on_publish]
+            (MQTT_NS::optional<std::uint16_t> packet_id,
+             MQTT_NS::publish_options pubopts,
+             MQTT_NS::buffer topic_name,
+             MQTT_NS::buffer contents,
+             MQTT_NS::v5::properties props) {
+                on_publish(packet_id, pubopts, topic_name, contents, MQTT_NS::force_move(props));
+                // 3. disconnect in the middle of the delivery
+                if (contents == std::to_string(num_of_messages / 2)) sub->async_force_disconnect();
+                return true;
+            }
+        );
+        std::once_flag sub_closed_once;
+        auto on_sub_closed = [&] { std::call_once(sub_closed_once, [&] { sub_closed.set_value(); }); };
+        sub->set_close_handler(on_sub_closed);
+        sub->set_error_handler([&](MQTT_NS::error_code) { on_sub_closed(); });
+        as::post(
+            ioc_sub,
+            [&] {
+                sub->start_session(sub);
+                sub->async_connect(
+                    cid,
+                    MQTT_NS::nullopt,
+                    MQTT_NS::nullopt,
+                    MQTT_NS::nullopt,
+                    0,
+                    MQTT_NS::v5::properties{
+                        MQTT_NS::v5::property::session_expiry_interval(MQTT_NS::session_never_expire)
+                    }
+                );
+            }
+        );
+        subscribed.get_future().wait();
+
+        // 2. publish
+        std::promise<void> published;
+        auto pub = connect_on(ioc_pub);
+        std::size_t pubacks = 0;
+        pub->set_v5_connack_handler(
+            [&]
+            (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+                for (std::size_t i = 0; i != num_of_messages; ++i) {
+                    pub->async_publish(topic, std::to_string(i), MQTT_NS::qos::at_least_once);
+                }
+                return true;
+            }
+        );
+        pub->set_v5_puback_handler(
+            [&]
+            (std::uint16_t, MQTT_NS::v5::puback_reason_code, MQTT_NS::v5::properties) {
+                if (++pubacks == num_of_messages) published.set_value();
+                return true;
+            }
+        );
+        as::post(
+            ioc_pub,
+            [&] {
+                pub->start_session(pub);
+                pub->async_connect(
+                    MQTT_NS::allocate_buffer("cid_pub" + std::to_string(round)),
+                    MQTT_NS::nullopt,
+                    MQTT_NS::nullopt,
+                    MQTT_NS::nullopt,
+                    0
+                );
+            }
+        );
+        published.get_future().wait();
+        sub_closed.get_future().wait();
+
+        // wait until the broker makes the session offline
+        auto online =
+            [&] {
+                for (auto const& s : b.get_session_stats()) {
+                    if (s.client_id == cid) return s.online;
+                }
+                return false;
+            };
+        while (online()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        // 4. reconnect
+        std::promise<void> all_received;
+        bool all_received_set = false;
+        auto sub2 = connect_on(ioc_sub);
+        sub2->set_v5_publish_handler(
+            [&, on_publish]
+            (MQTT_NS::optional<std::uint16_t> packet_id,
+             MQTT_NS::publish_options pubopts,
+             MQTT_NS::buffer topic_name,
+             MQTT_NS::buffer contents,
+             MQTT_NS::v5::properties props) {
+                on_publish(packet_id, pubopts, topic_name, contents, MQTT_NS::force_move(props));
+                std::lock_guard<std::mutex> g(mtx);
+                if (received.size() == num_of_messages && !all_received_set) {
+                    all_received_set = true;
+                    all_received.set_value();
+                }
+                return true;
+            }
+        );
+        as::post(
+            ioc_sub,
+            [&] {
+                sub2->start_session(sub2);
+                sub2->async_connect(cid, MQTT_NS::nullopt, MQTT_NS::nullopt, MQTT_NS::nullopt, 0);
+            }
+        );
+        auto f = all_received.get_future();
+        BOOST_TEST((f.wait_for(std::chrono::seconds(10)) == std::future_status::ready));
+        {
+            std::lock_guard<std::mutex> g(mtx);
+            BOOST_TEST(received.size() == num_of_messages);
+        }
+
+        std::promise<void> closed;
+        std::atomic<std::size_t> num_of_closed(0);
+        auto on_close = [&] { if (++num_of_closed == 2) closed.set_value(); };
+        for (auto const& c : { sub2, pub }) {
+            c->set_close_handler(on_close);
+            c->set_error_handler([on_close](MQTT_NS::error_code) { on_close(); });
+            as::post(c == pub ? ioc_pub : ioc_sub, [c] { c->async_disconnect(); });
+        }
+        closed.get_future().wait();
+    }
+
+    guard_sub.reset();
+    guard_pub.reset();
+    // The broker keeps the sessions and their timers, so stop the io_contexts explicitly.
+    ioc_sub.stop();
+    ioc_pub.stop();
+    th_sub.join();
+    th_pub.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -705,4 +705,67 @@ BOOST_AUTO_TEST_CASE( pub_sub_sid_multi_match ) {
 }
 
 
+BOOST_AUTO_TEST_CASE( pub_invalid_topic_name ) {
+    auto test = [](boost::asio::io_context& ioc, auto& cs, auto finish, auto& /*b*/) {
+        auto& c = cs[0];
+        clear_ordered();
+        c->set_client_id("cid1");
+        c->set_clean_session(true);
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // publish topic1/+, then the broker disconnects
+            cont("h_closed"),
+        };
+
+        switch (c->get_protocol_version()) {
+        case MQTT_NS::protocol_version::v3_1_1:
+            c->set_connack_handler(
+                [&chk, &c]
+                (bool, MQTT_NS::connect_return_code connack_return_code) {
+                    MQTT_CHK("h_connack");
+                    BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+                    c->publish("topic1/+", "topic1_contents", MQTT_NS::qos::at_most_once);
+                    return true;
+                });
+            break;
+        case MQTT_NS::protocol_version::v5:
+            c->set_v5_connack_handler(
+                [&chk, &c]
+                (bool, MQTT_NS::v5::connect_reason_code connack_return_code, MQTT_NS::v5::properties /*props*/) {
+                    MQTT_CHK("h_connack");
+                    BOOST_TEST(connack_return_code == MQTT_NS::v5::connect_reason_code::success);
+                    c->publish("topic1/+", "topic1_contents", MQTT_NS::qos::at_most_once);
+                    return true;
+                });
+            c->set_v5_disconnect_handler(
+                []
+                (MQTT_NS::v5::disconnect_reason_code disconnect_reason_code, MQTT_NS::v5::properties /*props*/) {
+                    BOOST_TEST(disconnect_reason_code == MQTT_NS::v5::disconnect_reason_code::topic_name_invalid);
+                });
+            break;
+        default:
+            BOOST_CHECK(false);
+            break;
+        }
+
+        auto closed =
+            [&] {
+                MQTT_CHK("h_closed");
+                finish();
+            };
+        c->set_close_handler(closed);
+        c->set_error_handler(
+            [&]
+            (MQTT_NS::error_code) {
+                closed();
+            });
+        c->connect();
+        ioc.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
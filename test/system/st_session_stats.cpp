@@ -0,0 +1,267 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "checker.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <cstdio>
+#include <set>
+#include <string>
+
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/broker/broker.hpp>
+#include <mqtt/broker/log_persistence.hpp>
+
+BOOST_AUTO_TEST_SUITE(st_session_stats)
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+
+using client_t = MQTT_NS::server<>::endpoint_t;
+using key = MQTT_NS::broker::session_stats::key;
+
+namespace {
+
+std::shared_ptr<client_t> connect_loopback(
+    as::io_context& ioc,
+    MQTT_NS::broker::broker_t& b) {
+    auto sockets = MQTT_NS::make_loopback_pair(ioc, ioc);
+    b.handle_accept(std::make_shared<MQTT_NS::broker::endpoint_t>(ioc, sockets.first));
+    auto c = std::make_shared<client_t>(ioc, sockets.second, MQTT_NS::protocol_version::v5);
+    c->set_async_operation(true);
+    return c;
+}
+
+struct remove_file {
+    explicit remove_file(std::string path) : path(path) {
+        std::remove(path.c_str());
+    }
+    ~remove_file() {
+        std::remove(path.c_str());
+    }
+    std::string path;
+};
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( select_top ) {
+    std::vector<MQTT_NS::broker::session_stats> stats(4);
+    stats[0].client_id = "a"_mb;
+    stats[0].offline_messages = 2;
+    stats[1].client_id = "b"_mb;
+    stats[1].offline_messages = 5;
+    stats[1].endpoint.packets_received[3] = 1;
+    stats[2].client_id = "c"_mb;
+    stats[2].endpoint.packets_received[3] = 7;
+    stats[2].endpoint.packets_received[1] = 1;
+    stats[3].client_id = "d"_mb;
+    stats[3].offline_messages = 3;
+
+    auto top = MQTT_NS::broker::select_top_sessions(stats, key::offline_messages, 2);
+    BOOST_TEST(top.size() == 2U);
+    BOOST_TEST(top[0].client_id == "b");
+    BOOST_TEST(top[1].client_id == "d");
+
+    top = MQTT_NS::broker::select_top_sessions(stats, key::packets_received, 1);
+    BOOST_TEST(top.size() == 1U);
+    BOOST_TEST(top[0].client_id == "c");
+    BOOST_TEST(top[0].value(key::packets_received) == 8U);
+
+    BOOST_TEST(MQTT_NS::broker::select_top_sessions(stats, key::bytes_sent, 10).size() == 4U);
+    BOOST_TEST(MQTT_NS::broker::select_top_sessions(stats, key::bytes_sent, 0).empty());
+}
+
+BOOST_AUTO_TEST_CASE( broker_sessions ) {
+
+    //
+    // 1. c1 subscribes topic1 QoS1 with a session that never expires, and disconnects
+    // 2. c2 publishes 3 messages to topic1 QoS1. They are stored for the offline session of c1.
+    // 3. the sessions are inspected on the last PUBACK
+    //
+
+    as::io_context ioc;
+    MQTT_NS::broker::broker_t b(ioc);
+
+    auto c1 = connect_loopback(ioc, b);
+    auto c2 = connect_loopback(ioc, b);
+
+    checker chk = {
+        cont("c1_h_connack"),
+        cont("c1_h_suback"),
+        cont("c1_h_close"),
+        cont("c2_h_connack"),
+        cont("c2_h_puback"),
+        cont("c2_h_close"),
+    };
+
+    c1->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code reason_code, MQTT_NS::v5::properties) {
+            MQTT_CHK("c1_h_connack");
+            BOOST_TEST(reason_code == MQTT_NS::v5::connect_reason_code::success);
+            c1->async_subscribe("topic1", MQTT_NS::qos::at_least_once);
+            return true;
+        }
+    );
+    c1->set_v5_suback_handler(
+        [&]
+        (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+            MQTT_CHK("c1_h_suback");
+            c1->async_disconnect();
+            return true;
+        }
+    );
+    c1->set_close_handler(
+        [&] {
+            MQTT_CHK("c1_h_close");
+            c2->start_session(c2);
+            c2->async_connect("cid2"_mb, MQTT_NS::nullopt, MQTT_NS::nullopt, MQTT_NS::nullopt, 0);
+        }
+    );
+    c1->set_error_handler([](MQTT_NS::error_code) { BOOST_CHECK(false); });
+
+    std::size_t pubacks = 0;
+    auto dispatch_time_of_cid2 =
+        [&] {
+            for (auto const& s : b.get_session_stats()) {
+                if (s.client_id == "cid2") return s.endpoint.dispatch_time;
+            }
+            BOOST_CHECK(false);
+            return std::chrono::nanoseconds(0);
+        };
+    std::chrono::nanoseconds dispatch_time_after_connect { 0 };
+    std::chrono::nanoseconds dispatch_time_after_first_publish { 0 };
+    c2->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+            MQTT_CHK("c2_h_connack");
+            dispatch_time_after_connect = dispatch_time_of_cid2();
+            BOOST_TEST(dispatch_time_after_connect.count() > 0);
+            for (int i = 0; i != 3; ++i) {
+                c2->async_publish("topic1", "payload", MQTT_NS::qos::at_least_once);
+            }
+            return true;
+        }
+    );
+    c2->set_v5_puback_handler(
+        [&]
+        (std::uint16_t, MQTT_NS::v5::puback_reason_code, MQTT_NS::v5::properties) {
+            // The broker parses each PUBLISH and handles it in the read completions.
+            if (++pubacks == 1) {
+                dispatch_time_after_first_publish = dispatch_time_of_cid2();
+                BOOST_TEST(dispatch_time_after_first_publish.count() > dispatch_time_after_connect.count());
+            }
+            if (pubacks != 3) return true;
+            MQTT_CHK("c2_h_puback");
+            BOOST_TEST(dispatch_time_of_cid2().count() > dispatch_time_after_first_publish.count());
+
+            auto stats = b.get_session_stats();
+            BOOST_TEST(stats.size() == 2U);
+
+            auto top = b.top_sessions(key::offline_messages, 1);
+            BOOST_TEST(top.size() == 1U);
+            BOOST_TEST(top[0].client_id == "cid1");
+            BOOST_TEST(!top[0].online);
+            BOOST_TEST(top[0].offline_messages == 3U);
+            BOOST_TEST(top[0].offline_bytes != 0U);
+            BOOST_TEST(top[0].endpoint.total_packets_received() == 0U);
+
+            // The gauges of the broker agree with the sessions
+            using metrics = MQTT_NS::broker::metrics;
+            auto const& m = b.get_metrics();
+            BOOST_TEST(m.get(metrics::gauge::connected_clients) == 1);
+            BOOST_TEST(m.get(metrics::gauge::offline_messages) == 3);
+            BOOST_TEST(m.get(metrics::gauge::offline_bytes) == std::int64_t(top[0].offline_bytes));
+
+            top = b.top_sessions(key::packets_received, 2);
+            BOOST_TEST(top.size() == 2U);
+            BOOST_TEST(top[0].client_id == "cid2");
+            BOOST_TEST(top[0].online);
+            BOOST_TEST(top[0].endpoint.received(MQTT_NS::control_packet_type::connect) == 1U);
+            BOOST_TEST(top[0].endpoint.received(MQTT_NS::control_packet_type::publish) == 3U);
+            BOOST_TEST(top[0].endpoint.sent(MQTT_NS::control_packet_type::connack) == 1U);
+            BOOST_TEST(top[0].endpoint.sent(MQTT_NS::control_packet_type::puback) == 3U);
+            BOOST_TEST(top[0].endpoint.total_bytes_received != 0U);
+            BOOST_TEST(top[0].endpoint.stored_messages == 0U);
+            BOOST_TEST(top[1].client_id == "cid1");
+
+            c2->async_disconnect();
+            return true;
+        }
+    );
+    c2->set_close_handler(
+        [&] {
+            MQTT_CHK("c2_h_close");
+            // The broker keeps the session of c1 and its timers, so stop the io_context explicitly.
+            ioc.stop();
+        }
+    );
+    c2->set_error_handler([](MQTT_NS::error_code) { BOOST_CHECK(false); });
+
+    c1->start_session(c1);
+    c1->async_connect(
+        "cid1"_mb,
+        MQTT_NS::nullopt,
+        MQTT_NS::nullopt,
+        MQTT_NS::nullopt,
+        0,
+        MQTT_NS::v5::properties{
+            MQTT_NS::v5::property::session_expiry_interval(MQTT_NS::session_never_expire)
+        }
+    );
+    ioc.run();
+    BOOST_TEST(chk.all());
+}
+
+BOOST_AUTO_TEST_CASE( many_offline_sessions ) {
+    // More sessions than the buckets walked under one lock
+    std::size_t const num_of_sessions = 3000;
+    remove_file rf("st_session_stats_many_offline_sessions.log");
+    as::io_context ioc;
+    {
+        MQTT_NS::broker::log_persistence ps(ioc, rf.path);
+        auto put =
+            [&](std::string const& cid, std::size_t messages) {
+                auto client_id = MQTT_NS::allocate_buffer(cid);
+                ps.put_session(client_id, MQTT_NS::protocol_version::v3_1_1, MQTT_NS::nullopt);
+                ps.session_offline(client_id, {}, {});
+                for (std::size_t i = 0; i != messages; ++i) {
+                    ps.push_offline_message(client_id, "topic1"_mb, "contents"_mb, MQTT_NS::qos::at_least_once, {});
+                }
+            };
+        for (std::size_t i = 0; i != num_of_sessions; ++i) {
+            put("cid" + std::to_string(i), 1);
+        }
+        put("top1", 5);
+        put("top2", 4);
+        put("top3", 3);
+    }
+
+    MQTT_NS::broker::broker_t b(ioc);
+    b.set_persistence(std::make_shared<MQTT_NS::broker::log_persistence>(ioc, rf.path));
+
+    auto stats = b.get_session_stats();
+    BOOST_TEST(stats.size() == num_of_sessions + 3);
+    std::set<std::string> cids;
+    for (auto const& s : stats) {
+        BOOST_TEST(!s.online);
+        cids.emplace(s.client_id);
+    }
+    BOOST_TEST(cids.size() == num_of_sessions + 3);
+
+    auto top = b.top_sessions(key::offline_messages, 3);
+    BOOST_TEST(top.size() == 3U);
+    BOOST_TEST(top[0].client_id == "top1");
+    BOOST_TEST(top[0].offline_messages == 5U);
+    BOOST_TEST(top[1].client_id == "top2");
+    BOOST_TEST(top[2].client_id == "top3");
+
+    BOOST_TEST(b.top_sessions(key::offline_messages, 0).empty());
+    BOOST_TEST(b.top_sessions(key::offline_messages, num_of_sessions + 10).size() == num_of_sessions + 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
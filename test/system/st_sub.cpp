@@ -1188,4 +1188,93 @@ BOOST_AUTO_TEST_CASE( suback_unsuback_prop ) {
     do_combi_test_sync(test);
 }
 
+BOOST_AUTO_TEST_CASE( sub_invalid_topic_filter ) {
+    auto test = [](boost::asio::io_context& ioc, auto& cs, auto finish, auto& /*b*/) {
+        auto& c = cs[0];
+        clear_ordered();
+        using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+        c->set_client_id("cid1");
+        c->set_clean_session(true);
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // subscribe a/#/b (invalid) and topic1
+            cont("h_suback"),
+            // disconnect
+            cont("h_close"),
+        };
+
+        auto subscribe =
+            [&c] {
+                std::vector<std::tuple<MQTT_NS::string_view, MQTT_NS::subscribe_options>> v;
+                v.emplace_back("a/#/b", MQTT_NS::qos::at_most_once);
+                v.emplace_back("topic1", MQTT_NS::qos::at_most_once);
+                c->subscribe(v);
+            };
+
+        switch (c->get_protocol_version()) {
+        case MQTT_NS::protocol_version::v3_1_1:
+            c->set_connack_handler(
+                [&chk, &subscribe]
+                (bool, MQTT_NS::connect_return_code connack_return_code) {
+                    MQTT_CHK("h_connack");
+                    BOOST_TEST(connack_return_code == MQTT_NS::connect_return_code::accepted);
+                    subscribe();
+                    return true;
+                });
+            c->set_suback_handler(
+                [&chk, &c]
+                (packet_id_t /*packet_id*/, std::vector<MQTT_NS::suback_return_code> results) {
+                    MQTT_CHK("h_suback");
+                    BOOST_TEST(results.size() == 2);
+                    BOOST_TEST(results[0] == MQTT_NS::suback_return_code::failure);
+                    BOOST_TEST(results[1] == MQTT_NS::suback_return_code::success_maximum_qos_0);
+                    c->disconnect();
+                    return true;
+                });
+            break;
+        case MQTT_NS::protocol_version::v5:
+            c->set_v5_connack_handler(
+                [&chk, &subscribe]
+                (bool, MQTT_NS::v5::connect_reason_code connack_return_code, MQTT_NS::v5::properties /*props*/) {
+                    MQTT_CHK("h_connack");
+                    BOOST_TEST(connack_return_code == MQTT_NS::v5::connect_reason_code::success);
+                    subscribe();
+                    return true;
+                });
+            c->set_v5_suback_handler(
+                [&chk, &c]
+                (packet_id_t /*packet_id*/, std::vector<MQTT_NS::v5::suback_reason_code> reasons, MQTT_NS::v5::properties /*props*/) {
+                    MQTT_CHK("h_suback");
+                    BOOST_TEST(reasons.size() == 2);
+                    BOOST_TEST(reasons[0] == MQTT_NS::v5::suback_reason_code::topic_filter_invalid);
+                    BOOST_TEST(reasons[1] == MQTT_NS::v5::suback_reason_code::granted_qos_0);
+                    c->disconnect();
+                    return true;
+                });
+            break;
+        default:
+            BOOST_CHECK(false);
+            break;
+        }
+
+        c->set_close_handler(
+            [&chk, &finish]
+            () {
+                MQTT_CHK("h_close");
+                finish();
+            });
+        c->set_error_handler(
+            []
+            (MQTT_NS::error_code) {
+                BOOST_CHECK(false);
+            });
+        c->connect();
+        ioc.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -444,6 +444,139 @@ BOOST_AUTO_TEST_CASE( auto_map ) {
     do_combi_test_sync(test);
 }
 
+BOOST_AUTO_TEST_CASE( broker_auto_map ) {
+    auto test = [](boost::asio::io_context& ioc, auto& cs, auto finish, auto& b) {
+        auto& c = cs[0];
+        clear_ordered();
+
+        if (c->get_protocol_version() != MQTT_NS::protocol_version::v5) {
+            finish();
+            return;
+        }
+
+        using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+        c->set_client_id("cid1");
+        c->set_clean_session(true);
+        // sent as Topic Alias Maximum on CONNECT
+        c->set_topic_alias_maximum(2);
+
+        b.set_auto_map_topic_alias_send();
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // subscribe t/+ QoS0
+            cont("h_suback"),
+            // publish t/1 t/2 t/1 t/3 t/2 QoS0
+            // broker assigns aliases 1 2 1 2(LRU) 1(LRU)
+            cont("h_publish1"),
+            cont("h_publish2"),
+            cont("h_publish3"),
+            cont("h_publish4"),
+            cont("h_publish5"),
+            // disconnect
+            cont("h_close"),
+        };
+
+        auto check_alias =
+            [](MQTT_NS::v5::properties const& props, MQTT_NS::topic_alias_t expected) {
+                BOOST_TEST(props.size() == 1U);
+                for (auto const& p : props) {
+                    MQTT_NS::visit(
+                        MQTT_NS::make_lambda_visitor(
+                            [&](MQTT_NS::v5::property::topic_alias const& t) {
+                                BOOST_TEST(t.val() == expected);
+                            },
+                            [&](auto&& ...) {
+                                BOOST_TEST(false);
+                            }
+                        ),
+                        p
+                    );
+                }
+            };
+
+        c->set_v5_connack_handler(
+            [&chk, &c]
+            (bool sp, MQTT_NS::v5::connect_reason_code connack_return_code, MQTT_NS::v5::properties /*props*/) {
+                MQTT_CHK("h_connack");
+                BOOST_TEST(sp == false);
+                BOOST_TEST(connack_return_code == MQTT_NS::v5::connect_reason_code::success);
+                c->subscribe("t/+", MQTT_NS::qos::at_most_once);
+                return true;
+            });
+        c->set_v5_suback_handler(
+            [&chk, &c]
+            (packet_id_t, std::vector<MQTT_NS::v5::suback_reason_code> reasons, MQTT_NS::v5::properties /*props*/) {
+                MQTT_CHK("h_suback");
+                BOOST_TEST(reasons.size() == 1U);
+                c->publish("t/1", "contents1", MQTT_NS::qos::at_most_once);
+                c->publish("t/2", "contents2", MQTT_NS::qos::at_most_once);
+                c->publish("t/1", "contents3", MQTT_NS::qos::at_most_once);
+                c->publish("t/3", "contents4", MQTT_NS::qos::at_most_once);
+                c->publish("t/2", "contents5", MQTT_NS::qos::at_most_once);
+                return true;
+            });
+        c->set_v5_publish_handler(
+            [&chk, &c, &check_alias]
+            (MQTT_NS::optional<packet_id_t> /*packet_id*/,
+             MQTT_NS::publish_options /*pubopts*/,
+             MQTT_NS::buffer topic,
+             MQTT_NS::buffer contents,
+             MQTT_NS::v5::properties props) {
+                MQTT_ORDERED(
+                    [&] {
+                        MQTT_CHK("h_publish1");
+                        BOOST_TEST(topic == "t/1");
+                        BOOST_TEST(contents == "contents1");
+                        check_alias(props, 1);
+                    },
+                    [&] {
+                        MQTT_CHK("h_publish2");
+                        BOOST_TEST(topic == "t/2");
+                        BOOST_TEST(contents == "contents2");
+                        check_alias(props, 2);
+                    },
+                    [&] {
+                        MQTT_CHK("h_publish3");
+                        BOOST_TEST(topic == "t/1");
+                        BOOST_TEST(contents == "contents3");
+                        check_alias(props, 1);
+                    },
+                    [&] {
+                        MQTT_CHK("h_publish4");
+                        BOOST_TEST(topic == "t/3");
+                        BOOST_TEST(contents == "contents4");
+                        check_alias(props, 2);
+                    },
+                    [&] {
+                        MQTT_CHK("h_publish5");
+                        BOOST_TEST(topic == "t/2");
+                        BOOST_TEST(contents == "contents5");
+                        check_alias(props, 1);
+                        c->disconnect();
+                    }
+                );
+                return true;
+            });
+        c->set_close_handler(
+            [&chk, &finish]
+            () {
+                MQTT_CHK("h_close");
+                finish();
+            });
+        c->set_error_handler(
+            []
+            (MQTT_NS::error_code) {
+                BOOST_CHECK(false);
+            });
+        c->connect();
+        ioc.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
 BOOST_AUTO_TEST_CASE( overwrite ) {
     auto test = [](boost::asio::io_context& ioc, auto& cs, auto finish, auto& /*b*/) {
         auto& c = cs[0];
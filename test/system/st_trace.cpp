@@ -0,0 +1,149 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// The trace points are compiled in only if MQTT_USE_TRACE is defined.
+#if !defined(MQTT_USE_TRACE)
+#define MQTT_USE_TRACE
+#endif // !defined(MQTT_USE_TRACE)
+
+#include "../common/test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+#include "ordered_caller.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <sstream>
+
+#include <mqtt/broker/trace_sink.hpp>
+
+BOOST_AUTO_TEST_SUITE(st_trace)
+
+using namespace MQTT_NS::literals;
+
+BOOST_AUTO_TEST_CASE( broker_pubsub ) {
+
+    //
+    // c1 ---- broker
+    //
+    // 1. c1 subscribe topic1 QoS0
+    // 2. c1 publish topic1 QoS0 twice
+    // 3. The broker traces each PUBLISH from read to the write completion of the delivery
+    //
+
+    MQTT_NS::broker::histogram_trace_sink sink(10);
+    MQTT_NS::set_trace_sink(&sink);
+
+    boost::asio::io_context iocb;
+    MQTT_NS::broker::broker_t b(iocb);
+    MQTT_NS::optional<test_server_no_tls> s;
+    std::promise<void> p;
+    auto f = p.get_future();
+    std::thread th(
+        [&] {
+            s.emplace(iocb, b);
+            p.set_value();
+            iocb.run();
+        }
+    );
+    f.wait();
+
+    boost::asio::io_context ioc;
+
+    auto c1 = MQTT_NS::make_client(ioc, broker_url, broker_notls_port, MQTT_NS::protocol_version::v5);
+    c1->set_clean_start(true);
+    c1->set_client_id("cid1");
+
+    checker chk = {
+        cont("c1_h_connack"),
+        cont("c1_h_suback"),
+        cont("c1_h_publish1"),
+        cont("c1_h_publish2"),
+        cont("c1_h_close"),
+    };
+
+    c1->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+            MQTT_CHK("c1_h_connack");
+            c1->subscribe("topic1", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    c1->set_v5_suback_handler(
+        [&]
+        (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+            MQTT_CHK("c1_h_suback");
+            c1->publish("topic1", "contents1", MQTT_NS::qos::at_most_once);
+            c1->publish("topic1", "contents2", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    c1->set_v5_publish_handler(
+        [&]
+        (MQTT_NS::optional<std::uint16_t>,
+         MQTT_NS::publish_options,
+         MQTT_NS::buffer,
+         MQTT_NS::buffer contents,
+         MQTT_NS::v5::properties) {
+            auto ret = MQTT_ORDERED(
+                [&] {
+                    MQTT_CHK("c1_h_publish1");
+                    BOOST_TEST(contents == "contents1");
+                },
+                [&] {
+                    MQTT_CHK("c1_h_publish2");
+                    BOOST_TEST(contents == "contents2");
+                    c1->disconnect();
+                }
+            );
+            BOOST_TEST(ret);
+            return true;
+        }
+    );
+    c1->set_close_handler(
+        [&] {
+            MQTT_CHK("c1_h_close");
+            as::post(
+                iocb,
+                [&] {
+                    s->close();
+                }
+            );
+        }
+    );
+    c1->set_error_handler([](MQTT_NS::error_code) { BOOST_CHECK(false); });
+
+    c1->connect();
+    ioc.run();
+    th.join();
+    BOOST_TEST(chk.all());
+    MQTT_NS::set_trace_sink(nullptr);
+
+    // The PUBLISH packets from the broker are traced. The ones from the client are not
+    // traced because the client doesn't send them while processing a received PUBLISH.
+    BOOST_TEST(sink.get_total().count() == 2U);
+    for (auto stage : {
+            MQTT_NS::trace_stage::read,
+            MQTT_NS::trace_stage::parse,
+            MQTT_NS::trace_stage::publish_handler,
+            MQTT_NS::trace_stage::match,
+            MQTT_NS::trace_stage::deliver,
+            MQTT_NS::trace_stage::queue,
+            MQTT_NS::trace_stage::write }) {
+        BOOST_TEST(sink.get(stage).count() == 2U);
+    }
+    BOOST_TEST(sink.get(MQTT_NS::trace_stage::done).count() == 0U);
+    BOOST_TEST(sink.get_total().max() > 0U);
+
+    std::stringstream ss;
+    sink.write_chrome_trace(ss);
+    auto json = ss.str();
+    BOOST_TEST(json.find("{\"traceEvents\":[{\"name\":\"read\"") == 0U);
+    BOOST_TEST(json.find("\"name\":\"queue\"") != std::string::npos);
+    BOOST_TEST(json.find("\"name\":\"done\"") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,164 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Use the binary logging backend as MQTT_LOG in this test, so that all MQTT_LOG call sites in
+// the broker and the endpoint are compiled with it.
+#if !defined(MQTT_USE_BINARY_LOG)
+#define MQTT_USE_BINARY_LOG
+#endif // !defined(MQTT_USE_BINARY_LOG)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <mqtt/broker/broker.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_binary_log)
+
+namespace {
+
+struct captured {
+    captured() {
+        MQTT_NS::binary_log::set_threshold({ { "ut_binary_log", MQTT_NS::severity_level::info } });
+        MQTT_NS::binary_log::start(
+            [this](MQTT_NS::string_view line) {
+                std::lock_guard<std::mutex> g(mtx);
+                lines.emplace_back(line);
+            }
+        );
+    }
+    ~captured() {
+        MQTT_NS::binary_log::stop();
+    }
+    std::vector<std::string> get() {
+        MQTT_NS::binary_log::flush();
+        std::lock_guard<std::mutex> g(mtx);
+        return lines;
+    }
+    std::mutex mtx;
+    std::vector<std::string> lines;
+};
+
+struct point {
+    int x;
+    int y;
+};
+
+std::ostream& operator<<(std::ostream& o, point const& p) {
+    return o << '(' << p.x << ',' << p.y << ')';
+}
+
+bool ends_with(std::string const& s, std::string const& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( format ) {
+    captured c;
+    std::string str = "abc";
+    MQTT_BINARY_LOG("ut_binary_log", debug) << "filtered";
+    MQTT_BINARY_LOG("ut_binary_log", info)
+        << "literal " << str << ' ' << -12 << ' ' << 34U << ' ' << std::hex << 255 << std::dec
+        << ' ' << std::boolalpha << true << ' ' << point{1, 2} << ' ' << 1.5;
+    str = "xyz";
+    MQTT_BINARY_LOG("other_channel", fatal) << "filtered";
+    MQTT_LOG("ut_binary_log", warning) << MQTT_ADD_VALUE(address, &c) << "via MQTT_LOG";
+
+    auto lines = c.get();
+    BOOST_TEST_REQUIRE(lines.size() == 2U);
+    BOOST_TEST(ends_with(lines[0], "literal abc -12 34 ff true (1,2) 1.5"));
+    BOOST_TEST(lines[0].find("S:info") != std::string::npos);
+    BOOST_TEST(lines[0].find("C:ut_binary_log") != std::string::npos);
+    BOOST_TEST(lines[0].find("ut_binary_log.cpp:") != std::string::npos);
+    BOOST_TEST(ends_with(lines[1], "via MQTT_LOG"));
+    std::ostringstream addr;
+    addr << "A:" << static_cast<void const*>(&c);
+    BOOST_TEST(lines[1].find(addr.str()) != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE( char_array ) {
+    captured c;
+    {
+        char buf[] = "mutable";
+        char const cbuf[] = "automatic";
+        MQTT_BINARY_LOG("ut_binary_log", info)
+            << buf << ' ' << MQTT_NS::string_view(cbuf, sizeof(cbuf) - 1);
+        buf[0] = 'X';
+    }
+    auto lines = c.get();
+    BOOST_TEST_REQUIRE(lines.size() == 1U);
+    BOOST_TEST(ends_with(lines[0], "mutable automatic"));
+}
+
+BOOST_AUTO_TEST_CASE( truncate ) {
+    captured c;
+    std::string long_str(MQTT_BINARY_LOG_RECORD_SIZE * 2, 'a');
+    MQTT_BINARY_LOG("ut_binary_log", info) << long_str << " not recorded";
+    MQTT_BINARY_LOG("ut_binary_log", info) << point{3, 4};
+    auto lines = c.get();
+    BOOST_TEST_REQUIRE(lines.size() == 2U);
+    BOOST_TEST(ends_with(lines[0], "aaa..."));
+    BOOST_TEST(lines[0].size() < std::size_t(MQTT_BINARY_LOG_RECORD_SIZE * 2));
+    BOOST_TEST(ends_with(lines[1], "(3,4)"));
+}
+
+BOOST_AUTO_TEST_CASE( multi_thread ) {
+    captured c;
+    auto dropped = MQTT_NS::binary_log::dropped();
+    std::vector<std::thread> ths;
+    for (int t = 0; t != 4; ++t) {
+        ths.emplace_back(
+            [t] {
+                for (int i = 0; i != 1000; ++i) {
+                    MQTT_BINARY_LOG("ut_binary_log", info) << "t:" << t << " i:" << i;
+                }
+            }
+        );
+    }
+    for (auto& th : ths) th.join();
+    auto lines = c.get();
+    BOOST_TEST(MQTT_NS::binary_log::dropped() == dropped);
+    BOOST_TEST(lines.size() == 4000U);
+
+    // the records of each thread keep their order
+    std::vector<int> next(4, 0);
+    for (auto const& line : lines) {
+        auto pos = line.find("t:");
+        BOOST_TEST_REQUIRE(pos != std::string::npos);
+        int t = 0;
+        int i = 0;
+        std::istringstream is(line.substr(pos + 2));
+        is >> t;
+        is.ignore(3); // " i:"
+        is >> i;
+        BOOST_TEST(i == next[static_cast<std::size_t>(t)]);
+        next[static_cast<std::size_t>(t)] = i + 1;
+    }
+}
+
+BOOST_AUTO_TEST_CASE( ring_wrap ) {
+    MQTT_NS::binary_log::detail::ring r(0);
+    std::string payload(1000, 'x');
+    std::size_t pushed = 0;
+    std::size_t consumed = 0;
+    for (std::size_t n = 0; n != 10; ++n) {
+        while (r.push(payload.data(), payload.size())) ++pushed;
+        r.consume(
+            [&](char const* p, std::size_t size) {
+                BOOST_TEST(std::string(p, size) == payload);
+                ++consumed;
+            }
+        );
+    }
+    BOOST_TEST(pushed == consumed);
+    BOOST_TEST(pushed > MQTT_NS::binary_log::detail::ring::capacity / 1008 * 10 - 10);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,153 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <limits>
+#include <random>
+#include <algorithm>
+#include <set>
+
+#include <mqtt/server.hpp>
+#include <mqtt/packet_id_manager.hpp>
+#include <mqtt/bitmap_packet_id_manager.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_bitmap_packet_id_manager)
+
+BOOST_AUTO_TEST_CASE( acquire_release ) {
+    MQTT_NS::bitmap_packet_id_manager<std::uint16_t> m;
+    BOOST_TEST(m.acquire_unique_id().value() == 1);
+    BOOST_TEST(m.acquire_unique_id().value() == 2);
+    BOOST_TEST(m.acquire_unique_id().value() == 3);
+    m.release_id(2);
+    BOOST_TEST(m.acquire_unique_id().value() == 2);
+    BOOST_TEST(m.acquire_unique_id().value() == 4);
+
+    BOOST_TEST(!m.register_id(0));
+    BOOST_TEST(!m.register_id(4));
+    BOOST_TEST(m.register_id(5));
+    BOOST_TEST(m.acquire_unique_id().value() == 6);
+
+    m.clear();
+    BOOST_TEST(m.acquire_unique_id().value() == 1);
+}
+
+BOOST_AUTO_TEST_CASE( exhaust ) {
+    MQTT_NS::bitmap_packet_id_manager<std::uint16_t> m;
+    for (std::size_t i = 1; i <= std::numeric_limits<std::uint16_t>::max(); ++i) {
+        BOOST_TEST(m.acquire_unique_id().value() == i);
+    }
+    BOOST_CHECK(!m.acquire_unique_id());
+    m.release_id(4097);
+    m.release_id(100);
+    BOOST_TEST(m.acquire_unique_id().value() == 100);
+    BOOST_TEST(m.acquire_unique_id().value() == 4097);
+    BOOST_CHECK(!m.acquire_unique_id());
+}
+
+BOOST_AUTO_TEST_CASE( block_boundary_32 ) {
+    MQTT_NS::bitmap_packet_id_manager<std::uint32_t> m;
+    for (std::size_t i = 1; i <= 0x10000; ++i) {
+        BOOST_TEST(m.acquire_unique_id().value() == i);
+    }
+    BOOST_TEST(m.register_id(0x20000));
+    BOOST_TEST(m.acquire_unique_id().value() == 0x10001);
+    m.release_id(0xffff);
+    BOOST_TEST(m.acquire_unique_id().value() == 0xffff);
+    BOOST_TEST(m.register_id(0xffffffff));
+    BOOST_TEST(!m.register_id(0xffffffff));
+    m.release_id(0xffffffff);
+    BOOST_TEST(m.register_id(0xffffffff));
+}
+
+BOOST_AUTO_TEST_CASE( same_as_packet_id_manager ) {
+    // Random acquire, register and release produce the same ids as packet_id_manager.
+    MQTT_NS::packet_id_manager<std::uint16_t> expected;
+    MQTT_NS::bitmap_packet_id_manager<std::uint16_t> actual;
+    std::vector<std::uint16_t> used;
+    std::mt19937 gen(0);
+    for (std::size_t i = 0; i != 100000; ++i) {
+        switch (gen() % 4) {
+        case 0:
+        case 1: {
+            auto e = expected.acquire_unique_id();
+            auto a = actual.acquire_unique_id();
+            BOOST_TEST(e.value() == a.value());
+            used.push_back(a.value());
+        } break;
+        case 2: {
+            auto id = static_cast<std::uint16_t>(gen());
+            auto r = expected.register_id(id);
+            BOOST_TEST(actual.register_id(id) == r);
+            if (r) used.push_back(id);
+        } break;
+        case 3:
+            if (!used.empty()) {
+                auto idx = gen() % used.size();
+                std::swap(used[idx], used.back());
+                expected.release_id(used.back());
+                actual.release_id(used.back());
+                used.pop_back();
+            }
+            break;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( packet_id_set_same_as_std_set ) {
+    auto check =
+        [](auto max_id) {
+            using packet_id_t = decltype(max_id);
+            std::set<packet_id_t> expected;
+            MQTT_NS::detail::packet_id_set<packet_id_t> actual;
+            std::mt19937 gen(0);
+            // A sliding window of ids, and random ids over the whole range
+            packet_id_t window = 0;
+            for (std::size_t i = 0; i != 100000; ++i) {
+                auto r = gen();
+                auto id = (r % 8 == 0)
+                    ? static_cast<packet_id_t>(gen() % max_id)
+                    : static_cast<packet_id_t>(window + r % 32);
+                if (r % 3 == 0) {
+                    BOOST_TEST(actual.insert(id) == expected.insert(id).second);
+                    ++window;
+                }
+                else if (r % 3 == 1) {
+                    BOOST_TEST(actual.erase(id) == (expected.erase(id) == 1));
+                }
+                else {
+                    BOOST_TEST(actual.contains(id) == (expected.count(id) == 1));
+                }
+                BOOST_TEST(actual.size() == expected.size());
+            }
+            std::vector<packet_id_t> ids;
+            actual.for_each([&](packet_id_t id) { ids.push_back(id); });
+            BOOST_TEST(std::equal(ids.begin(), ids.end(), expected.begin(), expected.end()));
+            actual.clear();
+            BOOST_TEST(actual.empty());
+            BOOST_TEST(!actual.contains(*expected.begin()));
+            BOOST_TEST(actual.insert(*expected.begin()));
+        };
+    check(std::numeric_limits<std::uint16_t>::max());
+    check(std::numeric_limits<std::uint32_t>::max());
+}
+
+BOOST_AUTO_TEST_CASE( endpoint_template ) {
+    using endpoint_t = MQTT_NS::callable_overlay<
+        MQTT_NS::server_endpoint<std::mutex, std::lock_guard, 2, MQTT_NS::bitmap_packet_id_manager>
+    >;
+    boost::asio::io_context ioc;
+    auto ep = std::make_shared<endpoint_t>(ioc);
+    BOOST_TEST(ep->acquire_unique_packet_id() == 1);
+    BOOST_TEST(ep->register_packet_id(3));
+    BOOST_TEST(ep->acquire_unique_packet_id() == 2);
+    BOOST_TEST(ep->acquire_unique_packet_id() == 4);
+    ep->release_packet_id(1);
+    BOOST_TEST(ep->acquire_unique_packet_id() == 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
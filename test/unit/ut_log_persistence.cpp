@@ -0,0 +1,303 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+#include <mqtt/broker/log_persistence.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_log_persistence)
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+
+namespace {
+
+struct remove_file {
+    explicit remove_file(std::string path) : path(path) {
+        std::remove(path.c_str());
+        std::remove((path + ".tmp").c_str());
+    }
+    ~remove_file() {
+        std::remove(path.c_str());
+    }
+    std::string path;
+};
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( append_log_replay ) {
+    remove_file rf("ut_append_log_replay.log");
+    {
+        MQTT_NS::append_log log(rf.path);
+        log.append(1, "abc");
+        log.append(2, "");
+        log.append(3, "defg");
+    }
+    {
+        MQTT_NS::append_log log(rf.path);
+        std::vector<std::pair<std::uint8_t, std::string>> records;
+        BOOST_TEST(
+            log.replay(
+                [&](std::uint8_t type, MQTT_NS::buffer payload) {
+                    records.emplace_back(type, std::string(payload));
+                }
+            )
+        );
+        BOOST_TEST(records.size() == 3);
+        BOOST_TEST(records[0].first == 1);
+        BOOST_TEST(records[0].second == "abc");
+        BOOST_TEST(records[1].first == 2);
+        BOOST_TEST(records[1].second == "");
+        BOOST_TEST(records[2].first == 3);
+        BOOST_TEST(records[2].second == "defg");
+    }
+}
+
+BOOST_AUTO_TEST_CASE( append_log_read ) {
+    remove_file rf("ut_append_log_read.log");
+    MQTT_NS::append_log log(rf.path);
+    std::vector<std::size_t> offsets;
+    offsets.push_back(log.append(1, "abc"));
+    offsets.push_back(log.append(2, ""));
+    offsets.push_back(log.append(3, "defg"));
+
+    // not synced yet
+    auto r = log.read(offsets[2]);
+    BOOST_TEST(r.first == 3);
+    BOOST_TEST(r.second == "defg");
+    r = log.read(offsets[0]);
+    BOOST_TEST(r.first == 1);
+    BOOST_TEST(r.second == "abc");
+
+    std::vector<std::size_t> replayed;
+    BOOST_TEST(
+        log.replay(
+            [&](std::uint8_t, MQTT_NS::buffer, std::size_t offset) {
+                replayed.push_back(offset);
+            }
+        )
+    );
+    BOOST_TEST(replayed == offsets);
+
+    // keep the last record only
+    std::size_t offset = 0;
+    log.rewrite(
+        [&](auto&& append) {
+            offset = append(3, log.read(offsets[2]).second);
+        }
+    );
+    BOOST_TEST(offset == 0);
+    r = log.read(offset);
+    BOOST_TEST(r.first == 3);
+    BOOST_TEST(r.second == "defg");
+    auto size = log.size();
+    BOOST_TEST(log.append(4, "h") == size);
+}
+
+BOOST_AUTO_TEST_CASE( append_log_torn_tail ) {
+    remove_file rf("ut_append_log_torn_tail.log");
+    {
+        MQTT_NS::append_log log(rf.path);
+        log.append(1, "abc");
+        log.append(2, "def");
+    }
+    {
+        // partially written record
+        std::ofstream ofs(rf.path, std::ios::binary | std::ios::app);
+        ofs.write("\0\0\0\x10\x01xy", 7);
+    }
+    MQTT_NS::append_log log(rf.path);
+    std::vector<std::string> records;
+    BOOST_TEST(
+        !log.replay(
+            [&](std::uint8_t, MQTT_NS::buffer payload) {
+                records.emplace_back(payload);
+            }
+        )
+    );
+    BOOST_TEST(records.size() == 2);
+
+    log.rewrite(
+        [&](auto&& append) {
+            for (auto const& r : records) append(1, r);
+        }
+    );
+    records.clear();
+    BOOST_TEST(
+        log.replay(
+            [&](std::uint8_t, MQTT_NS::buffer payload) {
+                records.emplace_back(payload);
+            }
+        )
+    );
+    BOOST_TEST(records.size() == 2);
+}
+
+BOOST_AUTO_TEST_CASE( append_log_corrupt_length ) {
+    remove_file rf("ut_append_log_corrupt_length.log");
+    {
+        MQTT_NS::append_log log(rf.path);
+        log.append(1, "abc");
+    }
+    {
+        // the length field says 4GB
+        std::ofstream ofs(rf.path, std::ios::binary | std::ios::app);
+        ofs.write("\xff\xff\xff\xf0\x01xyzxyzxyz", 14);
+    }
+    MQTT_NS::append_log log(rf.path);
+    std::vector<std::string> records;
+    BOOST_TEST(
+        !log.replay(
+            [&](std::uint8_t, MQTT_NS::buffer payload) {
+                records.emplace_back(payload);
+            }
+        )
+    );
+    BOOST_TEST(records.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE( restore_state ) {
+    remove_file rf("ut_log_persistence_restore_state.log");
+    as::io_context ioc;
+    {
+        MQTT_NS::broker::log_persistence ps(ioc, rf.path);
+        ps.put_session("cid1"_mb, MQTT_NS::protocol_version::v5, std::chrono::steady_clock::duration(std::chrono::seconds(100)));
+        ps.put_subscription("cid1"_mb, ""_mb, "topic1"_mb, MQTT_NS::qos::at_least_once, 5);
+        ps.put_subscription("cid1"_mb, ""_mb, "topic2"_mb, MQTT_NS::qos::exactly_once, MQTT_NS::nullopt);
+        ps.erase_subscription("cid1"_mb, ""_mb, "topic2"_mb);
+        ps.session_offline("cid1"_mb, { MQTT_NS::allocate_buffer("inflight") }, { 1, 2 });
+        auto id1 = ps.push_offline_message(
+            "cid1"_mb,
+            "topic1"_mb,
+            "contents1"_mb,
+            MQTT_NS::qos::at_least_once,
+            MQTT_NS::v5::properties { MQTT_NS::v5::property::content_type("text"_mb) }
+        );
+        ps.push_offline_message(
+            "cid1"_mb,
+            "topic1"_mb,
+            "contents2"_mb,
+            MQTT_NS::qos::at_most_once,
+            MQTT_NS::v5::properties {}
+        );
+        ps.erase_offline_message("cid1"_mb, id1);
+
+        ps.put_session("cid2"_mb, MQTT_NS::protocol_version::v3_1_1, MQTT_NS::nullopt);
+        ps.erase_session("cid2"_mb);
+
+        ps.put_retained("topic1"_mb, "retained1"_mb, MQTT_NS::v5::properties {}, MQTT_NS::qos::at_least_once);
+        ps.put_retained("topic2"_mb, "retained2"_mb, MQTT_NS::v5::properties {}, MQTT_NS::qos::at_most_once);
+        ps.erase_retained("topic2"_mb);
+    }
+
+    auto check =
+        [&] (MQTT_NS::broker::log_persistence& ps) {
+            std::size_t sessions = 0;
+            ps.for_each_session(
+                [&](MQTT_NS::broker::stored_session const& ss) {
+                    ++sessions;
+                    BOOST_TEST(ss.client_id == "cid1");
+                    BOOST_TEST(ss.version == MQTT_NS::protocol_version::v5);
+                    BOOST_CHECK(ss.session_expiry_interval.value() == std::chrono::seconds(100));
+                    BOOST_CHECK(ss.offline_at);
+                    BOOST_TEST(ss.subscriptions.size() == 1);
+                    BOOST_TEST(ss.subscriptions[0].topic_filter == "topic1");
+                    BOOST_TEST(ss.subscriptions[0].subopts.get_qos() == MQTT_NS::qos::at_least_once);
+                    BOOST_TEST(ss.subscriptions[0].sid.value() == 5);
+                    BOOST_TEST(ss.inflight_messages.size() == 1);
+                    BOOST_TEST(ss.inflight_messages[0] == "inflight");
+                    BOOST_TEST(ss.qos2_publish_handled.size() == 2);
+                    BOOST_TEST(ss.offline_messages.size() == 1);
+                    BOOST_TEST(ss.offline_messages.begin()->second.contents == "contents2");
+                }
+            );
+            BOOST_TEST(sessions == 1);
+
+            std::size_t retains = 0;
+            ps.for_each_retained(
+                [&](MQTT_NS::broker::stored_message const& m) {
+                    ++retains;
+                    BOOST_TEST(m.topic == "topic1");
+                    BOOST_TEST(m.contents == "retained1");
+                    BOOST_TEST(m.pubopts.get_qos() == MQTT_NS::qos::at_least_once);
+                }
+            );
+            BOOST_TEST(retains == 1);
+        };
+
+    std::size_t size_before_compaction;
+    {
+        MQTT_NS::broker::log_persistence ps(ioc, rf.path);
+        check(ps);
+        size_before_compaction = ps.log_size();
+        ps.compact();
+        BOOST_TEST(ps.log_size() < size_before_compaction);
+        check(ps);
+    }
+    {
+        MQTT_NS::broker::log_persistence ps(ioc, rf.path);
+        check(ps);
+
+        // The next offline message id must not be reused after restart
+        auto id = ps.push_offline_message(
+            "cid1"_mb,
+            "topic1"_mb,
+            "contents3"_mb,
+            MQTT_NS::qos::at_most_once,
+            MQTT_NS::v5::properties {}
+        );
+        ps.for_each_session(
+            [&](MQTT_NS::broker::stored_session const& ss) {
+                BOOST_TEST(ss.offline_messages.size() == 2);
+                BOOST_TEST(ss.offline_messages.rbegin()->first == id);
+            }
+        );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( compact_on_timer ) {
+    remove_file rf("ut_log_persistence_compact_on_timer.log");
+    as::io_context ioc;
+    MQTT_NS::broker::log_persistence::config c;
+    c.sync.interval = std::chrono::milliseconds(10);
+    c.compaction_min_bytes = 0;
+    MQTT_NS::broker::log_persistence ps(ioc, rf.path, c);
+    ps.put_retained("topic1"_mb, "retained1"_mb, MQTT_NS::v5::properties {}, MQTT_NS::qos::at_most_once);
+    auto size = ps.log_size();
+    for (int i = 0; i != 10; ++i) {
+        ps.put_retained("topic1"_mb, "retained1"_mb, MQTT_NS::v5::properties {}, MQTT_NS::qos::at_most_once);
+    }
+    // The writer doesn't compact the log
+    BOOST_TEST(ps.log_size() == size * 11);
+
+    ioc.run_for(std::chrono::milliseconds(50));
+    BOOST_TEST(ps.log_size() == size);
+}
+
+BOOST_AUTO_TEST_CASE( session_online ) {
+    remove_file rf("ut_log_persistence_session_online.log");
+    as::io_context ioc;
+    {
+        MQTT_NS::broker::log_persistence ps(ioc, rf.path);
+        ps.put_session("cid1"_mb, MQTT_NS::protocol_version::v3_1_1, MQTT_NS::nullopt);
+        ps.session_offline("cid1"_mb, { MQTT_NS::allocate_buffer("inflight") }, { 1 });
+        ps.session_online("cid1"_mb);
+    }
+    MQTT_NS::broker::log_persistence ps(ioc, rf.path);
+    ps.for_each_session(
+        [&](MQTT_NS::broker::stored_session const& ss) {
+            BOOST_CHECK(!ss.offline_at);
+            BOOST_TEST(ss.inflight_messages.empty());
+            BOOST_TEST(ss.qos2_publish_handled.empty());
+        }
+    );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 
 #include <mqtt/optional.hpp>
 #include <mqtt/message_variant.hpp>
+#include <mqtt/encoded_properties.hpp>
 
 #include <iterator>
 
@@ -346,4 +347,87 @@ BOOST_AUTO_TEST_CASE( pingreq_cbuf ) { // behalf of header only message
     BOOST_TEST(m.continuous_buffer() == expected);
 }
 
+BOOST_AUTO_TEST_CASE( v5_publish_encoded_properties ) {
+    MQTT_NS::v5::properties props {
+        MQTT_NS::v5::property::payload_format_indicator(MQTT_NS::v5::property::payload_format_indicator::string),
+        MQTT_NS::v5::property::message_expiry_interval(100),
+        MQTT_NS::v5::property::content_type("text/plain"_mb),
+        MQTT_NS::v5::property::user_property("key"_mb, "val"_mb),
+    };
+    MQTT_NS::v5::encoded_properties shared_props(props);
+
+    auto to_string =
+        [](std::vector<MQTT_NS::as::const_buffer> const& cbs) {
+            std::string ret;
+            for (auto const& cb : cbs) {
+                ret.append(static_cast<char const*>(cb.data()), cb.size());
+            }
+            return ret;
+        };
+
+    auto topic = "topic1"_mb;
+    auto payload = "payload"_mb;
+    auto expected_props = props;
+    expected_props.push_back(MQTT_NS::v5::property::subscription_identifier(5));
+    expected_props.push_back(MQTT_NS::v5::property::topic_alias(3));
+    auto expected = MQTT_NS::v5::publish_message(
+        1,
+        MQTT_NS::as::buffer(topic),
+        std::vector<MQTT_NS::as::const_buffer>{ MQTT_NS::as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        expected_props
+    );
+    auto m = MQTT_NS::v5::publish_message(
+        1,
+        MQTT_NS::as::buffer(topic),
+        std::vector<MQTT_NS::as::const_buffer>{ MQTT_NS::as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        shared_props,
+        MQTT_NS::v5::properties {
+            MQTT_NS::v5::property::subscription_identifier(5),
+            MQTT_NS::v5::property::topic_alias(3)
+        }
+    );
+
+    BOOST_TEST(m.continuous_buffer() == expected.continuous_buffer());
+    BOOST_TEST(to_string(m.const_buffer_sequence()) == expected.continuous_buffer());
+    BOOST_TEST(m.const_buffer_sequence().size() == m.num_of_const_buffer_sequence());
+    BOOST_TEST(m.num_of_const_buffer_sequence() < expected.num_of_const_buffer_sequence());
+    // The shared properties are referred to, not copied
+    BOOST_TEST(m.props().size() == 2U);
+    BOOST_TEST(&m.shared_props().props() == &shared_props.props());
+
+    // Updating a per-message property keeps the shared bytes
+    m.update_prop(MQTT_NS::v5::property::topic_alias(4));
+    expected.update_prop(MQTT_NS::v5::property::topic_alias(4));
+    BOOST_TEST(to_string(m.const_buffer_sequence()) == expected.continuous_buffer());
+    BOOST_TEST(m.shared_props().count() == props.size());
+
+    // Updating a shared property stops using the shared bytes
+    m.update_prop(MQTT_NS::v5::property::message_expiry_interval(50));
+    expected.update_prop(MQTT_NS::v5::property::message_expiry_interval(50));
+    BOOST_TEST(to_string(m.const_buffer_sequence()) == expected.continuous_buffer());
+    BOOST_TEST(m.num_of_const_buffer_sequence() == expected.num_of_const_buffer_sequence());
+    BOOST_TEST(m.shared_props().count() == 0U);
+    BOOST_TEST(m.props().size() == expected_props.size());
+
+    // The shared bytes are not modified
+    auto other = MQTT_NS::v5::publish_message(
+        2,
+        MQTT_NS::as::buffer(topic),
+        std::vector<MQTT_NS::as::const_buffer>{ MQTT_NS::as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        shared_props,
+        MQTT_NS::v5::properties {}
+    );
+    auto expected_other = MQTT_NS::v5::publish_message(
+        2,
+        MQTT_NS::as::buffer(topic),
+        std::vector<MQTT_NS::as::const_buffer>{ MQTT_NS::as::buffer(payload) },
+        MQTT_NS::qos::at_least_once,
+        props
+    );
+    BOOST_TEST(to_string(other.const_buffer_sequence()) == expected_other.continuous_buffer());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
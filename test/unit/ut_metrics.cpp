@@ -0,0 +1,171 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <thread>
+#include <vector>
+
+#include <mqtt/broker/broker.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_metrics)
+
+using metrics = MQTT_NS::broker::metrics;
+using histogram_snapshot = MQTT_NS::broker::histogram_snapshot;
+
+BOOST_AUTO_TEST_CASE( buckets ) {
+    for (std::uint64_t v : { 0ULL, 1ULL, 7ULL, 8ULL, 9ULL, 15ULL, 16ULL, 17ULL, 1000ULL, 123456789ULL, ~0ULL }) {
+        auto i = histogram_snapshot::bucket_index(v);
+        BOOST_TEST(i < std::size_t(histogram_snapshot::buckets));
+        auto low = histogram_snapshot::bucket_value(i);
+        BOOST_TEST(low <= v);
+        // within 12.5%
+        BOOST_TEST(v - low <= v / 8);
+        BOOST_TEST(histogram_snapshot::bucket_index(low) == i);
+    }
+    BOOST_TEST(histogram_snapshot::bucket_index(~0ULL) == std::size_t(histogram_snapshot::buckets - 1));
+}
+
+BOOST_AUTO_TEST_CASE( counters_multi_thread ) {
+    metrics m;
+    std::vector<std::thread> ths;
+    for (std::size_t t = 0; t != 8; ++t) {
+        ths.emplace_back(
+            [&] {
+                for (std::size_t i = 0; i != 10000; ++i) {
+                    m.add(metrics::counter::publish_received);
+                    m.add(metrics::counter::publish_sent, 2);
+                    m.record(metrics::histogram::fan_out, 2);
+                }
+            }
+        );
+    }
+    for (auto& th : ths) th.join();
+    BOOST_TEST(m.get(metrics::counter::publish_received) == 80000U);
+    BOOST_TEST(m.get(metrics::counter::publish_sent) == 160000U);
+    auto h = m.get(metrics::histogram::fan_out);
+    BOOST_TEST(h.count() == 80000U);
+    BOOST_TEST(h.max() == 2U);
+    BOOST_TEST(m.get(metrics::histogram::match_latency).count() == 0U);
+}
+
+BOOST_AUTO_TEST_CASE( percentiles ) {
+    metrics m;
+    BOOST_TEST(m.get(metrics::histogram::match_latency).value_at_percentile(50.0) == 0U);
+    for (std::uint64_t v = 1; v <= 100; ++v) {
+        m.record(metrics::histogram::match_latency, v * 1000);
+    }
+    auto h = m.get(metrics::histogram::match_latency);
+    BOOST_TEST(h.count() == 100U);
+    auto p50 = h.value_at_percentile(50.0);
+    BOOST_TEST(p50 <= 50000U);
+    BOOST_TEST(p50 >= 50000U - 50000U / 8);
+    auto p99 = h.value_at_percentile(99.0);
+    BOOST_TEST(p99 <= 99000U);
+    BOOST_TEST(p99 >= 99000U - 99000U / 8);
+    BOOST_TEST(h.max() <= 100000U);
+    BOOST_TEST(h.max() >= 100000U - 100000U / 8);
+}
+
+BOOST_AUTO_TEST_CASE( gauges_multi_thread ) {
+    metrics m;
+    std::vector<std::thread> ths;
+    for (std::size_t t = 0; t != 8; ++t) {
+        ths.emplace_back(
+            [&, t] {
+                for (std::size_t i = 0; i != 10000; ++i) {
+                    // released on a different thread than it was taken
+                    m.add(metrics::gauge::offline_messages, t % 2 ? -1 : 1);
+                    m.add(metrics::gauge::offline_bytes, 3);
+                }
+            }
+        );
+    }
+    for (auto& th : ths) th.join();
+    BOOST_TEST(m.get(metrics::gauge::offline_messages) == 0);
+    BOOST_TEST(m.get(metrics::gauge::offline_bytes) == 240000);
+}
+
+BOOST_AUTO_TEST_CASE( offline_bytes ) {
+    metrics m;
+    boost::asio::io_context ioc;
+    {
+        MQTT_NS::broker::offline_messages msgs(m);
+        msgs.push_back(ioc, MQTT_NS::allocate_buffer("topic1"), MQTT_NS::allocate_buffer("0123456789"), MQTT_NS::qos::at_least_once, {});
+        msgs.push_back(ioc, MQTT_NS::allocate_buffer("t2"), MQTT_NS::allocate_buffer("ab"), MQTT_NS::qos::at_least_once, {});
+        BOOST_TEST(msgs.size() == 2U);
+        BOOST_TEST(msgs.bytes() == 20U);
+        BOOST_TEST(m.get(metrics::gauge::offline_messages) == 2);
+        BOOST_TEST(m.get(metrics::gauge::offline_bytes) == 20);
+
+        // expired message is removed
+        msgs.push_back(
+            ioc,
+            MQTT_NS::allocate_buffer("t3"),
+            MQTT_NS::allocate_buffer("abc"),
+            MQTT_NS::qos::at_least_once,
+            MQTT_NS::v5::properties { MQTT_NS::v5::property::message_expiry_interval(0) }
+        );
+        BOOST_TEST(msgs.bytes() == 25U);
+        BOOST_TEST(m.get(metrics::gauge::offline_bytes) == 25);
+        ioc.run();
+        BOOST_TEST(msgs.size() == 2U);
+        BOOST_TEST(msgs.bytes() == 20U);
+        BOOST_TEST(m.get(metrics::gauge::offline_messages) == 2);
+        BOOST_TEST(m.get(metrics::gauge::offline_bytes) == 20);
+
+        msgs.clear();
+        BOOST_TEST(msgs.bytes() == 0U);
+        BOOST_TEST(m.get(metrics::gauge::offline_messages) == 0);
+        BOOST_TEST(m.get(metrics::gauge::offline_bytes) == 0);
+
+        msgs.push_back(ioc, MQTT_NS::allocate_buffer("t4"), MQTT_NS::allocate_buffer("abcd"), MQTT_NS::qos::at_least_once, {});
+        BOOST_TEST(m.get(metrics::gauge::offline_messages) == 1);
+    }
+    // destroyed with the session
+    BOOST_TEST(m.get(metrics::gauge::offline_messages) == 0);
+    BOOST_TEST(m.get(metrics::gauge::offline_bytes) == 0);
+}
+
+BOOST_AUTO_TEST_CASE( inflight_count ) {
+    metrics m;
+    {
+        MQTT_NS::broker::inflight_messages msgs(m);
+        for (std::uint16_t pid = 1; pid <= 3; ++pid) {
+            msgs.insert(MQTT_NS::v3_1_1::basic_pubrel_message<2>(pid), MQTT_NS::any(), nullptr);
+        }
+        BOOST_TEST(m.get(metrics::gauge::inflight_messages) == 3);
+        msgs.erase(std::uint16_t(2));
+        msgs.erase(std::uint16_t(2));
+        BOOST_TEST(m.get(metrics::gauge::inflight_messages) == 2);
+        msgs.clear();
+        BOOST_TEST(m.get(metrics::gauge::inflight_messages) == 0);
+        msgs.insert(MQTT_NS::v3_1_1::basic_pubrel_message<2>(1), MQTT_NS::any(), nullptr);
+    }
+    BOOST_TEST(m.get(metrics::gauge::inflight_messages) == 0);
+}
+
+BOOST_AUTO_TEST_CASE( broker_publish ) {
+    boost::asio::io_context ioc;
+    MQTT_NS::broker::broker_t b(ioc);
+    b.publish_local(MQTT_NS::allocate_buffer("a/b"), MQTT_NS::allocate_buffer("v"), MQTT_NS::qos::at_most_once, {});
+    auto const& m = b.get_metrics();
+    // no subscriber
+    BOOST_TEST(m.get(metrics::counter::publish_sent) == 0U);
+    auto h = m.get(metrics::histogram::fan_out);
+    BOOST_TEST(h.count() == 1U);
+    BOOST_TEST(h.max() == 0U);
+    BOOST_TEST(m.get(metrics::histogram::match_latency).count() == 1U);
+
+    b.publish_sys_topics();
+    // the broker's own $SYS messages are not counted
+    BOOST_TEST(m.get(metrics::histogram::fan_out).count() == 1U);
+    BOOST_TEST(m.get(metrics::histogram::match_latency).count() == 1U);
+    BOOST_TEST(m.get(metrics::counter::publish_sent) == 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
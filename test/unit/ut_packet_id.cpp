@@ -94,4 +94,16 @@ BOOST_AUTO_TEST_CASE( exhausted ) {
     }
 }
 
+BOOST_AUTO_TEST_CASE( qos2_publish_handled_pids ) {
+    boost::asio::io_context ioc;
+    auto c = MQTT_NS::make_client(ioc, host, port);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    BOOST_TEST(c->get_qos2_publish_handled_pids().empty());
+    std::set<packet_id_t> pids { 1, 3, 65535 };
+    c->restore_qos2_publish_handled_pids(pids);
+    BOOST_TEST(c->get_qos2_publish_handled_pids() == pids);
+    c->restore_qos2_publish_handled_pids(std::set<packet_id_t>{ 2 });
+    BOOST_TEST(c->get_qos2_publish_handled_pids() == std::set<packet_id_t>{ 2 });
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,128 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Compile the profiling phases out of line in this test.
+#if !defined(MQTT_USE_PROFILE)
+#define MQTT_USE_PROFILE
+#endif // !defined(MQTT_USE_PROFILE)
+
+#include <string>
+#include <vector>
+
+// Record the nesting of the phases.
+namespace {
+
+thread_local std::vector<std::string> phases;
+std::vector<std::vector<std::string>> match_stacks;
+
+struct phase_recorder {
+    explicit phase_recorder(char const* name) {
+        phases.emplace_back(name);
+        if (phases.back() == "match") match_stacks.push_back(phases);
+    }
+    ~phase_recorder() {
+        phases.pop_back();
+    }
+};
+
+} // anonymous namespace
+
+#define MQTT_PROFILE_PHASE_HOOK(name) phase_recorder recorder(#name)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <memory>
+
+#include <mqtt/profile.hpp>
+#include <mqtt/loopback_endpoint.hpp>
+#include <mqtt/broker/broker.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_profile)
+
+BOOST_AUTO_TEST_CASE( void_function ) {
+    int called = 0;
+    MQTT_NS::profile::run(MQTT_NS::profile::parse, [&] { ++called; });
+    auto const f = [&] { ++called; };
+    MQTT_NS::profile::run(MQTT_NS::profile::write, f);
+    BOOST_TEST(called == 2);
+}
+
+BOOST_AUTO_TEST_CASE( return_value ) {
+    auto s = MQTT_NS::profile::run(MQTT_NS::profile::encode, [] { return std::string("abc"); });
+    BOOST_TEST(s == "abc");
+
+    // move only
+    auto p = MQTT_NS::profile::run(MQTT_NS::profile::match, [] { return std::make_unique<int>(42); });
+    BOOST_TEST(*p == 42);
+}
+
+BOOST_AUTO_TEST_CASE( nested ) {
+    std::string order;
+    MQTT_NS::profile::run(
+        MQTT_NS::profile::match,
+        [&] {
+            order += "m";
+            MQTT_NS::profile::run(MQTT_NS::profile::deliver, [&] { order += "d"; });
+            order += "m";
+        }
+    );
+    BOOST_TEST(order == "mdm");
+}
+
+BOOST_AUTO_TEST_CASE( broker_match_under_parse ) {
+    namespace as = boost::asio;
+    using client_t = MQTT_NS::server<>::endpoint_t;
+    using namespace MQTT_NS::literals;
+
+    as::io_context ioc;
+    MQTT_NS::broker::broker_t b(ioc);
+    auto connect_loopback =
+        [&] {
+            auto sockets = MQTT_NS::make_loopback_pair(ioc, ioc);
+            b.handle_accept(std::make_shared<MQTT_NS::broker::endpoint_t>(ioc, sockets.first));
+            auto c = std::make_shared<client_t>(ioc, sockets.second, MQTT_NS::protocol_version::v5);
+            c->set_async_operation(true);
+            return c;
+        };
+    auto c = connect_loopback();
+    c->set_v5_connack_handler(
+        [&]
+        (bool, MQTT_NS::v5::connect_reason_code, MQTT_NS::v5::properties) {
+            c->async_subscribe("topic1", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    c->set_v5_suback_handler(
+        [&]
+        (std::uint16_t, std::vector<MQTT_NS::v5::suback_reason_code>, MQTT_NS::v5::properties) {
+            match_stacks.clear();
+            c->async_publish("topic1", "contents", MQTT_NS::qos::at_most_once);
+            return true;
+        }
+    );
+    c->set_v5_publish_handler(
+        [&]
+        (MQTT_NS::optional<std::uint16_t>,
+         MQTT_NS::publish_options,
+         MQTT_NS::buffer,
+         MQTT_NS::buffer,
+         MQTT_NS::v5::properties) {
+            // The broker keeps its timers, so stop the io_context explicitly.
+            ioc.stop();
+            return true;
+        }
+    );
+    c->start_session(c);
+    c->async_connect("cid1"_mb, MQTT_NS::nullopt, MQTT_NS::nullopt, MQTT_NS::nullopt, 0);
+    ioc.run();
+
+    // The broker matches the PUBLISH in the handler that is called from the read completion.
+    BOOST_TEST(match_stacks.size() == 1);
+    BOOST_TEST(match_stacks.front() == (std::vector<std::string>{ "parse", "match" }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,232 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+#include <mqtt/broker/broker.hpp>
+#include <mqtt/broker/log_persistence.hpp>
+#include <mqtt/broker/retained_snapshot.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_retained_snapshot)
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+
+namespace {
+
+struct remove_file {
+    explicit remove_file(std::string path) : path(path) {
+        std::remove(path.c_str());
+        std::remove((path + ".tmp").c_str());
+    }
+    ~remove_file() {
+        std::remove(path.c_str());
+    }
+    std::string path;
+};
+
+struct entry {
+    std::string topic;
+    std::string contents;
+    MQTT_NS::v5::properties props;
+    MQTT_NS::qos qos_value;
+    MQTT_NS::optional<std::chrono::system_clock::time_point> expiry;
+};
+
+std::map<std::string, entry> load(std::string const& path) {
+    std::map<std::string, entry> entries;
+    MQTT_NS::broker::retained_snapshot::load(
+        path,
+        [&](MQTT_NS::buffer topic,
+            MQTT_NS::buffer contents,
+            MQTT_NS::v5::properties props,
+            MQTT_NS::qos qos_value,
+            MQTT_NS::optional<std::chrono::system_clock::time_point> expiry) {
+            BOOST_TEST(topic.has_life());
+            BOOST_TEST(contents.has_life());
+            entries.emplace(
+                std::string(topic),
+                entry { std::string(topic), std::string(contents), MQTT_NS::force_move(props), qos_value, expiry }
+            );
+        }
+    );
+    return entries;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( write_load ) {
+    remove_file rf("ut_retained_snapshot_write_load.snap");
+    auto expiry = std::chrono::system_clock::now() + std::chrono::seconds(100);
+    {
+        MQTT_NS::broker::retained_snapshot::writer w(rf.path);
+        w.add("a/b", "contents1", MQTT_NS::v5::properties {}, MQTT_NS::qos::at_least_once, MQTT_NS::nullopt);
+        w.add(
+            "$SYS/c",
+            "",
+            MQTT_NS::v5::properties {
+                MQTT_NS::v5::property::content_type("text"_mb),
+                MQTT_NS::v5::property::message_expiry_interval(100)
+            },
+            MQTT_NS::qos::at_most_once,
+            expiry
+        );
+        BOOST_TEST(w.commit() == 2);
+    }
+
+    auto entries = load(rf.path);
+    BOOST_TEST(entries.size() == 2);
+
+    auto const& e1 = entries.at("a/b");
+    BOOST_TEST(e1.contents == "contents1");
+    BOOST_TEST(e1.props.empty());
+    BOOST_TEST(e1.qos_value == MQTT_NS::qos::at_least_once);
+    BOOST_CHECK(!e1.expiry);
+
+    auto const& e2 = entries.at("$SYS/c");
+    BOOST_TEST(e2.contents == "");
+    BOOST_TEST(e2.props.size() == 2);
+    BOOST_TEST(e2.qos_value == MQTT_NS::qos::at_most_once);
+    BOOST_CHECK(
+        std::chrono::duration_cast<std::chrono::milliseconds>(e2.expiry.value().time_since_epoch()) ==
+        std::chrono::duration_cast<std::chrono::milliseconds>(expiry.time_since_epoch())
+    );
+}
+
+BOOST_AUTO_TEST_CASE( truncated ) {
+    remove_file rf("ut_retained_snapshot_truncated.snap");
+    {
+        MQTT_NS::broker::retained_snapshot::writer w(rf.path);
+        w.add("a/b", "contents1", MQTT_NS::v5::properties {}, MQTT_NS::qos::at_least_once, MQTT_NS::nullopt);
+        w.commit();
+    }
+    std::string all;
+    {
+        std::ifstream ifs(rf.path, std::ios::binary);
+        all.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream ofs(rf.path, std::ios::binary | std::ios::trunc);
+        ofs.write(all.data(), static_cast<std::streamsize>(all.size() - 1));
+    }
+    BOOST_CHECK_THROW(load(rf.path), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( broker_save_load ) {
+    remove_file rf1("ut_retained_snapshot_broker_save_load1.snap");
+    remove_file rf2("ut_retained_snapshot_broker_save_load2.snap");
+    {
+        MQTT_NS::broker::retained_snapshot::writer w(rf1.path);
+        w.add("a/b", "contents1", MQTT_NS::v5::properties {}, MQTT_NS::qos::at_least_once, MQTT_NS::nullopt);
+        w.add(
+            "a/c",
+            "contents2",
+            MQTT_NS::v5::properties { MQTT_NS::v5::property::message_expiry_interval(100) },
+            MQTT_NS::qos::exactly_once,
+            std::chrono::system_clock::now() + std::chrono::seconds(100)
+        );
+        // expired
+        w.add(
+            "a/d",
+            "contents3",
+            MQTT_NS::v5::properties { MQTT_NS::v5::property::message_expiry_interval(1) },
+            MQTT_NS::qos::at_most_once,
+            std::chrono::system_clock::now() - std::chrono::seconds(1)
+        );
+        w.commit();
+    }
+
+    as::io_context ioc;
+    MQTT_NS::broker::broker_t b(ioc);
+    BOOST_TEST(b.load_retained_snapshot(rf1.path) == 2);
+    BOOST_TEST(b.save_retained_snapshot(rf2.path) == 2);
+
+    auto entries = load(rf2.path);
+    BOOST_TEST(entries.size() == 2);
+    BOOST_TEST(entries.at("a/b").contents == "contents1");
+    BOOST_CHECK(!entries.at("a/b").expiry);
+    auto const& e = entries.at("a/c");
+    BOOST_TEST(e.contents == "contents2");
+    BOOST_TEST(e.qos_value == MQTT_NS::qos::exactly_once);
+    BOOST_CHECK(e.expiry);
+    BOOST_CHECK(e.expiry.value() > std::chrono::system_clock::now() + std::chrono::seconds(90));
+}
+
+BOOST_AUTO_TEST_CASE( invalid_qos ) {
+    remove_file rf("ut_retained_snapshot_invalid_qos.snap");
+    {
+        MQTT_NS::broker::retained_snapshot::writer w(rf.path);
+        w.add("a/b", "contents1", MQTT_NS::v5::properties {}, static_cast<MQTT_NS::qos>(3), MQTT_NS::nullopt);
+        w.commit();
+    }
+    BOOST_CHECK_THROW(load(rf.path), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( broker_restart_with_persistence ) {
+    remove_file rf_snap("ut_retained_snapshot_broker_restart.snap");
+    remove_file rf_log("ut_retained_snapshot_broker_restart.log");
+    remove_file rf_check("ut_retained_snapshot_broker_restart_check.snap");
+    {
+        MQTT_NS::broker::retained_snapshot::writer w(rf_snap.path);
+        w.add("a/b", "contents1", MQTT_NS::v5::properties {}, MQTT_NS::qos::at_most_once, MQTT_NS::nullopt);
+        w.add("a/c", "contents2", MQTT_NS::v5::properties {}, MQTT_NS::qos::at_most_once, MQTT_NS::nullopt);
+        w.commit();
+    }
+
+    as::io_context ioc;
+    {
+        MQTT_NS::broker::broker_t b(ioc);
+        BOOST_TEST(b.load_retained_snapshot(rf_snap.path) == 2);
+        auto ps = std::make_shared<MQTT_NS::broker::log_persistence>(ioc, rf_log.path);
+        b.set_persistence(ps);
+        BOOST_TEST(b.save_retained_snapshot(rf_snap.path) == 2);
+
+        // The broker records a retained PUBLISH and an erasure after the save.
+        ps->put_retained("a/b"_mb, "contents3"_mb, MQTT_NS::v5::properties {}, MQTT_NS::qos::at_most_once);
+        ps->erase_retained("a/c"_mb);
+    }
+
+    auto check =
+        [&](MQTT_NS::broker::broker_t const& b) {
+            BOOST_TEST(b.save_retained_snapshot(rf_check.path) == 1);
+            auto entries = load(rf_check.path);
+            BOOST_TEST(entries.size() == 1);
+            BOOST_TEST(entries.at("a/b").contents == "contents3");
+        };
+
+    // restart. The log overrides the older snapshot.
+    {
+        MQTT_NS::broker::broker_t b(ioc);
+        BOOST_TEST(b.load_retained_snapshot(rf_snap.path) == 2);
+        auto ps = std::make_shared<MQTT_NS::broker::log_persistence>(ioc, rf_log.path);
+        b.set_persistence(ps);
+        auto tombstones =
+            [&] {
+                std::size_t n = 0;
+                ps->for_each_erased_retained([&](MQTT_NS::buffer const&) { ++n; });
+                return n;
+            };
+        BOOST_TEST(tombstones() == 1);
+        check(b);
+        // The tombstone is dropped after a new snapshot is saved.
+        BOOST_TEST(tombstones() == 0);
+        b.save_retained_snapshot(rf_snap.path);
+    }
+
+    // restart with the new snapshot. It is loaded after set_persistence() this time.
+    {
+        MQTT_NS::broker::broker_t b(ioc);
+        b.set_persistence(std::make_shared<MQTT_NS::broker::log_persistence>(ioc, rf_log.path));
+        BOOST_TEST(b.load_retained_snapshot(rf_snap.path) == 1);
+        check(b);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,89 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <atomic>
+#include <thread>
+
+#include <mqtt/broker/broker.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_session_handle)
+
+using namespace MQTT_NS::literals;
+namespace as = boost::asio;
+
+BOOST_AUTO_TEST_CASE( bind_unbind ) {
+    as::io_context ioc;
+    MQTT_NS::broker::mutex mtx_subs_map;
+    MQTT_NS::broker::sub_con_map subs_map;
+    MQTT_NS::broker::shared_target shared_targets;
+    MQTT_NS::broker::metrics broker_metrics;
+    MQTT_NS::broker::session_state ss(
+        ioc,
+        mtx_subs_map,
+        subs_map,
+        shared_targets,
+        broker_metrics,
+        MQTT_NS::protocol_version::v5,
+        "cid1"_mb,
+        MQTT_NS::nullopt
+    );
+
+    MQTT_NS::broker::session_handle h;
+    BOOST_TEST(!h.lock());
+    h.bind(ss);
+    {
+        auto l = h.lock();
+        BOOST_TEST(static_cast<bool>(l));
+        BOOST_TEST(l->client_id() == "cid1");
+        BOOST_TEST(&*l == &ss);
+    }
+    h.unbind();
+    BOOST_TEST(!h.lock());
+}
+
+BOOST_AUTO_TEST_CASE( unbind_waits_for_lock ) {
+    as::io_context ioc;
+    MQTT_NS::broker::mutex mtx_subs_map;
+    MQTT_NS::broker::sub_con_map subs_map;
+    MQTT_NS::broker::shared_target shared_targets;
+    MQTT_NS::broker::metrics broker_metrics;
+    MQTT_NS::broker::session_state ss(
+        ioc,
+        mtx_subs_map,
+        subs_map,
+        shared_targets,
+        broker_metrics,
+        MQTT_NS::protocol_version::v5,
+        "cid1"_mb,
+        MQTT_NS::nullopt
+    );
+
+    MQTT_NS::broker::session_handle h;
+    h.bind(ss);
+    std::atomic<bool> unbound { false };
+    std::thread th;
+    {
+        auto l = h.lock();
+        th = std::thread(
+            [&] {
+                h.unbind();
+                unbound = true;
+            }
+        );
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        // the session is still referred
+        BOOST_TEST(!unbound);
+        BOOST_TEST(l->client_id() == "cid1");
+    }
+    th.join();
+    BOOST_TEST(unbound);
+    BOOST_TEST(!h.lock());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
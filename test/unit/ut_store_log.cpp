@@ -0,0 +1,131 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <cstdio>
+
+#include <mqtt_client_cpp.hpp>
+#include <mqtt/store_log.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_store_log)
+
+namespace as = boost::asio;
+
+namespace {
+
+struct remove_file {
+    explicit remove_file(std::string path) : path(path) {
+        std::remove(path.c_str());
+        std::remove((path + ".tmp").c_str());
+    }
+    ~remove_file() {
+        std::remove(path.c_str());
+    }
+    std::string path;
+};
+
+std::string serialized_publish(std::uint16_t packet_id, std::string const& contents) {
+    std::string topic("topic1");
+    MQTT_NS::publish_message m(
+        packet_id,
+        as::buffer(topic),
+        as::buffer(contents),
+        MQTT_NS::qos::exactly_once
+    );
+    return m.continuous_buffer();
+}
+
+std::string serialized_pubrel(std::uint16_t packet_id) {
+    return MQTT_NS::pubrel_message(packet_id).continuous_buffer();
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( restore ) {
+    remove_file rf("ut_store_log_restore.log");
+    as::io_context ioc;
+    {
+        MQTT_NS::store_log log(ioc, rf.path);
+        auto p1 = serialized_publish(1, "contents1");
+        auto p2 = serialized_publish(2, "contents2");
+        auto p3 = serialized_publish(3, "contents3");
+        log.put(1, p1);
+        log.put(2, p2);
+        log.put(3, p3);
+        // PUBREC received
+        auto r1 = serialized_pubrel(1);
+        log.put(1, r1);
+        // PUBCOMP received
+        log.remove(2);
+        BOOST_TEST(log.size() == 2);
+    }
+
+    auto check =
+        [&](MQTT_NS::store_log const& log) {
+            BOOST_TEST(log.size() == 2);
+            auto c = MQTT_NS::make_client(ioc, "localhost", std::uint16_t(1883));
+            log.restore(*c);
+            std::vector<std::string> stored;
+            c->for_each_store(
+                [&](char const* data, std::size_t size) {
+                    stored.emplace_back(data, size);
+                }
+            );
+            BOOST_TEST(stored.size() == 2);
+            // the resend order is kept
+            BOOST_TEST(stored[0] == serialized_pubrel(1));
+            BOOST_TEST(stored[1] == serialized_publish(3, "contents3"));
+        };
+
+    {
+        MQTT_NS::store_log log(ioc, rf.path);
+        check(log);
+        auto size_before_compaction = log.log_size();
+        log.compact();
+        BOOST_TEST(log.log_size() < size_before_compaction);
+        check(log);
+    }
+    {
+        MQTT_NS::store_log log(ioc, rf.path);
+        check(log);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( attach ) {
+    remove_file rf("ut_store_log_attach.log");
+    as::io_context ioc;
+    MQTT_NS::store_log log(ioc, rf.path);
+    auto c = MQTT_NS::make_client(ioc, "localhost", std::uint16_t(1883));
+    log.attach(*c);
+    // The endpoint calls the serialize handlers when it stores and removes messages.
+    c->on_serialize_publish_message(
+        MQTT_NS::publish_message(
+            MQTT_NS::buffer(MQTT_NS::string_view(serialized_publish(1, "contents1")))
+        )
+    );
+    BOOST_TEST(log.size() == 1);
+    c->on_serialize_remove(1);
+    BOOST_TEST(log.size() == 0);
+}
+
+BOOST_AUTO_TEST_CASE( compaction ) {
+    remove_file rf("ut_store_log_compaction.log");
+    as::io_context ioc;
+    MQTT_NS::store_log::config c;
+    c.compaction_min_bytes = 1024;
+    MQTT_NS::store_log log(ioc, rf.path, c);
+    auto p = serialized_publish(1, std::string(100, 'x'));
+    for (std::size_t i = 0; i != 100; ++i) {
+        log.put(1, p);
+        log.remove(1);
+    }
+    BOOST_TEST(log.size() == 0);
+    BOOST_TEST(log.log_size() < 2048);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
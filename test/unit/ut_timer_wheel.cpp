@@ -0,0 +1,112 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <mqtt/broker/timer_wheel.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_timer_wheel)
+
+namespace as = boost::asio;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_CASE( expire ) {
+    as::io_context ioc;
+    MQTT_NS::broker::timer_wheel w(ioc, 10ms, 8);
+    std::size_t expired = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point expired_at;
+    auto e = w.make_entry(
+        [&] {
+            ++expired;
+            expired_at = std::chrono::steady_clock::now();
+        }
+    );
+    // longer than one revolution
+    w.schedule(e, 150ms);
+    BOOST_TEST(w.size() == 1);
+    // the timer stops after the last entry expires
+    ioc.run();
+    BOOST_TEST(expired == 1);
+    BOOST_TEST(w.size() == 0);
+    BOOST_CHECK(expired_at - start >= 150ms);
+}
+
+BOOST_AUTO_TEST_CASE( touch ) {
+    as::io_context ioc;
+    MQTT_NS::broker::timer_wheel w(ioc, 10ms);
+    std::chrono::steady_clock::time_point touched_at;
+    std::chrono::steady_clock::time_point expired_at;
+    auto e = w.make_entry(
+        [&] {
+            expired_at = std::chrono::steady_clock::now();
+        }
+    );
+    w.schedule(e, 50ms);
+
+    as::steady_timer tim(ioc);
+    std::size_t count = 0;
+    std::function<void()> touch =
+        [&] {
+            tim.expires_after(20ms);
+            tim.async_wait(
+                [&](MQTT_NS::error_code) {
+                    w.touch(*e);
+                    touched_at = std::chrono::steady_clock::now();
+                    if (++count != 5) touch();
+                }
+            );
+        };
+    touch();
+    ioc.run();
+    BOOST_TEST(count == 5);
+    BOOST_CHECK(expired_at - touched_at >= 50ms);
+}
+
+BOOST_AUTO_TEST_CASE( cancel ) {
+    as::io_context ioc;
+    MQTT_NS::broker::timer_wheel w(ioc, 10ms);
+    bool expired1 = false;
+    bool expired2 = false;
+    auto e1 = w.make_entry([&] { expired1 = true; });
+    auto e2 = w.make_entry([&] { expired2 = true; });
+    w.schedule(e1, 30ms);
+    w.schedule(e2, 30ms);
+    w.cancel(*e1);
+    BOOST_TEST(w.size() == 1);
+    ioc.run();
+    BOOST_TEST(!expired1);
+    BOOST_TEST(expired2);
+
+    // reschedule after the timer has stopped
+    ioc.restart();
+    w.schedule(e1, 30ms);
+    w.cancel(*e1);
+    BOOST_TEST(w.size() == 0);
+    auto start = std::chrono::steady_clock::now();
+    ioc.run();
+    BOOST_TEST(!expired1);
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < 30ms);
+}
+
+BOOST_AUTO_TEST_CASE( executor ) {
+    as::io_context ioc;
+    MQTT_NS::broker::timer_wheel w(ioc.get_executor(), 10ms, 8);
+    std::size_t expired = 0;
+    auto e = w.make_entry(
+        [&] {
+            BOOST_TEST(ioc.get_executor().running_in_this_thread());
+            ++expired;
+        }
+    );
+    w.schedule(e, 30ms);
+    ioc.run();
+    BOOST_TEST(expired == 1);
+    BOOST_TEST(w.size() == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -54,6 +54,23 @@ BOOST_AUTO_TEST_CASE( send ) {
 
 }
 
+BOOST_AUTO_TEST_CASE( send_remap_topic ) {
+    MQTT_NS::topic_alias_send tas{3};
+    tas.insert_or_update("topic1", 1);
+    tas.insert_or_update("topic2", 2);
+
+    // topic1 moves from alias 1 to alias 3. alias 1 becomes vacant.
+    tas.insert_or_update("topic1", 3);
+    BOOST_TEST(tas.find("topic1").value() == 3);
+    BOOST_TEST(tas.find(1) == "");
+    BOOST_TEST(tas.get_lru_alias() == 1); // first vacant
+
+    tas.insert_or_update("topic4", 1);
+    BOOST_TEST(tas.get_lru_alias() == 2); // least recently used
+    BOOST_TEST(tas.find(2) == "topic2");
+    BOOST_TEST(tas.get_lru_alias() == 3); // least recently used
+}
+
 BOOST_AUTO_TEST_CASE( recv ) {
     MQTT_NS::topic_alias_send tar{5};
     tar.insert_or_update("topic1", 1);
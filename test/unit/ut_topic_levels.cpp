@@ -0,0 +1,132 @@
+// Copyright Takatoshi Kondo 2021
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "../common/test_main.hpp"
+#include "../common/global_fixture.hpp"
+
+#include <random>
+#include <vector>
+
+#include <mqtt/broker/broker.hpp>
+
+BOOST_AUTO_TEST_SUITE(ut_topic_levels)
+
+namespace {
+
+std::vector<std::string> tokenize(MQTT_NS::string_view topic) {
+    std::vector<std::string> result;
+    MQTT_NS::broker::topic_filter_tokenizer(
+        topic,
+        [&](MQTT_NS::string_view t) {
+            result.emplace_back(t);
+            return true;
+        }
+    );
+    return result;
+}
+
+std::vector<std::string> tokenize(MQTT_NS::broker::topic_levels const& levels) {
+    std::vector<std::string> result;
+    MQTT_NS::broker::topic_filter_tokenizer(
+        levels,
+        [&](MQTT_NS::string_view t) {
+            result.emplace_back(t);
+            return true;
+        }
+    );
+    return result;
+}
+
+void check_same_as_scalar(MQTT_NS::string_view topic) {
+    MQTT_NS::broker::topic_levels levels(topic);
+    BOOST_TEST(tokenize(levels) == tokenize(topic));
+    BOOST_TEST(levels.valid_topic_name() == MQTT_NS::broker::validate_topic_name(topic));
+    BOOST_TEST(levels.valid_topic_filter() == MQTT_NS::broker::validate_topic_filter(topic));
+    BOOST_TEST((levels.utf8() == MQTT_NS::utf8string::validate_contents_scalar(topic)));
+
+    // The same levels and rules without the UTF-8 validation
+    MQTT_NS::broker::topic_levels unchecked(topic, false);
+    BOOST_TEST(tokenize(unchecked) == tokenize(topic));
+    BOOST_TEST(unchecked.valid_topic_name() == levels.valid_topic_name());
+    BOOST_TEST(unchecked.valid_topic_filter() == levels.valid_topic_filter());
+    BOOST_TEST((unchecked.utf8() == MQTT_NS::utf8string::validation::well_formed));
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( levels ) {
+    MQTT_NS::broker::topic_levels levels("building/floor3/room12/sensor/temperature/value");
+    BOOST_TEST(levels.size() == 6U);
+    BOOST_TEST(levels.level(0) == "building");
+    BOOST_TEST(levels.level(2) == "room12");
+    BOOST_TEST(levels.level(5) == "value");
+    BOOST_TEST(!levels.has_wildcard());
+    BOOST_TEST(levels.valid_topic_name());
+
+    MQTT_NS::broker::topic_levels empty_levels("a//");
+    BOOST_TEST(empty_levels.size() == 3U);
+    BOOST_TEST(empty_levels.level(1).empty());
+    BOOST_TEST(empty_levels.level(2).empty());
+}
+
+BOOST_AUTO_TEST_CASE( validation ) {
+    char const* topics[] = {
+        "", "/", " ", "/////", "#", "/#", "+/#", "+#", "++", "f#", "#/",
+        "+", "+/bob/alice/sue", "bob/alice/sue/+", "+/bob/+/sue/#",
+        "+a", "a+", "/a+", "a+/", "/a+/",
+        // wildcards after the first 16 bytes
+        "building/floor3/+/sensor/+/value",
+        "building/floor3/room12/sensor/#",
+        "building/floor3/room12/sensor#",
+        "building/floor3/room12+/sensor",
+        "building/floor3/room12/sensor/temperature/value/#/",
+        u8"building/étage3/room12/sensor/temperature",
+        "building/floor3/room12/sensor/temperature/\x01",
+        "building/floor3/room12/sensor/temperature/\xc0\x80",
+    };
+    for (auto t : topics) {
+        check_same_as_scalar(t);
+    }
+    check_same_as_scalar(MQTT_NS::string_view("building/floor3/room12\0/sensor", 30));
+    BOOST_TEST(MQTT_NS::broker::topic_levels(MQTT_NS::string_view("building/floor3/room12\0/sensor", 30)).has_null());
+    BOOST_TEST(!MQTT_NS::broker::topic_levels(std::string(0x10000, 'a')).valid_topic_name());
+}
+
+BOOST_AUTO_TEST_CASE( random_topics ) {
+    static std::string const pieces[] = {
+        "a", "sensor", "floor3", "/", "/", "/", "+", "#", u8"é", u8"あ", "\x01", std::string(1, '\0'), "\xff",
+    };
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<std::size_t> piece_dist(0, sizeof(pieces) / sizeof(pieces[0]) - 1);
+    std::uniform_int_distribution<std::size_t> len_dist(0, 80);
+    for (std::size_t n = 0; n != 5000; ++n) {
+        std::string s;
+        auto len = len_dist(gen);
+        while (s.size() < len) s += pieces[piece_dist(gen)];
+        check_same_as_scalar(s);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( maps ) {
+    MQTT_NS::broker::multiple_subscription_map<std::string, int> subs;
+    subs.insert_or_assign("a/+/c", "k1", 1);
+    subs.insert_or_assign("a/#", "k2", 2);
+    subs.insert_or_assign("a/b/d", "k3", 3);
+
+    MQTT_NS::broker::topic_levels levels("a/b/c");
+    std::set<int> matched;
+    subs.modify(levels, [&](std::string const&, int& v) { matched.insert(v); });
+    BOOST_TEST((matched == std::set<int>{1, 2}));
+
+    MQTT_NS::broker::retained_topic_map<int> retains;
+    BOOST_TEST(retains.insert_or_assign(levels, 10) == 1U);
+    BOOST_TEST(retains.insert_or_assign("a/b/c", 11) == 0U);
+    std::vector<int> found;
+    retains.find("a/+/c", [&](int v) { found.push_back(v); });
+    BOOST_TEST((found == std::vector<int>{11}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,8 @@
 #include "../common/test_main.hpp"
 #include "../common/global_fixture.hpp"
 
+#include <random>
+
 #include <mqtt/utf8encoded_strings.hpp>
 
 namespace MQTT_NS {
@@ -436,4 +438,55 @@ BOOST_AUTO_TEST_CASE( combination ) {
 #endif // MQTT_USE_STR_CHECK
 }
 
+BOOST_AUTO_TEST_CASE( simd_equivalence ) {
+#if defined(MQTT_USE_STR_CHECK)
+    using namespace MQTT_NS::utf8string;
+
+    // Mostly printable ASCII, or mostly multi-byte characters, with control characters,
+    // non-characters and random bytes, so that the SIMD runs stop at various positions.
+    static std::string const pieces[] = {
+        "a", "topic/", "0123456789abcdef", "{\"key\":\"value\"}",
+        u8"\u00e9", u8"\u3042", u8"\U0001f600", u8"\ufffe", u8"\U0001ffff",
+        "\x01", "\x7f", std::string(1, '\0'),
+        "\xc0\x80", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe3\x81",
+    };
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<std::size_t> piece_dist(0, sizeof(pieces) / sizeof(pieces[0]) - 1);
+    std::uniform_int_distribution<int> byte_dist(0, 255);
+    std::uniform_int_distribution<int> kind_dist(0, 99);
+    std::uniform_int_distribution<std::size_t> len_dist(0, 200);
+
+    for (std::size_t n = 0; n != 40000; ++n) {
+        // The odd strings are mostly non-ASCII (e.g. CJK topics)
+        bool non_ascii = n % 2 == 1;
+        std::string s;
+        auto len = len_dist(gen);
+        while (s.size() < len) {
+            auto kind = kind_dist(gen);
+            if (kind < 70) {
+                // pieces[0-3] are ASCII, and pieces[4-8] are well formed multi-byte characters
+                s += non_ascii ? pieces[4 + piece_dist(gen) % 5] : pieces[piece_dist(gen) % 4];
+            }
+            else if (kind < 97) {
+                s += pieces[piece_dist(gen)];
+            }
+            else {
+                s += static_cast<char>(byte_dist(gen));
+            }
+        }
+        auto expected = validate_contents_scalar(s);
+        BOOST_TEST(validate_contents(s) == expected);
+        BOOST_TEST(detail::validate_contents_with(s, &detail::printable_ascii_run_scalar) == expected);
+#if defined(MQTT_UTF8_SSE2)
+        BOOST_TEST(detail::validate_contents_with(s, &detail::printable_ascii_run_sse2) == expected);
+#endif // defined(MQTT_UTF8_SSE2)
+#if defined(MQTT_UTF8_AVX2)
+        if (__builtin_cpu_supports("avx2")) {
+            BOOST_TEST(detail::validate_contents_with(s, &detail::printable_ascii_run_avx2) == expected);
+        }
+#endif // defined(MQTT_UTF8_AVX2)
+    }
+#endif // MQTT_USE_STR_CHECK
+}
+
 BOOST_AUTO_TEST_SUITE_END()